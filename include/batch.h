@@ -0,0 +1,52 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <Arduino.h>
+
+#define BATCH_MAX_RECORDS 12    // scans kept between two connects
+#define BATCH_MAX_APS 5         // strongest APs kept per scan
+
+struct payload_t;
+
+struct batch_ap_t {
+  uint8_t bssid[6];
+  int8_t rssi;
+  uint8_t channel;
+};
+
+// one scan-only wake
+struct batch_record_t {
+  uint32_t time;           // batch clock sec
+  uint16_t mv;             // battery voltage
+  uint16_t send_cause;
+  uint8_t ap_ct;
+  batch_ap_t ap[BATCH_MAX_APS];
+};
+
+// ring of records, kept in rtc memory by the caller
+struct batch_t {
+  uint32_t clock;          // sec since power on, advanced by the sleep time
+  uint8_t head;            // oldest record
+  uint8_t count;
+  batch_record_t rec[BATCH_MAX_RECORDS];
+};
+
+// collects scans of wakes without a connect, they are sent with the next message
+class BATCH_BUFFER {
+public:
+  BATCH_BUFFER(struct batch_t* batch);
+  // keeps the strongest APs of the payload, drops the oldest record if full
+  void push(const payload_t* p, float voltage, uint16_t send_cause);
+  void clear();
+  void sleep(uint32_t seconds);
+  uint8_t count();
+  bool full();
+  // i = 0 is the oldest record
+  const batch_record_t &get(uint8_t i);
+  uint32_t age(uint8_t i);
+  void print(Print* out);
+private:
+  struct batch_t* _batch;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <Arduino.h>
+
+#define BATTERY_PIN 6
+#define BATTERY_RATE_HZ 2000     // adc conversions per sec in continuous mode
+#define BATTERY_FRAME 64         // conversions the driver averages per frame
+#define BATTERY_WINDOW_MS 500    // sampling after boot, runs alongside the scan
+#define BATTERY_HISTORY 16
+#define BATTERY_HISTORY_S 21600  // sec between history entries, 16 cover 4 days
+
+struct battery_entry_t {
+  uint32_t time;           // sec since power on
+  uint16_t mv;
+};
+
+// kept in rtc memory by the caller
+struct battery_t {
+  uint32_t clock;          // sec since power on, sleeps included
+  uint32_t smooth;         // mV x 16 averaged over wakes, 0 = no reading yet
+  uint16_t last_mv;        // reading of the last wake
+  uint16_t last_frames;    // frames averaged into it
+  uint8_t head;
+  uint8_t count;
+  battery_entry_t history[BATTERY_HISTORY];
+};
+
+// battery voltage oversampled by the adc in continuous mode while the wake goes on,
+// a smoothed value and a few days of history survive deep sleep
+class BATTERY {
+public:
+  BATTERY(struct battery_t* state);
+  // starts the sampling of this wake, on_frame runs in the isr each time a frame is ready
+  bool begin(float faktor, uint16_t offset_mv, void (*on_frame)());
+  // takes the ready frames, from loop()
+  void poll();
+  bool running();
+  // ms until the window is over
+  uint32_t left(uint32_t ti);
+  // stops sampling and books the reading of this wake
+  void end();
+  // this wake's reading, the smoothed one while there is none
+  float voltage();
+  float smoothed();
+  // mV per day over the history, 0 with less than a day of it
+  float trend();
+  void sleep(uint32_t seconds);
+  void clear();
+  void print(Print* out);
+private:
+  float toVolt(uint32_t adc_mv);
+  struct battery_t* _state;
+  float _faktor;
+  uint16_t _offset_mv;
+  bool _running;
+  uint32_t _start;
+  uint32_t _sum_mv;
+  uint16_t _frames;
+};
+
+#endif
@@ -2,48 +2,89 @@
 #define CMD_PROCESSOR_H
 
 #include <Arduino.h>
-#include <vector>
 
-class CMDS {
-public:
-  CMDS(String cmd, void (*callback)(String &cmd));
-  CMDS(String cmd, String args, void (*callback)(String &cmd, String args, void* values));
-  bool handle(String cmd, String args);
-  String getCmd();
-  String getArgs();
-  bool operator < (const CMDS& b) const {
-    return (b._cmd.length() < _cmd.length());
-  }
-private:
-  String _cmd;
-  String _args;
-  void (*_callback)(String &cmd);
-  void (*_callback2)(String &cmd, String args, void* values);
-};
+#define CMD_LINE_MAX 96     // chars of a line including the terminating 0
+#define CMD_HISTORY 10      // lines kept for cursor up/down
+#define CMD_MAX_CMDS 8
+#define CMD_RING 512        // bytes taken from the driver in one go in machine mode
+#define CMD_FRAME_MAX (CMD_LINE_MAX + 10)  // "<seq> " + line + "*<crc>", newline not counted
+#define CMD_RX_BUFFER 2048  // usb cdc rx buffer, holds a pasted config while a command runs
+
+// machine mode, for provisioning scripts: no echo, no line editing.
+// entered with esc M, left with esc m. each command comes as "<seq> <line>*<crc>\n",
+// seq counts up from 0 on entering, crc is the crc16 ccitt of "<seq> <line>" in 4 hex digits.
+// the device answers once per batch of frames read:
+//   "#ack <n>"  all frames below n are done
+//   "#nak <n>"  frame n was lost or damaged, resend from n on
+//   "#err <n>"  frame n arrived but its command failed
+//   "#end"      back to the line editor, also if it was already
+// anything else on the console is command output.
+#define CMD_MACHINE_ENTER "\33M"
+#define CMD_MACHINE_LEAVE "\33m"
+
+uint16_t cmd_crc(const char* data, size_t len);
+// writes the frame of line with seq into buf, returns its length, 0 if it does not fit
+size_t cmd_frame(char* buf, size_t size, uint16_t seq, const char* line);
 
 class CMD_PROCESSOR {
 public:
   CMD_PROCESSOR(Stream* cmd_stream = &Serial);
   void process();
-  bool registerCmd(String cmd, void (*callback)(String &cmd));
-  bool registerCmd(String cmd, String args, void (*callback)(String &cmd, String args, void* values));
+  // callback gets the trimmed line of every command starting with cmd, "" matches all,
+  // returns false if the command failed
+  bool registerCmd(const char* cmd, bool (*callback)(char* line));
   bool registerKey(char key, void (*callback)(char c));
+  bool machine();
 private:
+  struct cmd_t {
+    const char* cmd;
+    uint8_t len;
+    bool (*callback)(char* line);
+  };
+  void handleChar(char c);
   void handleCrLf();
+  void handleByte(char c);
+  void trim();
+  bool dispatch();
+  void enterMachine();
+  void processMachine();
+  void nak();
+  void handleFrame(char* frame, size_t len);
   bool handleKey(char c);
+  void showLine(const char* line);
   void writeHistory();
-  void splitCmdline();
+  const char* history(uint8_t i);
   Stream* _cmd_stream;
-  String _current_input;
-  uint8_t _current_pos;
+  char _line[CMD_LINE_MAX];
+  uint8_t _len = 0;
+  uint8_t _pos = 0;
   char _last_char = '\0';
-  String _input_cache;
-  String _cmd;
-  String _args;
-  std::vector<CMDS*> _cmds;
-  std::vector<String> _history;
-  int8_t _history_pos;
+  char _input_cache[CMD_LINE_MAX];
+  cmd_t _cmds[CMD_MAX_CMDS];
+  uint8_t _cmd_ct = 0;
+  // escape sequence state
+  bool _esc = false;
+  bool _sci = false;
+  bool _csi = false;
+  uint8_t _csi_len = 0;    // parameter bytes of the csi sequence
+  char _special_char = 0;
+  // ring of entered lines, _history_head is the newest
+  char _history[CMD_HISTORY][CMD_LINE_MAX];
+  uint8_t _history_head = 0;
+  uint8_t _history_ct = 0;
+  int8_t _history_pos = -1;
+  // machine mode, frames are cut out of the ring as their newline arrives
+  bool _machine = false;
+  char _ring[CMD_RING];
+  uint16_t _ring_head = 0;
+  uint16_t _ring_len = 0;
+  uint16_t _ring_scan = 0;   // bytes after the head already searched for a newline
+  bool _overlong = false;    // dropping a line longer than a frame
+  uint16_t _seq = 0;         // next frame expected
+  uint16_t _acked = 0;
+  bool _nak_sent = false;    // one nak per gap until the frame comes again
+  bool _dup = false;         // a resent frame came in, the host waits for an ack
 };
 
 
-#endif
\ No newline at end of file
+#endif
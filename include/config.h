@@ -0,0 +1,145 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <Arduino.h>
+#include <stddef.h>
+#include "batch.h"
+#include "payload.h"
+#include "energy.h"
+#include "wake_cycle.h"
+#include "scan_planner.h"
+#include "sleep_planner.h"
+
+struct systemconfig_t {
+  bool valid;
+  char hostname[32];
+  char ssid[32];
+  char wifi_pw[32];
+  char mqtt_server[32];
+  uint16_t mqtt_server_port;
+  char mqtt_topic[40];
+  uint16_t retry;
+  uint16_t interval;
+  float voltage_faktor;
+  uint16_t id;
+  uint32_t wifi_wait;       // ms a send may take from scan to puback
+  uint16_t scan_channel_time;
+  bool ext_antenna;
+  uint16_t fast_wait;      // ms budget to connect with the cached ap, 0 = always scan
+  uint16_t scan_channels;  // bitmask of channels to scan, bit 0 = ch 1
+  uint16_t scan_passive;   // bitmask of channels scanned passive
+  uint16_t scan_min_time;  // ms dwell on channels without the target ssid
+  uint8_t scan_max_ch;     // channels with known APs scanned per wake, 0 = all
+  uint8_t scan_explore;    // wakes until an unused channel is looked at again, 0 = never
+  uint8_t ap_max;          // strongest APs kept per scan
+  uint8_t payload_format;  // PAYLOAD_JSON or PAYLOAD_BIN
+  uint8_t batch_wakes;     // timer wakes per connect, scans in between are kept, 0/1 = send every wake
+  uint8_t trace_send;      // 1 = phase timestamps of earlier wakes go into the message
+  energy_currents_t currents;  // energy model, 0 = not set yet
+  uint16_t capacity_mah;
+  uint8_t same_pct;        // % of APs unchanged to skip the send of a timer wake, 0 = always send
+  uint8_t heartbeat;       // with same_pct: every n-th wake sends anyway, 0 = never forced
+  uint8_t delta_send;      // 1 = only new, changed and gone APs are sent
+  cycle_deadlines_t deadlines;
+  uint8_t mqtt_mode;       // MQTT_QOS1, MQTT_QOS0 or MQTT_PIPE
+  uint16_t dns_ttl;        // sec the resolved broker address is reused, 0 = look it up every wake
+  uint8_t mqtt_session;    // 1 = the broker keeps the session between wakes
+  uint8_t cpu_policy;      // CPU_FIXED_LOW, CPU_FIXED_HIGH or CPU_PHASES
+  sleep_config_t sleep;
+  uint16_t volt_offset;     // mV added after voltage_faktor, e.g. a diode ahead of the divider
+};
+
+enum config_type_t : uint8_t {
+  CF_STR,
+  CF_UINT,
+  CF_CHANS,                // channel bitmask, "1,6,11", "all" or "none"
+  CF_CHOICE,               // index into the choices of the help text
+  CF_VOLT                  // voltage factor, set from a measured voltage
+};
+
+struct config_field_t {
+  const char* name;
+  config_type_t type;
+  uint8_t size;
+  uint16_t offset;
+  uint32_t min;
+  uint32_t max;
+  const char* help;        // usage after the name, "<a|b>" lists the choices of CF_CHOICE
+};
+
+#define CONFIG_FIELD(name, member, type, min, max, help) \
+  {name, type, sizeof(systemconfig_t{}.member), offsetof(systemconfig_t, member), min, max, help}
+
+// console settings, in the order of show and help
+constexpr config_field_t config_fields[] = {
+  CONFIG_FIELD("ssid", ssid, CF_STR, 0, 0, "<ssid>"),
+  CONFIG_FIELD("pw", wifi_pw, CF_STR, 0, 0, "<password>"),
+  CONFIG_FIELD("name", hostname, CF_STR, 0, 0, "<hostname>"),
+  CONFIG_FIELD("id", id, CF_UINT, 0, UINT16_MAX, "<number>"),
+  CONFIG_FIELD("server", mqtt_server, CF_STR, 0, 0, "<mqtt server>"),
+  CONFIG_FIELD("port", mqtt_server_port, CF_UINT, 1, UINT16_MAX, "<mqtt port>"),
+  CONFIG_FIELD("topic", mqtt_topic, CF_STR, 0, 0, "<base topic>"),
+  CONFIG_FIELD("retry", retry, CF_UINT, 1, UINT16_MAX, "<time>"),
+  CONFIG_FIELD("interval", interval, CF_UINT, 1, UINT16_MAX, "<time>"),
+  CONFIG_FIELD("retrymax", sleep.retry_max, CF_UINT, 0, UINT16_MAX, "<sec failed sends back off to, 0 off>"),
+  CONFIG_FIELD("lowbat", sleep.low_pct, CF_UINT, 0, 100, "<% battery below which sleeps stretch, 0 off>"),
+  CONFIG_FIELD("quietfrom", sleep.quiet_from, CF_UINT, 0, 23, "<hour timer wakes stop, = quietto off>"),
+  CONFIG_FIELD("quietto", sleep.quiet_to, CF_UINT, 0, 23, "<hour timer wakes start again>"),
+  CONFIG_FIELD("utcoff", sleep.utc_offset, CF_UINT, 0, 1439, "<min local time is ahead of utc>"),
+  CONFIG_FIELD("wait", wifi_wait, CF_UINT, 0, UINT32_MAX, "<ms a send may take, 0 no limit>"),
+  CONFIG_FIELD("tscan", deadlines.scan_ms, CF_UINT, 0, UINT16_MAX, "<ms scan may take over the plan, 0 off>"),
+  CONFIG_FIELD("tassoc", deadlines.assoc_ms, CF_UINT, 0, UINT16_MAX, "<ms to associate, 0 off>"),
+  CONFIG_FIELD("tdhcp", deadlines.dhcp_ms, CF_UINT, 0, UINT16_MAX, "<ms to get an ip, 0 off>"),
+  CONFIG_FIELD("tmqtt", deadlines.mqtt_ms, CF_UINT, 0, UINT16_MAX, "<ms to connect the broker, 0 off>"),
+  CONFIG_FIELD("tpub", deadlines.publish_ms, CF_UINT, 0, UINT16_MAX, "<ms to publish, 0 off>"),
+  CONFIG_FIELD("tack", deadlines.ack_ms, CF_UINT, 0, UINT16_MAX, "<ms to the puback, 0 off>"),
+  CONFIG_FIELD("scantime", scan_channel_time, CF_UINT, 1, UINT16_MAX, "<ms scan each channel>"),
+  CONFIG_FIELD("chans", scan_channels, CF_CHANS, 1, SCAN_ALL_CHANNELS, "<1,6,11|all>"),
+  CONFIG_FIELD("passive", scan_passive, CF_CHANS, 0, SCAN_ALL_CHANNELS, "<1,6,11|all|none>"),
+  CONFIG_FIELD("scanmin", scan_min_time, CF_UINT, 0, UINT16_MAX, "<ms scan on channels without target>"),
+  CONFIG_FIELD("scanmax", scan_max_ch, CF_UINT, 0, SCAN_MAX_CHANNEL, "<channels with APs per wake, 0 all>"),
+  CONFIG_FIELD("apmax", ap_max, CF_UINT, 1, PAYLOAD_MAX_APS, "<strongest APs kept per scan>"),
+  CONFIG_FIELD("explore", scan_explore, CF_UINT, 0, UINT8_MAX, "<wakes between looks at unused channels, 0 never>"),
+  CONFIG_FIELD("fast", fast_wait, CF_UINT, 0, UINT16_MAX, "<ms to connect with cached ap, 0 off>"),
+  CONFIG_FIELD("format", payload_format, CF_CHOICE, 0, 1, "<json|bin>"),
+  CONFIG_FIELD("deliver", mqtt_mode, CF_CHOICE, 0, 2, "<qos1|qos0|pipe>"),
+  CONFIG_FIELD("dnsttl", dns_ttl, CF_UINT, 0, UINT16_MAX, "<sec to reuse the broker address, 0 off>"),
+  CONFIG_FIELD("session", mqtt_session, CF_CHOICE, 0, 1, "<clean|keep>"),
+  CONFIG_FIELD("cpu", cpu_policy, CF_CHOICE, 0, 2, "<80|160|phase>"),
+  CONFIG_FIELD("batch", batch_wakes, CF_UINT, 0, BATCH_MAX_RECORDS + 1, "<timer wakes per send, 0 off>"),
+  CONFIG_FIELD("same", same_pct, CF_UINT, 0, 100, "<% of APs unchanged to skip the send, 0 off>"),
+  CONFIG_FIELD("heartbeat", heartbeat, CF_UINT, 0, UINT8_MAX, "<wakes until a send is forced, 0 never>"),
+  CONFIG_FIELD("delta", delta_send, CF_CHOICE, 0, 1, "<off|on>"),
+  CONFIG_FIELD("trace", trace_send, CF_CHOICE, 0, 1, "<off|on>"),
+  CONFIG_FIELD("isleep", currents.sleep_ua, CF_UINT, 1, UINT16_MAX, "<uA in deep sleep>"),
+  CONFIG_FIELD("iidle", currents.idle_ma, CF_UINT, 1, UINT16_MAX, "<mA awake with radio off>"),
+  CONFIG_FIELD("iscan", currents.scan_ma, CF_UINT, 1, UINT16_MAX, "<mA while scanning>"),
+  CONFIG_FIELD("iradio", currents.radio_ma, CF_UINT, 1, UINT16_MAX, "<mA while connected>"),
+  CONFIG_FIELD("cap", capacity_mah, CF_UINT, 1, UINT16_MAX, "<battery mAh>"),
+  CONFIG_FIELD("voffset", volt_offset, CF_UINT, 0, 2000, "<mV added after the factor, set before volt>"),
+  CONFIG_FIELD("volt", voltage_faktor, CF_VOLT, 0, 0, "<measured voltage>"),
+  CONFIG_FIELD("ant", ext_antenna, CF_CHOICE, 0, 1, "<int|ext>"),
+};
+
+#define CONFIG_VERSION 1     // stored with the records, bump it with a step in config_load() if a field changes meaning
+
+// O(1) lookup by name, nullptr if there is no such setting
+const config_field_t* config_find(const char* name);
+// parses and checks value, the config is unchanged if it is refused
+bool config_set(systemconfig_t* cfg, const config_field_t &f, const char* value);
+// "name value" line
+void config_print(const systemconfig_t* cfg, const config_field_t &f, Print* out);
+// "name <usage>" line
+void config_help(const config_field_t &f, Print* out);
+
+// crc16 ccitt
+uint16_t config_crc(const void* data, size_t len);
+// the rtc copy is used only if it still matches the crc taken before sleep or restart
+bool config_cached(const systemconfig_t* cfg, uint16_t crc);
+// nvs holds one record per field, keyed by its name: value and crc16. fields without a good
+// record keep what cfg holds, so the defaults go in before. false if no config is stored
+bool config_load(systemconfig_t* cfg);
+// writes only the records that changed, returns their number or -1
+int config_store(systemconfig_t* cfg);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef CPU_POLICY_H
+#define CPU_POLICY_H
+
+#include <Arduino.h>
+#include <esp_pm.h>
+#include "wake_cycle.h"
+
+#define CPU_LOW_MHZ 80
+#define CPU_HIGH_MHZ 160
+#define CPU_SLEEP_MHZ 40         // floor with automatic light sleep on usb
+// phases with cpu work of their own: wpa handshake, tls and the mqtt connect, serialization
+#define CPU_FAST_PHASES ((1 << CS_ASSOC) | (1 << CS_MQTT) | (1 << CS_PUBLISH))
+
+enum cpu_policy_t : uint8_t {
+  CPU_FIXED_LOW,           // 80 MHz the whole wake
+  CPU_FIXED_HIGH,          // 160 MHz the whole wake
+  CPU_PHASES               // 160 MHz in CPU_FAST_PHASES, 80 MHz in the waits
+};
+
+// the cpu clock per wake phase, through a power management lock while dynamic frequency
+// scaling is available, else by setting the clock directly
+class CPU_POLICY {
+public:
+  CPU_POLICY();
+  // light_sleep: usb powered, the clock may drop to CPU_SLEEP_MHZ between events
+  void begin(cpu_policy_t policy, bool light_sleep);
+  void phase(cycle_state_t state);
+  uint16_t mhz();
+  bool dfs() { return _dfs; }
+private:
+  cpu_policy_t _policy;
+  bool _dfs;
+  bool _held;
+  esp_pm_lock_handle_t _lock;
+};
+
+#endif
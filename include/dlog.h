@@ -0,0 +1,143 @@
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <type_traits>
+
+#define DLOG_ERROR 1
+#define DLOG_WARN 2
+#define DLOG_INFO 3
+#define DLOG_DEBUG 4
+// call sites above the level are compiled out together with their format strings
+#ifndef DLOG_LEVEL
+#ifdef DEBUG
+#define DLOG_LEVEL DLOG_DEBUG
+#else
+#define DLOG_LEVEL 0
+#endif
+#endif
+
+#define DLOG_RING 1024           // bytes of records, the oldest are dropped when full
+#define DLOG_ARGS_MAX 64         // argument bytes of one record, it ends at the first one that does not fit
+#define DLOG_STR_MAX 23          // chars kept of a string argument
+#define DLOG_HEADER 7            // id, ms, length of the arguments
+#define DLOG_BLOCK_MAX 240       // record bytes of one block on the uart
+#define DLOG_ID_DROPPED 0        // "%u records dropped", written by flush
+#define DLOG_MAGIC 0xD106
+
+// on the uart: 0xA5 0x5A, length, records, crc16 ccitt of the records. a record is the
+// id of its format string (u16), millis() (u32), the length of its arguments (u8) and the
+// arguments: integers as u32, floats as float, strings as length and chars
+#define DLOG_BLOCK_MAGIC0 0xA5
+#define DLOG_BLOCK_MAGIC1 0x5A
+
+// kept in rtc memory by the caller, a wake that crashed is flushed on the next boot
+struct dlog_t {
+  uint16_t magic;
+  uint16_t head;           // oldest record
+  uint16_t len;
+  uint16_t dropped;        // records lost since the last flush
+  uint8_t ring[DLOG_RING];
+};
+
+// format strings of the call sites, collected only in host builds for the decoder
+struct dlog_format_t {
+  uint16_t id;
+  uint8_t level;
+  const char* fmt;
+};
+
+// the id is a hash of the format string, the device never holds the strings
+constexpr uint16_t dlog_id(const char* fmt) {
+  uint32_t h = 2166136261u;
+  while(*fmt) {
+    h = (h ^ (uint8_t)*fmt++) * 16777619u;
+  }
+  uint16_t id = (h >> 16) ^ (h & 0xffff);
+  return (id == DLOG_ID_DROPPED) ? 1 : id;
+}
+
+// checks the arguments against the format at compile time, never called
+inline void dlog_check(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+inline void dlog_check(const char* fmt, ...) {}
+
+#ifdef DLOG_FORMATS
+#define DLOG_REGISTER(id, level, fmt) \
+  static const dlog_format_t dlog_format __attribute__((used, section("dlog_formats"))) = {id, level, fmt}
+#else
+#define DLOG_REGISTER(id, level, fmt)
+#endif
+
+#define DLOG_AT(log, level, fmt, ...) do { \
+  if constexpr((level) <= DLOG_LEVEL) { \
+    constexpr uint16_t dlog_id_ = dlog_id(fmt); \
+    DLOG_REGISTER(dlog_id_, level, fmt); \
+    if(false) { \
+      dlog_check(fmt, ##__VA_ARGS__); \
+    } \
+    (log).write(dlog_id_, ##__VA_ARGS__); \
+  } \
+} while(0)
+
+// log records with the raw arguments, formatted on the host. a call copies a few bytes
+// into the ring, the uart only gets them when the caller is idle or about to sleep
+class DLOG {
+public:
+  DLOG(struct dlog_t* state);
+  // keeps what an earlier wake left, unless the ring is damaged
+  void begin();
+  void clear();
+  template <typename... Args>
+  void write(uint16_t id, const Args&... args) {
+    if constexpr(sizeof...(Args) == 0) {
+      append(id, nullptr, 0);
+    } else {
+      uint8_t buf[DLOG_ARGS_MAX];
+      uint8_t len = 0;
+      // the record ends at the first argument that does not fit, the decoder shows the rest as ?
+      (void)(put(buf, len, args) && ...);
+      append(id, buf, len);
+    }
+  }
+  // sends whole blocks while they fit into max bytes, returns the bytes sent
+  size_t flush(Print* out, size_t max);
+  uint16_t pending();
+private:
+  template <typename T>
+  static bool put(uint8_t* buf, uint8_t &len, const T &v) {
+    if constexpr(std::is_convertible_v<T, const char*>) {
+      if(len >= DLOG_ARGS_MAX) {
+        return false;
+      }
+      const char* s = v;
+      // stops at the nul, strnlen would be told to read past a short literal
+      uint8_t n = 0;
+      while(s && (n < DLOG_STR_MAX) && (n < DLOG_ARGS_MAX - len - 1) && s[n]) {
+        n++;
+      }
+      buf[len++] = n;
+      memcpy(buf + len, s, n);
+      len += n;
+    } else if(len + 4 > DLOG_ARGS_MAX) {
+      return false;
+    } else {
+      if constexpr(std::is_floating_point_v<T>) {
+        float f = v;
+        memcpy(buf + len, &f, 4);
+      } else {
+        uint32_t u = (uint32_t)v;
+        memcpy(buf + len, &u, 4);
+      }
+      len += 4;
+    }
+    return true;
+  }
+  void append(uint16_t id, const uint8_t* args, uint8_t len);
+  void dropOldest();
+  void copyOut(uint16_t pos, uint8_t* dst, uint16_t n);
+  struct dlog_t* _state;
+  portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif
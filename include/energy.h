@@ -0,0 +1,66 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <Arduino.h>
+
+#define ENERGY_SLEEP_UA 25       // defaults for configs without currents
+#define ENERGY_IDLE_MA 25
+#define ENERGY_SCAN_MA 75
+#define ENERGY_RADIO_MA 95
+#define ENERGY_CAPACITY_MAH 250
+#define ENERGY_BASE_MHZ 80       // the currents are given at this cpu clock
+#define ENERGY_UA_PER_MHZ 110    // cpu share of the current, per MHz away from ENERGY_BASE_MHZ
+
+// what the device does while awake
+enum energy_state_t : uint8_t {
+  ES_IDLE,                 // cpu on, radio off
+  ES_SCAN,                 // channel scan
+  ES_RADIO,                // associated, tx/rx
+  ES_COUNT
+};
+
+struct energy_currents_t {
+  uint16_t sleep_ua;
+  uint16_t idle_ma;
+  uint16_t scan_ma;
+  uint16_t radio_ma;
+};
+
+// totals since power on, kept in rtc memory by the caller
+struct energy_t {
+  uint64_t ua_ms;          // charge used, uA x ms
+  uint32_t state_ms[ES_COUNT];
+  uint32_t sleep_s;
+  uint32_t wakes;
+};
+
+// charge estimate from time spent per state and the configured currents
+class ENERGY {
+public:
+  ENERGY(struct energy_t* energy);
+  // start of a wake, idle since boot
+  void begin(const energy_currents_t &currents);
+  void state(energy_state_t state);
+  // cpu clock from now on
+  void cpu(uint16_t mhz);
+  // closes the wake and books the coming deep sleep
+  void sleep(uint32_t seconds);
+  void clear();
+  uint32_t usedUah();
+  float mahPerWake();
+  float mahPerDay();
+  // from the battery voltage and the average use so far, 0xffff if nothing is known yet
+  uint16_t daysLeft(float voltage, uint16_t capacity_mah);
+  void print(Print* out, float voltage, uint16_t capacity_mah);
+  // rough lipo state of charge in %
+  static uint8_t charge(float voltage);
+private:
+  void book();
+  struct energy_t* _energy;
+  energy_currents_t _currents;
+  energy_state_t _state;
+  uint16_t _mhz;
+  uint32_t _since;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NAME_INDEX_NONE 0xff
+
+// fnv-1a, the seed is searched at compile time until no two names share a slot
+constexpr uint32_t name_hash(const char* s, uint32_t seed) {
+  uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+  while(*s) {
+    h = (h ^ (uint8_t)*s++) * 16777619u;
+  }
+  // the low bits pick the slot, fold the well mixed high bits into them
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h;
+}
+
+// collision free hash over the .name of a constexpr table, SLOTS a power of 2
+template <size_t SLOTS>
+struct name_index_t {
+  uint32_t seed;
+  uint8_t slot[SLOTS];   // table index or NAME_INDEX_NONE
+};
+
+template <size_t SLOTS, typename T, size_t N>
+constexpr name_index_t<SLOTS> make_name_index(const T (&table)[N]) {
+  static_assert((SLOTS & (SLOTS - 1)) == 0, "slots must be a power of 2");
+  static_assert(N < NAME_INDEX_NONE, "table too large");
+  name_index_t<SLOTS> idx{};
+  for(uint32_t seed = 0;; ++seed) {
+    for(size_t i = 0; i < SLOTS; ++i) {
+      idx.slot[i] = NAME_INDEX_NONE;
+    }
+    bool ok = true;
+    for(size_t i = 0; ok && (i < N); ++i) {
+      uint8_t &s = idx.slot[name_hash(table[i].name, seed) & (SLOTS - 1)];
+      ok = (s == NAME_INDEX_NONE);
+      s = i;
+    }
+    if(ok) {
+      idx.seed = seed;
+      return idx;
+    }
+  }
+}
+
+// one hash and one compare, nullptr if the name is not in the table
+template <size_t SLOTS, typename T, size_t N>
+const T* name_index_find(const name_index_t<SLOTS> &idx, const T (&table)[N], const char* name) {
+  uint8_t i = idx.slot[name_hash(name, idx.seed) & (SLOTS - 1)];
+  if((i == NAME_INDEX_NONE) || strcmp(table[i].name, name)) {
+    return nullptr;
+  }
+  return &table[i];
+}
+
+#endif
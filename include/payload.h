@@ -0,0 +1,106 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <Arduino.h>
+#include <stddef.h>
+#include "batch.h"
+#include "trace.h"
+
+#define PAYLOAD_MAX_APS 32
+#define PAYLOAD_SIZE (3072 + BATCH_MAX_RECORDS * 320 + TRACE_MAX_EVENTS * 16)
+
+struct payload_ap_t {
+  char ssid[33];
+  uint8_t bssid[6];
+  int8_t rssi;
+  uint8_t channel;
+};
+
+// everything one message carries, filled by the scan and onMqttConnect
+struct payload_t {
+  payload_ap_t ap[PAYLOAD_MAX_APS];
+  uint8_t ap_ct;
+  float voltage;
+  int32_t button_ct;
+  uint16_t id;
+  int32_t wifi_fail;
+  int32_t mqtt_fail;
+  uint16_t send_cause;
+  uint32_t runtime;
+  uint32_t used_uah;       // estimated charge used since power on
+  uint16_t days_left;      // estimated battery life, 0xffff = unknown
+  BATCH_BUFFER* batch;     // scans of earlier wakes, sent along if not empty
+  TRACE* trace;            // probe timestamps of earlier wakes, nullptr = not sent
+  uint8_t trace_ct;        // oldest events of trace that are sent
+  bool delta;              // ap holds only new and changed APs
+  uint8_t gone_ct;         // with delta: APs no longer seen
+  uint8_t gone[PAYLOAD_MAX_APS][6];
+};
+
+// encoding on the wire, selected per device with the format command
+enum payload_format_t : uint8_t {
+  PAYLOAD_JSON,
+  PAYLOAD_BIN
+};
+
+enum payload_type_t : uint8_t {
+  PT_INT,
+  PT_UINT,
+  PT_FLOAT,
+  PT_STR,
+  PT_MAC
+};
+
+struct payload_field_t {
+  const char* name;
+  payload_type_t type;
+  uint8_t size;
+  uint16_t offset;
+};
+
+#define PAYLOAD_FIELD(s, member, type) {#member, type, sizeof(s::member), offsetof(s, member)}
+
+// message layout, order is the order on the wire
+constexpr payload_field_t payload_ap_fields[] = {
+  PAYLOAD_FIELD(payload_ap_t, ssid, PT_STR),
+  PAYLOAD_FIELD(payload_ap_t, bssid, PT_MAC),
+  PAYLOAD_FIELD(payload_ap_t, rssi, PT_INT),
+  PAYLOAD_FIELD(payload_ap_t, channel, PT_UINT),
+};
+
+constexpr payload_field_t batch_ap_fields[] = {
+  PAYLOAD_FIELD(batch_ap_t, bssid, PT_MAC),
+  PAYLOAD_FIELD(batch_ap_t, rssi, PT_INT),
+  PAYLOAD_FIELD(batch_ap_t, channel, PT_UINT),
+};
+
+// after "age", the sec since the record was taken
+constexpr payload_field_t batch_record_fields[] = {
+  PAYLOAD_FIELD(batch_record_t, mv, PT_UINT),
+  PAYLOAD_FIELD(batch_record_t, send_cause, PT_UINT),
+};
+
+constexpr payload_field_t payload_fields[] = {
+  PAYLOAD_FIELD(payload_t, voltage, PT_FLOAT),
+  PAYLOAD_FIELD(payload_t, button_ct, PT_INT),
+  PAYLOAD_FIELD(payload_t, id, PT_UINT),
+  PAYLOAD_FIELD(payload_t, wifi_fail, PT_INT),
+  PAYLOAD_FIELD(payload_t, mqtt_fail, PT_INT),
+  PAYLOAD_FIELD(payload_t, send_cause, PT_UINT),
+  PAYLOAD_FIELD(payload_t, runtime, PT_UINT),
+  PAYLOAD_FIELD(payload_t, used_uah, PT_UINT),
+  PAYLOAD_FIELD(payload_t, days_left, PT_UINT),
+};
+
+void payload_clear(payload_t* p);
+bool payload_add_ap(payload_t* p, const char* ssid, const uint8_t* bssid, int8_t rssi, uint8_t channel);
+// keeps the k strongest APs of a scan, the list is a heap on rssi (weakest first) until payload_sort_aps()
+bool payload_keep_ap(payload_t* p, uint8_t k, const char* ssid, const uint8_t* bssid, int8_t rssi, uint8_t channel);
+// strongest first, after the last payload_keep_ap()
+void payload_sort_aps(payload_t* p);
+// json into buf, APs that do not fit are left out, returns the length
+size_t payload_to_json(const payload_t* p, char* buf, size_t size);
+// compact binary form, see payload_format.h, returns 0 if it does not fit
+size_t payload_to_bin(const payload_t* p, uint8_t* buf, size_t size);
+
+#endif
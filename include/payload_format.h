@@ -0,0 +1,76 @@
+#ifndef PAYLOAD_FORMAT_H
+#define PAYLOAD_FORMAT_H
+
+#include <stdint.h>
+
+// binary message layout, shared by the firmware encoder and the host decoder
+// all numbers little endian
+//
+// header, PAYLOAD_BIN_HEADER bytes
+//   0  u8   magic 'K'
+//   1  u8   version
+//   2  u8   flags, PAYLOAD_BIN_FLAG_*
+//   3  u16  voltage in mV
+//   5  u16  id
+//   7  u16  button_ct   (counters saturate at 0xffff)
+//   9  u16  wifi_fail
+//  11  u16  mqtt_fail
+//  13  u16  send_cause
+//  15  u32  runtime
+//  19  u8   number of ssids in the dictionary
+//  20  u8   number of APs
+// ssid dictionary, per entry
+//   u8 length, length bytes (no terminator)
+// APs, per entry
+//   6  bssid
+//   i8 rssi
+//   u8 channel << 4 | ssid index, index 15 means the index follows in the next byte
+// batch, only with PAYLOAD_BIN_FLAG_BATCH
+//   u8 number of records, oldest first, per record
+//     u32 age in sec
+//     u16 voltage in mV
+//     u16 send_cause
+//     u8  number of APs, per AP
+//       6  bssid
+//       i8 rssi
+//       u8 channel
+// energy, only with PAYLOAD_BIN_FLAG_ENERGY
+//   u32 used uAh
+//   u16 days left
+// gone, only with PAYLOAD_BIN_FLAG_DELTA, the AP list holds new and changed APs only
+//   u8 number of APs no longer seen, per AP
+//     6  bssid
+// trace, only with PAYLOAD_BIN_FLAG_TRACE
+//   u8 number of events, oldest first, per event
+//     u8  probe, trace_probe_t
+//     u8  arg
+//     u16 ms since the wake started
+
+#define PAYLOAD_BIN_MAGIC 'K'
+#define PAYLOAD_BIN_VERSION 1
+#define PAYLOAD_BIN_HEADER 21
+#define PAYLOAD_BIN_AP 8
+#define PAYLOAD_BIN_SSID_ESC 15
+#define PAYLOAD_BIN_SSID_MAX 32
+#define PAYLOAD_BIN_RECORD 9
+#define PAYLOAD_BIN_FLAG_BATCH 0x01
+#define PAYLOAD_BIN_FLAG_TRACE 0x02
+#define PAYLOAD_BIN_TRACE 4
+#define PAYLOAD_BIN_FLAG_ENERGY 0x04
+#define PAYLOAD_BIN_ENERGY 6
+#define PAYLOAD_BIN_FLAG_DELTA 0x08
+
+// probe points of a wake in the trace
+enum trace_probe_t : uint8_t {
+  TP_BOOT,                 // arg: wakeup cause
+  TP_SCAN_DONE,            // arg: channel
+  TP_STA_CONNECTED,
+  TP_GOT_IP,
+  TP_MQTT_CONNECTED,
+  TP_PUBACK,
+  TP_SLEEP,
+  TP_DNS,                  // broker address known, arg: 1 = from the rtc cache
+  TP_COUNT
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef PRESS_STATS_H
+#define PRESS_STATS_H
+
+#include <Arduino.h>
+
+#define PRESS_BUCKETS 14         // upper bounds 100 150 200 300 400 500 750 1000 1500 2000 3000 5000 10000 ms, then the rest
+
+// button press to the puback of its "pressed" message, since power on, kept in rtc memory by the caller
+struct press_stats_t {
+  uint16_t bucket[PRESS_BUCKETS];
+  uint16_t acked;
+  uint16_t failed;         // presses whose send gave up
+  uint16_t max_ms;         // saturates
+  uint32_t sum_ms;
+  uint16_t published;      // acked + failed when the histogram was last sent
+};
+
+// latency histogram of the button presses
+class PRESS_STATS {
+public:
+  PRESS_STATS(struct press_stats_t* stats);
+  void acked(uint32_t ms);
+  void failed();
+  void clear();
+  // presses acked or failed since power on
+  uint16_t total();
+  // there are presses the last sent histogram does not have
+  bool unpublished();
+  // total() of the histogram the broker acknowledged
+  void published(uint16_t total);
+  // upper bound in ms of the bucket pct % of the acked presses fall into, max_ms for the last bucket
+  uint16_t percentile(uint8_t pct);
+  // {"n":..,"fail":..,"avg":..,"p50":..,"p90":..,"max":..,"hist":[..]}, 0 if it does not fit
+  size_t toJson(char* buf, size_t size);
+  void print(Print* out);
+private:
+  struct press_stats_t* _stats;
+};
+
+#endif
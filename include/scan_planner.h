@@ -0,0 +1,53 @@
+#ifndef SCAN_PLANNER_H
+#define SCAN_PLANNER_H
+
+#include <Arduino.h>
+
+#define SCAN_MAX_CHANNEL 13
+#define SCAN_ALL_CHANNELS ((1 << SCAN_MAX_CHANNEL) - 1)
+
+// per channel history, kept in rtc memory by the caller
+struct scan_channel_stats_t {
+  uint8_t ap_avg;          // moving average of APs seen, x16
+  uint8_t target_avg;      // moving average of target ssid APs seen, x16
+  uint16_t last_scan;      // plan number the channel was last scanned in
+  uint16_t last_target;    // plan number the target ssid was last seen in
+};
+
+struct scan_stats_t {
+  uint16_t plans;          // completed scan plans
+  scan_channel_stats_t ch[SCAN_MAX_CHANNEL];
+};
+
+struct scan_step_t {
+  uint8_t channel;
+  bool passive;
+  uint16_t dwell;
+};
+
+// orders the channels of a wake by expected yield from the history
+class SCAN_PLANNER {
+public:
+  SCAN_PLANNER(struct scan_stats_t* stats);
+  void begin(uint16_t channels, uint16_t passive, uint16_t dwell, uint16_t min_dwell,
+             uint8_t max_channels, uint8_t explore);
+  bool next(scan_step_t &step);
+  // the target was on none of the planned channels: the allowed channels not in the plan follow
+  // with the full dwell, false if there are none
+  bool widen();
+  void record(uint8_t channel, uint8_t ap_ct, uint8_t target_ct);
+  void end();
+  uint32_t planTime();
+  void print(Print* out);
+private:
+  uint16_t score(uint8_t channel);
+  struct scan_stats_t* _stats;
+  scan_step_t _plan[SCAN_MAX_CHANNEL];
+  uint8_t _plan_ct;
+  uint8_t _pos;
+  uint16_t _channels;
+  uint16_t _passive;
+  uint16_t _dwell;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SLEEP_PLANNER_H
+#define SLEEP_PLANNER_H
+
+#include <Arduino.h>
+
+#define SLEEP_STRETCH_MAX 4      // sleeps get this much longer towards an empty battery
+#define SLEEP_DAY 86400UL
+
+struct sleep_config_t {
+  uint16_t retry_max;      // sec the backoff after failed sends grows to, <= retry = no backoff
+  uint8_t low_pct;         // battery % below which sleeps are stretched, 0 = off
+  uint8_t quiet_from;      // hour no timer wake happens from, same as quiet_to = off
+  uint8_t quiet_to;        // hour the timer wakes start again
+  uint16_t utc_offset;     // min local time is ahead of utc, 0..1439
+};
+
+// kept in rtc memory by the caller
+struct sleep_state_t {
+  uint8_t fails;           // failed sends in a row
+  uint8_t charge;          // inputs and parts of the last plan, for print()
+  uint32_t base;
+  uint32_t stretched;
+  uint32_t planned;
+};
+
+// sec until the next timer wake, from the outcome of the send, the battery and the time of day. no io
+// of its own, the caller passes charge, clock and the random number
+class SLEEP_PLANNER {
+public:
+  SLEEP_PLANNER(struct sleep_state_t* state);
+  void begin(const sleep_config_t &config, uint16_t interval, uint16_t retry);
+  // counts the failed sends in a row
+  void sent(bool ok);
+  // charge in % from the battery voltage, utc_sec < 0 while the clock is not set
+  uint32_t next(bool retry, uint8_t charge, int32_t utc_sec, uint32_t rnd);
+  uint8_t fails();
+  void clear();
+  void print(Print* out);
+private:
+  uint32_t backoff(uint32_t rnd);
+  uint32_t quiet(uint32_t seconds, int32_t utc_sec);
+  struct sleep_state_t* _state;
+  sleep_config_t _config;
+  uint16_t _interval;
+  uint16_t _retry;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <Arduino.h>
+#include "payload.h"
+
+#define SNAPSHOT_RSSI_TOLERANCE 8   // dB an AP may drift and still count as unchanged
+
+struct snapshot_ap_t {
+  uint8_t bssid[6];
+  int8_t rssi;
+};
+
+// AP set of a scan, sorted by bssid
+struct ap_snapshot_t {
+  bool valid;
+  uint8_t ap_ct;
+  snapshot_ap_t ap[PAYLOAD_MAX_APS];
+};
+
+// the AP set the backend knows, kept in rtc memory by the caller
+struct snapshot_state_t {
+  ap_snapshot_t last;      // as of the last acknowledged send
+  uint8_t skipped;         // wakes in a row without a send because nothing changed
+};
+
+// change detection against the last acknowledged AP set
+class AP_SNAPSHOT {
+public:
+  AP_SNAPSHOT(struct snapshot_state_t* state);
+  // sorted AP set of the scan in p
+  static void take(const payload_t* p, ap_snapshot_t &snap);
+  // % of the APs of both sets seen in both within the tolerance, 0 without a last set
+  uint8_t similarity(const ap_snapshot_t &snap);
+  // cuts p->ap down to new and changed APs and lists the gone ones, next gets the
+  // set the backend has once this message is acknowledged
+  void delta(payload_t* p, const ap_snapshot_t &snap, ap_snapshot_t &next);
+  // the message built from next was acknowledged
+  void commit(const ap_snapshot_t &next);
+  void skip();
+  uint8_t skipped();
+  void clear();
+private:
+  struct snapshot_state_t* _state;
+};
+
+#endif
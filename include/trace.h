@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include "payload_format.h"
+
+#define TRACE_MAX_EVENTS 64
+
+struct trace_event_t {
+  uint16_t ms;             // millis() in the wake, saturates
+  uint8_t probe;
+  uint8_t arg;
+};
+
+// ring of events, kept in rtc memory by the caller
+struct trace_t {
+  uint8_t head;            // oldest event
+  uint8_t count;
+  trace_event_t ev[TRACE_MAX_EVENTS];
+};
+
+// timestamps of the probe points of the last wakes, the oldest are dropped if full
+class TRACE {
+public:
+  TRACE(struct trace_t* trace);
+  void mark(trace_probe_t probe, uint8_t arg = 0);
+  void clear();
+  // events of the finished wakes, all before the TP_BOOT of this one
+  uint8_t complete();
+  // drops the n oldest events
+  void drop(uint8_t n);
+  uint8_t count();
+  // i = 0 is the oldest event
+  const trace_event_t &get(uint8_t i);
+  void print(Print* out);
+private:
+  struct trace_t* _trace;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef WAKE_CYCLE_H
+#define WAKE_CYCLE_H
+
+#include <Arduino.h>
+
+// phases of a sending wake, in the order they are passed
+enum cycle_state_t : uint8_t {
+  CS_IDLE,                 // no send started
+  CS_SCAN,
+  CS_ASSOC,
+  CS_DHCP,
+  CS_MQTT,                 // tcp + CONNECT/CONNACK
+  CS_PUBLISH,
+  CS_ACK,                  // waiting for the pubacks
+  CS_SLEEP,                // done, sent or nothing to send
+  CS_FAILED,               // a phase ran out of time
+  CS_COUNT
+};
+
+enum cycle_event_t : uint8_t {
+  CE_SCAN_DONE,            // scan plan finished, connecting
+  CE_CONNECTED,
+  CE_GOT_IP,
+  CE_MQTT_CONNECTED,
+  CE_PUBLISHED,            // message handed to the client
+  CE_ACKED,                // all pubacks in
+  CE_DONE,                 // nothing to send, a batched or unchanged scan
+};
+
+// ms a phase may take, 0 = only the total limit applies
+struct cycle_deadlines_t {
+  uint16_t scan_ms;        // on top of the planned dwell time
+  uint16_t assoc_ms;
+  uint16_t dhcp_ms;
+  uint16_t mqtt_ms;
+  uint16_t publish_ms;
+  uint16_t ack_ms;
+};
+
+// transitions since power on, kept in rtc memory by the caller
+struct cycle_stats_t {
+  uint16_t entered[CS_COUNT];
+  uint16_t timeout[CS_COUNT];
+  uint16_t fast_miss;      // fast connects that fell back to the scan
+};
+
+// the wake cycle as a state machine driven by wifi/mqtt events and the clock, no io of its own
+class WAKE_CYCLE {
+public:
+  WAKE_CYCLE(struct cycle_stats_t* stats);
+  // total_ms limits the whole send, 0 = no limit
+  void begin(const cycle_deadlines_t &deadlines, uint32_t total_ms);
+  // a send starts with the scan or, fast, with the cached ap, which falls back to the scan after fast_ms
+  void start(uint32_t now, bool fast = false, uint16_t fast_ms = 0);
+  // dwell time of the scan plan, extends the scan deadline
+  void planned(uint32_t plan_ms);
+  // moves on to the phase the event leads to, events of passed phases are ignored
+  bool event(cycle_event_t event, uint32_t now);
+  // the phase that ran out of time, CS_IDLE if none. state() is CS_FAILED then or CS_SCAN
+  // when a fast connect falls back
+  cycle_state_t expired(uint32_t now);
+  // ms until the next deadline, UINT32_MAX if there is none
+  uint32_t timeout(uint32_t now);
+  cycle_state_t state() { return _state; }
+  bool busy() { return (_state > CS_IDLE) && (_state < CS_SLEEP); }
+  bool fast() { return _fast; }
+  // ms since start
+  uint32_t elapsed(uint32_t now) { return now - _start; }
+  // called on every phase change, e.g. to set the cpu clock of the phase
+  void onEnter(void (*fn)(cycle_state_t state)) { _on_enter = fn; }
+  void clear();
+  void print(Print* out);
+  static const char* name(cycle_state_t state);
+private:
+  void enter(cycle_state_t state, uint32_t now);
+  uint32_t budget();
+  struct cycle_stats_t* _stats;
+  cycle_deadlines_t _deadlines;
+  uint32_t _total_ms;
+  cycle_state_t _state;
+  bool _fast;
+  uint16_t _fast_ms;
+  uint32_t _plan_ms;
+  uint32_t _start;
+  uint32_t _since;
+  void (*_on_enter)(cycle_state_t state);
+};
+
+#endif
@@ -0,0 +1,695 @@
+#include "ingest.h"
+#include <cstring>
+#include "payload_format.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace payload_decoder {
+
+#define INGEST_MAX_DEPTH 16  // nesting of skipped values
+
+void Columns::reserve(size_t messages, size_t aps) {
+  for(auto* v : {&id, &send_cause, &days_left}) {
+    v->reserve(messages);
+  }
+  for(auto* v : {&button_ct, &wifi_fail, &mqtt_fail}) {
+    v->reserve(messages);
+  }
+  for(auto* v : {&runtime, &used_uah, &gone_begin}) {
+    v->reserve(messages);
+  }
+  voltage.reserve(messages);
+  delta.reserve(messages);
+  // a message has its own scan and a few batch records
+  size_t scans = 4 * messages;
+  for(auto* v : {&scan_msg, &scan_age, &scan_ap_begin}) {
+    v->reserve(scans);
+  }
+  scan_mv.reserve(scans);
+  scan_send_cause.reserve(scans);
+  bssid.reserve(aps);
+  gone_bssid.reserve(aps / 4);
+  rssi.reserve(aps);
+  channel.reserve(aps);
+  ssid_begin.reserve(aps);
+  ssid_len.reserve(aps);
+  ssid_bytes.reserve(aps * 12);
+}
+
+// the sizes the columns had before a message, to drop it again
+struct ColumnMark {
+  size_t messages;
+  size_t scans;
+  size_t aps;
+  size_t ssid_bytes;
+  size_t gone;
+};
+
+static ColumnMark mark(const Columns &c) {
+  return {c.id.size(), c.scan_msg.size(), c.bssid.size(), c.ssid_bytes.size(), c.gone_bssid.size()};
+}
+
+static void rewind(Columns &c, const ColumnMark &m) {
+  c.id.resize(m.messages);
+  c.voltage.resize(m.messages);
+  c.button_ct.resize(m.messages);
+  c.wifi_fail.resize(m.messages);
+  c.mqtt_fail.resize(m.messages);
+  c.send_cause.resize(m.messages);
+  c.runtime.resize(m.messages);
+  c.used_uah.resize(m.messages);
+  c.days_left.resize(m.messages);
+  c.delta.resize(m.messages);
+  c.gone_begin.resize(m.messages);
+  c.scan_msg.resize(m.scans);
+  c.scan_age.resize(m.scans);
+  c.scan_mv.resize(m.scans);
+  c.scan_send_cause.resize(m.scans);
+  c.scan_ap_begin.resize(m.scans);
+  c.bssid.resize(m.aps);
+  c.rssi.resize(m.aps);
+  c.channel.resize(m.aps);
+  c.ssid_begin.resize(m.aps);
+  c.ssid_len.resize(m.aps);
+  c.ssid_bytes.resize(m.ssid_bytes);
+  c.gone_bssid.resize(m.gone);
+}
+
+void Columns::clear() {
+  rewind(*this, {});
+}
+
+// per message values, they come after the ap list on the wire
+struct MessageRow {
+  uint16_t id = 0;
+  float voltage = 0;
+  int32_t button_ct = 0;
+  int32_t wifi_fail = 0;
+  int32_t mqtt_fail = 0;
+  uint16_t send_cause = 0;
+  uint32_t runtime = 0;
+  uint32_t used_uah = 0;
+  uint16_t days_left = 0xffff;
+  uint8_t delta = 0;
+};
+
+static void pushMessage(Columns &c, const MessageRow &m, uint32_t gone_begin) {
+  c.id.push_back(m.id);
+  c.voltage.push_back(m.voltage);
+  c.button_ct.push_back(m.button_ct);
+  c.wifi_fail.push_back(m.wifi_fail);
+  c.mqtt_fail.push_back(m.mqtt_fail);
+  c.send_cause.push_back(m.send_cause);
+  c.runtime.push_back(m.runtime);
+  c.used_uah.push_back(m.used_uah);
+  c.days_left.push_back(m.days_left);
+  c.delta.push_back(m.delta);
+  c.gone_begin.push_back(gone_begin);
+}
+
+static void pushScan(Columns &c, uint32_t msg, uint32_t age, uint16_t mv, uint16_t send_cause) {
+  c.scan_msg.push_back(msg);
+  c.scan_age.push_back(age);
+  c.scan_mv.push_back(mv);
+  c.scan_send_cause.push_back(send_cause);
+  c.scan_ap_begin.push_back(c.bssid.size());
+}
+
+static void pushAp(Columns &c, uint64_t bssid, int8_t rssi, uint8_t channel, uint32_t ssid_begin, uint8_t ssid_len) {
+  c.bssid.push_back(bssid);
+  c.rssi.push_back(rssi);
+  c.channel.push_back(channel);
+  c.ssid_begin.push_back(ssid_begin);
+  c.ssid_len.push_back(ssid_len);
+}
+
+static uint64_t bssid64(const uint8_t* b) {
+  uint64_t v = 0;
+  for(int i = 0; i < 6; ++i) {
+    v = (v << 8) | b[i];
+  }
+  return v;
+}
+
+void Columns::append(const Message &msg) {
+  uint32_t row = id.size();
+  bool energy = msg.flags & PAYLOAD_BIN_FLAG_ENERGY;
+  MessageRow m;
+  m.id = msg.id;
+  m.voltage = msg.voltage;
+  m.button_ct = msg.button_ct;
+  m.wifi_fail = msg.wifi_fail;
+  m.mqtt_fail = msg.mqtt_fail;
+  m.send_cause = msg.send_cause;
+  m.runtime = msg.runtime;
+  m.used_uah = energy ? msg.used_uah : 0;
+  m.days_left = energy ? msg.days_left : 0xffff;
+  m.delta = msg.delta;
+  pushMessage(*this, m, gone_bssid.size());
+  for(const auto &g : msg.gone) {
+    gone_bssid.push_back(bssid64(g.data()));
+  }
+  for(const Record &r : msg.batch) {
+    pushScan(*this, row, r.age, r.mv, r.send_cause);
+    for(const Ap &ap : r.ap) {
+      pushAp(*this, bssid64(ap.bssid), ap.rssi, ap.channel, ssid_bytes.size(), 0);
+    }
+  }
+  pushScan(*this, row, 0, msg.voltage * 1000.0f + 0.5f, msg.send_cause);
+  for(const Ap &ap : msg.ap) {
+    uint32_t begin = ssid_bytes.size();
+    ssid_bytes.insert(ssid_bytes.end(), ap.ssid.begin(), ap.ssid.end());
+    pushAp(*this, bssid64(ap.bssid), ap.rssi, ap.channel, begin, ap.ssid.size());
+  }
+}
+
+// first '"' or '\\' from p on, end if there is none
+static const char* findSpecial(const char* p, const char* end) {
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  while(end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    int hits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+    if(hits) {
+      return p + __builtin_ctz(hits);
+    }
+    p += 16;
+  }
+#endif
+  while((p < end) && (*p != '"') && (*p != '\\')) {
+    p++;
+  }
+  return p;
+}
+
+const char* ingestScanner() {
+#ifdef __SSE2__
+  return "sse2";
+#else
+  return "scalar";
+#endif
+}
+
+// 0-15, 0xff for anything else
+struct HexTable {
+  uint8_t v[256];
+  constexpr HexTable() : v() {
+    for(int i = 0; i < 256; ++i) {
+      v[i] = 0xff;
+    }
+    for(int i = 0; i < 10; ++i) {
+      v['0' + i] = i;
+    }
+    for(int i = 0; i < 6; ++i) {
+      v['a' + i] = v['A' + i] = 10 + i;
+    }
+  }
+};
+static constexpr HexTable hex_table;
+
+static const double pow10_table[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// reads the tokens of one message in place, any failure sticks
+class JSON_SCANNER {
+public:
+  JSON_SCANNER(const char* buf, size_t len) : _p(buf), _end(buf + len), _fail(false) {}
+  bool failed() { return _fail; }
+  bool fail() {
+    _fail = true;
+    return false;
+  }
+  void ws() {
+    while((_p < _end) && ((*_p == ' ') || (*_p == '\n') || (*_p == '\r') || (*_p == '\t'))) {
+      _p++;
+    }
+  }
+  bool eat(char c) {
+    ws();
+    if((_p < _end) && (*_p == c)) {
+      _p++;
+      return true;
+    }
+    return false;
+  }
+  bool expect(char c) {
+    return eat(c) || fail();
+  }
+  bool atEnd() {
+    ws();
+    return _p == _end;
+  }
+  // "name": in place, keys of the firmware have no escapes
+  bool key(const char* &name, size_t &len) {
+    if(!expect('"')) {
+      return false;
+    }
+    const char* q = findSpecial(_p, _end);
+    if((q == _end) || (*q != '"')) {
+      return fail();
+    }
+    name = _p;
+    len = q - _p;
+    _p = q + 1;
+    return expect(':');
+  }
+  // appends the unescaped string
+  bool str(std::vector<char> &out) {
+    if(!expect('"')) {
+      return false;
+    }
+    for(;;) {
+      const char* q = findSpecial(_p, _end);
+      if(q == _end) {
+        return fail();
+      }
+      out.insert(out.end(), _p, q);
+      _p = q + 1;
+      if(*q == '"') {
+        return true;
+      }
+      if(_p == _end) {
+        return fail();
+      }
+      char c = *_p++;
+      switch(c) {
+        case '"': case '\\': case '/': out.push_back(c); break;
+        case 'b': out.push_back('\b'); break;
+        case 'f': out.push_back('\f'); break;
+        case 'n': out.push_back('\n'); break;
+        case 'r': out.push_back('\r'); break;
+        case 't': out.push_back('\t'); break;
+        case 'u': {
+          if(_end - _p < 4) {
+            return fail();
+          }
+          uint32_t code = 0;
+          for(int i = 0; i < 4; ++i) {
+            uint8_t h = hex_table.v[(uint8_t)*_p++];
+            if(h > 15) {
+              return fail();
+            }
+            code = (code << 4) | h;
+          }
+          // the firmware only escapes control characters, others as utf-8 without surrogate pairs
+          if(code < 0x80) {
+            out.push_back(code);
+          } else if(code < 0x800) {
+            out.push_back(0xc0 | (code >> 6));
+            out.push_back(0x80 | (code & 0x3f));
+          } else {
+            out.push_back(0xe0 | (code >> 12));
+            out.push_back(0x80 | ((code >> 6) & 0x3f));
+            out.push_back(0x80 | (code & 0x3f));
+          }
+          break;
+        }
+        default:
+          return fail();
+      }
+    }
+  }
+  // "F4:E2:10:20:30:01"
+  bool mac(uint64_t &v) {
+    ws();
+    if((_end - _p < 19) || (_p[0] != '"') || (_p[18] != '"')) {
+      return fail();
+    }
+    const uint8_t* s = (const uint8_t*)_p + 1;
+    v = 0;
+    for(int i = 0; i < 6; ++i, s += 3) {
+      uint8_t h = hex_table.v[s[0]];
+      uint8_t l = hex_table.v[s[1]];
+      if(((h | l) > 15) || ((i < 5) && (s[2] != ':'))) {
+        return fail();
+      }
+      v = (v << 8) | (h << 4) | l;
+    }
+    _p += 19;
+    return true;
+  }
+  bool num(int64_t &v) {
+    ws();
+    bool neg = (_p < _end) && (*_p == '-');
+    _p += neg;
+    uint64_t u;
+    int digits = uint(u);
+    if(!digits || (digits > 18) || ((_p < _end) && ((*_p == '.') || (*_p == 'e') || (*_p == 'E')))) {
+      return fail();
+    }
+    v = neg ? -(int64_t)u : (int64_t)u;
+    return true;
+  }
+  template <typename T>
+  bool num(T &v, int64_t min, int64_t max) {
+    int64_t n;
+    if(!num(n) || (n < min) || (n > max)) {
+      return fail();
+    }
+    v = n;
+    return true;
+  }
+  // what %.7g writes, up to 19 significant digits are taken exactly
+  bool flt(float &v) {
+    ws();
+    bool neg = (_p < _end) && (*_p == '-');
+    _p += neg;
+    uint64_t mant = 0;
+    int exp10 = 0;
+    int digits = 0;
+    const char* start = _p;
+    while((_p < _end) && ((uint8_t)(*_p - '0') < 10)) {
+      if(digits < 19) {
+        mant = mant * 10 + (*_p - '0');
+        digits += (mant != 0);
+      } else {
+        exp10++;
+      }
+      _p++;
+    }
+    bool any = _p != start;
+    if((_p < _end) && (*_p == '.')) {
+      _p++;
+      while((_p < _end) && ((uint8_t)(*_p - '0') < 10)) {
+        if(digits < 19) {
+          mant = mant * 10 + (*_p - '0');
+          digits += (mant != 0);
+          exp10--;
+        }
+        any = true;
+        _p++;
+      }
+    }
+    if(!any) {
+      return fail();
+    }
+    if((_p < _end) && ((*_p == 'e') || (*_p == 'E'))) {
+      _p++;
+      bool eneg = (_p < _end) && (*_p == '-');
+      _p += eneg || ((_p < _end) && (*_p == '+'));
+      uint64_t e;
+      if(!uint(e) || (e > 400)) {
+        return fail();
+      }
+      exp10 += eneg ? -(int)e : (int)e;
+    }
+    double d = mant;
+    while(exp10 > 22) {
+      d *= 1e22;
+      exp10 -= 22;
+    }
+    while(exp10 < -22) {
+      d /= 1e22;
+      exp10 += 22;
+    }
+    d = (exp10 < 0) ? d / pow10_table[-exp10] : d * pow10_table[exp10];
+    v = neg ? -d : d;
+    return true;
+  }
+  // any value, for keys the columns do not hold
+  bool skip(int depth = 0) {
+    ws();
+    if((_p == _end) || (depth > INGEST_MAX_DEPTH)) {
+      return fail();
+    }
+    char c = *_p;
+    if(c == '"') {
+      _p++;
+      for(;;) {
+        const char* q = findSpecial(_p, _end);
+        if(q == _end) {
+          return fail();
+        }
+        _p = q + 1;
+        if(*q == '"') {
+          return true;
+        }
+        // the escaped character, \u digits are plain
+        if(_p++ == _end) {
+          return fail();
+        }
+      }
+    }
+    if((c == '{') || (c == '[')) {
+      char close = (c == '{') ? '}' : ']';
+      _p++;
+      if(eat(close)) {
+        return true;
+      }
+      do {
+        if(c == '{') {
+          const char* name;
+          size_t len;
+          if(!key(name, len)) {
+            return false;
+          }
+        }
+        if(!skip(depth + 1)) {
+          return false;
+        }
+      } while(eat(','));
+      return expect(close);
+    }
+    // number, true, false, null
+    const char* start = _p;
+    while((_p < _end) && (*_p != ',') && (*_p != '}') && (*_p != ']') && (*_p != ' ')) {
+      _p++;
+    }
+    return (_p != start) || fail();
+  }
+private:
+  // digits from _p, their count
+  int uint(uint64_t &v) {
+    v = 0;
+    int n = 0;
+    while((_p < _end) && ((uint8_t)(*_p - '0') < 10) && (n < 20)) {
+      v = v * 10 + (*_p++ - '0');
+      n++;
+    }
+    return n;
+  }
+  const char* _p;
+  const char* _end;
+  bool _fail;
+};
+
+template <size_t N>
+static inline bool is(const char* name, size_t len, const char (&lit)[N]) {
+  return (len == N - 1) && !memcmp(name, lit, N - 1);
+}
+
+// {"ssid":"..","bssid":"..","rssi":-61,"channel":1}, the batch records have no ssid
+static bool apObject(JSON_SCANNER &s, Columns &c) {
+  if(!s.expect('{')) {
+    return false;
+  }
+  uint64_t bssid = 0;
+  int8_t rssi = 0;
+  uint8_t channel = 0;
+  uint32_t ssid_begin = c.ssid_bytes.size();
+  if(!s.eat('}')) {
+    do {
+      const char* name;
+      size_t len;
+      if(!s.key(name, len)) {
+        return false;
+      }
+      bool ok;
+      if(is(name, len, "ssid")) {
+        c.ssid_bytes.resize(ssid_begin);
+        ok = s.str(c.ssid_bytes) && ((c.ssid_bytes.size() - ssid_begin) <= UINT8_MAX || s.fail());
+      } else if(is(name, len, "bssid")) {
+        ok = s.mac(bssid);
+      } else if(is(name, len, "rssi")) {
+        ok = s.num(rssi, INT8_MIN, INT8_MAX);
+      } else if(is(name, len, "channel")) {
+        ok = s.num(channel, 0, UINT8_MAX);
+      } else {
+        ok = s.skip();
+      }
+      if(!ok) {
+        return false;
+      }
+    } while(s.eat(','));
+    if(!s.expect('}')) {
+      return false;
+    }
+  }
+  pushAp(c, bssid, rssi, channel, ssid_begin, c.ssid_bytes.size() - ssid_begin);
+  return true;
+}
+
+static bool apArray(JSON_SCANNER &s, Columns &c) {
+  if(!s.expect('[')) {
+    return false;
+  }
+  if(s.eat(']')) {
+    return true;
+  }
+  do {
+    if(!apObject(s, c)) {
+      return false;
+    }
+  } while(s.eat(','));
+  return s.expect(']');
+}
+
+// [{"age":600,"mv":4100,"send_cause":132,"ap":[...]},...]
+static bool batchArray(JSON_SCANNER &s, Columns &c, uint32_t row) {
+  if(!s.expect('[')) {
+    return false;
+  }
+  if(s.eat(']')) {
+    return true;
+  }
+  do {
+    if(!s.expect('{')) {
+      return false;
+    }
+    size_t scan = c.scan_msg.size();
+    pushScan(c, row, 0, 0, 0);
+    if(!s.eat('}')) {
+      do {
+        const char* name;
+        size_t len;
+        if(!s.key(name, len)) {
+          return false;
+        }
+        bool ok;
+        if(is(name, len, "age")) {
+          ok = s.num(c.scan_age[scan], 0, UINT32_MAX);
+        } else if(is(name, len, "mv")) {
+          ok = s.num(c.scan_mv[scan], 0, UINT16_MAX);
+        } else if(is(name, len, "send_cause")) {
+          ok = s.num(c.scan_send_cause[scan], 0, UINT16_MAX);
+        } else if(is(name, len, "ap")) {
+          ok = apArray(s, c);
+        } else {
+          ok = s.skip();
+        }
+        if(!ok) {
+          return false;
+        }
+      } while(s.eat(','));
+      if(!s.expect('}')) {
+        return false;
+      }
+    }
+  } while(s.eat(','));
+  return s.expect(']');
+}
+
+static bool goneArray(JSON_SCANNER &s, Columns &c) {
+  if(!s.expect('[')) {
+    return false;
+  }
+  if(s.eat(']')) {
+    return true;
+  }
+  do {
+    uint64_t v;
+    if(!s.mac(v)) {
+      return false;
+    }
+    c.gone_bssid.push_back(v);
+  } while(s.eat(','));
+  return s.expect(']');
+}
+
+static bool message(JSON_SCANNER &s, Columns &c) {
+  uint32_t row = c.id.size();
+  uint32_t gone_begin = c.gone_bssid.size();
+  MessageRow m;
+  int64_t own_scan = -1;
+  if(!s.expect('{')) {
+    return false;
+  }
+  if(!s.eat('}')) {
+    do {
+      const char* name;
+      size_t len;
+      if(!s.key(name, len)) {
+        return false;
+      }
+      bool ok;
+      // in the order the firmware writes them
+      if(is(name, len, "ap")) {
+        own_scan = c.scan_msg.size();
+        pushScan(c, row, 0, 0, 0);
+        ok = apArray(s, c);
+      } else if(is(name, len, "voltage")) {
+        ok = s.flt(m.voltage);
+      } else if(is(name, len, "button_ct")) {
+        ok = s.num(m.button_ct, INT32_MIN, INT32_MAX);
+      } else if(is(name, len, "id")) {
+        ok = s.num(m.id, 0, UINT16_MAX);
+      } else if(is(name, len, "wifi_fail")) {
+        ok = s.num(m.wifi_fail, INT32_MIN, INT32_MAX);
+      } else if(is(name, len, "mqtt_fail")) {
+        ok = s.num(m.mqtt_fail, INT32_MIN, INT32_MAX);
+      } else if(is(name, len, "send_cause")) {
+        ok = s.num(m.send_cause, 0, UINT16_MAX);
+      } else if(is(name, len, "runtime")) {
+        ok = s.num(m.runtime, 0, UINT32_MAX);
+      } else if(is(name, len, "used_uah")) {
+        ok = s.num(m.used_uah, 0, UINT32_MAX);
+      } else if(is(name, len, "days_left")) {
+        ok = s.num(m.days_left, 0, UINT16_MAX);
+      } else if(is(name, len, "batch")) {
+        ok = batchArray(s, c, row);
+      } else if(is(name, len, "gone")) {
+        m.delta = 1;
+        ok = goneArray(s, c);
+      } else {
+        ok = s.skip();
+      }
+      if(!ok) {
+        return false;
+      }
+    } while(s.eat(','));
+    if(!s.expect('}')) {
+      return false;
+    }
+  }
+  if(!s.atEnd()) {
+    return s.fail();
+  }
+  if(own_scan < 0) {
+    // no APs, the scan row is there anyway
+    own_scan = c.scan_msg.size();
+    pushScan(c, row, 0, 0, 0);
+  }
+  c.scan_mv[own_scan] = m.voltage * 1000.0f + 0.5f;
+  c.scan_send_cause[own_scan] = m.send_cause;
+  pushMessage(c, m, gone_begin);
+  return true;
+}
+
+Error ingestJson(const char* buf, size_t len, Columns &cols) {
+  ColumnMark before = mark(cols);
+  JSON_SCANNER s(buf, len);
+  if(!message(s, cols)) {
+    rewind(cols, before);
+    return Error::bad_json;
+  }
+  return Error::none;
+}
+
+Error ingest(const uint8_t* buf, size_t len, Columns &cols) {
+  if(!isBinary(buf, len)) {
+    return ingestJson((const char*)buf, len, cols);
+  }
+  // kept between calls, its vectors keep their capacity
+  static thread_local Message msg;
+  Error err = decode(buf, len, msg);
+  if(err == Error::none) {
+    cols.append(msg);
+  }
+  return err;
+}
+
+}
@@ -0,0 +1,69 @@
+#ifndef PAYLOAD_INGEST_H
+#define PAYLOAD_INGEST_H
+
+// backend intake of many messages into columns: the json of the firmware is scanned in place
+// without a document tree, binary messages go through decode(). once the columns have grown to
+// the size of a batch, clear() keeps the memory and the next batch allocates nothing
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "payload_decoder.h"
+
+namespace payload_decoder {
+
+struct Columns {
+  // one row per message
+  std::vector<uint16_t> id;
+  std::vector<float> voltage;
+  std::vector<int32_t> button_ct;
+  std::vector<int32_t> wifi_fail;
+  std::vector<int32_t> mqtt_fail;
+  std::vector<uint16_t> send_cause;
+  std::vector<uint32_t> runtime;
+  std::vector<uint32_t> used_uah;
+  std::vector<uint16_t> days_left;       // 0xffff = not in the message or unknown
+  std::vector<uint8_t> delta;            // 1 = the scan holds new and changed APs only
+  std::vector<uint32_t> gone_begin;      // first row in gone_bssid, up to the next message
+  // one row per scan in wire order: the batch records of the message, then its own scan (age 0)
+  std::vector<uint32_t> scan_msg;        // message row
+  std::vector<uint32_t> scan_age;        // sec before the message was sent
+  std::vector<uint16_t> scan_mv;
+  std::vector<uint16_t> scan_send_cause;
+  std::vector<uint32_t> scan_ap_begin;   // first row in the ap columns, up to the next scan
+  // one row per ap
+  std::vector<uint64_t> bssid;           // first byte in bits 40..47
+  std::vector<int8_t> rssi;
+  std::vector<uint8_t> channel;
+  std::vector<uint32_t> ssid_begin;      // into ssid_bytes, batch records have no ssid
+  std::vector<uint8_t> ssid_len;
+  std::vector<char> ssid_bytes;          // unescaped, not 0 terminated
+  std::vector<uint64_t> gone_bssid;
+
+  size_t messages() const { return id.size(); }
+  size_t scans() const { return scan_msg.size(); }
+  size_t aps() const { return bssid.size(); }
+  // [begin, end) of the ap rows of a scan
+  uint32_t apEnd(size_t scan) const {
+    return (scan + 1 < scan_ap_begin.size()) ? scan_ap_begin[scan + 1] : bssid.size();
+  }
+  uint32_t goneEnd(size_t msg) const {
+    return (msg + 1 < gone_begin.size()) ? gone_begin[msg + 1] : gone_bssid.size();
+  }
+  void reserve(size_t messages, size_t aps);
+  void clear();
+  // a decoded binary message, its trace is not kept
+  void append(const Message &msg);
+};
+
+// one json message of the firmware appended to the columns, on an error nothing is appended.
+// the trace and unknown keys are skipped
+Error ingestJson(const char* buf, size_t len, Columns &cols);
+// json or binary
+Error ingest(const uint8_t* buf, size_t len, Columns &cols);
+// "sse2" or "scalar", the string scanner compiled in
+const char* ingestScanner();
+
+}
+
+#endif
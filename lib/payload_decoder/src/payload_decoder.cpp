@@ -0,0 +1,271 @@
+#include "payload_decoder.h"
+#include <algorithm>
+#include <cstdio>
+#include "payload_format.h"
+
+namespace payload_decoder {
+
+class READER {
+public:
+  READER(const uint8_t* buf, size_t len) : _buf(buf), _len(len), _pos(0), _fail(false) {}
+  bool need(size_t n) {
+    if(_fail || (_len - _pos < n)) {
+      _fail = true;
+      return false;
+    }
+    return true;
+  }
+  uint8_t u8() {
+    return need(1) ? _buf[_pos++] : 0;
+  }
+  uint16_t u16() {
+    if(!need(2)) {
+      return 0;
+    }
+    uint16_t v = _buf[_pos] | (_buf[_pos + 1] << 8);
+    _pos += 2;
+    return v;
+  }
+  uint32_t u32() {
+    if(!need(4)) {
+      return 0;
+    }
+    uint32_t v = _buf[_pos] | (_buf[_pos + 1] << 8) | (_buf[_pos + 2] << 16) | ((uint32_t)_buf[_pos + 3] << 24);
+    _pos += 4;
+    return v;
+  }
+  const uint8_t* bytes(size_t n) {
+    if(!need(n)) {
+      return nullptr;
+    }
+    const uint8_t* p = _buf + _pos;
+    _pos += n;
+    return p;
+  }
+  bool failed() { return _fail; }
+  size_t left() { return _len - _pos; }
+private:
+  const uint8_t* _buf;
+  size_t _len;
+  size_t _pos;
+  bool _fail;
+};
+
+bool isBinary(const uint8_t* buf, size_t len) {
+  return (len >= PAYLOAD_BIN_HEADER) && (buf[0] == PAYLOAD_BIN_MAGIC);
+}
+
+Error decode(const uint8_t* buf, size_t len, Message &msg) {
+  READER r(buf, len);
+  if(len < PAYLOAD_BIN_HEADER) {
+    return Error::truncated;
+  }
+  if(r.u8() != PAYLOAD_BIN_MAGIC) {
+    return Error::bad_magic;
+  }
+  msg.version = r.u8();
+  if(msg.version != PAYLOAD_BIN_VERSION) {
+    return Error::bad_version;
+  }
+  msg.flags = r.u8();
+  msg.voltage = r.u16() / 1000.0f;
+  msg.id = r.u16();
+  msg.button_ct = r.u16();
+  msg.wifi_fail = r.u16();
+  msg.mqtt_fail = r.u16();
+  msg.send_cause = r.u16();
+  msg.runtime = r.u32();
+  uint8_t ssid_ct = r.u8();
+  uint8_t ap_ct = r.u8();
+  // kept between calls, the strings keep their capacity
+  static thread_local std::vector<std::string> ssids;
+  ssids.resize(ssid_ct);
+  for(auto &ssid : ssids) {
+    uint8_t n = r.u8();
+    const uint8_t* s = r.bytes(n);
+    if(!s) {
+      return Error::truncated;
+    }
+    ssid.assign((const char*)s, n);
+  }
+  msg.ap.resize(ap_ct);
+  for(auto &ap : msg.ap) {
+    const uint8_t* b = r.bytes(6);
+    if(!b) {
+      return Error::truncated;
+    }
+    std::copy(b, b + 6, ap.bssid);
+    ap.rssi = (int8_t)r.u8();
+    uint8_t v = r.u8();
+    ap.channel = v >> 4;
+    uint8_t idx = v & 0x0f;
+    if(idx == PAYLOAD_BIN_SSID_ESC) {
+      idx = r.u8();
+    }
+    if(r.failed()) {
+      return Error::truncated;
+    }
+    if(idx >= ssid_ct) {
+      return Error::bad_ssid_index;
+    }
+    ap.ssid = ssids[idx];
+  }
+  msg.batch.clear();
+  if(msg.flags & PAYLOAD_BIN_FLAG_BATCH) {
+    msg.batch.resize(r.u8());
+    for(auto &rec : msg.batch) {
+      rec.age = r.u32();
+      rec.mv = r.u16();
+      rec.send_cause = r.u16();
+      rec.ap.resize(r.u8());
+      for(auto &ap : rec.ap) {
+        const uint8_t* b = r.bytes(6);
+        if(!b) {
+          return Error::truncated;
+        }
+        std::copy(b, b + 6, ap.bssid);
+        ap.rssi = (int8_t)r.u8();
+        ap.channel = r.u8();
+      }
+    }
+  }
+  msg.used_uah = 0;
+  msg.days_left = 0;
+  if(msg.flags & PAYLOAD_BIN_FLAG_ENERGY) {
+    msg.used_uah = r.u32();
+    msg.days_left = r.u16();
+  }
+  msg.delta = msg.flags & PAYLOAD_BIN_FLAG_DELTA;
+  msg.gone.clear();
+  if(msg.delta) {
+    msg.gone.resize(r.u8());
+    for(auto &bssid : msg.gone) {
+      const uint8_t* b = r.bytes(6);
+      if(!b) {
+        return Error::truncated;
+      }
+      std::copy(b, b + 6, bssid.begin());
+    }
+  }
+  msg.trace.clear();
+  if(msg.flags & PAYLOAD_BIN_FLAG_TRACE) {
+    msg.trace.resize(r.u8());
+    for(auto &e : msg.trace) {
+      e.probe = r.u8();
+      e.arg = r.u8();
+      e.ms = r.u16();
+    }
+  }
+  if(r.failed()) {
+    return Error::truncated;
+  }
+  return r.left() ? Error::trailing_data : Error::none;
+}
+
+const char* errorName(Error err) {
+  switch(err) {
+    case Error::none: return "none";
+    case Error::truncated: return "truncated";
+    case Error::bad_magic: return "bad magic";
+    case Error::bad_version: return "bad version";
+    case Error::bad_ssid_index: return "bad ssid index";
+    case Error::trailing_data: return "trailing data";
+    case Error::bad_json: return "bad json";
+  }
+  return "?";
+}
+
+static void jsonStr(std::string &out, const std::string &s) {
+  static const char hex[] = "0123456789abcdef";
+  out += '"';
+  for(uint8_t c : s) {
+    if((c == '"') || (c == '\\')) {
+      out += '\\';
+      out += c;
+    } else if(c < 0x20) {
+      out += "\\u00";
+      out += hex[c >> 4];
+      out += hex[c & 0x0f];
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+static void jsonBssid(std::string &out, const Ap &ap) {
+  char tmp[64];
+  snprintf(tmp, sizeof(tmp), "\"bssid\":\"%02X:%02X:%02X:%02X:%02X:%02X\",\"rssi\":%d,\"channel\":%u",
+           ap.bssid[0], ap.bssid[1], ap.bssid[2], ap.bssid[3], ap.bssid[4], ap.bssid[5], ap.rssi, ap.channel);
+  out += tmp;
+}
+
+std::string toJson(const Message &msg) {
+  std::string out = "{";
+  char tmp[64];
+  if(!msg.trace.empty()) {
+    out += "\"trace\":[";
+    for(size_t i = 0; i < msg.trace.size(); ++i) {
+      const TraceEvent &e = msg.trace[i];
+      snprintf(tmp, sizeof(tmp), "%s[%u,%u,%u]", i ? "," : "", e.probe, e.ms, e.arg);
+      out += tmp;
+    }
+    out += "],";
+  }
+  if(!msg.batch.empty()) {
+    out += "\"batch\":[";
+    for(size_t i = 0; i < msg.batch.size(); ++i) {
+      const Record &rec = msg.batch[i];
+      snprintf(tmp, sizeof(tmp), "%s{\"age\":%u,\"mv\":%u,\"send_cause\":%u,\"ap\":[",
+               i ? "," : "", rec.age, rec.mv, rec.send_cause);
+      out += tmp;
+      for(size_t k = 0; k < rec.ap.size(); ++k) {
+        out += k ? ",{" : "{";
+        jsonBssid(out, rec.ap[k]);
+        out += '}';
+      }
+      out += "]}";
+    }
+    out += "],";
+  }
+  if(msg.delta) {
+    out += "\"gone\":[";
+    for(size_t i = 0; i < msg.gone.size(); ++i) {
+      const uint8_t* b = msg.gone[i].data();
+      snprintf(tmp, sizeof(tmp), "%s\"%02X:%02X:%02X:%02X:%02X:%02X\"", i ? "," : "", b[0], b[1], b[2], b[3], b[4], b[5]);
+      out += tmp;
+    }
+    out += "],";
+  }
+  if(!msg.ap.empty()) {
+    out += "\"ap\":[";
+    for(size_t i = 0; i < msg.ap.size(); ++i) {
+      const Ap &ap = msg.ap[i];
+      if(i) {
+        out += ',';
+      }
+      out += "{\"ssid\":";
+      jsonStr(out, ap.ssid);
+      out += ',';
+      jsonBssid(out, ap);
+      out += '}';
+    }
+    out += "],";
+  }
+  snprintf(tmp, sizeof(tmp), "\"voltage\":%.3f,", msg.voltage);
+  out += tmp;
+  snprintf(tmp, sizeof(tmp), "\"button_ct\":%u,\"id\":%u,", msg.button_ct, msg.id);
+  out += tmp;
+  snprintf(tmp, sizeof(tmp), "\"wifi_fail\":%u,\"mqtt_fail\":%u,", msg.wifi_fail, msg.mqtt_fail);
+  out += tmp;
+  snprintf(tmp, sizeof(tmp), "\"send_cause\":%u,\"runtime\":%u", msg.send_cause, msg.runtime);
+  out += tmp;
+  if(msg.flags & PAYLOAD_BIN_FLAG_ENERGY) {
+    snprintf(tmp, sizeof(tmp), ",\"used_uah\":%u,\"days_left\":%u", msg.used_uah, msg.days_left);
+    out += tmp;
+  }
+  out += '}';
+  return out;
+}
+
+}
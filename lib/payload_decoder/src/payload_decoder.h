@@ -0,0 +1,76 @@
+#ifndef PAYLOAD_DECODER_H
+#define PAYLOAD_DECODER_H
+
+// decodes the binary payload (include/payload_format.h) on the backend side
+// and turns it back into the json the firmware sends with "format json"
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <string>
+#include <vector>
+
+namespace payload_decoder {
+
+struct Ap {
+  std::string ssid;
+  uint8_t bssid[6];
+  int8_t rssi;
+  uint8_t channel;
+};
+
+// one scan of a wake without a connect (batching)
+struct Record {
+  uint32_t age;            // sec before the message was sent
+  uint16_t mv;
+  uint16_t send_cause;
+  std::vector<Ap> ap;      // ssid empty
+};
+
+// probe timestamp of an earlier wake, see include/trace.h
+struct TraceEvent {
+  uint8_t probe;
+  uint8_t arg;
+  uint16_t ms;
+};
+
+struct Message {
+  uint8_t version;
+  uint8_t flags;
+  float voltage;
+  uint16_t id;
+  uint16_t button_ct;
+  uint16_t wifi_fail;
+  uint16_t mqtt_fail;
+  uint16_t send_cause;
+  uint32_t runtime;
+  uint32_t used_uah;       // only with PAYLOAD_BIN_FLAG_ENERGY
+  uint16_t days_left;
+  std::vector<Ap> ap;
+  std::vector<Record> batch;
+  bool delta;              // ap holds new and changed APs only
+  std::vector<std::array<uint8_t, 6>> gone;
+  std::vector<TraceEvent> trace;
+};
+
+enum class Error {
+  none,
+  truncated,
+  bad_magic,
+  bad_version,
+  bad_ssid_index,
+  trailing_data,
+  bad_json                 // ingestJson() only
+};
+
+// true if buf starts like a binary payload, json messages start with '{'
+bool isBinary(const uint8_t* buf, size_t len);
+// fills msg, returns Error::none on success
+Error decode(const uint8_t* buf, size_t len, Message &msg);
+const char* errorName(Error err);
+// same keys and order as the firmware json encoder
+std::string toJson(const Message &msg);
+
+}
+
+#endif
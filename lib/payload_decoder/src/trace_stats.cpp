@@ -0,0 +1,96 @@
+#include "trace_stats.h"
+#include <algorithm>
+#include <cstdio>
+#include "payload_format.h"
+
+namespace payload_decoder {
+
+static const char* phase_names[PHASE_COUNT] = {
+  "boot", "scan", "assoc", "dhcp", "dns", "mqtt", "ack", "tail", "awake"
+};
+
+const char* TraceStats::phaseName(TracePhase phase) {
+  return (phase < PHASE_COUNT) ? phase_names[phase] : "?";
+}
+
+void TraceStats::add(const Message &msg) {
+  // events before the first boot belong to a wake whose start was dropped
+  size_t start = msg.trace.size();
+  for(size_t i = 0; i <= msg.trace.size(); ++i) {
+    if((i == msg.trace.size()) || (msg.trace[i].probe == TP_BOOT)) {
+      if(start < i) {
+        addWake(&msg.trace[start], i - start);
+      }
+      start = i;
+    }
+  }
+}
+
+void TraceStats::addWake(const TraceEvent* ev, size_t n) {
+  int32_t first[TP_COUNT];
+  int32_t last[TP_COUNT];
+  std::fill(first, first + TP_COUNT, -1);
+  std::fill(last, last + TP_COUNT, -1);
+  for(size_t i = 0; i < n; ++i) {
+    if(ev[i].probe < TP_COUNT) {
+      if(first[ev[i].probe] < 0) {
+        first[ev[i].probe] = ev[i].ms;
+      }
+      last[ev[i].probe] = ev[i].ms;
+    }
+  }
+  if(last[TP_SLEEP] < 0) {
+    // no sleep entry, the wake was cut off by a reset
+    return;
+  }
+  _wakes++;
+  auto phase = [this](TracePhase p, int32_t from, int32_t to) {
+    if((from >= 0) && (to >= from)) {
+      _ms[p].push_back(to - from);
+    }
+  };
+  // the fast path connects without a scan
+  int32_t scan_end = (last[TP_SCAN_DONE] >= 0) ? last[TP_SCAN_DONE] : first[TP_BOOT];
+  phase(PHASE_BOOT, 0, first[TP_BOOT]);
+  phase(PHASE_SCAN, first[TP_BOOT], last[TP_SCAN_DONE]);
+  phase(PHASE_ASSOC, scan_end, first[TP_STA_CONNECTED]);
+  phase(PHASE_DHCP, first[TP_STA_CONNECTED], first[TP_GOT_IP]);
+  // a literal broker address needs no lookup and has no dns event
+  int32_t dns_end = (first[TP_DNS] >= 0) ? first[TP_DNS] : first[TP_GOT_IP];
+  phase(PHASE_DNS, first[TP_GOT_IP], first[TP_DNS]);
+  phase(PHASE_MQTT, dns_end, first[TP_MQTT_CONNECTED]);
+  phase(PHASE_ACK, first[TP_MQTT_CONNECTED], last[TP_PUBACK]);
+  phase(PHASE_TAIL, last[TP_PUBACK], last[TP_SLEEP]);
+  phase(PHASE_AWAKE, 0, last[TP_SLEEP]);
+}
+
+int32_t TraceStats::percentile(TracePhase phase, double pct) const {
+  std::vector<uint32_t> v = _ms[phase];
+  if(v.empty()) {
+    return -1;
+  }
+  // nearest rank
+  size_t rank = (size_t)(pct / 100.0 * v.size() + 0.999999);
+  rank = std::min(std::max(rank, (size_t)1), v.size());
+  std::nth_element(v.begin(), v.begin() + rank - 1, v.end());
+  return v[rank - 1];
+}
+
+std::string TraceStats::report() const {
+  std::string out;
+  char line[96];
+  snprintf(line, sizeof(line), "%zu wakes\n%-6s %7s %7s %7s %7s %7s\n", _wakes, "phase", "n", "p50", "p90", "p99", "max");
+  out += line;
+  for(int p = 0; p < PHASE_COUNT; ++p) {
+    TracePhase phase = (TracePhase)p;
+    if(_ms[p].empty()) {
+      continue;
+    }
+    snprintf(line, sizeof(line), "%-6s %7zu %7d %7d %7d %7d\n", phaseName(phase), count(phase),
+             percentile(phase, 50), percentile(phase, 90), percentile(phase, 99), percentile(phase, 100));
+    out += line;
+  }
+  return out;
+}
+
+}
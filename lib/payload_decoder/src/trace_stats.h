@@ -0,0 +1,46 @@
+#ifndef TRACE_STATS_H
+#define TRACE_STATS_H
+
+// collects the traces of many messages (of many devices) and reports
+// percentiles of the wake phases, to see where the wake budget goes
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "payload_decoder.h"
+
+namespace payload_decoder {
+
+enum TracePhase {
+  PHASE_BOOT,              // until setup() runs
+  PHASE_SCAN,              // setup until the last channel is scanned
+  PHASE_ASSOC,
+  PHASE_DHCP,
+  PHASE_DNS,               // got ip until the broker address is known
+  PHASE_MQTT,              // until the CONNACK
+  PHASE_ACK,
+  PHASE_TAIL,              // puback until deep sleep
+  PHASE_AWAKE,             // the whole wake
+  PHASE_COUNT
+};
+
+class TraceStats {
+public:
+  // splits msg.trace into wakes, phases of a wake missing a probe are skipped
+  void add(const Message &msg);
+  size_t wakes() const { return _wakes; }
+  // ms of the phase at percentile pct (0-100), -1 if there was none
+  int32_t percentile(TracePhase phase, double pct) const;
+  size_t count(TracePhase phase) const { return _ms[phase].size(); }
+  static const char* phaseName(TracePhase phase);
+  // one line per phase: n, p50, p90, p99, max
+  std::string report() const;
+private:
+  void addWake(const TraceEvent* ev, size_t n);
+  std::vector<uint32_t> _ms[PHASE_COUNT];
+  size_t _wakes = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+// host replacement of the arduino-esp32 core for the native simulation build
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <strings.h>
+#include <vector>
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "IPAddress.h"
+#include "esp_system.h"
+#include "esp_sleep.h"
+
+// rtc memory survives deep sleep, the simulator saves and restores this section between wakes
+#define RTC_DATA_ATTR __attribute__((section("rtc_sim")))
+#define RTC_NOINIT_ATTR __attribute__((section("rtc_sim")))
+#define IRAM_ATTR
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define FALLING 0x02
+#define CHANGE 0x03
+
+typedef enum {
+  GPIO_NUM_0, GPIO_NUM_1, GPIO_NUM_2, GPIO_NUM_3, GPIO_NUM_4, GPIO_NUM_5, GPIO_NUM_6, GPIO_NUM_7,
+  GPIO_NUM_8, GPIO_NUM_9, GPIO_NUM_10, GPIO_NUM_11, GPIO_NUM_12, GPIO_NUM_13, GPIO_NUM_14, GPIO_NUM_15,
+  GPIO_NUM_16, GPIO_NUM_17, GPIO_NUM_18, GPIO_NUM_19, GPIO_NUM_20, GPIO_NUM_21, GPIO_NUM_22, GPIO_NUM_23,
+  GPIO_NUM_MAX,
+} gpio_num_t;
+
+typedef enum {
+  GPIO_INTR_DISABLE,
+  GPIO_INTR_POSEDGE,
+  GPIO_INTR_NEGEDGE,
+  GPIO_INTR_ANYEDGE,
+  GPIO_INTR_LOW_LEVEL,
+  GPIO_INTR_HIGH_LEVEL,
+} gpio_int_type_t;
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type);
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num);
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type);
+
+// seeed xiao esp32c6 pins
+static const uint8_t LED_BUILTIN = 15;
+static const uint8_t D0 = 0;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void yield();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+uint32_t analogReadMilliVolts(uint8_t pin);
+// adc continuous mode: frames of the scenario battery level with conversion noise, one per
+// conversions_per_pin / sampling_freq_hz on the virtual clock
+typedef struct {
+  uint8_t pin;
+  uint8_t channel;
+  int avg_read_raw;
+  int avg_read_mvolts;
+} adc_continuous_data_t;
+bool analogContinuous(const uint8_t pins[], size_t pins_count, uint32_t conversions_per_pin,
+                      uint32_t sampling_freq_hz, void (*userFunc)(void));
+bool analogContinuousRead(adc_continuous_data_t** buffer, uint32_t timeout_ms);
+bool analogContinuousStart();
+bool analogContinuousStop();
+bool analogContinuousDeinit();
+bool setCpuFrequencyMhz(uint32_t cpu_freq_mhz);
+uint32_t getCpuFrequencyMhz();
+bool usb_serial_jtag_is_connected();
+// sntp: the clock is set one round trip after the call if the network is up, utc on the virtual wall clock
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char* server1,
+                const char* server2 = nullptr, const char* server3 = nullptr);
+bool getLocalTime(struct tm* info, uint32_t ms = 5000);
+#define digitalPinToInterrupt(p) (p)
+// only the button pin raises interrupts, on press and release of the scripted button
+void attachInterrupt(uint8_t pin, void (*isr)(), int mode);
+
+typedef const char* esp_event_base_t;
+typedef void (*esp_event_handler_t)(void* arg, esp_event_base_t base, int32_t id, void* data);
+typedef enum {
+  ARDUINO_HW_CDC_ANY_EVENT = -1,
+  ARDUINO_HW_CDC_CONNECTED_EVENT = 0,
+  ARDUINO_HW_CDC_BUS_RESET_EVENT,
+  ARDUINO_HW_CDC_RX_EVENT,
+  ARDUINO_HW_CDC_TX_EVENT,
+} arduino_hw_cdc_event_t;
+
+// usb cdc console, fed by the simulation script
+class HWCDC : public Stream {
+public:
+  void begin(unsigned long baud = 115200) {}
+  void end() {}
+  size_t setRxBufferSize(size_t size);
+  // rx events fire when script input arrives
+  void onEvent(arduino_hw_cdc_event_t event, esp_event_handler_t callback);
+  operator bool() const;
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t readBytes(char* buffer, size_t length) override;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+};
+
+// uart used for debug output, 115200 baud, a write blocks while the fifo and tx buffer are full
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud) {}
+  void end() {}
+  size_t setTxBufferSize(size_t size);
+  int availableForWrite();
+  void flush();
+  operator bool() const { return true; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+};
+
+extern HWCDC Serial;
+extern HardwareSerial Serial0;
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef SIM_ASYNCMQTTCLIENT_H
+#define SIM_ASYNCMQTTCLIENT_H
+
+// broker stand-in with the latencies of the simulation scenario
+
+#include <Arduino.h>
+#include <functional>
+
+enum class AsyncMqttClientDisconnectReason : uint8_t {
+  TCP_DISCONNECTED = 0,
+  MQTT_UNACCEPTABLE_PROTOCOL_VERSION = 1,
+  MQTT_IDENTIFIER_REJECTED = 2,
+  MQTT_SERVER_UNAVAILABLE = 3,
+  MQTT_MALFORMED_CREDENTIALS = 4,
+  MQTT_NOT_AUTHORIZED = 5,
+  ESP8266_NOT_ENOUGH_SPACE = 6,
+  TLS_BAD_FINGERPRINT = 7
+};
+
+typedef std::function<void(bool sessionPresent)> OnConnectUserCallback;
+typedef std::function<void(AsyncMqttClientDisconnectReason reason)> OnDisconnectUserCallback;
+typedef std::function<void(uint16_t packetId)> OnPublishUserCallback;
+
+class AsyncMqttClient {
+public:
+  AsyncMqttClient& setKeepAlive(uint16_t keepAlive) { _keepAlive = keepAlive; return *this; }
+  AsyncMqttClient& setClientId(const char* clientId) { _clientId = clientId; return *this; }
+  AsyncMqttClient& setCleanSession(bool cleanSession) { _cleanSession = cleanSession; return *this; }
+  AsyncMqttClient& setCredentials(const char* username, const char* password = nullptr) { return *this; }
+  AsyncMqttClient& setServer(IPAddress ip, uint16_t port);
+  AsyncMqttClient& setServer(const char* host, uint16_t port);
+
+  AsyncMqttClient& onConnect(OnConnectUserCallback callback) { _onConnect = callback; return *this; }
+  AsyncMqttClient& onDisconnect(OnDisconnectUserCallback callback) { _onDisconnect = callback; return *this; }
+  AsyncMqttClient& onPublish(OnPublishUserCallback callback) { _onPublish = callback; return *this; }
+
+  bool connected() const { return _connected; }
+  void connect();
+  void disconnect(bool force = false);
+  uint16_t publish(const char* topic, uint8_t qos, bool retain, const char* payload = nullptr,
+                   size_t length = 0, bool dup = false, uint16_t message_id = 0);
+  const char* getClientId() const { return _clientId; }
+
+private:
+  OnConnectUserCallback _onConnect;
+  OnDisconnectUserCallback _onDisconnect;
+  OnPublishUserCallback _onPublish;
+  const char* _clientId = "esp32-sim";
+  const char* _host = nullptr;
+  IPAddress _ip;
+  uint16_t _port = 1883;
+  uint16_t _keepAlive = 15;
+  bool _cleanSession = true;
+  bool _connected = false;
+  bool _connecting = false;
+  uint16_t _nextPacketId = 1;
+  uint32_t _generation = 0;
+};
+
+#endif
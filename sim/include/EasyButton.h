@@ -0,0 +1,25 @@
+#ifndef SIM_EASYBUTTON_H
+#define SIM_EASYBUTTON_H
+
+#include <Arduino.h>
+
+class EasyButton {
+public:
+  EasyButton(uint8_t pin, uint32_t debounce_time = 35, bool pullup_enable = true, bool active_low = true)
+    : _pin(pin) {}
+  void begin() { _last = digitalRead(_pin); _pressed = false; }
+  bool read() {
+    int current = digitalRead(_pin);
+    _pressed = (_last == HIGH) && (current == LOW);
+    _last = current;
+    return current == LOW;
+  }
+  bool wasPressed() { return _pressed; }
+
+private:
+  uint8_t _pin;
+  int _last = HIGH;
+  bool _pressed = false;
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef SIM_IPADDRESS_H
+#define SIM_IPADDRESS_H
+
+#include "Print.h"
+
+class IPAddress : public Printable {
+public:
+  IPAddress() : _addr(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    : _addr((uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24)) {}
+  IPAddress(uint32_t addr) : _addr(addr) {}
+  operator uint32_t() const { return _addr; }
+  uint8_t operator[](int index) const { return (_addr >> (8 * index)) & 0xff; }
+  bool operator==(const IPAddress& rhs) const { return _addr == rhs._addr; }
+  bool operator!=(const IPAddress& rhs) const { return _addr != rhs._addr; }
+  bool fromString(const char* address);
+  String toString() const;
+  size_t printTo(Print& p) const override { return p.print(toString()); }
+
+private:
+  uint32_t _addr; // network byte order like lwip
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef SIM_PREFERENCES_H
+#define SIM_PREFERENCES_H
+
+// nvs replacement, the simulator keeps the content across wakes like the flash would
+
+#include <cstddef>
+#include <cstdint>
+
+class Preferences {
+public:
+  bool begin(const char* name, bool readOnly = false, const char* partition_label = nullptr);
+  void end();
+  bool clear();
+  bool remove(const char* key);
+  bool isKey(const char* key);
+  size_t putBytes(const char* key, const void* value, size_t len);
+  size_t getBytesLength(const char* key);
+  size_t getBytes(const char* key, void* buf, size_t maxLen);
+
+private:
+  bool _started = false;
+  bool _readOnly = false;
+  char _name[16];
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SIM_PRINT_H
+#define SIM_PRINT_H
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include "WString.h"
+
+class Print;
+
+class Printable {
+public:
+  virtual ~Printable() = default;
+  virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+  virtual ~Print() = default;
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* str);
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+  virtual void flush() {}
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+  size_t vprintf(const char* format, va_list args);
+
+  size_t print(const String& s) { return write(s.c_str(), s.length()); }
+  size_t print(const char* str) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char num, int base = 10) { return print((unsigned long)num, base); }
+  size_t print(int num, int base = 10) { return print((long)num, base); }
+  size_t print(unsigned int num, int base = 10) { return print((unsigned long)num, base); }
+  size_t print(long num, int base = 10);
+  size_t print(unsigned long num, int base = 10);
+  size_t print(double num, int digits = 2);
+  size_t print(const Printable& p) { return p.printTo(*this); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(const T& value) {
+    size_t n = print(value);
+    return n + println();
+  }
+  template <typename T>
+  size_t println(const T& value, int arg) {
+    size_t n = print(value, arg);
+    return n + println();
+  }
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef SIM_WSTRING_H
+#define SIM_WSTRING_H
+
+// host replacement of the Arduino String class, only the parts the firmware uses
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class StringSumHelper;
+
+class String {
+public:
+  String(const char* cstr = "");
+  String(const String& str) = default;
+  String(String&& str) = default;
+  explicit String(char c);
+  explicit String(int value, unsigned char base = 10);
+  explicit String(unsigned int value, unsigned char base = 10);
+  explicit String(long value, unsigned char base = 10);
+  explicit String(unsigned long value, unsigned char base = 10);
+  explicit String(float value, unsigned int decimals = 2);
+  explicit String(double value, unsigned int decimals = 2);
+  virtual ~String() = default;
+
+  String& operator=(const String& rhs) = default;
+  String& operator=(String&& rhs) = default;
+  String& operator=(const char* cstr);
+
+  bool reserve(unsigned int size);
+  unsigned int length() const { return _buf.length(); }
+  bool isEmpty() const { return _buf.empty(); }
+  const char* c_str() const { return _buf.c_str(); }
+
+  bool concat(const String& str);
+  bool concat(const char* cstr);
+  bool concat(const char* cstr, unsigned int length);
+  bool concat(char c);
+  bool concat(int num);
+  bool concat(unsigned int num);
+  bool concat(long num);
+  bool concat(unsigned long num);
+  bool concat(float num);
+  bool concat(double num);
+
+  String& operator+=(const String& rhs) { concat(rhs); return *this; }
+  String& operator+=(const char* cstr) { concat(cstr); return *this; }
+  String& operator+=(char c) { concat(c); return *this; }
+  String& operator+=(int num) { concat(num); return *this; }
+  String& operator+=(unsigned int num) { concat(num); return *this; }
+  String& operator+=(long num) { concat(num); return *this; }
+  String& operator+=(unsigned long num) { concat(num); return *this; }
+
+  friend StringSumHelper& operator+(const StringSumHelper& lhs, const String& rhs);
+  friend StringSumHelper& operator+(const StringSumHelper& lhs, const char* cstr);
+  friend StringSumHelper& operator+(const StringSumHelper& lhs, char c);
+  friend StringSumHelper& operator+(const StringSumHelper& lhs, int num);
+  friend StringSumHelper& operator+(const StringSumHelper& lhs, unsigned int num);
+
+  int compareTo(const String& s) const { return _buf.compare(s._buf); }
+  bool equals(const String& s) const { return _buf == s._buf; }
+  bool equals(const char* cstr) const { return _buf == (cstr ? cstr : ""); }
+  bool equalsIgnoreCase(const String& s) const;
+  bool operator==(const String& rhs) const { return equals(rhs); }
+  bool operator==(const char* cstr) const { return equals(cstr); }
+  bool operator!=(const String& rhs) const { return !equals(rhs); }
+  bool operator!=(const char* cstr) const { return !equals(cstr); }
+  bool operator<(const String& rhs) const { return compareTo(rhs) < 0; }
+  bool startsWith(const String& prefix) const;
+  bool startsWith(const String& prefix, unsigned int offset) const;
+  bool endsWith(const String& suffix) const;
+
+  char charAt(unsigned int index) const;
+  void setCharAt(unsigned int index, char c);
+  char operator[](unsigned int index) const { return charAt(index); }
+  char& operator[](unsigned int index);
+
+  int indexOf(char ch, unsigned int fromIndex = 0) const;
+  int indexOf(const String& str, unsigned int fromIndex = 0) const;
+  int lastIndexOf(char ch) const;
+  String substring(unsigned int beginIndex) const;
+  String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+  void replace(const String& find, const String& replace);
+  void remove(unsigned int index);
+  void remove(unsigned int index, unsigned int count);
+  void toLowerCase();
+  void toUpperCase();
+  void trim();
+
+  long toInt() const;
+  float toFloat() const;
+  double toDouble() const;
+
+private:
+  std::string _buf;
+};
+
+class StringSumHelper : public String {
+public:
+  StringSumHelper(const String& s) : String(s) {}
+  StringSumHelper(const char* p) : String(p) {}
+  StringSumHelper(char c) : String(c) {}
+  StringSumHelper(int num) : String(num) {}
+  StringSumHelper(unsigned int num) : String(num) {}
+};
+
+#endif
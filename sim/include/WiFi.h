@@ -0,0 +1,138 @@
+#ifndef SIM_WIFI_H
+#define SIM_WIFI_H
+
+// scripted station + scanner, events are delivered on the virtual clock
+
+#include <Arduino.h>
+#include "esp_wifi.h"
+
+typedef enum {
+  WIFI_MODE_NULL,
+  WIFI_MODE_STA,
+  WIFI_MODE_AP,
+  WIFI_MODE_APSTA,
+} wifi_mode_t;
+#define WIFI_OFF WIFI_MODE_NULL
+#define WIFI_STA WIFI_MODE_STA
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6,
+  WL_STOPPED = 254,
+} wl_status_t;
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+typedef enum {
+  ARDUINO_EVENT_NONE,
+  ARDUINO_EVENT_WIFI_READY,
+  ARDUINO_EVENT_WIFI_SCAN_DONE,
+  ARDUINO_EVENT_WIFI_STA_START,
+  ARDUINO_EVENT_WIFI_STA_STOP,
+  ARDUINO_EVENT_WIFI_STA_CONNECTED,
+  ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+  ARDUINO_EVENT_WIFI_STA_AUTHMODE_CHANGE,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP,
+  ARDUINO_EVENT_WIFI_STA_LOST_IP,
+  ARDUINO_EVENT_MAX
+} arduino_event_id_t;
+typedef arduino_event_id_t WiFiEvent_t;
+
+typedef struct {
+  uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+  esp_ip4_addr_t ip;
+  esp_ip4_addr_t netmask;
+  esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct {
+  int if_index;
+  void* esp_netif;
+  esp_netif_ip_info_t ip_info;
+  bool ip_changed;
+} ip_event_got_ip_t;
+
+typedef struct {
+  uint32_t status;
+  uint8_t number;
+  uint8_t scan_id;
+} wifi_event_sta_scan_done_t;
+
+typedef struct {
+  uint8_t ssid[32];
+  uint8_t ssid_len;
+  uint8_t bssid[6];
+  uint8_t channel;
+  int authmode;
+  uint16_t aid;
+} wifi_event_sta_connected_t;
+
+typedef struct {
+  uint8_t ssid[32];
+  uint8_t ssid_len;
+  uint8_t bssid[6];
+  uint8_t reason;
+  int8_t rssi;
+} wifi_event_sta_disconnected_t;
+
+typedef union {
+  wifi_event_sta_scan_done_t wifi_scan_done;
+  wifi_event_sta_connected_t wifi_sta_connected;
+  wifi_event_sta_disconnected_t wifi_sta_disconnected;
+  ip_event_got_ip_t got_ip;
+} arduino_event_info_t;
+typedef arduino_event_info_t WiFiEventInfo_t;
+
+typedef void (*WiFiEventFuncCb)(arduino_event_id_t event, arduino_event_info_t info);
+typedef size_t wifi_event_id_t;
+
+class WiFiClass {
+public:
+  wifi_event_id_t onEvent(WiFiEventFuncCb cbEvent, arduino_event_id_t event = ARDUINO_EVENT_MAX);
+  bool mode(wifi_mode_t mode);
+  wifi_mode_t getMode() { return _mode; }
+  bool setHostname(const char* hostname);
+  const char* getHostname();
+
+  int16_t scanNetworks(bool async = false, bool show_hidden = false, bool passive = false,
+                       uint32_t max_ms_per_chan = 300, uint8_t channel = 0,
+                       const char* ssid = nullptr, const uint8_t* bssid = nullptr);
+  int16_t scanComplete();
+  void scanDelete();
+  String SSID(uint8_t networkItem);
+  int32_t RSSI(uint8_t networkItem);
+  uint8_t* BSSID(uint8_t networkItem, uint8_t* bssid = nullptr);
+  String BSSIDstr(uint8_t networkItem);
+  int32_t channel(uint8_t networkItem);
+  void* getScanInfoByIndex(int i);  // wifi_ap_record_t
+
+  wl_status_t begin(const char* ssid, const char* passphrase = nullptr, int32_t channel = 0,
+                    const uint8_t* bssid = nullptr, bool connect = true);
+  bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet,
+              IPAddress dns1 = (uint32_t)0, IPAddress dns2 = (uint32_t)0);
+  bool disconnect(bool wifioff = false, bool eraseap = false);
+  bool isConnected();
+  wl_status_t status();
+  uint8_t channel();
+  IPAddress localIP();
+  IPAddress gatewayIP();
+  IPAddress subnetMask();
+  IPAddress dnsIP(uint8_t dns_no = 0);
+  int hostByName(const char* aHostname, IPAddress& aResult);
+
+private:
+  wifi_mode_t _mode = WIFI_MODE_NULL;
+};
+
+extern WiFiClass WiFi;
+
+#endif
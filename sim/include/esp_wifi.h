@@ -0,0 +1,18 @@
+#ifndef SIM_ESP_WIFI_H
+#define SIM_ESP_WIFI_H
+
+#include "esp_system.h"
+
+// the part of the driver's scan record the firmware reads
+typedef struct {
+  uint8_t bssid[6];
+  uint8_t ssid[33];
+  uint8_t primary;
+  int second;
+  int8_t rssi;
+  int authmode;
+} wifi_ap_record_t;
+
+esp_err_t esp_wifi_set_country_code(const char* country, bool ieee80211d_enabled);
+
+#endif
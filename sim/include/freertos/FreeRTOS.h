@@ -0,0 +1,25 @@
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+// the parts of freertos the firmware uses, one tick is one ms of the virtual clock
+
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+// one thread runs the callbacks, the critical sections have nothing to lock out
+typedef struct {
+  uint32_t owner;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+#endif
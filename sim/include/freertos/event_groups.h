@@ -0,0 +1,16 @@
+#ifndef SIM_EVENT_GROUPS_H
+#define SIM_EVENT_GROUPS_H
+
+#include "FreeRTOS.h"
+
+typedef uint32_t EventBits_t;
+typedef struct EventGroup* EventGroupHandle_t;
+
+EventGroupHandle_t xEventGroupCreate();
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t group, EventBits_t bits, BaseType_t* woken);
+// runs the virtual clock until one (or all) of bits is set or the ticks are gone
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all,
+                                TickType_t ticks);
+
+#endif
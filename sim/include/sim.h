@@ -0,0 +1,146 @@
+#ifndef SIM_H
+#define SIM_H
+
+// virtual clock, scripted radio/broker behaviour and wake cycle recording
+// used by the fake Arduino layers of the native build
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace sim {
+
+struct Ap {
+  std::string ssid;
+  uint8_t bssid[6];
+  int8_t rssi;
+  uint8_t channel;
+};
+
+// timing model of the environment the device wakes up in
+struct Scenario {
+  std::string name = "ok";
+  std::vector<Ap> aps;
+  uint32_t boot_ms = 120;          // rom + bootloader until the system timer starts
+  uint32_t startup_ms = 35;        // millis() when setup() is entered
+  uint32_t scan_overhead_ms = 12;  // per channel on top of the dwell time
+  uint32_t assoc_ms = 80;          // auth + assoc + 4 way handshake on air
+  uint32_t assoc_cpu_ms = 100;     // pmk and key derivation at 80 MHz, scales with the clock
+  uint32_t dhcp_ms = 650;
+  uint32_t dns_ms = 40;            // lookup of the broker name at the resolver of the ap
+  uint32_t mqtt_connect_ms = 90;   // tcp + CONNECT/CONNACK
+  uint32_t tls_cpu_ms = 0;         // tls handshake at 80 MHz, 0 = plain tcp
+  uint32_t puback_ms = 45;         // publish until the broker application acks it
+  uint32_t tcp_ack_ms = 20;        // data until the broker host tcp acks it, ends a clean close
+  bool ap_up = true;
+  bool broker_up = true;
+  uint32_t button_every = 0;       // every n-th wake is a button wake, 0 = never
+  uint32_t move_at = 0;            // from this wake on the own APs are on channel 9, 0 = never
+  uint32_t battery_adc_mv = 2050;
+};
+
+enum Probe : uint8_t {
+  PROBE_SETUP,
+  PROBE_SCAN_START,
+  PROBE_SCAN_DONE,
+  PROBE_WIFI_BEGIN,
+  PROBE_STA_CONNECTED,
+  PROBE_GOT_IP,
+  PROBE_MQTT_CONNECT,
+  PROBE_MQTT_CONNECTED,
+  PROBE_PUBLISH,
+  PROBE_PUBACK,
+  PROBE_SLEEP,
+  PROBE_RESTART,
+  PROBE_COUNT
+};
+
+const char* probeName(Probe probe);
+
+struct Mark {
+  uint32_t ms;
+  Probe probe;
+  uint16_t arg;
+};
+
+enum WakeEnd : uint8_t { END_SLEEP, END_RESTART, END_STUCK };
+
+// everything a wake reports back to the driver process
+struct WakeReport {
+  static const int MAX_MARKS = 128;
+  static const int MAX_PAYLOAD = 4096;
+  WakeEnd end;
+  uint32_t awake_ms;               // millis() at the end of the wake
+  uint64_t sleep_us;               // 0 if no timer wakeup was armed
+  bool ext1_armed;
+  uint32_t cpu_mhz;
+  bool light_sleep;                // automatic light sleep was configured
+  uint32_t loop_ct;                // passes through loop()
+  uint32_t wait_ms;                // spent blocked on events
+  uint16_t mark_ct;
+  Mark marks[MAX_MARKS];
+  uint32_t publish_ct;
+  uint32_t publish_bytes;
+  uint32_t payload_len;
+  char payload[MAX_PAYLOAD];       // last published payload
+};
+
+// state of the running wake, valid inside the child process only
+uint32_t now();
+void advance(uint32_t ms);
+// ms that cpu work of ms_at_80mhz takes at the current clock
+uint32_t cpuMs(uint32_t ms_at_80mhz);
+void at(uint32_t delay_ms, std::function<void()> fn);
+bool dispatch();
+void mark(Probe probe, uint16_t arg = 0);
+const Scenario& scenario();
+WakeReport& report();
+uint64_t wallMs();
+bool usbConnected();
+void setUsbConnected(bool connected);
+bool buttonDown();
+void consoleInput(const std::string& text);
+int wakeupCause();
+int resetReason();
+[[noreturn]] void endWake(WakeEnd end);
+
+// driver side
+// averages over the wakes after provisioning that reached the broker
+struct RunStats {
+  uint32_t sends;
+  double connect_to_sleep_ms;      // mqtt connect until deep sleep, the radio on time the mode decides
+  double awake_ms;
+  double bytes;
+  double phase_ms[8];              // average per phase of the sim table, setup to tail
+  float mah_per_wake;              // firmware energy model after the run
+  float mah_per_day;
+};
+struct Options {
+  uint32_t cycles = 5;
+  bool verbose = false;
+  bool timeline = false;
+  std::vector<std::string> config;  // console lines sent on the provisioning boot
+  bool machine = false;             // sent as machine mode frames, not typed
+  RunStats* stats = nullptr;        // filled in if set
+};
+Scenario makeScenario(const std::string& name);
+int run(const Scenario& scenario, const Options& options);
+
+// heap accounting of the native build, malloc and friends are wrapped in heap.cpp
+struct HeapStats {
+  size_t current;
+  size_t peak;
+  size_t allocs;
+};
+void heapReset();
+HeapStats heapStats();
+
+// host benchmarks, "program bench <name> [args]"
+int bench(int argc, char** argv);
+// many devices against one broker, "program fleet [args]"
+int fleet(int argc, char** argv);
+
+}
+
+#endif
@@ -0,0 +1,426 @@
+#include <Arduino.h>
+#include <algorithm>
+#include <cstdio>
+#include <esp_wifi.h>
+#include <WiFi.h>
+#include "logdump.h"
+#include "sim_internal.h"
+
+HWCDC Serial;
+HardwareSerial Serial0;
+
+///////////////////////////////////////////////////////
+// print / stream
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while(size--) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::write(const char* str) {
+  if(!str) {
+    return 0;
+  }
+  return write((const uint8_t*)str, strlen(str));
+}
+
+size_t Print::vprintf(const char* format, va_list args) {
+  char buf[256];
+  va_list copy;
+  va_copy(copy, args);
+  int len = vsnprintf(buf, sizeof(buf), format, copy);
+  va_end(copy);
+  if(len < 0) {
+    return 0;
+  }
+  if((size_t)len < sizeof(buf)) {
+    return write((const uint8_t*)buf, len);
+  }
+  std::vector<char> big(len + 1);
+  vsnprintf(big.data(), big.size(), format, args);
+  return write((const uint8_t*)big.data(), len);
+}
+
+size_t Print::printf(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  size_t n = vprintf(format, args);
+  va_end(args);
+  return n;
+}
+
+size_t Print::print(long num, int base) {
+  return print(String(num, (unsigned char)base));
+}
+
+size_t Print::print(unsigned long num, int base) {
+  return print(String(num, (unsigned char)base));
+}
+
+size_t Print::print(double num, int digits) {
+  return print(String(num, (unsigned int)digits));
+}
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+  size_t n = 0;
+  while((n < length) && available()) {
+    buffer[n++] = (char)read();
+  }
+  return n;
+}
+
+bool IPAddress::fromString(const char* address) {
+  unsigned a, b, c, d;
+  if(sscanf(address, "%u.%u.%u.%u", &a, &b, &c, &d) != 4) {
+    return false;
+  }
+  *this = IPAddress(a, b, c, d);
+  return true;
+}
+
+String IPAddress::toString() const {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+  return String(buf);
+}
+
+///////////////////////////////////////////////////////
+// serial ports, both end up on stderr in verbose mode
+
+void HWCDC::onEvent(arduino_hw_cdc_event_t event, esp_event_handler_t callback) {
+  if(event != ARDUINO_HW_CDC_RX_EVENT) {
+    return;
+  }
+  sim::wake.console_rx = callback;
+  if(sim::wake.console_in.size() > sim::wake.console_rx_size) {
+    // sent before anyone read, what does not fit the driver buffer is lost
+    sim::wake.console_in.resize(sim::wake.console_rx_size);
+  }
+  if(callback && !sim::wake.console_in.empty()) {
+    // the provisioning script is typed before the console is up
+    callback(nullptr, "ARDUINO_HW_CDC_EVENTS", ARDUINO_HW_CDC_RX_EVENT, nullptr);
+  }
+}
+
+HWCDC::operator bool() const {
+  return sim::wake.usb;
+}
+
+int HWCDC::available() {
+  return sim::wake.console_in.size();
+}
+
+int HWCDC::read() {
+  if(sim::wake.console_in.empty()) {
+    return -1;
+  }
+  char c = sim::wake.console_in.front();
+  sim::wake.console_in.pop_front();
+  return (uint8_t)c;
+}
+
+size_t HWCDC::setRxBufferSize(size_t size) {
+  sim::wake.console_rx_size = size;
+  return size;
+}
+
+// one lock per call on the device, the bytes go in one copy
+size_t HWCDC::readBytes(char* buffer, size_t length) {
+  size_t n = std::min(length, sim::wake.console_in.size());
+  std::copy_n(sim::wake.console_in.begin(), n, buffer);
+  sim::wake.console_in.erase(sim::wake.console_in.begin(), sim::wake.console_in.begin() + n);
+  return n;
+}
+
+int HWCDC::peek() {
+  return sim::wake.console_in.empty() ? -1 : (uint8_t)sim::wake.console_in.front();
+}
+
+size_t HWCDC::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t HWCDC::write(const uint8_t* buffer, size_t size) {
+  if(sim::wake.verbose) {
+    fwrite(buffer, 1, size, stderr);
+  }
+  return size;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+#define UART_BYTES_PER_MS 11.52  // 115200 baud 8N1
+
+// bytes in the fifo and tx buffer now, they drain on the virtual clock
+static double uartLevel() {
+  sim::Wake& w = sim::wake;
+  w.uart_level = std::max(0.0, w.uart_level - (w.now - w.uart_at) * UART_BYTES_PER_MS);
+  w.uart_at = w.now;
+  return w.uart_level;
+}
+
+size_t HardwareSerial::setTxBufferSize(size_t size) {
+  sim::wake.uart_tx_size = 128 + size;
+  return size;
+}
+
+int HardwareSerial::availableForWrite() {
+  return sim::wake.uart_tx_size - (size_t)std::ceil(uartLevel());
+}
+
+void HardwareSerial::flush() {
+  sim::wake.now += (uint32_t)std::ceil(uartLevel() / UART_BYTES_PER_MS);
+  uartLevel();
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  if(sim::wake.verbose) {
+    // the log records decoded as "program logdump" would
+    static sim::LogDecoder decoder;
+    decoder.feed(buffer, size, stderr);
+  }
+  // the caller waits until the rest fits, events fall due meanwhile and run late
+  double over = uartLevel() + size - sim::wake.uart_tx_size;
+  if(over > 0) {
+    sim::wake.now += (uint32_t)std::ceil(over / UART_BYTES_PER_MS);
+    uartLevel();
+  }
+  sim::wake.uart_level += size;
+  return size;
+}
+
+///////////////////////////////////////////////////////
+// core
+
+unsigned long millis() {
+  return sim::now();
+}
+
+unsigned long micros() {
+  return sim::now() * 1000UL;
+}
+
+void delay(uint32_t ms) {
+  sim::advance(ms);
+}
+
+void yield() {
+  sim::dispatch();
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+static uint8_t led_state = HIGH;
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if(pin == LED_BUILTIN) {
+    led_state = val;
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  if(pin == LED_BUILTIN) {
+    return led_state;
+  }
+  if(pin == D0) {
+    return sim::buttonDown() ? LOW : HIGH;
+  }
+  return HIGH;
+}
+
+uint32_t analogReadMilliVolts(uint8_t pin) {
+  return sim::scenario().battery_adc_mv;
+}
+
+static struct {
+  uint8_t pin;
+  uint32_t conversions;
+  uint32_t frame_ms;
+  void (*isr)();
+  bool running;
+  bool ready;
+  uint32_t generation;     // frames scheduled before a stop are dropped
+  adc_continuous_data_t frame;
+} adc;
+
+bool analogContinuous(const uint8_t pins[], size_t pins_count, uint32_t conversions_per_pin,
+                      uint32_t sampling_freq_hz, void (*userFunc)(void)) {
+  if((pins_count != 1) || !conversions_per_pin || !sampling_freq_hz) {
+    return false;
+  }
+  adc.pin = pins[0];
+  adc.conversions = conversions_per_pin;
+  adc.frame_ms = std::max<uint32_t>(1, 1000 * conversions_per_pin / sampling_freq_hz);
+  adc.isr = userFunc;
+  return true;
+}
+
+static void adcFrame(uint32_t generation) {
+  if(!adc.running || (generation != adc.generation)) {
+    return;
+  }
+  // +-60 mV per conversion, the radio pulls the rail around
+  static uint32_t seed = 1;
+  int32_t sum = 0;
+  for(uint32_t i = 0; i < adc.conversions; ++i) {
+    seed = seed * 1103515245 + 12345;
+    sum += sim::scenario().battery_adc_mv + (int32_t)((seed >> 16) % 121) - 60;
+  }
+  adc.frame = {adc.pin, 0, 0, (int)((sum + (int32_t)adc.conversions / 2) / (int32_t)adc.conversions)};
+  adc.ready = true;
+  if(adc.isr) {
+    adc.isr();
+  }
+  sim::at(adc.frame_ms, [generation] { adcFrame(generation); });
+}
+
+bool analogContinuousStart() {
+  if(!adc.conversions) {
+    return false;
+  }
+  adc.running = true;
+  adc.ready = false;
+  uint32_t generation = ++adc.generation;
+  sim::at(adc.frame_ms, [generation] { adcFrame(generation); });
+  return true;
+}
+
+bool analogContinuousRead(adc_continuous_data_t** buffer, uint32_t timeout_ms) {
+  if(!adc.ready) {
+    return false;
+  }
+  adc.ready = false;
+  *buffer = &adc.frame;
+  return true;
+}
+
+bool analogContinuousStop() {
+  adc.running = false;
+  return true;
+}
+
+bool analogContinuousDeinit() {
+  uint32_t generation = adc.generation;
+  adc = {};
+  adc.generation = generation;
+  return true;
+}
+
+bool setCpuFrequencyMhz(uint32_t cpu_freq_mhz) {
+  sim::wake.cpu_mhz = cpu_freq_mhz;
+  return true;
+}
+
+uint32_t getCpuFrequencyMhz() {
+  return sim::wake.cpu_mhz;
+}
+
+namespace sim {
+
+uint32_t cpuMs(uint32_t ms_at_80mhz) {
+  return (ms_at_80mhz * 80 + wake.cpu_mhz / 2) / wake.cpu_mhz;
+}
+
+}
+
+bool usb_serial_jtag_is_connected() {
+  return sim::wake.usb;
+}
+
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char* server1,
+                const char* server2, const char* server3) {
+  if(WiFi.isConnected()) {
+    sim::at(2 * sim::scenario().dns_ms, [] { sim::shared->clock_set = true; });
+  }
+}
+
+bool getLocalTime(struct tm* info, uint32_t ms) {
+  if(!sim::shared->clock_set) {
+    return false;
+  }
+  time_t t = sim::EPOCH + sim::wallMs() / 1000;
+  gmtime_r(&t, info);
+  return true;
+}
+
+// repeatable per run, differs between the wakes
+uint32_t esp_random() {
+  static uint64_t x = 0;
+  if(!x) {
+    x = sim::wake.wall_at_boot * 2654435761ULL + 1;
+  }
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return x >> 16;
+}
+
+void attachInterrupt(uint8_t pin, void (*isr)(), int mode) {
+  if(pin != D0) {
+    return;
+  }
+  sim::wake.button_isr = isr;
+  if(sim::buttonDown()) {
+    sim::at(sim::wake.button_release_ms - sim::now(), [] { sim::wake.button_isr(); });
+  }
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+  return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num) {
+  return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////
+// system / sleep
+
+esp_reset_reason_t esp_reset_reason() {
+  return (esp_reset_reason_t)sim::resetReason();
+}
+
+void esp_restart() {
+  sim::mark(sim::PROBE_RESTART);
+  sim::endWake(sim::END_RESTART);
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us) {
+  sim::wake.sleep_us = time_in_us;
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup() {
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_ext1_wakeup(uint64_t io_mask, esp_sleep_ext1_wakeup_mode_t level_mode) {
+  sim::wake.ext1 = io_mask != 0;
+  return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() {
+  return (esp_sleep_wakeup_cause_t)sim::wakeupCause();
+}
+
+void esp_deep_sleep_disable_rom_logging() {
+}
+
+void esp_deep_sleep_start() {
+  sim::mark(sim::PROBE_SLEEP);
+  sim::endWake(sim::END_SLEEP);
+}
+
+esp_err_t esp_wifi_set_country_code(const char* country, bool ieee80211d_enabled) {
+  return ESP_OK;
+}
@@ -0,0 +1,41 @@
+#include <cstdio>
+#include <cstring>
+#include "bench.h"
+#include "sim.h"
+
+namespace sim {
+
+struct Bench {
+  const char* name;
+  int (*fn)(int argc, char** argv);
+  const char* help;
+};
+
+static const Bench benches[] = {
+  {"payload", benchPayload, "[-n iterations] [-a aps]  json encoder vs ArduinoJson, time and heap"},
+  {"format", benchFormat, "[-n messages] [-s seed]  binary payload round trip and size vs json"},
+  {"ingest", benchIngest, "[-n messages] [-s seed]  backend intake into columns, checks and msgs/s"},
+  {"console", benchConsole, "[-n rounds] [-l lines]  line editor keystroke cost, config paste, provisioning over a lossy link"},
+  {"log", benchLog, "[-n runs] [-s seed]  log ring round trip through the decoder, call site cost"},
+  {"cpu", benchCpu, "[-n cycles] [-t tls ms]  phase times and charge of the cpu clock policies"},
+  {"mqtt", benchMqtt, "[-n cycles]  connect to sleep time of the delivery modes against the broker stand-in"},
+  {"cycle", benchCycle, "[-n wakes] [-s seed]  wake cycle state machine, scripted and random events"},
+  {"sleep", benchSleep, "[-s seed]  sleep planner checks and battery life in a dead zone"},
+};
+
+int bench(int argc, char** argv) {
+  if(argc >= 2) {
+    for(auto& b : benches) {
+      if(!strcmp(argv[1], b.name)) {
+        return b.fn(argc - 1, argv + 1);
+      }
+    }
+  }
+  printf("benchmarks:\n");
+  for(auto& b : benches) {
+    printf("  bench %-10s %s\n", b.name, b.help);
+  }
+  return 2;
+}
+
+}
@@ -0,0 +1,27 @@
+#ifndef SIM_BENCH_H
+#define SIM_BENCH_H
+
+#include <chrono>
+#include <cstdint>
+
+namespace sim {
+
+int benchPayload(int argc, char** argv);
+int benchFormat(int argc, char** argv);
+int benchIngest(int argc, char** argv);
+int benchConsole(int argc, char** argv);
+int benchCycle(int argc, char** argv);
+int benchMqtt(int argc, char** argv);
+int benchCpu(int argc, char** argv);
+int benchLog(int argc, char** argv);
+int benchSleep(int argc, char** argv);
+// also run by test/test_payload_format
+int formatRoundTrip(int iterations, unsigned seed);
+
+inline double nowUs() {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+#endif
@@ -0,0 +1,353 @@
+#include <Arduino.h>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <string>
+#include <type_traits>
+#include "bench.h"
+#include "cmd_processor.h"
+#include "provision.h"
+#include "sim.h"
+
+namespace sim {
+
+// replays a keystroke script and swallows the echo
+class KeyStream : public Stream {
+public:
+  void load(const std::string &keys) {
+    _keys = &keys;
+    _pos = 0;
+  }
+  int available() override { return _keys->size() - _pos; }
+  int read() override {
+    reads++;
+    return (uint8_t)(*_keys)[_pos++];
+  }
+  size_t readBytes(char* buffer, size_t length) override {
+    reads++;
+    size_t n = std::min(length, _keys->size() - _pos);
+    memcpy(buffer, _keys->data() + _pos, n);
+    _pos += n;
+    return n;
+  }
+  int peek() override { return (uint8_t)(*_keys)[_pos]; }
+  size_t write(uint8_t c) override {
+    echo++;
+    return 1;
+  }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    echo += size;
+    return size;
+  }
+  size_t echo = 0;
+  size_t reads = 0;         // driver calls, each takes the rx lock on the device
+private:
+  const std::string* _keys = nullptr;
+  size_t _pos = 0;
+};
+
+static volatile size_t sink;
+
+// what CMD_PROCESSOR did before: String line rebuilt on insert, split after
+// every key, history as a vector of Strings inserted at the front
+class StringEditor {
+public:
+  StringEditor(Stream* s) : _s(s) {}
+  void process() {
+    while(_s->available()) {
+      key(_s->read());
+    }
+  }
+private:
+  void split() {
+    String helper(_in);
+    helper.trim();
+    int idx = helper.indexOf(" ");
+    if(idx > 0) {
+      _cmd = helper.substring(0, idx);
+      _args = helper.substring(idx + 1);
+    } else {
+      _cmd = helper;
+      _args = "";
+    }
+  }
+  void key(char c) {
+    if(_esc) {
+      _csi = (c == 0x5B);
+      _esc = false;
+      return;
+    } else if(_csi) {
+      _csi = false;
+      if((c == 'A') && (_hist_pos < (int)_hist.size() - 1)) {
+        _in = _hist.at(++_hist_pos);
+        _pos = _in.length();
+        _s->printf("\33[2K\r%s", _in.c_str());
+        split();
+      } else if((c == 'D') && _pos) {
+        _s->printf("\33[D");
+        _pos--;
+      }
+      return;
+    } else if(c == 0x1B) {
+      _esc = true;
+      return;
+    }
+    if((c >= 0x20) && (c <= 0x7E)) {
+      if(_pos == _in.length()) {
+        _in += c;
+        _s->print(c);
+      } else {
+        _in = _in.substring(0, _pos) + c + _in.substring(_pos);
+        _s->printf("\r%s \b\33[%dD", _in.c_str(), _in.length() - _pos - 1);
+      }
+      _pos++;
+    } else if(c == '\r') {
+      // CMDS::handle got cmd and args by value and glued them together again
+      String cmd(_cmd);
+      String args(_args);
+      String line = args.isEmpty() ? cmd : cmd + " " + args;
+      sink = line.length();
+      if(!_in.isEmpty() && (_hist.empty() || (_hist.at(0) != _in))) {
+        _hist.insert(_hist.begin(), _in);
+        if(_hist.size() > CMD_HISTORY) {
+          _hist.pop_back();
+        }
+      }
+      _hist_pos = -1;
+      _in = "";
+      _pos = 0;
+    } else if((c == 8) && _pos) {
+      _in.remove(_pos - 1, 1);
+      _s->printf("\r%s \b\33[%dD", _in.c_str(), _in.length() - _pos + 1);
+      _pos--;
+    }
+    split();
+  }
+  Stream* _s;
+  String _in;
+  String _cmd;
+  String _args;
+  unsigned _pos = 0;
+  bool _esc = false;
+  bool _csi = false;
+  std::vector<String> _hist;
+  int _hist_pos = -1;
+};
+
+static bool onLine(char* line) {
+  sink = strlen(line);
+  return true;
+}
+
+// typing, a fix in the middle of the line, recalling the line and a new one per round
+static std::string makeScript(int lines) {
+  static const char* cmds[] = {
+    "scantime 120", "chans 1,6,11", "server 192.168.178.20", "topic home/king/button", "show", "interval 7200",
+  };
+  std::string keys;
+  for(int i = 0; i < lines; ++i) {
+    keys += cmds[i % 6];
+    keys += "\33[D\33[D\33[DX\b";
+    keys += '\r';
+    keys += "\33[A\r";
+  }
+  return keys;
+}
+
+template <typename E>
+static void measure(const char* name, const std::string &keys, int rounds) {
+  KeyStream in;
+  E* editor = new E(&in);
+  if constexpr(std::is_same_v<E, CMD_PROCESSOR>) {
+    editor->registerCmd("", onLine);
+  }
+  in.load(keys);
+  heapReset();
+  HeapStats before = heapStats();
+  editor->process();
+  HeapStats after = heapStats();
+  double start = nowUs();
+  for(int i = 0; i < rounds; ++i) {
+    in.load(keys);
+    editor->process();
+  }
+  double ns = (nowUs() - start) * 1000.0 / ((double)rounds * keys.size());
+  printf("%-14s %9.1f %9zu %10zu %9zu\n", name, ns, after.allocs, after.peak - before.current,
+         in.echo / (rounds + 1));
+  delete editor;
+}
+
+static const char* config_lines[] = {
+  "ssid kingnet", "pw secret123", "name king1", "server 192.168.178.20", "port 1883", "topic home/king/button",
+  "id 17", "retry 30", "interval 7200", "scantime 120", "chans 1,6,11", "wait 15000", "volt 4.1", "cpu phase",
+};
+
+static std::vector<std::string> configScript(int copies) {
+  std::vector<std::string> lines;
+  for(int i = 0; i < copies; ++i) {
+    lines.insert(lines.end(), std::begin(config_lines), std::end(config_lines));
+  }
+  lines.push_back("save");
+  return lines;
+}
+
+// a config pasted into the line editor against the same lines sent as frames
+static void measurePaste(const char* name, const std::string &bytes, int rounds) {
+  KeyStream in;
+  CMD_PROCESSOR cmd(&in);
+  cmd.registerCmd("", onLine);
+  in.load(bytes);
+  cmd.process();
+  in.echo = 0;
+  in.reads = 0;
+  double start = nowUs();
+  for(int i = 0; i < rounds; ++i) {
+    in.load(bytes);
+    cmd.process();
+  }
+  double ns = (nowUs() - start) * 1000.0 / ((double)rounds * bytes.size());
+  printf("%-14s %9zu %9.1f %9zu %9zu\n", name, bytes.size(), ns, in.echo / rounds, in.reads / rounds);
+}
+
+// usb cdc in both directions, bytes of the host get dropped or garbled
+class LinkStream : public Stream {
+public:
+  int available() override { return in.size(); }
+  int read() override {
+    char c = in.front();
+    in.pop_front();
+    return (uint8_t)c;
+  }
+  int peek() override { return (uint8_t)in.front(); }
+  size_t readBytes(char* buffer, size_t length) override {
+    size_t n = std::min(length, in.size());
+    std::copy_n(in.begin(), n, buffer);
+    in.erase(in.begin(), in.begin() + n);
+    return n;
+  }
+  size_t write(uint8_t c) override {
+    out += (char)c;
+    return 1;
+  }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    out.append((const char*)buffer, size);
+    return size;
+  }
+  std::deque<char> in;
+  std::string out;
+};
+
+static LinkStream* link_stream;
+static CMD_PROCESSOR* link_cmd;
+static std::vector<std::string> link_ran;
+
+static bool onLinkLine(char* line) {
+  if(link_cmd->machine()) {
+    link_ran.push_back(line);
+  }
+  return true;
+}
+
+struct LinkResult {
+  bool ok;
+  size_t bytes;
+  size_t resent;
+  size_t reruns;
+  int silences;
+};
+
+// the provisioning client against the command processor over a lossy link
+static LinkResult runLink(const std::vector<std::string> &lines, double loss, std::mt19937 &rnd) {
+  LinkStream link;
+  CMD_PROCESSOR cmd(&link);
+  link_stream = &link;
+  link_cmd = &cmd;
+  link_ran.clear();
+  cmd.registerCmd("", onLinkLine);
+  std::uniform_real_distribution<double> chance(0, 1);
+  ProvisionClient client([&](const char* data, size_t len) {
+    for(size_t i = 0; i < len; ++i) {
+      double r = chance(rnd);
+      if(r < loss / 2) {
+        continue;
+      }
+      link.in.push_back((r < loss) ? (char)(0x20 + rnd() % 0x5f) : data[i]);
+    }
+  });
+  client.start(lines);
+  int silences = 0;
+  while(!client.left() && (silences < 50)) {
+    if(client.done() && !client.leaving()) {
+      client.finish();
+    }
+    cmd.process();
+    bool heard = false;
+    size_t eol;
+    while((eol = link.out.find_first_of("\r\n")) != std::string::npos) {
+      std::string line = link.out.substr(0, eol);
+      link.out.erase(0, eol + 1);
+      heard |= client.reply(line.c_str());
+    }
+    if(!heard && link.in.empty()) {
+      silences++;
+      client.timeout();
+    }
+  }
+  // a lost enter sequence makes the device start over, the last pass has to be complete
+  bool ok = client.left() && !cmd.machine() && (link_ran.size() >= lines.size()) &&
+            std::equal(lines.begin(), lines.end(), link_ran.end() - lines.size());
+  return {ok, client.bytes(), client.resent(), link_ran.size() - lines.size(), silences};
+}
+
+int benchConsole(int argc, char** argv) {
+  int rounds = 2000;
+  int lines = 50;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-n") && (i + 1 < argc)) {
+      rounds = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-l") && (i + 1 < argc)) {
+      lines = atoi(argv[++i]);
+    }
+  }
+  std::string keys = makeScript(lines);
+  printf("%d lines, %zu keys per round, %d rounds (host cpu, compare the ratio)\n", lines * 2, keys.size(), rounds);
+  printf("%-14s %9s %9s %10s %9s\n", "", "ns/key", "allocs", "peak heap", "echo");
+  measure<StringEditor>("String", keys, rounds);
+  measure<CMD_PROCESSOR>("fixed buffer", keys, rounds);
+
+  std::vector<std::string> script = configScript(4);
+  std::string typed;
+  std::string framed = CMD_MACHINE_ENTER;
+  char frame[CMD_FRAME_MAX + 2];
+  for(size_t i = 0; i < script.size(); ++i) {
+    typed += script[i] + "\r";
+    framed.append(frame, cmd_frame(frame, sizeof(frame), i, script[i].c_str()));
+  }
+  printf("\nconfig paste, %zu lines\n", script.size());
+  printf("%-14s %9s %9s %9s %9s\n", "", "bytes in", "ns/byte", "out", "reads");
+  measurePaste("typed", typed, rounds);
+  measurePaste("machine mode", framed, rounds);
+
+  int failed = 0;
+  std::mt19937 rnd(1);
+  printf("\nprovisioning client over a lossy link, %d runs each\n", 200);
+  printf("%-14s %9s %9s %9s %9s %9s\n", "loss/byte", "ok", "bytes", "resent", "reruns", "silences");
+  for(double loss : {0.0, 0.0005, 0.002, 0.01}) {
+    int ok = 0;
+    double bytes = 0, resent = 0, reruns = 0, silences = 0;
+    for(int i = 0; i < 200; ++i) {
+      LinkResult r = runLink(script, loss, rnd);
+      ok += r.ok;
+      bytes += r.bytes;
+      resent += r.resent;
+      reruns += r.reruns;
+      silences += r.silences;
+    }
+    failed += 200 - ok;
+    printf("%-14g %9d %9.0f %9.1f %9.2f %9.2f\n", loss, ok, bytes / 200, resent / 200, reruns / 200, silences / 200);
+  }
+  printf("%d failed\n", failed);
+  return failed ? 1 : 0;
+}
+
+}
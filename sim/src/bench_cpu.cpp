@@ -0,0 +1,88 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "bench.h"
+#include "sim.h"
+
+namespace sim {
+
+static const struct {
+  const char* name;
+  const char* cmd;
+} policies[] = {
+  {"fixed 80", "cpu 80"},
+  {"fixed 160", "cpu 160"},
+  {"phase", "cpu phase"},
+};
+
+// the wake cycle simulation with one cpu policy, its table goes to /dev/null
+static RunStats runPolicy(const Scenario &s, const char* cmd, uint32_t cycles) {
+  RunStats stats{};
+  Options options;
+  options.cycles = cycles;
+  options.config.push_back(cmd);
+  options.stats = &stats;
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  FILE* null = fopen("/dev/null", "w");
+  dup2(fileno(null), STDOUT_FILENO);
+  run(s, options);
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  fclose(null);
+  return stats;
+}
+
+// phase times and the charge of the firmware energy model per cpu clock policy, plain mqtt and
+// with a tls handshake, the cpu work of a phase scales with the clock, the waits do not
+int benchCpu(int argc, char** argv) {
+  uint32_t cycles = 12;
+  uint32_t tls = 400;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-n") && (i + 1 < argc)) {
+      cycles = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-t") && (i + 1 < argc)) {
+      tls = atoi(argv[++i]);
+    }
+  }
+  // columns of the sim table that the clock can change
+  static const int cols[] = {1, 2, 3, 5, 6};
+  static const char* col_names[] = {"scan", "assoc", "dhcp", "mqtt", "ack"};
+  for(uint32_t tls_ms : {0u, tls}) {
+    Scenario s = makeScenario("ok");
+    s.tls_cpu_ms = tls_ms;
+    printf("wpa %u ms", s.assoc_cpu_ms);
+    if(tls_ms) {
+      printf(", tls %u ms", tls_ms);
+    }
+    printf(" of cpu work at 80 MHz\n%-10s", "policy");
+    for(const char* n : col_names) {
+      printf(" %6s", n);
+    }
+    printf(" %7s %9s %9s\n", "awake", "uAh/wake", "mAh/day");
+    int best = -1;
+    float best_day = 0;
+    for(int p = 0; p < (int)(sizeof(policies) / sizeof(policies[0])); ++p) {
+      RunStats st = runPolicy(s, policies[p].cmd, cycles);
+      if(!st.sends) {
+        printf("%-10s no wake reached the broker\n", policies[p].name);
+        return 1;
+      }
+      printf("%-10s", policies[p].name);
+      for(int c : cols) {
+        printf(" %6.0f", st.phase_ms[c]);
+      }
+      printf(" %7.0f %9.1f %9.3f\n", st.awake_ms, st.mah_per_wake * 1000, st.mah_per_day);
+      if((best < 0) || (st.mah_per_day < best_day)) {
+        best = p;
+        best_day = st.mah_per_day;
+      }
+    }
+    printf("lowest: %s\n\n", policies[best].name);
+  }
+  return 0;
+}
+
+}
@@ -0,0 +1,153 @@
+#include <Arduino.h>
+#include <cstdlib>
+#include <random>
+#include "bench.h"
+#include "wake_cycle.h"
+
+namespace sim {
+
+static const cycle_deadlines_t deadlines = {2000, 3000, 4000, 3000, 1000, 3000};
+#define TOTAL_MS 15000
+
+// a scripted wake: events at fixed times, the outcome and when it has to be known
+struct CycleCase {
+  const char* name;
+  bool fast;
+  uint32_t plan_ms;
+  struct {
+    uint32_t ms;
+    cycle_event_t event;
+  } steps[8];
+  uint8_t step_ct;
+  cycle_state_t end;          // CS_SLEEP or CS_FAILED
+  cycle_state_t late;         // phase that timed out
+  uint32_t end_ms;
+};
+
+static const CycleCase cases[] = {
+  {"good send", false, 4000,
+   {{4056, CE_SCAN_DONE}, {4236, CE_CONNECTED}, {4886, CE_GOT_IP}, {4976, CE_MQTT_CONNECTED},
+    {4976, CE_PUBLISHED}, {5021, CE_ACKED}}, 6, CS_SLEEP, CS_IDLE, 5021},
+  {"batched scan", false, 4000, {{4056, CE_DONE}}, 1, CS_SLEEP, CS_IDLE, 4056},
+  {"scan hangs", false, 4000, {}, 0, CS_FAILED, CS_SCAN, 6000},
+  {"no ap", false, 4000, {{4056, CE_SCAN_DONE}}, 1, CS_FAILED, CS_ASSOC, 7056},
+  {"no dhcp", false, 4000, {{4056, CE_SCAN_DONE}, {4236, CE_CONNECTED}}, 2, CS_FAILED, CS_DHCP, 8236},
+  {"no broker", false, 4000,
+   {{4056, CE_SCAN_DONE}, {4236, CE_CONNECTED}, {4886, CE_GOT_IP}}, 3, CS_FAILED, CS_MQTT, 7886},
+  {"no puback", false, 4000,
+   {{4056, CE_SCAN_DONE}, {4236, CE_CONNECTED}, {4886, CE_GOT_IP}, {4976, CE_MQTT_CONNECTED},
+    {4976, CE_PUBLISHED}}, 5, CS_FAILED, CS_ACK, 7976},
+  {"fast connect", true, 0,
+   {{180, CE_CONNECTED}, {182, CE_GOT_IP}, {272, CE_MQTT_CONNECTED}, {272, CE_PUBLISHED},
+    {317, CE_ACKED}}, 5, CS_SLEEP, CS_IDLE, 317},
+  {"fast falls back", true, 0,
+   {{5556, CE_SCAN_DONE}, {5736, CE_CONNECTED}, {6386, CE_GOT_IP}, {6476, CE_MQTT_CONNECTED},
+    {6476, CE_PUBLISHED}, {6521, CE_ACKED}}, 6, CS_SLEEP, CS_IDLE, 6521},
+  {"slow everything", false, 4000,
+   {{5900, CE_SCAN_DONE}, {8800, CE_CONNECTED}, {12700, CE_GOT_IP}}, 3, CS_FAILED, CS_MQTT, TOTAL_MS},
+  {"events skip ahead", false, 4000,
+   {{4056, CE_SCAN_DONE}, {4886, CE_GOT_IP}, {4236, CE_CONNECTED}, {4976, CE_MQTT_CONNECTED},
+    {4976, CE_PUBLISHED}, {5021, CE_ACKED}}, 6, CS_SLEEP, CS_IDLE, 5021},
+};
+
+// runs the cycle like loop() does: event, deadline check, block until the next deadline
+static bool runCase(const CycleCase &c, cycle_stats_t &stats) {
+  WAKE_CYCLE cycle(&stats);
+  cycle.begin(deadlines, TOTAL_MS);
+  cycle.start(0, c.fast, 1500);
+  cycle.planned(c.plan_ms);
+  uint32_t now = 0;
+  uint8_t step = 0;
+  cycle_state_t late = CS_IDLE;
+  while(cycle.busy()) {
+    uint32_t next = (step < c.step_ct) ? std::max(c.steps[step].ms, now) : UINT32_MAX;
+    uint32_t deadline = cycle.timeout(now);
+    if((deadline != UINT32_MAX) && (now + deadline < next)) {
+      now += deadline;
+      cycle_state_t l = cycle.expired(now);
+      if(l == CS_IDLE) {
+        printf("%s: no timeout at the deadline, %u ms\n", c.name, now);
+        return false;
+      }
+      if(cycle.state() == CS_SCAN) {
+        cycle.planned(4000);
+      } else {
+        late = l;
+      }
+      continue;
+    }
+    if(next == UINT32_MAX) {
+      printf("%s: stuck in %s\n", c.name, WAKE_CYCLE::name(cycle.state()));
+      return false;
+    }
+    now = next;
+    if(cycle.expired(now) != CS_IDLE) {
+      continue;
+    }
+    cycle.event(c.steps[step++].event, now);
+  }
+  if((cycle.state() != c.end) || (late != c.late) || (now != c.end_ms)) {
+    printf("%s: %s at %u ms, %s late, expected %s at %u ms, %s late\n", c.name, WAKE_CYCLE::name(cycle.state()),
+           now, WAKE_CYCLE::name(late), WAKE_CYCLE::name(c.end), c.end_ms, WAKE_CYCLE::name(c.late));
+    return false;
+  }
+  return true;
+}
+
+// scripted wakes against their expected outcome, then random event streams against the invariants
+int benchCycle(int argc, char** argv) {
+  int iterations = 100000;
+  unsigned seed = 1;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-n") && (i + 1 < argc)) {
+      iterations = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-s") && (i + 1 < argc)) {
+      seed = atoi(argv[++i]);
+    }
+  }
+  int failed = 0;
+  cycle_stats_t stats{};
+  for(const auto &c : cases) {
+    failed += !runCase(c, stats);
+  }
+  printf("scripted: %zu wakes, %d failed\n", sizeof(cases) / sizeof(cases[0]), failed);
+
+  std::mt19937 rnd(seed);
+  int broken = 0;
+  uint64_t events = 0;
+  double start = nowUs();
+  for(int i = 0; i < iterations; ++i) {
+    cycle_stats_t s{};
+    WAKE_CYCLE cycle(&s);
+    cycle.begin(deadlines, (rnd() & 1) ? TOTAL_MS : 0);
+    uint32_t now = rnd();
+    cycle.start(now, rnd() & 1, 500 + rnd() % 2000);
+    cycle.planned(rnd() % 5000);
+    cycle_state_t last = cycle.state();
+    while(cycle.busy()) {
+      now += rnd() % 3000;
+      cycle_state_t before = cycle.state();
+      bool fast = cycle.fast();
+      cycle_state_t l = cycle.expired(now);
+      if(l == CS_IDLE) {
+        cycle.event((cycle_event_t)(rnd() % (CE_DONE + 1)), now);
+        events++;
+      } else if((l != before) || ((cycle.state() != CS_FAILED) && !(fast && (l == CS_ASSOC)))) {
+        broken++;
+        break;
+      }
+      // only forward, except the one fall back of a fast connect
+      if((cycle.state() < last) && !((last == CS_ASSOC) && (cycle.state() == CS_SCAN))) {
+        broken++;
+        break;
+      }
+      last = cycle.state();
+    }
+  }
+  double ns = (nowUs() - start) * 1000.0 / (events ? events : 1);
+  printf("random: %d wakes, %llu events, %d broke an invariant, %.1f ns per event\n", iterations,
+         (unsigned long long)events, broken, ns);
+  return (failed || broken) ? 1 : 0;
+}
+
+}
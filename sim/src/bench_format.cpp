@@ -0,0 +1,204 @@
+#include <Arduino.h>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include "bench.h"
+#include "payload.h"
+#include "payload_decoder.h"
+
+namespace sim {
+
+static payload_t payload;
+static batch_t batch_state;
+static BATCH_BUFFER batch(&batch_state);
+static trace_t trace_state;
+static TRACE trace(&trace_state);
+static char json_buf[PAYLOAD_SIZE];
+static uint8_t bin_buf[PAYLOAD_SIZE];
+
+// random but plausible: few distinct ssids, some repeated, empty and odd characters included
+static void randomPayload(std::mt19937 &rnd, int ap_ct) {
+  static const char* ssids[] = {"kingnet", "", "FRITZ!Box 7590 XY", "guest \"quoted\"", "DIRECT-3F-HP M479",
+                                "Vodafone-ABCD", "a\\b", "0123456789abcdef0123456789abcdef"};
+  payload_clear(&payload);
+  for(int i = 0; i < ap_ct; ++i) {
+    uint8_t bssid[6];
+    for(auto &b : bssid) {
+      b = rnd();
+    }
+    char ssid[33];
+    int pick = rnd() % 24;
+    if(pick < 8) {
+      snprintf(ssid, sizeof(ssid), "%s", ssids[pick]);
+    } else {
+      // unique ssids push the dictionary past the 4 bit index
+      snprintf(ssid, sizeof(ssid), "net%d", pick);
+    }
+    payload_add_ap(&payload, ssid, bssid, -30 - (int)(rnd() % 70), 1 + rnd() % 13);
+  }
+  payload.voltage = (3000 + rnd() % 1300) / 1000.0f;
+  payload.button_ct = rnd() % 70000;
+  payload.id = rnd();
+  payload.wifi_fail = rnd() % 100;
+  payload.mqtt_fail = rnd() % 100;
+  payload.send_cause = rnd() % 512;
+  payload.runtime = rnd();
+  payload.used_uah = rnd();
+  payload.days_left = rnd();
+  // every other message carries earlier scans, cut down to their strongest APs
+  batch.clear();
+  payload.batch = nullptr;
+  if(rnd() & 1) {
+    payload_t scan = payload;
+    int records = rnd() % (BATCH_MAX_RECORDS + 3);
+    for(int i = 0; i < records; ++i) {
+      batch.sleep(rnd() % 3600);
+      scan.ap_ct = rnd() % (ap_ct + 1);
+      batch.push(&scan, payload.voltage, rnd() % 512);
+    }
+    payload.batch = &batch;
+  }
+  if(rnd() & 1) {
+    payload.delta = true;
+    payload.gone_ct = rnd() % (PAYLOAD_MAX_APS + 1);
+    for(int i = 0; i < payload.gone_ct; ++i) {
+      for(auto &b : payload.gone[i]) {
+        b = rnd();
+      }
+    }
+  }
+  trace.clear();
+  payload.trace = nullptr;
+  payload.trace_ct = 0;
+  if(rnd() & 1) {
+    int events = rnd() % (TRACE_MAX_EVENTS + 8);
+    for(int i = 0; i < events; ++i) {
+      trace.mark((trace_probe_t)(rnd() % TP_COUNT), rnd());
+    }
+    payload.trace = &trace;
+    payload.trace_ct = trace.count() ? rnd() % (trace.count() + 1) : 0;
+  }
+}
+
+static bool same(const payload_decoder::Message &msg) {
+  if((fabsf(msg.voltage - payload.voltage) > 0.0006f) || (msg.id != payload.id) ||
+     (msg.button_ct != ((payload.button_ct > 0xffff) ? 0xffff : payload.button_ct)) ||
+     (msg.wifi_fail != payload.wifi_fail) || (msg.mqtt_fail != payload.mqtt_fail) ||
+     (msg.send_cause != payload.send_cause) || (msg.runtime != payload.runtime) ||
+     (msg.used_uah != payload.used_uah) || (msg.days_left != payload.days_left) ||
+     (msg.ap.size() != payload.ap_ct)) {
+    return false;
+  }
+  for(size_t i = 0; i < msg.ap.size(); ++i) {
+    const payload_ap_t &ap = payload.ap[i];
+    if((msg.ap[i].ssid != ap.ssid) || memcmp(msg.ap[i].bssid, ap.bssid, 6) ||
+       (msg.ap[i].rssi != ap.rssi) || (msg.ap[i].channel != ap.channel)) {
+      return false;
+    }
+  }
+  if((msg.delta != payload.delta) || (msg.gone.size() != (payload.delta ? payload.gone_ct : 0))) {
+    return false;
+  }
+  for(size_t i = 0; i < msg.gone.size(); ++i) {
+    if(memcmp(msg.gone[i].data(), payload.gone[i], 6)) {
+      return false;
+    }
+  }
+  if(msg.trace.size() != (payload.trace ? payload.trace_ct : 0)) {
+    return false;
+  }
+  for(size_t i = 0; i < msg.trace.size(); ++i) {
+    const trace_event_t &e = trace.get(i);
+    if((msg.trace[i].probe != e.probe) || (msg.trace[i].arg != e.arg) || (msg.trace[i].ms != e.ms)) {
+      return false;
+    }
+  }
+  if(msg.batch.size() != (payload.batch ? batch.count() : 0)) {
+    return false;
+  }
+  for(size_t i = 0; i < msg.batch.size(); ++i) {
+    const batch_record_t &r = batch.get(i);
+    const payload_decoder::Record &rec = msg.batch[i];
+    if((rec.age != batch.age(i)) || (rec.mv != r.mv) || (rec.send_cause != r.send_cause) ||
+       (rec.ap.size() != r.ap_ct)) {
+      return false;
+    }
+    for(size_t k = 0; k < rec.ap.size(); ++k) {
+      if(memcmp(rec.ap[k].bssid, r.ap[k].bssid, 6) || (rec.ap[k].rssi != r.ap[k].rssi) ||
+         (rec.ap[k].channel != r.ap[k].channel) || ((k > 0) && (r.ap[k].rssi > r.ap[k - 1].rssi))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// encodes random payloads, decodes them again and compares, returns the number of mismatches
+int formatRoundTrip(int iterations, unsigned seed) {
+  std::mt19937 rnd(seed);
+  int failed = 0;
+  payload_decoder::Message msg;
+  for(int i = 0; i < iterations; ++i) {
+    randomPayload(rnd, rnd() % (PAYLOAD_MAX_APS + 1));
+    size_t len = payload_to_bin(&payload, bin_buf, sizeof(bin_buf));
+    payload_decoder::Error err = payload_decoder::decode(bin_buf, len, msg);
+    if((err != payload_decoder::Error::none) || !same(msg)) {
+      if(failed++ < 5) {
+        printf("mismatch in message %d (%zu bytes, %s)\n", i, len, payload_decoder::errorName(err));
+      }
+      continue;
+    }
+    // a cut message has to be refused, not misread
+    if(len && (payload_decoder::decode(bin_buf, len - 1, msg) == payload_decoder::Error::none)) {
+      if(failed++ < 5) {
+        printf("truncated message %d accepted\n", i);
+      }
+    }
+  }
+  return failed;
+}
+
+// the round trip plus the size win over json
+int benchFormat(int argc, char** argv) {
+  int iterations = 10000;
+  unsigned seed = 1;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-n") && (i + 1 < argc)) {
+      iterations = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-s") && (i + 1 < argc)) {
+      seed = atoi(argv[++i]);
+    }
+  }
+  int failed = formatRoundTrip(iterations, seed);
+  printf("round trip: %d messages, %d failed\n", iterations, failed);
+
+  printf("%6s %10s %10s %7s\n", "aps", "json", "bin", "ratio");
+  for(int ap_ct : {0, 1, 4, 12, 24, 32}) {
+    std::mt19937 r(ap_ct);
+    randomPayload(r, ap_ct);
+    payload.batch = nullptr;
+    payload.trace = nullptr;
+    size_t json = payload_to_json(&payload, json_buf, sizeof(json_buf));
+    size_t bin = payload_to_bin(&payload, bin_buf, sizeof(bin_buf));
+    printf("%6d %10zu %10zu %6.1f%%\n", ap_ct, json, bin, 100.0 * bin / json);
+  }
+  // worst case: full batch ring and trace plus a full scan of the sending wake
+  std::mt19937 r(0);
+  randomPayload(r, PAYLOAD_MAX_APS);
+  batch.clear();
+  for(int i = 0; i < BATCH_MAX_RECORDS; ++i) {
+    batch.push(&payload, payload.voltage, 0x84);
+  }
+  payload.batch = &batch;
+  for(int i = 0; i < TRACE_MAX_EVENTS; ++i) {
+    trace.mark(TP_SCAN_DONE, 13);
+  }
+  payload.trace = &trace;
+  payload.trace_ct = trace.count();
+  size_t json = payload_to_json(&payload, json_buf, sizeof(json_buf));
+  size_t bin = payload_to_bin(&payload, bin_buf, sizeof(bin_buf));
+  printf("%2d+%-3d %10zu %10zu %6.1f%%\n", PAYLOAD_MAX_APS, BATCH_MAX_RECORDS, json, bin, 100.0 * bin / json);
+  return failed ? 1 : 0;
+}
+
+}
@@ -0,0 +1,263 @@
+#include <Arduino.h>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include "bench.h"
+#include "ingest.h"
+#include "payload.h"
+#include "sim.h"
+#if __has_include(<ArduinoJson.h>)
+#include <ArduinoJson.h>
+#endif
+
+namespace sim {
+
+using payload_decoder::Columns;
+using payload_decoder::Error;
+
+static payload_t payload;
+static batch_t batch_state;
+static BATCH_BUFFER batch(&batch_state);
+static trace_t trace_state;
+static TRACE trace(&trace_state);
+static char json_buf[PAYLOAD_SIZE];
+static uint8_t bin_buf[PAYLOAD_SIZE];
+
+// what a fleet sends: a few ssids seen everywhere, batch records, deltas and traces now and then
+static void randomPayload(std::mt19937 &rnd, int ap_ct) {
+  static const char* ssids[] = {"kingnet", "", "FRITZ!Box 7590 XY", "guest \"quoted\"", "DIRECT-3F-HP M479",
+                                "Vodafone-ABCD", "a\\b", "tab\there", "0123456789abcdef0123456789abcdef"};
+  payload_clear(&payload);
+  for(int i = 0; i < ap_ct; ++i) {
+    uint8_t bssid[6];
+    for(auto &b : bssid) {
+      b = rnd();
+    }
+    payload_add_ap(&payload, ssids[rnd() % 9], bssid, -30 - (int)(rnd() % 70), 1 + rnd() % 13);
+  }
+  payload.voltage = (3000 + rnd() % 1300) / 1000.0f;
+  payload.button_ct = rnd() % 0xffff;
+  payload.id = rnd();
+  payload.wifi_fail = rnd() % 100;
+  payload.mqtt_fail = rnd() % 100;
+  payload.send_cause = rnd() % 512;
+  payload.runtime = rnd();
+  payload.used_uah = rnd();
+  payload.days_left = rnd();
+  batch.clear();
+  payload.batch = nullptr;
+  if(!(rnd() % 4)) {
+    payload_t scan = payload;
+    int records = 1 + rnd() % BATCH_MAX_RECORDS;
+    for(int i = 0; i < records; ++i) {
+      batch.sleep(rnd() % 3600);
+      scan.ap_ct = rnd() % (ap_ct + 1);
+      batch.push(&scan, payload.voltage, rnd() % 512);
+    }
+    payload.batch = &batch;
+  }
+  if(!(rnd() % 4)) {
+    payload.delta = true;
+    payload.gone_ct = rnd() % 4;
+    for(int i = 0; i < payload.gone_ct; ++i) {
+      for(auto &b : payload.gone[i]) {
+        b = rnd();
+      }
+    }
+  }
+  trace.clear();
+  payload.trace = nullptr;
+  payload.trace_ct = 0;
+  if(!(rnd() % 8)) {
+    for(int i = 0; i < TRACE_MAX_EVENTS; ++i) {
+      trace.mark((trace_probe_t)(rnd() % TP_COUNT), rnd());
+    }
+    payload.trace = &trace;
+    payload.trace_ct = trace.count();
+  }
+}
+
+template <typename T>
+static bool sameColumn(const std::vector<T> &a, const std::vector<T> &b, T tolerance = 0) {
+  if(a.size() != b.size()) {
+    return false;
+  }
+  for(size_t i = 0; i < a.size(); ++i) {
+    if(((a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i]) > tolerance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// the json scanner against the binary decoder, which bench format checks against the encoder
+static bool sameColumns(const Columns &a, const Columns &b) {
+  return sameColumn(a.id, b.id) && sameColumn(a.voltage, b.voltage, 0.0006f) && sameColumn(a.button_ct, b.button_ct) &&
+         sameColumn(a.wifi_fail, b.wifi_fail) && sameColumn(a.mqtt_fail, b.mqtt_fail) &&
+         sameColumn(a.send_cause, b.send_cause) && sameColumn(a.runtime, b.runtime) &&
+         sameColumn(a.used_uah, b.used_uah) && sameColumn(a.days_left, b.days_left) && sameColumn(a.delta, b.delta) &&
+         sameColumn(a.gone_begin, b.gone_begin) && sameColumn(a.scan_msg, b.scan_msg) &&
+         sameColumn(a.scan_age, b.scan_age) && sameColumn(a.scan_mv, b.scan_mv, (uint16_t)1) &&
+         sameColumn(a.scan_send_cause, b.scan_send_cause) && sameColumn(a.scan_ap_begin, b.scan_ap_begin) &&
+         sameColumn(a.bssid, b.bssid) && sameColumn(a.rssi, b.rssi) && sameColumn(a.channel, b.channel) &&
+         sameColumn(a.ssid_begin, b.ssid_begin) && sameColumn(a.ssid_len, b.ssid_len) &&
+         sameColumn(a.ssid_bytes, b.ssid_bytes) && sameColumn(a.gone_bssid, b.gone_bssid);
+}
+
+// a stream of messages back to back, as a broker subscription hands them over
+struct Corpus {
+  std::vector<char> bytes;
+  std::vector<size_t> begin;
+  size_t count() const { return begin.size() - 1; }
+  const char* at(size_t i) const { return bytes.data() + begin[i]; }
+  size_t len(size_t i) const { return begin[i + 1] - begin[i]; }
+};
+
+static Corpus makeCorpus(int messages, bool bin, unsigned seed) {
+  std::mt19937 rnd(seed);
+  Corpus c;
+  c.begin.push_back(0);
+  for(int i = 0; i < messages; ++i) {
+    randomPayload(rnd, 8 + rnd() % 17);
+    size_t len = bin ? payload_to_bin(&payload, bin_buf, sizeof(bin_buf))
+                     : payload_to_json(&payload, json_buf, sizeof(json_buf));
+    const char* src = bin ? (const char*)bin_buf : json_buf;
+    c.bytes.insert(c.bytes.end(), src, src + len);
+    c.begin.push_back(c.bytes.size());
+  }
+  return c;
+}
+
+static volatile size_t sink;
+
+// messages per second on one core, the columns cleared every batch
+static void timeIngest(const char* name, const Corpus &c, int batch_size) {
+  Columns cols;
+  cols.reserve(batch_size, batch_size * 32);
+  // warm up until the columns hold the largest batch, then count the heap use of one pass
+  for(int pass = 0; pass < 2; ++pass) {
+    if(pass) {
+      heapReset();
+    }
+    for(size_t i = 0; i < c.count(); ++i) {
+      if(!(i % batch_size)) {
+        cols.clear();
+      }
+      payload_decoder::ingest((const uint8_t*)c.at(i), c.len(i), cols);
+    }
+  }
+  HeapStats heap = heapStats();
+  size_t n = 0;
+  double start = nowUs();
+  double us;
+  do {
+    for(size_t i = 0; i < c.count(); ++i, ++n) {
+      if(!(i % batch_size)) {
+        cols.clear();
+      }
+      payload_decoder::ingest((const uint8_t*)c.at(i), c.len(i), cols);
+    }
+    us = nowUs() - start;
+  } while(us < 1e6);
+  sink = cols.aps();
+  double mb = (double)c.bytes.size() * n / c.count() / us;
+  printf("%-14s %12.0f %9.1f %9zu\n", name, n * 1e6 / us, mb, heap.allocs);
+}
+
+#if __has_include(<ArduinoJson.h>)
+// the document tree way: parse every message, then walk it into the same columns
+static void timeArduinoJson(const Corpus &c) {
+  Columns cols;
+  JsonDocument doc;
+  heapReset();
+  size_t n = 0;
+  double start = nowUs();
+  double us;
+  do {
+    for(size_t i = 0; i < c.count(); ++i, ++n) {
+      if(deserializeJson(doc, c.at(i), c.len(i))) {
+        continue;
+      }
+      cols.id.push_back(doc["id"]);
+      cols.voltage.push_back(doc["voltage"]);
+      for(JsonObject ap : doc["ap"].as<JsonArray>()) {
+        cols.rssi.push_back(ap["rssi"]);
+        cols.channel.push_back(ap["channel"]);
+        const char* ssid = ap["ssid"];
+        cols.ssid_bytes.insert(cols.ssid_bytes.end(), ssid, ssid + strlen(ssid));
+      }
+      if(cols.id.size() >= 1000) {
+        cols.clear();
+      }
+    }
+    us = nowUs() - start;
+  } while(us < 1e6);
+  sink = cols.aps();
+  double mb = (double)c.bytes.size() * n / c.count() / us;
+  printf("%-14s %12.0f %9.1f %9zu\n", "ArduinoJson", n * 1e6 / us, mb, heapStats().allocs * c.count() / n);
+}
+#endif
+
+// backend intake: json scanned into columns checked against the binary decoder, then throughput
+int benchIngest(int argc, char** argv) {
+  int iterations = 10000;
+  unsigned seed = 1;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-n") && (i + 1 < argc)) {
+      iterations = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-s") && (i + 1 < argc)) {
+      seed = atoi(argv[++i]);
+    }
+  }
+  std::mt19937 rnd(seed);
+  int failed = 0;
+  Columns from_json;
+  Columns from_bin;
+  payload_decoder::Message msg;
+  for(int i = 0; i < iterations; ++i) {
+    randomPayload(rnd, rnd() % (PAYLOAD_MAX_APS + 1));
+    size_t json = payload_to_json(&payload, json_buf, sizeof(json_buf));
+    size_t bin = payload_to_bin(&payload, bin_buf, sizeof(bin_buf));
+    Error err = payload_decoder::ingestJson(json_buf, json, from_json);
+    if(payload_decoder::decode(bin_buf, bin, msg) == Error::none) {
+      from_bin.append(msg);
+    }
+    if((err != Error::none) || !sameColumns(from_json, from_bin)) {
+      if(failed++ < 5) {
+        printf("mismatch in message %d (%s): %.*s\n", i, payload_decoder::errorName(err), (int)json, json_buf);
+      }
+      from_json.clear();
+      from_bin.clear();
+      continue;
+    }
+    // a cut message is refused and leaves the columns as they were
+    size_t messages = from_json.messages();
+    size_t aps = from_json.aps();
+    if((payload_decoder::ingestJson(json_buf, rnd() % json, from_json) != Error::bad_json) ||
+       (from_json.messages() != messages) || (from_json.aps() != aps)) {
+      if(failed++ < 5) {
+        printf("truncated message %d accepted\n", i);
+      }
+    }
+    if(from_json.messages() >= 1000) {
+      from_json.clear();
+      from_bin.clear();
+    }
+  }
+  printf("json vs binary into columns: %d messages, %d failed\n", iterations, failed);
+
+  Corpus json = makeCorpus(2000, false, seed);
+  Corpus bin = makeCorpus(2000, true, seed);
+  printf("%zu messages, %.0f bytes json, %.0f bytes binary each, batches of 1000, scanner %s, allocs per pass\n", json.count(),
+         (double)json.bytes.size() / json.count(), (double)bin.bytes.size() / bin.count(),
+         payload_decoder::ingestScanner());
+  printf("%-14s %12s %9s %9s\n", "", "msgs/s", "MB/s", "allocs");
+  timeIngest("ingest json", json, 1000);
+  timeIngest("ingest binary", bin, 1000);
+#if __has_include(<ArduinoJson.h>)
+  timeArduinoJson(json);
+#endif
+  return failed ? 1 : 0;
+}
+
+}
@@ -0,0 +1,195 @@
+#include <Arduino.h>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include "bench.h"
+#include "dlog.h"
+#include "logdump.h"
+#include "sim.h"
+
+namespace sim {
+
+// what the debug uart would have carried
+class Capture : public Print {
+public:
+  size_t write(uint8_t c) override {
+    bytes.push_back(c);
+    return 1;
+  }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    bytes.insert(bytes.end(), buffer, buffer + size);
+    return size;
+  }
+  std::vector<uint8_t> bytes;
+};
+
+static dlog_t log_state;
+static DLOG log_ring(&log_state);
+static volatile size_t sink;
+
+static std::string cut(const char* s) {
+  return std::string(s, strnlen(s, DLOG_STR_MAX));
+}
+
+// the chars a record keeps of a string with room argument bytes left, ? once it is full
+static std::string fit(const char* s, size_t &room) {
+  if(!room) {
+    return "?";
+  }
+  size_t n = std::min(strnlen(s, DLOG_STR_MAX), room - 1);
+  room -= 1 + n;
+  return std::string(s, n);
+}
+
+// one of a few call sites with random arguments, returns the text printf makes of it
+static std::string randomRecord(std::mt19937 &rnd) {
+  static const char* words[] = {"", "kingnet", "broker.lan", "a much longer string than a record keeps", "%d"};
+  char buf[160];
+  int i = rnd();
+  unsigned u = rnd();
+  float f = (int)(rnd() % 100000) / 1000.0f;
+  const char* s = words[rnd() % 5];
+  const char* t = words[rnd() % 5];
+  switch(rnd() % 6) {
+    case 0:
+      DLOG_AT(log_ring, DLOG_INFO, "int %d uint %u hex %04x", i, u, u & 0xffff);
+      snprintf(buf, sizeof(buf), "int %d uint %u hex %04x", i, u, u & 0xffff);
+      break;
+    case 1:
+      DLOG_AT(log_ring, DLOG_INFO, "str '%s' float %.3f", s, f);
+      snprintf(buf, sizeof(buf), "str '%s' float %.3f", cut(s).c_str(), f);
+      break;
+    case 2:
+      DLOG_AT(log_ring, DLOG_DEBUG, "%s/%s %d%%", s, t, i % 100);
+      snprintf(buf, sizeof(buf), "%s/%s %d%%", cut(s).c_str(), cut(t).c_str(), i % 100);
+      break;
+    case 3:
+      DLOG_AT(log_ring, DLOG_WARN, "no arguments");
+      snprintf(buf, sizeof(buf), "no arguments");
+      break;
+    case 4: {
+      // up to 72 bytes, more than a record holds
+      DLOG_AT(log_ring, DLOG_DEBUG, "%s %s %s %u", s, t, s, u);
+      size_t room = DLOG_ARGS_MAX;
+      std::string a = fit(s, room);
+      std::string b = fit(t, room);
+      std::string c = fit(s, room);
+      snprintf(buf, sizeof(buf), "%s %s %s %s", a.c_str(), b.c_str(), c.c_str(),
+               (room >= 4) ? std::to_string(u).c_str() : "?");
+      break;
+    }
+    default:
+      DLOG_AT(log_ring, DLOG_ERROR, "%s took %u ms, %s", s, u % 10000, t);
+      snprintf(buf, sizeof(buf), "%s took %u ms, %s", cut(s).c_str(), u % 10000, cut(t).c_str());
+      break;
+  }
+  return buf;
+}
+
+// the decoded text without the ms column
+static std::vector<std::string> decode(const std::vector<uint8_t> &bytes, LogDecoder &decoder) {
+  char* text = nullptr;
+  size_t len = 0;
+  FILE* out = open_memstream(&text, &len);
+  decoder.feed(bytes.data(), bytes.size(), out);
+  fclose(out);
+  std::vector<std::string> lines;
+  for(char* line = strtok(text, "\n"); line; line = strtok(nullptr, "\n")) {
+    bool record = (strlen(line) >= 9) && (strspn(line, " 0123456789") >= 8) && (line[8] == ' ');
+    lines.push_back(record ? line + 9 : line);
+  }
+  free(text);
+  return lines;
+}
+
+// records through the ring, flushed in pieces between text on the uart, and decoded
+int benchLog(int argc, char** argv) {
+  int iterations = 2000;
+  unsigned seed = 1;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-n") && (i + 1 < argc)) {
+      iterations = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-s") && (i + 1 < argc)) {
+      seed = atoi(argv[++i]);
+    }
+  }
+  int failed = 0;
+  std::vector<uint16_t> clash = logCollisions();
+  for(uint16_t id : clash) {
+    printf("id %04x used by two format strings\n", id);
+  }
+  failed += clash.size();
+  printf("%zu format strings in this build, %zu ids shared\n", logFormats().size(), clash.size());
+
+  std::mt19937 rnd(seed);
+  size_t records = 0;
+  size_t text_bytes = 0;
+  size_t bin_bytes = 0;
+  for(int i = 0; i < iterations; ++i) {
+    log_ring.clear();
+    Capture uart;
+    std::vector<std::string> expect;
+    // more than the ring holds now and then, the oldest go and a count stands in for them
+    int n = 1 + rnd() % ((i % 10) ? 20 : 200);
+    for(int k = 0; k < n; ++k) {
+      expect.push_back(randomRecord(rnd));
+      text_bytes += expect.back().size() + 2;
+    }
+    const char* noise = "rst:0x5 (DSLEEP),boot:0xc (SPI_FAST_FLASH_BOOT)\n";
+    uart.write((const uint8_t*)noise, strlen(noise));
+    while(log_ring.pending()) {
+      size_t before = uart.bytes.size();
+      log_ring.flush(&uart, 20 + rnd() % 300);
+      if(uart.bytes.size() == before) {
+        break;
+      }
+    }
+    log_ring.flush(&uart, SIZE_MAX);
+    bin_bytes += uart.bytes.size() - strlen(noise);
+    LogDecoder decoder;
+    std::vector<std::string> got = decode(uart.bytes, decoder);
+    records += decoder.records;
+    bool ok = !got.empty() && (got[0] == "rst:0x5 (DSLEEP),boot:0xc (SPI_FAST_FLASH_BOOT)") && !decoder.damaged &&
+              !decoder.unknown;
+    // the dropped count stands first, then the newest records in order
+    size_t dropped = 0;
+    size_t count = 0;
+    int used = 0;
+    size_t first = 1;
+    // a record of only a number would match the count up to the words
+    if(ok && (got.size() > 1) && (sscanf(got[1].c_str(), "%zu records dropped%n", &count, &used) == 1) &&
+       (used == (int)got[1].size())) {
+      dropped = count;
+      first = 2;
+    }
+    ok = ok && (dropped <= expect.size()) && (got.size() - first == expect.size() - dropped) &&
+         std::equal(got.begin() + first, got.end(), expect.begin() + dropped);
+    if(!ok && (failed++ < 5)) {
+      printf("mismatch in run %d, %zu records, %zu lines decoded\n", i, expect.size(), got.size());
+    }
+  }
+  printf("ring, flush in pieces, decode: %d runs, %zu records, %d failed\n", iterations, records, failed);
+  printf("uart bytes per record: text %.1f, records %.1f\n", (double)text_bytes / records, (double)bin_bytes / records);
+
+  // the cost at the call site, the text version formats and would still have to wait for the uart
+  const int calls = 1000000;
+  char buf[96];
+  log_ring.clear();
+  double start = nowUs();
+  for(int i = 0; i < calls; ++i) {
+    DLOG_AT(log_ring, DLOG_INFO, "scan ok: %d APs", i & 63);
+    DLOG_AT(log_ring, DLOG_INFO, "broker %u.%u.%u.%u%s", 192, 168, 1, i & 0xff, " cached");
+  }
+  double ring_ns = (nowUs() - start) * 1000.0 / (2.0 * calls);
+  start = nowUs();
+  for(int i = 0; i < calls; ++i) {
+    sink = sink + snprintf(buf, sizeof(buf), "%d scan ok: %d APs\r\n", i, i & 63);
+    sink = sink + snprintf(buf, sizeof(buf), "%d broker %u.%u.%u.%u%s\r\n", i, 192, 168, 1, i & 0xff, " cached");
+  }
+  double text_ns = (nowUs() - start) * 1000.0 / (2.0 * calls);
+  printf("ns per call (host cpu): ring %.1f, snprintf %.1f plus %.0f us of uart per line once the fifo is full\n",
+         ring_ns, text_ns, 1000.0 * (text_bytes / (double)records) / 11.52);
+  return failed ? 1 : 0;
+}
+
+}
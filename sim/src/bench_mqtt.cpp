@@ -0,0 +1,58 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "bench.h"
+#include "sim.h"
+
+namespace sim {
+
+static const char* modes[] = {"qos1", "qos0", "pipe"};
+
+// the wake cycle simulation with one delivery mode, its table goes to /dev/null
+static RunStats runMode(const Scenario &s, const char* mode, uint32_t cycles) {
+  RunStats stats{};
+  Options options;
+  options.cycles = cycles;
+  options.config.push_back(std::string("deliver ") + mode);
+  options.stats = &stats;
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  FILE* null = fopen("/dev/null", "w");
+  dup2(fileno(null), STDOUT_FILENO);
+  run(s, options);
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  fclose(null);
+  return stats;
+}
+
+// time from mqtt connect to deep sleep per delivery mode, against the broker stand-in of the
+// simulation, for a fast and a slow broker
+int benchMqtt(int argc, char** argv) {
+  uint32_t cycles = 6;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-n") && (i + 1 < argc)) {
+      cycles = atoi(argv[++i]);
+    }
+  }
+  printf("%-7s %7s %7s %12s %9s %7s\n", "mode", "puback", "tcpack", "connect-sleep", "awake", "bytes");
+  for(uint32_t puback : {45u, 250u}) {
+    for(const char* mode : modes) {
+      Scenario s = makeScenario("ok");
+      s.puback_ms = puback;
+      s.tcp_ack_ms = 20;
+      RunStats st = runMode(s, mode, cycles);
+      if(!st.sends) {
+        printf("%-7s no wake reached the broker\n", mode);
+        return 1;
+      }
+      printf("%-7s %7u %7u %12.0f %9.0f %7.0f\n", mode, s.puback_ms, s.tcp_ack_ms, st.connect_to_sleep_ms,
+             st.awake_ms, st.bytes);
+    }
+  }
+  return 0;
+}
+
+}
@@ -0,0 +1,123 @@
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <cstdlib>
+#include "bench.h"
+#include "payload.h"
+#include "sim.h"
+
+namespace sim {
+
+// the scan result and status the way the firmware sees them
+struct BenchAp {
+  char ssid[33];
+  uint8_t bssid[6];
+  int8_t rssi;
+  uint8_t channel;
+};
+
+static std::vector<BenchAp> makeAps(int count) {
+  static const char* ssids[] = {"s1", "s2", "FRITZ!Box 7590 XY", "guest", "kingnet", "DIRECT-3F-HP M479"};
+  std::vector<BenchAp> aps(count);
+  for(int i = 0; i < count; ++i) {
+    BenchAp &ap = aps[i];
+    snprintf(ap.ssid, sizeof(ap.ssid), "%s", ssids[i % 6]);
+    uint8_t bssid[6] = {0xf4, 0xe2, 0x10, 0x20, (uint8_t)(i >> 8), (uint8_t)i};
+    memcpy(ap.bssid, bssid, 6);
+    ap.rssi = -50 - (i * 7) % 45;
+    ap.channel = 1 + (i * 5) % 13;
+  }
+  return aps;
+}
+
+static String bssidStr(const uint8_t* b) {
+  char str[18];
+  snprintf(str, sizeof(str), "%02X:%02X:%02X:%02X:%02X:%02X", b[0], b[1], b[2], b[3], b[4], b[5]);
+  return String(str);
+}
+
+static volatile size_t sink;
+
+// what the firmware did before: fill a JsonDocument during the scan, serialize it
+// into a String on connect and once more pretty printed for the debug output
+static size_t viaArduinoJson(const std::vector<BenchAp> &aps) {
+  JsonDocument ap_list;
+  for(size_t i = 0; i < aps.size(); ++i) {
+    ap_list["ap"][i]["ssid"] = String(aps[i].ssid);
+    ap_list["ap"][i]["bssid"] = bssidStr(aps[i].bssid);
+    ap_list["ap"][i]["rssi"] = aps[i].rssi;
+    ap_list["ap"][i]["channel"] = aps[i].channel;
+  }
+  String output;
+  ap_list["voltage"] = 4.106757f;
+  ap_list["button_ct"] = 0;
+  ap_list["id"] = 1;
+  ap_list["wifi_fail"] = 0;
+  ap_list["mqtt_fail"] = 0;
+  ap_list["send_cause"] = 132;
+  ap_list["runtime"] = 11111;
+  serializeJson(ap_list, output);
+  size_t len = output.length();
+  #ifdef DEBUG
+  serializeJsonPretty(ap_list, output);
+  #endif
+  sink = output.length();
+  return len;
+}
+
+static payload_t payload;
+static char payload_buf[PAYLOAD_SIZE];
+
+static size_t viaPayload(const std::vector<BenchAp> &aps) {
+  payload_clear(&payload);
+  for(auto &ap : aps) {
+    payload_add_ap(&payload, ap.ssid, ap.bssid, ap.rssi, ap.channel);
+  }
+  payload.voltage = 4.106757f;
+  payload.button_ct = 0;
+  payload.id = 1;
+  payload.wifi_fail = 0;
+  payload.mqtt_fail = 0;
+  payload.send_cause = 132;
+  payload.runtime = 11111;
+  size_t len = payload_to_json(&payload, payload_buf, sizeof(payload_buf));
+  sink = len;
+  return len;
+}
+
+template <typename F>
+static void measure(const char* name, int iterations, F fn) {
+  // one pass for heap numbers, then the timed loop
+  heapReset();
+  HeapStats before = heapStats();
+  size_t len = fn();
+  HeapStats after = heapStats();
+  double start = nowUs();
+  for(int i = 0; i < iterations; ++i) {
+    fn();
+  }
+  double us = (nowUs() - start) / iterations;
+  printf("%-14s %9.2f %9zu %10zu %7zu\n", name, us, after.allocs, after.peak - before.current, len);
+}
+
+int benchPayload(int argc, char** argv) {
+  int iterations = 20000;
+  int ap_ct = 12;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-n") && (i + 1 < argc)) {
+      iterations = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-a") && (i + 1 < argc)) {
+      ap_ct = atoi(argv[++i]);
+    }
+  }
+  if(ap_ct > PAYLOAD_MAX_APS) {
+    ap_ct = PAYLOAD_MAX_APS;
+  }
+  std::vector<BenchAp> aps = makeAps(ap_ct);
+  printf("payload with %d APs, %d iterations (host cpu, compare the ratio)\n", ap_ct, iterations);
+  printf("%-14s %9s %9s %10s %7s\n", "", "us/msg", "allocs", "peak heap", "bytes");
+  measure("ArduinoJson", iterations, [&] { return viaArduinoJson(aps); });
+  measure("fixed buffer", iterations, [&] { return viaPayload(aps); });
+  return 0;
+}
+
+}
@@ -0,0 +1,107 @@
+#include <Arduino.h>
+#include <cstdlib>
+#include <random>
+#include "bench.h"
+#include "energy.h"
+#include "sleep_planner.h"
+
+namespace sim {
+
+#define INTERVAL 600
+#define RETRY 30
+
+static int failed = 0;
+
+static void expect(bool ok, const char* what, uint32_t got) {
+  if(!ok && (failed++ < 10)) {
+    printf("%s: got %u\n", what, got);
+  }
+}
+
+static void checks(std::mt19937 &rnd) {
+  sleep_state_t state = {};
+  SLEEP_PLANNER plan(&state);
+  sleep_config_t cfg = {3600, 20, 0, 0, 0};
+  plan.begin(cfg, INTERVAL, RETRY);
+  expect(plan.next(false, 100, -1, rnd()) == INTERVAL, "send ok", state.planned);
+
+  // doubling with +-25%, capped, never below retry
+  for(int f = 1; f <= 20; ++f) {
+    plan.sent(false);
+    uint32_t base = std::min<uint64_t>((uint64_t)RETRY << std::min(f - 1, 30), 3600);
+    for(int i = 0; i < 1000; ++i) {
+      uint32_t s = plan.next(true, 100, -1, rnd());
+      expect((s >= std::max<uint32_t>(RETRY, base - base / 4)) && (s <= base + base / 4), "backoff", s);
+    }
+  }
+  plan.sent(true);
+  expect(plan.fails() == 0, "send ok clears the backoff", plan.fails());
+  expect(plan.next(true, 100, -1, rnd()) == RETRY, "retry after a send", state.planned);
+  cfg.retry_max = 0;
+  plan.begin(cfg, INTERVAL, RETRY);
+  plan.sent(false);
+  plan.sent(false);
+  expect(plan.next(true, 100, -1, rnd()) == RETRY, "backoff off", state.planned);
+  plan.sent(true);
+
+  // stretch from 1x at low_pct to 4x when empty
+  expect(plan.next(false, 20, -1, 0) == INTERVAL, "no stretch at low_pct", state.planned);
+  expect(plan.next(false, 10, -1, 0) == INTERVAL * 5 / 2, "stretch at half", state.planned);
+  expect(plan.next(false, 0, -1, 0) == INTERVAL * SLEEP_STRETCH_MAX, "stretch when empty", state.planned);
+  cfg.low_pct = 0;
+  plan.begin(cfg, INTERVAL, RETRY);
+  expect(plan.next(false, 0, -1, 0) == INTERVAL, "stretch off", state.planned);
+
+  // 22-6 local, utc+1
+  cfg = {0, 0, 22, 6, 60};
+  plan.begin(cfg, 3600, RETRY);
+  expect(plan.next(false, 100, 20 * 3600 + 1800, 0) == 30600, "wake in the quiet hours", state.planned);
+  expect(plan.next(false, 100, 19 * 3600, 0) == 3600, "wake before the quiet hours", state.planned);
+  expect(plan.next(false, 100, 5 * 3600, 0) == 3600, "wake after the quiet hours", state.planned);
+  expect(plan.next(false, 100, 4 * 3600, 0) == 3600, "wake at their end", state.planned);
+  expect(plan.next(false, 100, -1, 0) == 3600, "clock not set", state.planned);
+  cfg = {0, 0, 1, 5, 0};
+  plan.begin(cfg, 3600, RETRY);
+  expect(plan.next(false, 100, 0, 0) == 5 * 3600, "window within the day", state.planned);
+  expect(plan.next(false, 100, 4 * 3600, 0) == 3600, "window end", state.planned);
+}
+
+// a device in a dead zone: every wake fails after a scan and the assoc timeout
+static double deadZoneDays(const sleep_config_t &cfg, std::mt19937 &rnd) {
+  const double fail_mah = 3.4 * ENERGY_RADIO_MA / 3600.0;
+  const double sleep_ma = ENERGY_SLEEP_UA / 1000.0;
+  sleep_state_t state = {};
+  SLEEP_PLANNER plan(&state);
+  plan.begin(cfg, INTERVAL, RETRY);
+  double left = ENERGY_CAPACITY_MAH;
+  double sec = 0;
+  while(left > 0) {
+    plan.sent(false);
+    uint32_t s = plan.next(true, (uint8_t)(100.0 * left / ENERGY_CAPACITY_MAH), -1, rnd());
+    left -= fail_mah + sleep_ma * s / 3600.0;
+    sec += s + 3.4;
+  }
+  return sec / SLEEP_DAY;
+}
+
+// planner checks on the host, then battery life of a device that never reaches its ap
+int benchSleep(int argc, char** argv) {
+  unsigned seed = 1;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-s") && (i + 1 < argc)) {
+      seed = atoi(argv[++i]);
+    }
+  }
+  std::mt19937 rnd(seed);
+  failed = 0;
+  checks(rnd);
+  printf("planner checks: %d failed\n", failed);
+  printf("dead zone, %u mAh, %u mA for 3.4 s per failed wake\n", ENERGY_CAPACITY_MAH, ENERGY_RADIO_MA);
+  printf("%-24s %8s\n", "", "days");
+  printf("%-24s %8.1f\n", "fixed retry 30 s", deadZoneDays({0, 0, 0, 0, 0}, rnd));
+  printf("%-24s %8.1f\n", "backoff to 1 h", deadZoneDays({3600, 0, 0, 0, 0}, rnd));
+  printf("%-24s %8.1f\n", "backoff + stretch < 20%", deadZoneDays({3600, 20, 0, 0, 0}, rnd));
+  return failed ? 1 : 0;
+}
+
+}
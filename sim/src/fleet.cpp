@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <vector>
+#include "esp_sleep.h"
+#include "sim_internal.h"
+#include "energy.h"
+
+extern energy_t energy_state;
+
+extern "C" {
+extern uint8_t __start_rtc_sim[] __attribute__((weak));
+extern uint8_t __stop_rtc_sim[] __attribute__((weak));
+}
+
+namespace sim {
+
+#define MINUTE_MS 60000ULL
+
+// one device of the fleet between its wakes, the rtc and nvs images travel through shared
+struct Device {
+  std::vector<uint8_t> rtc;
+  std::vector<uint8_t> nvs;
+  uint64_t wall;                   // ms of the next boot
+  int wakeup_cause;
+  int reset_reason;
+  uint8_t site;                    // the ap it reaches
+  bool provisioned;
+  bool failing;                    // the last wake did not send
+  bool broker_session;
+  bool clock_set;
+};
+
+// broker traffic of one minute
+struct Bin {
+  uint32_t connects;
+  uint32_t refused;
+  uint32_t retries;                // wakes of devices whose last wake did not send
+  uint32_t messages;
+  uint64_t bytes;
+};
+
+// the broker as the fleet sees it: when it is down and what reaches it, in one minute bins
+class FleetBroker {
+public:
+  FleetBroker(uint32_t minutes) : _bins(minutes) {}
+  void outage(uint64_t from_ms, uint64_t len_ms) {
+    _down_from = from_ms;
+    _down_to = from_ms + len_ms;
+  }
+  bool up(uint64_t wall_ms) const { return (wall_ms < _down_from) || (wall_ms >= _down_to); }
+  void record(const WakeReport &r, uint64_t wall_at_boot, bool retry) {
+    int32_t refused = 0;
+    for(int i = 0; i < r.mark_ct; ++i) {
+      refused += (r.marks[i].probe == PROBE_MQTT_CONNECT) - (r.marks[i].probe == PROBE_MQTT_CONNECTED);
+    }
+    if(Bin* b = bin(wall_at_boot)) {
+      b->retries += retry;
+      b->refused += refused;
+    }
+    for(int i = 0; i < r.mark_ct; ++i) {
+      Bin* b = bin(wall_at_boot + r.marks[i].ms);
+      if(!b) {
+        continue;
+      }
+      if(r.marks[i].probe == PROBE_MQTT_CONNECT) {
+        b->connects++;
+      } else if(r.marks[i].probe == PROBE_PUBLISH) {
+        b->messages++;
+        b->bytes += r.publish_bytes / r.publish_ct;
+      }
+    }
+  }
+  const std::vector<Bin> &bins() const { return _bins; }
+private:
+  Bin* bin(uint64_t wall_ms) {
+    uint64_t i = wall_ms / MINUTE_MS;
+    return (i < _bins.size()) ? &_bins[i] : nullptr;
+  }
+  std::vector<Bin> _bins;
+  uint64_t _down_from = 0;
+  uint64_t _down_to = 0;
+};
+
+static void usage() {
+  printf("usage: fleet [-d devices] [-h hours] [-s ok|broker_down|ap_reboot] [-o min+len] [-c \"console cmd\"]... [-t]\n");
+  printf("  -d  devices, powered on spread over the first 10 min (default 1000)\n");
+  printf("  -h  hours of wall time (default 6)\n");
+  printf("  -s  broker_down: broker unreachable for 10 min after 1 h\n");
+  printf("      ap_reboot: the ap of site 0 (every 10th device) gone for 3 min after 1 h\n");
+  printf("  -o  start and length of the outage in min\n");
+  printf("  -c  console command sent to every device on its provisioning boot\n");
+  printf("  -t  traffic per 10 min\n");
+}
+
+// the device firmware thousands of times against one broker on a shared virtual wall clock
+int fleet(int argc, char** argv) {
+  uint32_t device_ct = 1000;
+  uint32_t hours = 6;
+  std::string name = "ok";
+  int32_t down_min = -1;
+  uint32_t down_len = 0;
+  bool table = false;
+  Options options;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-d") && (i + 1 < argc)) {
+      device_ct = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-h") && (i + 1 < argc)) {
+      hours = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-s") && (i + 1 < argc)) {
+      name = argv[++i];
+    } else if(!strcmp(argv[i], "-o") && (i + 1 < argc)) {
+      if(sscanf(argv[++i], "%d+%u", &down_min, &down_len) != 2) {
+        usage();
+        return 2;
+      }
+    } else if(!strcmp(argv[i], "-c") && (i + 1 < argc)) {
+      options.config.push_back(argv[++i]);
+    } else if(!strcmp(argv[i], "-t")) {
+      table = true;
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if(!device_ct || !hours || ((name != "ok") && (name != "broker_down") && (name != "ap_reboot"))) {
+    usage();
+    return 2;
+  }
+  if(down_min < 0) {
+    down_min = 60;
+    down_len = (name == "ap_reboot") ? 3 : 10;
+  }
+  if(!attachShared()) {
+    return 2;
+  }
+  uint64_t end_ms = hours * 60 * MINUTE_MS;
+  uint64_t down_from = down_min * MINUTE_MS;
+  uint64_t down_to = down_from + down_len * MINUTE_MS;
+  FleetBroker broker(hours * 60);
+  if(name == "broker_down") {
+    broker.outage(down_from, down_len * MINUTE_MS);
+  }
+  const Scenario base = makeScenario("ok");
+  std::vector<uint8_t> rtc_power_on(__start_rtc_sim, __stop_rtc_sim);
+  std::mt19937 rnd(1);
+  std::vector<Device> devices(device_ct);
+  using Next = std::pair<uint64_t, uint32_t>;
+  std::priority_queue<Next, std::vector<Next>, std::greater<Next>> queue;
+  for(uint32_t d = 0; d < device_ct; ++d) {
+    Device &dev = devices[d];
+    dev.rtc = rtc_power_on;
+    dev.wall = rnd() % (10 * MINUTE_MS);
+    dev.wakeup_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+    dev.reset_reason = ESP_RST_POWERON;
+    dev.site = d % 10;
+    queue.push({dev.wall, d});
+  }
+
+  printf("fleet of %u devices, %u h, scenario %s", device_ct, hours, name.c_str());
+  if(name != "ok") {
+    printf(", outage %d+%u min", down_min, down_len);
+  }
+  printf("\n");
+  uint64_t wakes = 0;
+  uint64_t sends = 0;
+  uint64_t failed = 0;
+  uint32_t stopped = 0;
+  while(!queue.empty() && (queue.top().first < end_ms)) {
+    uint32_t d = queue.top().second;
+    queue.pop();
+    Device &dev = devices[d];
+    wake = Wake();
+    wake.scenario = base;
+    wake.scenario.broker_up = broker.up(dev.wall);
+    wake.scenario.ap_up = !((name == "ap_reboot") && !dev.site && (dev.wall >= down_from) && (dev.wall < down_to));
+    wake.wall_at_boot = dev.wall + base.boot_ms;
+    wake.wakeup_cause = dev.wakeup_cause;
+    wake.reset_reason = dev.reset_reason;
+    if(!dev.provisioned) {
+      Options o = options;
+      o.config.insert(o.config.begin(), "id " + std::to_string(d + 1));
+      wake.usb = true;
+      provisioningScript(o);
+    }
+    shared->rtc_len = dev.rtc.size();
+    memcpy(shared->rtc, dev.rtc.data(), dev.rtc.size());
+    shared->nvs_len = dev.nvs.size();
+    memcpy(shared->nvs, dev.nvs.data(), dev.nvs.size());
+    shared->broker_session = dev.broker_session;
+    shared->clock_set = dev.clock_set;
+    if(!forkWake(!dev.provisioned)) {
+      fprintf(stderr, "device %u crashed\n", d);
+      return 2;
+    }
+    const WakeReport &r = shared->report;
+    dev.rtc.assign(shared->rtc, shared->rtc + shared->rtc_len);
+    dev.nvs.assign(shared->nvs, shared->nvs + shared->nvs_len);
+    dev.broker_session = shared->broker_session;
+    dev.clock_set = shared->clock_set;
+    if(dev.provisioned) {
+      wakes++;
+      broker.record(r, wake.wall_at_boot, dev.failing);
+      sends += (r.publish_ct > 0);
+      failed += !r.publish_ct;
+      dev.failing = !r.publish_ct;
+    }
+    dev.provisioned = true;
+    dev.wall += base.boot_ms + r.awake_ms;
+    if(r.end == END_RESTART) {
+      dev.wakeup_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+      dev.reset_reason = ESP_RST_SW;
+    } else if((r.end == END_SLEEP) && r.sleep_us) {
+      dev.wakeup_cause = ESP_SLEEP_WAKEUP_TIMER;
+      dev.reset_reason = ESP_RST_DEEPSLEEP;
+      dev.wall += r.sleep_us / 1000ULL;
+    } else {
+      // stuck or sleeping without a wakeup source
+      stopped++;
+      continue;
+    }
+    queue.push({dev.wall, d});
+  }
+
+  const std::vector<Bin> &bins = broker.bins();
+  Bin total = {};
+  uint32_t peak_msg = 0;
+  uint32_t peak_con = 0;
+  uint32_t peak_retry = 0;
+  uint64_t peak_bytes = 0;
+  for(uint32_t m = 0; m < bins.size(); ++m) {
+    const Bin &b = bins[m];
+    total.connects += b.connects;
+    total.refused += b.refused;
+    total.retries += b.retries;
+    total.messages += b.messages;
+    total.bytes += b.bytes;
+    peak_msg = (b.messages > bins[peak_msg].messages) ? m : peak_msg;
+    peak_con = (b.connects > bins[peak_con].connects) ? m : peak_con;
+    peak_retry = (b.retries > bins[peak_retry].retries) ? m : peak_retry;
+    peak_bytes = std::max(peak_bytes, b.bytes);
+  }
+  if(table) {
+    printf("%6s %9s %9s %9s %9s %9s\n", "min", "connects", "refused", "retries", "messages", "B/s");
+    for(uint32_t m = 0; m < bins.size(); m += 10) {
+      Bin s = {};
+      for(uint32_t k = m; (k < m + 10) && (k < bins.size()); ++k) {
+        s.connects += bins[k].connects;
+        s.refused += bins[k].refused;
+        s.retries += bins[k].retries;
+        s.messages += bins[k].messages;
+        s.bytes += bins[k].bytes;
+      }
+      printf("%6u %9u %9u %9u %9u %9.0f\n", m, s.connects, s.refused, s.retries, s.messages, s.bytes / 600.0);
+    }
+  }
+  double sec = hours * 3600.0;
+  double mean_con = (double)total.connects / bins.size();
+  printf("wakes %llu, sent %llu, without send %llu, stopped devices %u\n", (unsigned long long)wakes,
+         (unsigned long long)sends, (unsigned long long)failed, stopped);
+  printf("messages %.2f/s, peak %.2f/s in min %u\n", total.messages / sec, bins[peak_msg].messages / 60.0, peak_msg);
+  printf("bytes per message %.0f\n", total.messages ? (double)total.bytes / total.messages : 0.0);
+  printf("broker ingress %.0f B/s, peak %.0f B/s\n", total.bytes / sec, peak_bytes / 60.0);
+  printf("connects %.1f/min, peak %u in min %u (%.1fx), %u refused\n", mean_con, bins[peak_con].connects, peak_con,
+         mean_con ? bins[peak_con].connects / mean_con : 0.0, total.refused);
+  printf("retry wakes %u, peak %u in min %u\n", total.retries, bins[peak_retry].retries, peak_retry);
+
+  // the firmware energy model as each device's rtc memory left it
+  std::vector<float> per_day;
+  for(const Device &dev : devices) {
+    std::copy(dev.rtc.begin(), dev.rtc.end(), __start_rtc_sim);
+    ENERGY energy(&energy_state);
+    per_day.push_back(energy.mahPerDay());
+  }
+  std::copy(rtc_power_on.begin(), rtc_power_on.end(), __start_rtc_sim);
+  std::sort(per_day.begin(), per_day.end());
+  double sum = 0;
+  for(float v : per_day) {
+    sum += v;
+  }
+  printf("energy per device %.2f mAh/day, p90 %.2f, max %.2f\n", sum / per_day.size(),
+         per_day[per_day.size() * 9 / 10], per_day.back());
+  return 0;
+}
+
+}
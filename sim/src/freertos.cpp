@@ -0,0 +1,80 @@
+#include <Arduino.h>
+#include <esp_pm.h>
+#include <freertos/event_groups.h>
+#include "sim_internal.h"
+
+// event groups and power management on the virtual clock, a wait lets the scripted radio,
+// broker and console go on like the other tasks of the device would
+
+struct EventGroup {
+  EventBits_t bits = 0;
+};
+
+EventGroupHandle_t xEventGroupCreate() {
+  return new EventGroup;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  group->bits |= bits;
+  return group->bits;
+}
+
+BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t group, EventBits_t bits, BaseType_t* woken) {
+  group->bits |= bits;
+  if(woken) {
+    *woken = pdTRUE;
+  }
+  return pdTRUE;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all,
+                                TickType_t ticks) {
+  auto done = [&] { return all ? ((group->bits & bits) == bits) : (group->bits & bits); };
+  uint32_t start = sim::now();
+  while(!done() && (sim::now() - start < ticks)) {
+    sim::advance(1);
+  }
+  sim::report().wait_ms += sim::now() - start;
+  EventBits_t result = group->bits;
+  if(clear && done()) {
+    group->bits &= ~bits;
+  }
+  return result;
+}
+
+static void pmClock() {
+  if(sim::wake.pm_max_mhz) {
+    sim::wake.cpu_mhz = sim::wake.pm_locks ? sim::wake.pm_max_mhz : sim::wake.pm_min_mhz;
+  }
+}
+
+esp_err_t esp_pm_configure(const void* config) {
+  const esp_pm_config_t* pm = static_cast<const esp_pm_config_t*>(config);
+  sim::wake.light_sleep = pm->light_sleep_enable;
+  sim::wake.pm_max_mhz = pm->max_freq_mhz;
+  sim::wake.pm_min_mhz = pm->min_freq_mhz;
+  pmClock();
+  return ESP_OK;
+}
+
+// one lock type is enough for the firmware, the handle only has to be distinct from nullptr
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg, const char* name, esp_pm_lock_handle_t* out_handle) {
+  static int lock;
+  *out_handle = (lock_type == ESP_PM_CPU_FREQ_MAX) ? (esp_pm_lock_handle_t)&lock : nullptr;
+  return *out_handle ? ESP_OK : ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle) {
+  sim::wake.pm_locks++;
+  pmClock();
+  return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle) {
+  if(!sim::wake.pm_locks) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  sim::wake.pm_locks--;
+  pmClock();
+  return ESP_OK;
+}
@@ -0,0 +1,94 @@
+#include <cstddef>
+#include <malloc.h>
+#include "sim.h"
+
+// glibc exports its allocator under these names, wrapping them lets the
+// benchmarks see every allocation including the ones of the libraries
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+static size_t heap_current = 0;
+static size_t heap_peak = 0;
+static size_t heap_allocs = 0;
+
+static void* track(void* ptr) {
+  if(ptr) {
+    heap_current += malloc_usable_size(ptr);
+    heap_allocs++;
+    if(heap_current > heap_peak) {
+      heap_peak = heap_current;
+    }
+  }
+  return ptr;
+}
+
+static void untrack(void* ptr) {
+  if(ptr) {
+    heap_current -= malloc_usable_size(ptr);
+  }
+}
+
+extern "C" {
+
+void* malloc(size_t size) {
+  return track(__libc_malloc(size));
+}
+
+void* calloc(size_t n, size_t size) {
+  return track(__libc_calloc(n, size));
+}
+
+void* realloc(void* ptr, size_t size) {
+  untrack(ptr);
+  void* p = __libc_realloc(ptr, size);
+  if(!p && size) {
+    // old block is still valid
+    track(ptr);
+    heap_allocs--;
+    return p;
+  }
+  return track(p);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  return track(__libc_memalign(alignment, size));
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  return track(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+  void* p = track(__libc_memalign(alignment, size));
+  if(!p) {
+    return 12;  // ENOMEM
+  }
+  *memptr = p;
+  return 0;
+}
+
+void free(void* ptr) {
+  untrack(ptr);
+  __libc_free(ptr);
+}
+
+}
+
+namespace sim {
+
+void heapReset() {
+  heap_peak = heap_current;
+  heap_allocs = 0;
+}
+
+HeapStats heapStats() {
+  return {heap_current, heap_peak, heap_allocs};
+}
+
+}
@@ -0,0 +1,218 @@
+#include "logdump.h"
+#include <cstring>
+#include <map>
+#include "config.h"
+
+extern "C" {
+extern const dlog_format_t __start_dlog_formats[] __attribute__((weak));
+extern const dlog_format_t __stop_dlog_formats[] __attribute__((weak));
+}
+
+namespace sim {
+
+const std::vector<const dlog_format_t*>& logFormats() {
+  static std::vector<const dlog_format_t*> formats;
+  if(formats.empty()) {
+    for(const dlog_format_t* f = __start_dlog_formats; f < __stop_dlog_formats; ++f) {
+      formats.push_back(f);
+    }
+  }
+  return formats;
+}
+
+const dlog_format_t* logFormat(uint16_t id) {
+  static std::map<uint16_t, const dlog_format_t*> by_id;
+  if(by_id.empty()) {
+    for(const dlog_format_t* f : logFormats()) {
+      by_id.emplace(f->id, f);
+    }
+  }
+  auto it = by_id.find(id);
+  return (it == by_id.end()) ? nullptr : it->second;
+}
+
+std::vector<uint16_t> logCollisions() {
+  std::vector<uint16_t> ids;
+  for(const dlog_format_t* f : logFormats()) {
+    const dlog_format_t* first = logFormat(f->id);
+    if(strcmp(first->fmt, f->fmt) && (ids.empty() || (ids.back() != f->id))) {
+      ids.push_back(f->id);
+    }
+  }
+  return ids;
+}
+
+std::string logText(const char* fmt, const uint8_t* args, size_t len) {
+  std::string out;
+  size_t pos = 0;
+  char buf[128];
+  while(*fmt) {
+    if(*fmt != '%') {
+      out += *fmt++;
+      continue;
+    }
+    if(fmt[1] == '%') {
+      out += '%';
+      fmt += 2;
+      continue;
+    }
+    // flags, width and precision stay, the length modifiers go, every integer came as 32 bit
+    std::string spec = "%";
+    const char* p = fmt + 1;
+    while(*p && strchr("-+ #0123456789.", *p)) {
+      spec += *p++;
+    }
+    while(*p && strchr("hlLqjzt", *p)) {
+      p++;
+    }
+    char conv = *p;
+    fmt = *p ? p + 1 : p;
+    spec += conv;
+    if(conv == 's') {
+      size_t n = (pos < len) ? args[pos] : 0;
+      if((pos >= len) || (pos + 1 + n > len)) {
+        out += '?';
+        pos = len;
+        continue;
+      }
+      std::string s((const char*)args + pos + 1, n);
+      pos += 1 + n;
+      snprintf(buf, sizeof(buf), spec.c_str(), s.c_str());
+    } else {
+      if(pos + 4 > len) {
+        out += '?';
+        pos = len;
+        continue;
+      }
+      uint32_t u;
+      memcpy(&u, args + pos, 4);
+      pos += 4;
+      if(strchr("fFeEgGaA", conv)) {
+        float f;
+        memcpy(&f, &u, 4);
+        snprintf(buf, sizeof(buf), spec.c_str(), (double)f);
+      } else if(strchr("dic", conv)) {
+        snprintf(buf, sizeof(buf), spec.c_str(), (int32_t)u);
+      } else {
+        snprintf(buf, sizeof(buf), spec.c_str(), u);
+      }
+    }
+    out += buf;
+  }
+  return out;
+}
+
+void LogDecoder::feed(const uint8_t* data, size_t len, FILE* out) {
+  for(size_t i = 0; i < len; ++i) {
+    uint8_t c = data[i];
+    switch(_state) {
+      case TEXT:
+        if(c == DLOG_BLOCK_MAGIC0) {
+          _state = MAGIC;
+        } else {
+          fputc(c, out);
+        }
+        break;
+      case MAGIC:
+        if(c == DLOG_BLOCK_MAGIC1) {
+          _state = LEN;
+        } else {
+          fputc(DLOG_BLOCK_MAGIC0, out);
+          _state = TEXT;
+          i--;
+        }
+        break;
+      case LEN:
+        _body.clear();
+        _need = c + 2;
+        _state = BODY;
+        break;
+      case BODY:
+        _body.push_back(c);
+        if(_body.size() == _need) {
+          block(out);
+          _state = TEXT;
+        }
+        break;
+    }
+  }
+}
+
+void LogDecoder::block(FILE* out) {
+  size_t len = _body.size() - 2;
+  uint16_t crc = _body[len] | (_body[len + 1] << 8);
+  if(config_crc(_body.data(), len) != crc) {
+    damaged++;
+    fprintf(out, "[damaged log block, %zu bytes]\n", len);
+    return;
+  }
+  const uint8_t* p = _body.data();
+  const uint8_t* end = p + len;
+  while(end - p >= DLOG_HEADER) {
+    uint16_t id = p[0] | (p[1] << 8);
+    uint32_t ms = p[2] | (p[3] << 8) | (p[4] << 16) | ((uint32_t)p[5] << 24);
+    size_t n = p[6];
+    const uint8_t* args = p + DLOG_HEADER;
+    if(args + n > end) {
+      break;
+    }
+    p = args + n;
+    records++;
+    const dlog_format_t* f = logFormat(id);
+    if(id == DLOG_ID_DROPPED) {
+      fprintf(out, "%7u  %s\n", ms, logText("%u records dropped", args, n).c_str());
+    } else if(f) {
+      fprintf(out, "%7u  %s\n", ms, logText(f->fmt, args, n).c_str());
+    } else {
+      unknown++;
+      fprintf(out, "%7u  [format %04x unknown, %zu bytes]\n", ms, id, n);
+    }
+  }
+}
+
+int logdump(int argc, char** argv) {
+  const char* path = nullptr;
+  bool list = false;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-l")) {
+      list = true;
+    } else if(argv[i][0] != '-') {
+      path = argv[i];
+    } else {
+      printf("usage: logdump [capture] [-l]\n");
+      printf("  decodes the log blocks of a debug uart capture (stdin without a file)\n");
+      printf("  -l  lists the format strings of this build\n");
+      return 2;
+    }
+  }
+  if(list) {
+    static const char* levels[] = {"", "error", "warn", "info", "debug"};
+    for(const dlog_format_t* f : logFormats()) {
+      printf("%04x %-5s \"%s\"\n", f->id, (f->level <= DLOG_DEBUG) ? levels[f->level] : "?", f->fmt);
+    }
+    std::vector<uint16_t> clash = logCollisions();
+    for(uint16_t id : clash) {
+      printf("id %04x used by two format strings\n", id);
+    }
+    return clash.empty() ? 0 : 1;
+  }
+  FILE* in = path ? fopen(path, "rb") : stdin;
+  if(!in) {
+    perror(path);
+    return 1;
+  }
+  LogDecoder decoder;
+  uint8_t buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    decoder.feed(buf, n, stdout);
+  }
+  if(path) {
+    fclose(in);
+  }
+  fprintf(stderr, "%zu records, %zu damaged blocks, %zu of unknown format\n", decoder.records, decoder.damaged,
+          decoder.unknown);
+  return decoder.damaged ? 1 : 0;
+}
+
+}
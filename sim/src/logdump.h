@@ -0,0 +1,39 @@
+#ifndef SIM_LOGDUMP_H
+#define SIM_LOGDUMP_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "dlog.h"
+
+namespace sim {
+
+// the format strings of every call site in this build, from the dlog_formats section
+const std::vector<const dlog_format_t*>& logFormats();
+const dlog_format_t* logFormat(uint16_t id);
+// ids used by two different format strings
+std::vector<uint16_t> logCollisions();
+// the text of one record, printf applied to the raw arguments
+std::string logText(const char* fmt, const uint8_t* args, size_t len);
+
+// turns the blocks of a debug uart capture back into lines, other bytes pass through
+class LogDecoder {
+public:
+  void feed(const uint8_t* data, size_t len, FILE* out);
+  size_t records = 0;
+  size_t damaged = 0;      // blocks with a bad crc
+  size_t unknown = 0;      // records of a format this build does not know
+private:
+  void block(FILE* out);
+  enum { TEXT, MAGIC, LEN, BODY } _state = TEXT;
+  std::vector<uint8_t> _body;
+  size_t _need = 0;
+};
+
+// "program logdump [capture] [-l]"
+int logdump(int argc, char** argv);
+
+}
+
+#endif
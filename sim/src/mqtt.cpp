@@ -0,0 +1,103 @@
+#include <AsyncMqttClient.h>
+#include <WiFi.h>
+#include "sim_internal.h"
+
+AsyncMqttClient& AsyncMqttClient::setServer(IPAddress ip, uint16_t port) {
+  _ip = ip;
+  _host = nullptr;
+  _port = port;
+  return *this;
+}
+
+AsyncMqttClient& AsyncMqttClient::setServer(const char* host, uint16_t port) {
+  _host = host;
+  _port = port;
+  return *this;
+}
+
+void AsyncMqttClient::connect() {
+  if(_connected || _connecting) {
+    return;
+  }
+  _connecting = true;
+  uint32_t gen = ++_generation;
+  sim::mark(sim::PROBE_MQTT_CONNECT);
+  bool reachable = WiFi.isConnected() && sim::scenario().broker_up;
+  uint32_t connect_ms = sim::scenario().mqtt_connect_ms + sim::cpuMs(sim::scenario().tls_cpu_ms);
+  IPAddress ip = _ip;
+  if(_host && !ip.fromString(_host)) {
+    // the client resolves a name before the tcp connect
+    connect_ms += sim::scenario().dns_ms;
+    ip = strcmp(_host, sim::broker_host) ? 0 : sim::broker_ip;
+  }
+  reachable &= ((uint32_t)ip == sim::broker_ip);
+  sim::at(WiFi.isConnected() ? connect_ms : 0, [this, gen, reachable] {
+    if(gen != _generation) {
+      return;
+    }
+    _connecting = false;
+    if(reachable && WiFi.isConnected()) {
+      _connected = true;
+      sim::mark(sim::PROBE_MQTT_CONNECTED);
+      bool session = !_cleanSession && sim::shared->broker_session;
+      sim::shared->broker_session = !_cleanSession;
+      if(_onConnect) {
+        _onConnect(session);
+      }
+    } else if(_onDisconnect) {
+      _onDisconnect(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+    }
+  });
+}
+
+void AsyncMqttClient::disconnect(bool force) {
+  bool was_connected = _connected || _connecting;
+  // a clean close sends DISCONNECT behind the queued data and ends once tcp has all of it acked
+  uint32_t close_ms = (_connected && !force) ? sim::scenario().tcp_ack_ms : 1;
+  _connected = false;
+  _connecting = false;
+  _generation++;
+  if(was_connected && _onDisconnect) {
+    sim::at(close_ms, [this] {
+      _onDisconnect(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+    });
+  }
+}
+
+uint16_t AsyncMqttClient::publish(const char* topic, uint8_t qos, bool retain, const char* payload,
+                                  size_t length, bool dup, uint16_t message_id) {
+  if(!_connected) {
+    return 0;
+  }
+  if(payload && !length) {
+    length = strlen(payload);
+  }
+  sim::WakeReport& r = sim::report();
+  size_t remaining = 2 + strlen(topic) + (qos ? 2 : 0) + length;
+  size_t header = 2 + (remaining > 127) + (remaining > 16383);
+  r.publish_ct++;
+  r.publish_bytes += header + remaining;
+  r.payload_len = std::min(length, (size_t)sim::WakeReport::MAX_PAYLOAD);
+  if(payload) {
+    memcpy(r.payload, payload, r.payload_len);
+  }
+  sim::mark(sim::PROBE_PUBLISH, qos);
+  if(!qos) {
+    return 1;
+  }
+  uint16_t id = _nextPacketId++;
+  if(!_nextPacketId) {
+    _nextPacketId = 1;
+  }
+  uint32_t gen = _generation;
+  sim::at(sim::scenario().puback_ms, [this, gen, id] {
+    if(gen != _generation) {
+      return;
+    }
+    sim::mark(sim::PROBE_PUBACK, id);
+    if(_onPublish) {
+      _onPublish(id);
+    }
+  });
+  return id;
+}
@@ -0,0 +1,115 @@
+#include <Preferences.h>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "sim_internal.h"
+
+typedef std::map<std::string, std::vector<uint8_t>> Namespace;
+static std::map<std::string, Namespace> nvs;
+
+bool Preferences::begin(const char* name, bool readOnly, const char* partition_label) {
+  if(_started || !name || (strlen(name) >= sizeof(_name))) {
+    return false;
+  }
+  if(readOnly && !nvs.count(name)) {
+    return false;
+  }
+  strcpy(_name, name);
+  nvs[_name];
+  _readOnly = readOnly;
+  _started = true;
+  return true;
+}
+
+void Preferences::end() {
+  _started = false;
+}
+
+bool Preferences::clear() {
+  if(!_started || _readOnly) {
+    return false;
+  }
+  nvs[_name].clear();
+  return true;
+}
+
+bool Preferences::remove(const char* key) {
+  if(!_started || _readOnly) {
+    return false;
+  }
+  return nvs[_name].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char* key) {
+  return _started && nvs[_name].count(key);
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t len) {
+  if(!_started || _readOnly || !key || !value || !len) {
+    return 0;
+  }
+  auto p = static_cast<const uint8_t*>(value);
+  nvs[_name][key].assign(p, p + len);
+  return len;
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+  if(!_started || !nvs[_name].count(key)) {
+    return 0;
+  }
+  return nvs[_name][key].size();
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+  size_t len = getBytesLength(key);
+  if(!len || !buf || (len > maxLen)) {
+    return 0;
+  }
+  memcpy(buf, nvs[_name][key].data(), len);
+  return len;
+}
+
+namespace sim {
+
+// flat dump: name\0 key\0 u32 len, bytes ... per entry
+
+size_t nvsSave(uint8_t* buf, size_t max_len) {
+  size_t pos = 0;
+  for(auto& ns : nvs) {
+    for(auto& entry : ns.second) {
+      size_t need = ns.first.size() + entry.first.size() + 2 + 4 + entry.second.size();
+      if(pos + need > max_len) {
+        return pos;
+      }
+      memcpy(buf + pos, ns.first.c_str(), ns.first.size() + 1);
+      pos += ns.first.size() + 1;
+      memcpy(buf + pos, entry.first.c_str(), entry.first.size() + 1);
+      pos += entry.first.size() + 1;
+      uint32_t len = entry.second.size();
+      memcpy(buf + pos, &len, 4);
+      pos += 4;
+      memcpy(buf + pos, entry.second.data(), len);
+      pos += len;
+    }
+  }
+  return pos;
+}
+
+void nvsLoad(const uint8_t* buf, size_t len) {
+  nvs.clear();
+  size_t pos = 0;
+  while(pos < len) {
+    std::string name((const char*)buf + pos);
+    pos += name.size() + 1;
+    std::string key((const char*)buf + pos);
+    pos += key.size() + 1;
+    uint32_t vlen;
+    memcpy(&vlen, buf + pos, 4);
+    pos += 4;
+    nvs[name][key].assign(buf + pos, buf + pos + vlen);
+    pos += vlen;
+  }
+}
+
+}
@@ -0,0 +1,214 @@
+#include "provision.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "cmd_processor.h"
+
+namespace sim {
+
+bool ProvisionClient::start(const std::vector<std::string>& lines) {
+  char buf[CMD_FRAME_MAX + 2];
+  _frames.clear();
+  _errors.clear();
+  _acked = 0;
+  _resent = 0;
+  _bytes = 0;
+  _ready = false;
+  _leaving = false;
+  _left = false;
+  for(const auto& line : lines) {
+    size_t len = cmd_frame(buf, sizeof(buf), _frames.size(), line.c_str());
+    if(!len || (_frames.size() >= 0xffff)) {
+      return false;
+    }
+    _frames.emplace_back(buf, len);
+  }
+  // the burst follows the enter sequence right away, the device cuts frames out of its ring
+  _send(CMD_MACHINE_ENTER, strlen(CMD_MACHINE_ENTER));
+  _bytes += strlen(CMD_MACHINE_ENTER);
+  sendFrom(0);
+  return true;
+}
+
+void ProvisionClient::sendFrom(size_t seq) {
+  std::string burst;
+  for(size_t i = seq; i < _frames.size(); ++i) {
+    burst += _frames[i];
+  }
+  _send(burst.data(), burst.size());
+  _bytes += burst.size();
+}
+
+bool ProvisionClient::reply(const char* line) {
+  unsigned n;
+  if(sscanf(line, "#ack %u", &n) == 1) {
+    _ready = true;
+    if((n > _acked) && (n <= _frames.size())) {
+      _acked = n;
+    }
+  } else if(sscanf(line, "#nak %u", &n) == 1) {
+    // the device drops everything after a gap, send the rest again
+    if((n >= _acked) && (n < _frames.size())) {
+      _acked = n;
+      _resent += _frames.size() - n;
+      sendFrom(n);
+    }
+  } else if(sscanf(line, "#err %u", &n) == 1) {
+    _errors.push_back(n);
+  } else if(!strcmp(line, "#end")) {
+    _left = _leaving;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void ProvisionClient::timeout() {
+  if(_leaving) {
+    finish();
+    return;
+  }
+  if(!_ready) {
+    // enter sequence lost or nothing came back, the device starts over at 0 and so do we
+    _send(CMD_MACHINE_ENTER, strlen(CMD_MACHINE_ENTER));
+    _bytes += strlen(CMD_MACHINE_ENTER);
+    _acked = 0;
+  }
+  if(!done()) {
+    _resent += _frames.size() - _acked;
+    sendFrom(_acked);
+  }
+}
+
+void ProvisionClient::finish() {
+  _leaving = true;
+  _send(CMD_MACHINE_LEAVE, strlen(CMD_MACHINE_LEAVE));
+  _bytes += strlen(CMD_MACHINE_LEAVE);
+}
+
+std::vector<std::string> readProvisionFile(const char* path) {
+  std::vector<std::string> lines;
+  FILE* f = fopen(path, "r");
+  if(!f) {
+    perror(path);
+    return lines;
+  }
+  char buf[256];
+  while(fgets(buf, sizeof(buf), f)) {
+    buf[strcspn(buf, "\r\n")] = '\0';
+    const char* line = buf + strspn(buf, " \t");
+    if(*line && (*line != '#')) {
+      lines.push_back(line);
+    }
+  }
+  fclose(f);
+  if(!lines.empty() && (lines.back() != "save")) {
+    lines.push_back("save");
+  }
+  return lines;
+}
+
+static bool openPort(const char* port, int& fd) {
+  fd = open(port, O_RDWR | O_NOCTTY);
+  if(fd < 0) {
+    perror(port);
+    return false;
+  }
+  termios tio;
+  if(tcgetattr(fd, &tio)) {
+    perror(port);
+    close(fd);
+    return false;
+  }
+  cfmakeraw(&tio);
+  cfsetspeed(&tio, B115200);
+  tcsetattr(fd, TCSANOW, &tio);
+  tcflush(fd, TCIOFLUSH);
+  return true;
+}
+
+int provision(int argc, char** argv) {
+  const char* path = nullptr;
+  const char* port = nullptr;
+  int wait_ms = 2000;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-p") && (i + 1 < argc)) {
+      port = argv[++i];
+    } else if(!strcmp(argv[i], "-w") && (i + 1 < argc)) {
+      wait_ms = atoi(argv[++i]);
+    } else if(argv[i][0] != '-') {
+      path = argv[i];
+    } else {
+      path = nullptr;
+      break;
+    }
+  }
+  if(!path || !port) {
+    printf("usage: provision <config file> -p <port> [-w ms]\n");
+    printf("  sends the console commands of the file in machine mode, \"save\" last\n");
+    printf("  -w  silence until frames are sent again (default 2000)\n");
+    return 2;
+  }
+  std::vector<std::string> lines = readProvisionFile(path);
+  if(lines.empty()) {
+    return 1;
+  }
+  int fd;
+  if(!openPort(port, fd)) {
+    return 1;
+  }
+  ProvisionClient client([fd](const char* data, size_t len) {
+    while(len) {
+      ssize_t n = write(fd, data, len);
+      if(n <= 0) {
+        perror("write");
+        return;
+      }
+      data += n;
+      len -= n;
+    }
+  });
+  if(!client.start(lines)) {
+    printf("a line is longer than %d chars\n", CMD_LINE_MAX - 1);
+    close(fd);
+    return 1;
+  }
+  std::string in;
+  int silent = 0;
+  while(!client.left() && (silent < 5)) {
+    if(client.done() && !client.leaving()) {
+      client.finish();
+    }
+    pollfd p = {fd, POLLIN, 0};
+    char buf[256];
+    ssize_t n = (poll(&p, 1, wait_ms) > 0) ? read(fd, buf, sizeof(buf)) : 0;
+    if(n <= 0) {
+      silent++;
+      client.timeout();
+      continue;
+    }
+    silent = 0;
+    in.append(buf, n);
+    size_t eol;
+    while((eol = in.find_first_of("\r\n")) != std::string::npos) {
+      std::string line = in.substr(0, eol);
+      in.erase(0, eol + 1);
+      if(!line.empty() && !client.reply(line.c_str())) {
+        printf("  %s\n", line.c_str());
+      }
+    }
+  }
+  close(fd);
+  for(uint16_t seq : client.errors()) {
+    printf("failed: %s\n", lines[seq].c_str());
+  }
+  printf("%zu of %zu commands done, %zu errors, %zu frames resent, %zu bytes sent\n", client.acked(), lines.size(),
+         client.errors().size(), client.resent(), client.bytes());
+  return (client.done() && client.errors().empty()) ? 0 : 1;
+}
+
+}
@@ -0,0 +1,51 @@
+#ifndef SIM_PROVISION_H
+#define SIM_PROVISION_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace sim {
+
+// host end of the console machine mode: all frames in one burst, go back to the first
+// frame the device naks or, after a silence, to the first one not acked
+class ProvisionClient {
+public:
+  explicit ProvisionClient(std::function<void(const char* data, size_t len)> send) : _send(send) {}
+  // enters machine mode and sends every line, false if a line is too long for a frame
+  bool start(const std::vector<std::string>& lines);
+  // a line the device printed, false if it is command output and not a reply
+  bool reply(const char* line);
+  // nothing heard for a while
+  void timeout();
+  // leaves machine mode once all frames are done, timeout() sends it again
+  void finish();
+  bool done() const { return _acked == _frames.size(); }
+  bool leaving() const { return _leaving; }
+  bool left() const { return _left; }
+  size_t acked() const { return _acked; }
+  const std::vector<uint16_t>& errors() const { return _errors; }
+  size_t resent() const { return _resent; }
+  size_t bytes() const { return _bytes; }
+private:
+  void sendFrom(size_t seq);
+  std::function<void(const char* data, size_t len)> _send;
+  std::vector<std::string> _frames;
+  std::vector<uint16_t> _errors;
+  size_t _acked = 0;
+  size_t _resent = 0;
+  size_t _bytes = 0;
+  bool _ready = false;
+  bool _leaving = false;
+  bool _left = false;
+};
+
+// lines of a config file, comments and blank lines dropped, "save" added if missing
+std::vector<std::string> readProvisionFile(const char* path);
+// "program provision <file> -p <port>"
+int provision(int argc, char** argv);
+
+}
+
+#endif
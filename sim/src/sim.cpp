@@ -0,0 +1,509 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "esp_sleep.h"
+#include "sim_internal.h"
+#include "cmd_processor.h"
+#include "config.h"
+#include "energy.h"
+#include "press_stats.h"
+#include "payload_decoder.h"
+#include "trace_stats.h"
+
+// firmware entry points
+void setup();
+void loop();
+extern systemconfig_t sys_config;
+extern energy_t energy_state;
+extern press_stats_t press_state;
+
+extern "C" {
+extern uint8_t __start_rtc_sim[] __attribute__((weak));
+extern uint8_t __stop_rtc_sim[] __attribute__((weak));
+}
+
+#define STUCK_MS 180000UL    // a wake lasting longer than this never reaches deep sleep
+
+namespace sim {
+
+Wake wake;
+Shared* shared = nullptr;
+const char* broker_host = "broker.lan";
+const uint32_t broker_ip = IPAddress(192, 168, 1, 10);
+
+static const char* probe_names[PROBE_COUNT] = {
+  "setup", "scan start", "scan done", "wifi begin", "sta connected", "got ip",
+  "mqtt connect", "mqtt connected", "publish", "puback", "sleep", "restart"
+};
+
+const char* probeName(Probe probe) {
+  return (probe < PROBE_COUNT) ? probe_names[probe] : "?";
+}
+
+uint32_t now() {
+  return wake.now;
+}
+
+bool dispatch() {
+  bool any = false;
+  while(!wake.events.empty() && (wake.events.begin()->first <= wake.now)) {
+    auto fn = wake.events.begin()->second;
+    wake.events.erase(wake.events.begin());
+    fn();
+    any = true;
+  }
+  return any;
+}
+
+void advance(uint32_t ms) {
+  while(ms--) {
+    wake.now++;
+    dispatch();
+  }
+}
+
+void at(uint32_t delay_ms, std::function<void()> fn) {
+  wake.events.emplace(wake.now + delay_ms, fn);
+}
+
+void mark(Probe probe, uint16_t arg) {
+  WakeReport& r = shared->report;
+  if(r.mark_ct < WakeReport::MAX_MARKS) {
+    r.marks[r.mark_ct++] = {wake.now, probe, arg};
+  }
+}
+
+const Scenario& scenario() {
+  return wake.scenario;
+}
+
+WakeReport& report() {
+  return shared->report;
+}
+
+uint64_t wallMs() {
+  return wake.wall_at_boot + wake.now;
+}
+
+bool usbConnected() {
+  return wake.usb;
+}
+
+void setUsbConnected(bool connected) {
+  wake.usb = connected;
+}
+
+bool buttonDown() {
+  return wake.now < wake.button_release_ms;
+}
+
+void consoleInput(const std::string& text) {
+  wake.console_in.insert(wake.console_in.end(), text.begin(), text.end());
+  if(wake.console_rx && !text.empty()) {
+    wake.console_rx(nullptr, "ARDUINO_HW_CDC_EVENTS", ARDUINO_HW_CDC_RX_EVENT, nullptr);
+  }
+}
+
+int wakeupCause() {
+  return wake.wakeup_cause;
+}
+
+int resetReason() {
+  return wake.reset_reason;
+}
+
+void endWake(WakeEnd end) {
+  WakeReport& r = shared->report;
+  r.end = end;
+  r.awake_ms = wake.now;
+  r.sleep_us = (end == END_SLEEP) ? wake.sleep_us : 0;
+  r.ext1_armed = wake.ext1;
+  r.cpu_mhz = wake.cpu_mhz;
+  r.light_sleep = wake.light_sleep;
+  shared->rtc_len = __stop_rtc_sim - __start_rtc_sim;
+  memcpy(shared->rtc, __start_rtc_sim, shared->rtc_len);
+  shared->nvs_len = nvsSave(shared->nvs, Shared::NVS_MAX);
+  fflush(stdout);
+  fflush(stderr);
+  _exit(0);
+}
+
+static void runWake() {
+  if(shared->rtc_len) {
+    memcpy(__start_rtc_sim, shared->rtc, shared->rtc_len);
+  }
+  nvsLoad(shared->nvs, shared->nvs_len);
+  memset(&shared->report, 0, sizeof(shared->report));
+  wake.now = wake.scenario.startup_ms;
+  mark(PROBE_SETUP);
+  setup();
+  while(wake.now < STUCK_MS) {
+    loop();
+    shared->report.loop_ct++;
+    advance(1);
+  }
+  endWake(END_STUCK);
+}
+
+///////////////////////////////////////////////////////
+// driver
+
+Scenario makeScenario(const std::string& name) {
+  Scenario s;
+  s.name = name;
+  s.aps = {
+    {"kingnet", {0xf4, 0xe2, 0x10, 0x20, 0x30, 0x01}, -61, 1},
+    {"s2",      {0xfa, 0xe2, 0x10, 0x20, 0x30, 0x02}, -83, 1},
+    {"kingnet", {0x18, 0xe8, 0x10, 0x20, 0x30, 0x03}, -74, 6},
+    {"neighbr", {0x3c, 0xa6, 0x10, 0x20, 0x30, 0x04}, -88, 6},
+    {"kingnet", {0xf4, 0xe2, 0x10, 0x20, 0x30, 0x05}, -90, 11},
+    {"guest",   {0x9c, 0x53, 0x10, 0x20, 0x30, 0x06}, -79, 13},
+  };
+  if(name == "no_ap") {
+    s.ap_up = false;
+  } else if(name == "no_broker") {
+    s.broker_up = false;
+  } else if(name == "button") {
+    s.button_every = 2;
+  } else if(name == "moved") {
+    // the router picked another channel, the history still points at the old ones
+    s.move_at = 6;
+  } else if(name == "dense") {
+    // apartment block: 60 more APs on every channel, mostly weaker than the own ones
+    for(int i = 0; i < 60; ++i) {
+      s.aps.push_back({"flat" + std::to_string(i), {0x02, 0x1a, 0x11, 0x40, 0x00, (uint8_t)i},
+                       (int8_t)(-55 - (i * 7) % 40), (uint8_t)(1 + (i * 5) % 13)});
+    }
+  } else if(name != "ok") {
+    fprintf(stderr, "unknown scenario '%s', using 'ok'\n", name.c_str());
+    s.name = "ok";
+  }
+  return s;
+}
+
+struct PhaseDef {
+  const char* name;
+  Probe from;
+  bool from_last;   // start at the last occurrence of the probe instead of the first
+  Probe to;
+  bool to_last;
+};
+
+static const PhaseDef phases[] = {
+  {"setup", PROBE_SETUP, false, PROBE_SCAN_START, false},
+  {"scan", PROBE_SCAN_START, false, PROBE_SCAN_DONE, true},
+  {"assoc", PROBE_WIFI_BEGIN, false, PROBE_STA_CONNECTED, false},
+  {"dhcp", PROBE_STA_CONNECTED, false, PROBE_GOT_IP, false},
+  {"dns", PROBE_GOT_IP, false, PROBE_MQTT_CONNECT, false},
+  {"mqtt", PROBE_MQTT_CONNECT, false, PROBE_MQTT_CONNECTED, false},
+  {"ack", PROBE_PUBLISH, false, PROBE_PUBACK, true},
+  {"tail", PROBE_PUBACK, true, PROBE_SLEEP, false},
+};
+static const int PHASE_CT = sizeof(phases) / sizeof(phases[0]);
+static_assert(PHASE_CT == sizeof(RunStats::phase_ms) / sizeof(double), "phase column per phase");
+
+static int32_t phaseMs(const WakeReport& r, const PhaseDef& p) {
+  int32_t first[PROBE_COUNT];
+  int32_t last[PROBE_COUNT];
+  for(int i = 0; i < PROBE_COUNT; ++i) {
+    first[i] = last[i] = -1;
+  }
+  for(int i = 0; i < r.mark_ct; ++i) {
+    Probe probe = r.marks[i].probe;
+    if(first[probe] < 0) {
+      first[probe] = r.marks[i].ms;
+    }
+    last[probe] = r.marks[i].ms;
+  }
+  int32_t from = p.from_last ? last[p.from] : first[p.from];
+  int32_t to = p.to_last ? last[p.to] : first[p.to];
+  if((from < 0) || (to < from)) {
+    return -1;
+  }
+  return to - from;
+}
+
+static const char* causeName(int wakeup_cause, int reset_reason) {
+  if(wakeup_cause == ESP_SLEEP_WAKEUP_TIMER) {
+    return "timer";
+  } else if(wakeup_cause == ESP_SLEEP_WAKEUP_EXT1) {
+    return "button";
+  }
+  return (reset_reason == ESP_RST_POWERON) ? "power" : "reset";
+}
+
+class StdoutPrint : public Print {
+public:
+  size_t write(uint8_t c) override {
+    if(c != '\r') {
+      putchar(c);
+    }
+    return 1;
+  }
+};
+
+static void printTimeline(const WakeReport& r) {
+  for(int i = 0; i < r.mark_ct; ++i) {
+    printf("      %6u ms  %-15s", r.marks[i].ms, probeName(r.marks[i].probe));
+    if(r.marks[i].arg) {
+      printf(" %u", r.marks[i].arg);
+    }
+    printf("\n");
+  }
+}
+
+void provisioningScript(const Options& options) {
+  static const char* defaults[] = {
+    "ssid kingnet", "pw secret123", "name king1", "server broker.lan", "port 1883",
+    "topic test", "id 1", "retry 30", "interval 600", "scantime 300", "wait 15000", "volt 4.1",
+  };
+  std::vector<std::string> lines(std::begin(defaults), std::end(defaults));
+  lines.insert(lines.end(), options.config.begin(), options.config.end());
+  lines.push_back("save");
+  if(options.machine) {
+    // what "program provision" sends, in one burst
+    char frame[CMD_FRAME_MAX + 2];
+    wake.console_in.insert(wake.console_in.end(), CMD_MACHINE_ENTER, CMD_MACHINE_ENTER + strlen(CMD_MACHINE_ENTER));
+    for(size_t i = 0; i < lines.size(); ++i) {
+      size_t len = cmd_frame(frame, sizeof(frame), i, lines[i].c_str());
+      wake.console_in.insert(wake.console_in.end(), frame, frame + len);
+    }
+    return;
+  }
+  for(auto& line : lines) {
+    wake.console_in.insert(wake.console_in.end(), line.begin(), line.end());
+    wake.console_in.push_back('\r');
+  }
+}
+
+bool attachShared() {
+  if(!shared) {
+    void* mem = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) {
+      perror("mmap");
+      return false;
+    }
+    shared = static_cast<Shared*>(mem);
+  }
+  return true;
+}
+
+bool forkWake(bool provisioning) {
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if(pid < 0) {
+    perror("fork");
+    return false;
+  }
+  if(pid == 0) {
+    if(provisioning) {
+      // unplug once the config is saved
+      at(2000, [] { setUsbConnected(false); });
+    }
+    runWake();
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+int run(const Scenario& scenario, const Options& options) {
+  if(!attachShared()) {
+    return 2;
+  }
+  shared->rtc_len = 0;
+  // the wakes fork from this process, a second run has to start from power on rtc again
+  std::vector<uint8_t> rtc_power_on(__start_rtc_sim, __stop_rtc_sim);
+  shared->nvs_len = 0;
+  shared->broker_session = false;
+  shared->clock_set = false;
+  if((size_t)(__stop_rtc_sim - __start_rtc_sim) > Shared::RTC_MAX) {
+    fprintf(stderr, "rtc section too large\n");
+    return 2;
+  }
+
+  printf("scenario %s, %u cycles\n", scenario.name.c_str(), options.cycles);
+  printf("%4s %-7s", "cyc", "cause");
+  for(int p = 0; p < PHASE_CT; ++p) {
+    printf(" %6s", phases[p].name);
+  }
+  printf(" %7s %6s %6s\n", "awake", "bytes", "sleep");
+
+  double sums[PHASE_CT] = {};
+  uint32_t counts[PHASE_CT] = {};
+  payload_decoder::TraceStats traces;
+  double awake_sum = 0;
+  uint32_t awake_ct = 0;
+  uint64_t loop_sum = 0;
+  uint64_t wait_sum = 0;
+  uint64_t run_sum = 0;
+  bool light_sleep = false;
+  double press_sum = 0;
+  uint32_t press_ct = 0;
+  uint32_t press_max = 0;
+  uint64_t wall = 0;
+  int wakeup_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+  int reset_reason = ESP_RST_POWERON;
+  int result = 0;
+  for(uint32_t cycle = 0; cycle <= options.cycles; ++cycle) {
+    wake = Wake();
+    wake.scenario = scenario;
+    if(scenario.move_at && (cycle >= scenario.move_at)) {
+      for(Ap& ap : wake.scenario.aps) {
+        ap.channel = (ap.ssid == "kingnet") ? 9 : ap.channel;
+      }
+    }
+    wake.verbose = options.verbose;
+    wake.wall_at_boot = wall + scenario.boot_ms;
+    wake.wakeup_cause = wakeup_cause;
+    wake.reset_reason = reset_reason;
+    if(cycle == 0) {
+      // power on with the console attached, configure and unplug
+      wake.usb = true;
+      provisioningScript(options);
+    } else if(wakeup_cause == ESP_SLEEP_WAKEUP_EXT1) {
+      wake.button_release_ms = 150;
+    }
+
+    if(!forkWake(cycle == 0)) {
+      fprintf(stderr, "wake %u crashed\n", cycle);
+      return 2;
+    }
+    const WakeReport& r = shared->report;
+
+    printf("%4u %-7s", cycle, cycle ? causeName(wakeup_cause, reset_reason) : "prov");
+    for(int p = 0; p < PHASE_CT; ++p) {
+      int32_t ms = phaseMs(r, phases[p]);
+      if(ms < 0) {
+        printf(" %6s", "-");
+      } else {
+        printf(" %6d", ms);
+        if(cycle) {
+          sums[p] += ms;
+          counts[p]++;
+        }
+      }
+    }
+    uint32_t awake = scenario.boot_ms + r.awake_ms;
+    if(cycle) {
+      awake_sum += awake;
+      awake_ct++;
+    }
+    if(cycle && (wakeup_cause == ESP_SLEEP_WAKEUP_EXT1)) {
+      // what the user sees: the press wakes the chip, the first puback answers it
+      for(int i = 0; i < r.mark_ct; ++i) {
+        if(r.marks[i].probe == PROBE_PUBACK) {
+          uint32_t ms = scenario.boot_ms + r.marks[i].ms;
+          press_sum += ms;
+          press_ct++;
+          press_max = std::max(press_max, ms);
+          break;
+        }
+      }
+    }
+    if(cycle && options.stats && (r.end == END_SLEEP) && r.publish_ct) {
+      RunStats& st = *options.stats;
+      int32_t connect = -1;
+      for(int i = 0; (i < r.mark_ct) && (connect < 0); ++i) {
+        connect = (r.marks[i].probe == PROBE_MQTT_CONNECT) ? r.marks[i].ms : -1;
+      }
+      st.sends++;
+      st.connect_to_sleep_ms += ((double)r.awake_ms - connect - st.connect_to_sleep_ms) / st.sends;
+      st.awake_ms += (awake - st.awake_ms) / st.sends;
+      st.bytes += (r.publish_bytes - st.bytes) / st.sends;
+      for(int p = 0; p < PHASE_CT; ++p) {
+        int32_t ms = phaseMs(r, phases[p]);
+        st.phase_ms[p] += ((ms < 0 ? 0 : ms) - st.phase_ms[p]) / st.sends;
+      }
+    }
+    loop_sum += r.loop_ct;
+    wait_sum += r.wait_ms;
+    run_sum += r.awake_ms;
+    light_sleep |= r.light_sleep;
+    printf(" %7u %6u", awake, r.publish_bytes);
+    if(r.end == END_SLEEP) {
+      printf(" %6llu\n", (unsigned long long)(r.sleep_us / 1000000ULL));
+    } else {
+      printf(" %6s\n", (r.end == END_RESTART) ? "restart" : "STUCK");
+    }
+    if(options.timeline && cycle) {
+      printTimeline(r);
+    }
+    // binary messages with "trace on" carry the device side timestamps of the earlier wakes
+    payload_decoder::Message msg;
+    const uint8_t* payload = (const uint8_t*)r.payload;
+    if(r.payload_len && payload_decoder::isBinary(payload, r.payload_len) &&
+       (payload_decoder::decode(payload, r.payload_len, msg) == payload_decoder::Error::none)) {
+      traces.add(msg);
+    }
+
+    wall += awake;
+    if(r.end == END_STUCK) {
+      fprintf(stderr, "wake %u did not reach deep sleep within %lu ms\n", cycle, STUCK_MS);
+      result = 1;
+      break;
+    }
+    if(r.end == END_RESTART) {
+      wakeup_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+      reset_reason = ESP_RST_SW;
+      continue;
+    }
+    reset_reason = ESP_RST_DEEPSLEEP;
+    bool button = scenario.button_every && ((cycle + 1) % scenario.button_every == 0) && r.ext1_armed;
+    if(button) {
+      wakeup_cause = ESP_SLEEP_WAKEUP_EXT1;
+      wall += r.sleep_us ? (r.sleep_us / 2000ULL) : 1000;
+    } else if(r.sleep_us) {
+      wakeup_cause = ESP_SLEEP_WAKEUP_TIMER;
+      wall += r.sleep_us / 1000ULL;
+    } else {
+      printf("no wakeup source armed, device sleeps forever\n");
+      break;
+    }
+  }
+
+  printf("%4s %-7s", "avg", "");
+  for(int p = 0; p < PHASE_CT; ++p) {
+    if(counts[p]) {
+      printf(" %6.0f", sums[p] / counts[p]);
+    } else {
+      printf(" %6s", "-");
+    }
+  }
+  printf(" %7.0f\n", awake_ct ? awake_sum / awake_ct : 0.0);
+  if(press_ct) {
+    printf("press to first puback, boot included: %u presses, avg %.0f ms, max %u ms\n", press_ct,
+           press_sum / press_ct, press_max);
+  }
+  printf("loop() ran %llu times, blocked on events %.0f%% of the awake time%s\n", (unsigned long long)loop_sum,
+         run_sum ? 100.0 * wait_sum / run_sum : 0.0, light_sleep ? ", auto light sleep on usb" : "");
+  // the firmware energy model as the rtc memory of the last wake left it
+  memcpy(__start_rtc_sim, shared->rtc, shared->rtc_len);
+  StdoutPrint out;
+  ENERGY energy(&energy_state);
+  printf("\nenergy model, ");
+  energy.print(&out, sys_config.voltage_faktor * scenario.battery_adc_mv, sys_config.capacity_mah);
+  PRESS_STATS press(&press_state);
+  if(press.total()) {
+    printf("\npress latency as the device measured it, ");
+    press.print(&out);
+  }
+  if(options.stats) {
+    options.stats->mah_per_wake = energy.mahPerWake();
+    options.stats->mah_per_day = energy.mahPerDay();
+  }
+  if(traces.wakes()) {
+    printf("\ndevice trace, ");
+    printf("%s", traces.report().c_str());
+  }
+  std::copy(rtc_power_on.begin(), rtc_power_on.end(), __start_rtc_sim);
+  munmap(shared, sizeof(Shared));
+  shared = nullptr;
+  return result;
+}
+
+}
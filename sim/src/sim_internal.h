@@ -0,0 +1,74 @@
+#ifndef SIM_INTERNAL_H
+#define SIM_INTERNAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <map>
+#include "sim.h"
+
+namespace sim {
+
+// state of one wake, set up by the driver right before it forks the wake process
+struct Wake {
+  Scenario scenario;
+  uint32_t now = 0;
+  uint64_t wall_at_boot = 0;
+  int wakeup_cause = 0;
+  int reset_reason = 0;
+  bool usb = false;
+  bool verbose = false;
+  uint32_t button_release_ms = 0;
+  std::deque<char> console_in;
+  size_t console_rx_size = 256;    // usb cdc rx buffer of the driver
+  size_t uart_tx_size = 128;       // debug uart hardware fifo plus tx buffer
+  double uart_level = 0;           // bytes still to go out at uart_at
+  uint32_t uart_at = 0;
+  std::multimap<uint32_t, std::function<void()>> events;
+  uint64_t sleep_us = 0;
+  bool ext1 = false;
+  uint32_t cpu_mhz = 160;
+  uint32_t pm_min_mhz = 0;         // dynamic frequency scaling, 0 = not configured
+  uint32_t pm_max_mhz = 0;
+  uint32_t pm_locks = 0;           // cpu max locks held
+  void (*button_isr)() = nullptr;
+  void (*console_rx)(void* arg, const char* base, int32_t id, void* data) = nullptr;
+  bool light_sleep = false;
+};
+
+// memory shared between the driver and the wake processes
+struct Shared {
+  static const size_t RTC_MAX = 64 * 1024;
+  static const size_t NVS_MAX = 64 * 1024;
+  WakeReport report;
+  size_t rtc_len;
+  uint8_t rtc[RTC_MAX];
+  size_t nvs_len;
+  uint8_t nvs[NVS_MAX];
+  bool broker_session;             // the broker holds a kept session of the client
+  bool clock_set;                  // sntp answered once, the rtc keeps the time through deep sleep
+};
+
+extern Wake wake;
+extern Shared* shared;
+
+// maps the memory shared with the wake processes once
+bool attachShared();
+// runs the wake set up in wake and the rtc/nvs images in shared as a child process, false if it crashed
+bool forkWake(bool provisioning);
+// console lines of the provisioning boot
+void provisioningScript(const Options& options);
+
+size_t nvsSave(uint8_t* buf, size_t max_len);
+void nvsLoad(const uint8_t* buf, size_t len);
+// the resolver knows the broker under this name
+extern const char* broker_host;
+extern const uint32_t broker_ip;
+// wall clock 0 of a run, 2026-10-17 00:00 utc
+const time_t EPOCH = 1792195200;
+
+}
+
+#endif
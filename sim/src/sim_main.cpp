@@ -0,0 +1,105 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "logdump.h"
+#include "provision.h"
+#include "sim.h"
+
+// pio test brings its own main
+#ifndef PIO_UNIT_TESTING
+
+static void usage(const char* name) {
+  printf("usage: %s [-n cycles] [-s ok|no_ap|no_broker|button|dense|moved] [-p param=ms]... [-c \"console cmd\"]... [-m] [-t] [-v]\n", name);
+  printf("  -n  number of wake cycles after the provisioning boot (default 5)\n");
+  printf("  -s  scenario of the simulated environment\n");
+  printf("  -p  override a scenario timing: boot, scan, assoc, dhcp, dns, connect, puback, tcpack,\n");
+  printf("      cpu work at 80 MHz: wpa, tls\n");
+  printf("  -c  extra console command sent before 'save' on the provisioning boot\n");
+  printf("  -m  send the provisioning commands as machine mode frames\n");
+  printf("  -t  print the probe timeline of every wake\n");
+  printf("  -v  pass the firmware serial output through to stderr\n");
+  printf("       %s bench <name> [args] runs a host benchmark, 'bench' lists them\n", name);
+  printf("       %s fleet [args] runs many devices against one broker, 'fleet -?' for the args\n", name);
+  printf("       %s provision <file> -p <port> sends a config file to a device in machine mode\n", name);
+  printf("       %s logdump [capture] decodes the log records of a debug uart capture, -l lists the formats\n", name);
+}
+
+static bool setParam(sim::Scenario& s, const char* arg) {
+  char name[16];
+  unsigned ms;
+  if(sscanf(arg, "%15[a-z]=%u", name, &ms) != 2) {
+    return false;
+  }
+  if(!strcmp(name, "boot")) {
+    s.boot_ms = ms;
+  } else if(!strcmp(name, "scan")) {
+    s.scan_overhead_ms = ms;
+  } else if(!strcmp(name, "assoc")) {
+    s.assoc_ms = ms;
+  } else if(!strcmp(name, "dhcp")) {
+    s.dhcp_ms = ms;
+  } else if(!strcmp(name, "dns")) {
+    s.dns_ms = ms;
+  } else if(!strcmp(name, "wpa")) {
+    s.assoc_cpu_ms = ms;
+  } else if(!strcmp(name, "tls")) {
+    s.tls_cpu_ms = ms;
+  } else if(!strcmp(name, "connect")) {
+    s.mqtt_connect_ms = ms;
+  } else if(!strcmp(name, "puback")) {
+    s.puback_ms = ms;
+  } else if(!strcmp(name, "tcpack")) {
+    s.tcp_ack_ms = ms;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if((argc >= 2) && !strcmp(argv[1], "bench")) {
+    return sim::bench(argc - 1, argv + 1);
+  }
+  if((argc >= 2) && !strcmp(argv[1], "fleet")) {
+    return sim::fleet(argc - 1, argv + 1);
+  }
+  if((argc >= 2) && !strcmp(argv[1], "provision")) {
+    return sim::provision(argc - 1, argv + 1);
+  }
+  if((argc >= 2) && !strcmp(argv[1], "logdump")) {
+    return sim::logdump(argc - 1, argv + 1);
+  }
+  sim::Options options;
+  std::string scenario = "ok";
+  std::vector<const char*> params;
+  for(int i = 1; i < argc; ++i) {
+    if(!strcmp(argv[i], "-n") && (i + 1 < argc)) {
+      options.cycles = atoi(argv[++i]);
+    } else if(!strcmp(argv[i], "-s") && (i + 1 < argc)) {
+      scenario = argv[++i];
+    } else if(!strcmp(argv[i], "-p") && (i + 1 < argc)) {
+      params.push_back(argv[++i]);
+    } else if(!strcmp(argv[i], "-c") && (i + 1 < argc)) {
+      options.config.push_back(argv[++i]);
+    } else if(!strcmp(argv[i], "-m")) {
+      options.machine = true;
+    } else if(!strcmp(argv[i], "-t")) {
+      options.timeline = true;
+    } else if(!strcmp(argv[i], "-v")) {
+      options.verbose = true;
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  sim::Scenario s = sim::makeScenario(scenario);
+  for(auto param : params) {
+    if(!setParam(s, param)) {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  return sim::run(s, options);
+}
+
+#endif
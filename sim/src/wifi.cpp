@@ -0,0 +1,281 @@
+#include <WiFi.h>
+#include "sim_internal.h"
+
+#define SIM_TARGET_SSID "kingnet"
+#define SIM_CONNECT_SCAN_MS 780     // all channel scan the driver does when no channel is given
+#define SIM_NOT_FOUND_MS 1500       // until the driver reports a failed association
+
+WiFiClass WiFi;
+
+struct Handler {
+  WiFiEventFuncCb cb;
+  arduino_event_id_t event;
+};
+
+static std::vector<Handler> handlers;
+static std::vector<sim::Ap> scan_result;
+static std::vector<wifi_ap_record_t> scan_records;
+static char hostname[33] = "esp32c6";
+static uint32_t generation = 0;     // invalidates events of an abandoned connect
+static bool sta_connected = false;
+static bool got_ip = false;
+static uint8_t sta_channel = 0;
+static IPAddress static_ip;
+static IPAddress static_gw;
+static IPAddress static_mask;
+static IPAddress static_dns;
+static const IPAddress dhcp_ip(192, 168, 1, 57);
+static const IPAddress dhcp_gw(192, 168, 1, 1);
+static const IPAddress dhcp_mask(255, 255, 255, 0);
+
+static void postEvent(arduino_event_id_t event, const arduino_event_info_t& info) {
+  for(auto& h : handlers) {
+    if((h.event == ARDUINO_EVENT_MAX) || (h.event == event)) {
+      h.cb(event, info);
+    }
+  }
+}
+
+static bool visible(const sim::Ap& ap) {
+  return sim::scenario().ap_up || (ap.ssid != SIM_TARGET_SSID);
+}
+
+wifi_event_id_t WiFiClass::onEvent(WiFiEventFuncCb cbEvent, arduino_event_id_t event) {
+  handlers.push_back({cbEvent, event});
+  return handlers.size();
+}
+
+bool WiFiClass::mode(wifi_mode_t m) {
+  if(m == WIFI_MODE_NULL) {
+    disconnect();
+  }
+  _mode = m;
+  return true;
+}
+
+bool WiFiClass::setHostname(const char* name) {
+  strncpy(hostname, name, sizeof(hostname) - 1);
+  return true;
+}
+
+const char* WiFiClass::getHostname() {
+  return hostname;
+}
+
+int16_t WiFiClass::scanNetworks(bool async, bool show_hidden, bool passive, uint32_t max_ms_per_chan,
+                                uint8_t channel, const char* ssid, const uint8_t* bssid) {
+  if(_mode == WIFI_MODE_NULL) {
+    _mode = WIFI_MODE_STA;
+  }
+  scan_result.clear();
+  scan_records.clear();
+  sim::mark(sim::PROBE_SCAN_START, channel);
+  uint32_t channels = channel ? 1 : 13;
+  uint32_t duration = channels * (max_ms_per_chan + sim::scenario().scan_overhead_ms);
+  auto finish = [channel] {
+    for(auto& ap : sim::scenario().aps) {
+      if(((channel == 0) || (ap.channel == channel)) && visible(ap)) {
+        scan_result.push_back(ap);
+        wifi_ap_record_t r = {};
+        memcpy(r.bssid, ap.bssid, sizeof(r.bssid));
+        snprintf((char*)r.ssid, sizeof(r.ssid), "%s", ap.ssid.c_str());
+        r.primary = ap.channel;
+        r.rssi = ap.rssi;
+        scan_records.push_back(r);
+      }
+    }
+    sim::mark(sim::PROBE_SCAN_DONE, channel);
+  };
+  if(!async) {
+    sim::advance(duration);
+    finish();
+    return scan_result.size();
+  }
+  sim::at(duration, [finish] {
+    finish();
+    arduino_event_info_t info = {};
+    info.wifi_scan_done.status = 0;
+    info.wifi_scan_done.number = scan_result.size();
+    postEvent(ARDUINO_EVENT_WIFI_SCAN_DONE, info);
+  });
+  return WIFI_SCAN_RUNNING;
+}
+
+int16_t WiFiClass::scanComplete() {
+  return scan_result.size();
+}
+
+void WiFiClass::scanDelete() {
+  scan_result.clear();
+  scan_records.clear();
+}
+
+void* WiFiClass::getScanInfoByIndex(int i) {
+  return ((i >= 0) && (i < (int)scan_records.size())) ? &scan_records[i] : nullptr;
+}
+
+String WiFiClass::SSID(uint8_t i) {
+  return (i < scan_result.size()) ? String(scan_result[i].ssid.c_str()) : String();
+}
+
+int32_t WiFiClass::RSSI(uint8_t i) {
+  return (i < scan_result.size()) ? scan_result[i].rssi : 0;
+}
+
+uint8_t* WiFiClass::BSSID(uint8_t i, uint8_t* bssid) {
+  if(i >= scan_result.size()) {
+    return nullptr;
+  }
+  if(bssid) {
+    memcpy(bssid, scan_result[i].bssid, 6);
+    return bssid;
+  }
+  return scan_result[i].bssid;
+}
+
+String WiFiClass::BSSIDstr(uint8_t i) {
+  if(i >= scan_result.size()) {
+    return String();
+  }
+  const uint8_t* b = scan_result[i].bssid;
+  char str[18];
+  snprintf(str, sizeof(str), "%02X:%02X:%02X:%02X:%02X:%02X", b[0], b[1], b[2], b[3], b[4], b[5]);
+  return String(str);
+}
+
+int32_t WiFiClass::channel(uint8_t i) {
+  return (i < scan_result.size()) ? scan_result[i].channel : 0;
+}
+
+wl_status_t WiFiClass::begin(const char* ssid, const char* passphrase, int32_t channel,
+                             const uint8_t* bssid, bool connect) {
+  if(_mode == WIFI_MODE_NULL) {
+    _mode = WIFI_MODE_STA;
+  }
+  disconnect();
+  uint32_t gen = generation;
+  sim::mark(sim::PROBE_WIFI_BEGIN, channel);
+  const sim::Ap* target = nullptr;
+  for(auto& ap : sim::scenario().aps) {
+    if(ssid && (ap.ssid == ssid) && visible(ap) &&
+       ((channel == 0) || (ap.channel == channel)) &&
+       ((bssid == nullptr) || !memcmp(bssid, ap.bssid, 6))) {
+      if(!target || (ap.rssi > target->rssi)) {
+        target = &ap;
+      }
+    }
+  }
+  if(!target) {
+    sim::at(SIM_NOT_FOUND_MS, [gen] {
+      if(gen != generation) {
+        return;
+      }
+      arduino_event_info_t info = {};
+      info.wifi_sta_disconnected.reason = 201;  // no ap found
+      postEvent(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, info);
+    });
+    return WL_DISCONNECTED;
+  }
+  uint32_t assoc = sim::scenario().assoc_ms + sim::cpuMs(sim::scenario().assoc_cpu_ms) + (channel ? 0 : SIM_CONNECT_SCAN_MS);
+  uint8_t ch = target->channel;
+  sim::at(assoc, [gen, ch] {
+    if(gen != generation) {
+      return;
+    }
+    sta_connected = true;
+    sta_channel = ch;
+    sim::mark(sim::PROBE_STA_CONNECTED, ch);
+    arduino_event_info_t info = {};
+    info.wifi_sta_connected.channel = ch;
+    postEvent(ARDUINO_EVENT_WIFI_STA_CONNECTED, info);
+    uint32_t dhcp = (uint32_t)static_ip ? 2 : sim::scenario().dhcp_ms;
+    sim::at(dhcp, [gen] {
+      if(gen != generation) {
+        return;
+      }
+      got_ip = true;
+      sim::mark(sim::PROBE_GOT_IP);
+      arduino_event_info_t info = {};
+      info.got_ip.ip_info.ip.addr = WiFi.localIP();
+      info.got_ip.ip_info.gw.addr = WiFi.gatewayIP();
+      info.got_ip.ip_info.netmask.addr = WiFi.subnetMask();
+      postEvent(ARDUINO_EVENT_WIFI_STA_GOT_IP, info);
+    });
+  });
+  return WL_DISCONNECTED;
+}
+
+bool WiFiClass::config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+  static_ip = local_ip;
+  static_gw = gateway;
+  static_mask = subnet;
+  static_dns = dns1;
+  return true;
+}
+
+bool WiFiClass::disconnect(bool wifioff, bool eraseap) {
+  generation++;
+  sta_connected = false;
+  got_ip = false;
+  sta_channel = 0;
+  if(wifioff) {
+    _mode = WIFI_MODE_NULL;
+  }
+  return true;
+}
+
+bool WiFiClass::isConnected() {
+  return got_ip;
+}
+
+wl_status_t WiFiClass::status() {
+  return got_ip ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+uint8_t WiFiClass::channel() {
+  return sta_channel;
+}
+
+IPAddress WiFiClass::localIP() {
+  if(!got_ip) {
+    return IPAddress();
+  }
+  return (uint32_t)static_ip ? static_ip : dhcp_ip;
+}
+
+IPAddress WiFiClass::gatewayIP() {
+  if(!got_ip) {
+    return IPAddress();
+  }
+  return (uint32_t)static_ip ? static_gw : dhcp_gw;
+}
+
+IPAddress WiFiClass::subnetMask() {
+  if(!got_ip) {
+    return IPAddress();
+  }
+  return (uint32_t)static_ip ? static_mask : dhcp_mask;
+}
+
+IPAddress WiFiClass::dnsIP(uint8_t dns_no) {
+  if(!got_ip || dns_no) {
+    return IPAddress();
+  }
+  return (uint32_t)static_ip ? static_dns : dhcp_gw;
+}
+
+// blocks for the round trip to the resolver like the lwip lookup does
+int WiFiClass::hostByName(const char* aHostname, IPAddress& aResult) {
+  if(aResult.fromString(aHostname)) {
+    return 1;
+  }
+  if(!got_ip) {
+    return 0;
+  }
+  sim::advance(sim::scenario().dns_ms);
+  if(!got_ip || strcmp(aHostname, sim::broker_host)) {
+    return 0;
+  }
+  aResult = sim::broker_ip;
+  return 1;
+}
@@ -0,0 +1,241 @@
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include "WString.h"
+
+static std::string toBase(unsigned long value, unsigned char base, bool negative) {
+  char buf[8 * sizeof(long) + 2];
+  char* p = buf + sizeof(buf) - 1;
+  *p = '\0';
+  if(base < 2) {
+    base = 10;
+  }
+  do {
+    unsigned digit = value % base;
+    *--p = (digit < 10) ? ('0' + digit) : ('a' + digit - 10);
+    value /= base;
+  } while(value);
+  if(negative) {
+    *--p = '-';
+  }
+  return p;
+}
+
+static std::string toDecimals(double value, unsigned int decimals) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+  return buf;
+}
+
+String::String(const char* cstr) : _buf(cstr ? cstr : "") {}
+String::String(char c) : _buf(1, c) {}
+String::String(int value, unsigned char base)
+  : _buf((base == 10) ? toBase(value < 0 ? -(long)value : value, 10, value < 0) : toBase((unsigned)value, base, false)) {}
+String::String(unsigned int value, unsigned char base) : _buf(toBase(value, base, false)) {}
+String::String(long value, unsigned char base)
+  : _buf((base == 10) ? toBase(value < 0 ? -(unsigned long)value : value, 10, value < 0) : toBase((unsigned long)value, base, false)) {}
+String::String(unsigned long value, unsigned char base) : _buf(toBase(value, base, false)) {}
+String::String(float value, unsigned int decimals) : _buf(toDecimals(value, decimals)) {}
+String::String(double value, unsigned int decimals) : _buf(toDecimals(value, decimals)) {}
+
+String& String::operator=(const char* cstr) {
+  if(cstr) {
+    _buf = cstr;
+  } else {
+    _buf.clear();
+  }
+  return *this;
+}
+
+bool String::reserve(unsigned int size) {
+  _buf.reserve(size);
+  return true;
+}
+
+bool String::concat(const String& str) { _buf += str._buf; return true; }
+bool String::concat(const char* cstr) {
+  if(!cstr) {
+    return false;
+  }
+  _buf += cstr;
+  return true;
+}
+bool String::concat(const char* cstr, unsigned int length) {
+  if(!cstr) {
+    return false;
+  }
+  _buf.append(cstr, length);
+  return true;
+}
+bool String::concat(char c) { _buf += c; return true; }
+bool String::concat(int num) { return concat(String(num)); }
+bool String::concat(unsigned int num) { return concat(String(num)); }
+bool String::concat(long num) { return concat(String(num)); }
+bool String::concat(unsigned long num) { return concat(String(num)); }
+bool String::concat(float num) { return concat(String(num)); }
+bool String::concat(double num) { return concat(String(num)); }
+
+StringSumHelper& operator+(const StringSumHelper& lhs, const String& rhs) {
+  auto& a = const_cast<StringSumHelper&>(lhs);
+  a.concat(rhs);
+  return a;
+}
+StringSumHelper& operator+(const StringSumHelper& lhs, const char* cstr) {
+  auto& a = const_cast<StringSumHelper&>(lhs);
+  a.concat(cstr);
+  return a;
+}
+StringSumHelper& operator+(const StringSumHelper& lhs, char c) {
+  auto& a = const_cast<StringSumHelper&>(lhs);
+  a.concat(c);
+  return a;
+}
+StringSumHelper& operator+(const StringSumHelper& lhs, int num) {
+  auto& a = const_cast<StringSumHelper&>(lhs);
+  a.concat(num);
+  return a;
+}
+StringSumHelper& operator+(const StringSumHelper& lhs, unsigned int num) {
+  auto& a = const_cast<StringSumHelper&>(lhs);
+  a.concat(num);
+  return a;
+}
+
+bool String::equalsIgnoreCase(const String& s) const {
+  if(length() != s.length()) {
+    return false;
+  }
+  for(size_t i = 0; i < _buf.length(); ++i) {
+    if(tolower((unsigned char)_buf[i]) != tolower((unsigned char)s._buf[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool String::startsWith(const String& prefix) const {
+  return _buf.compare(0, prefix._buf.length(), prefix._buf) == 0;
+}
+
+bool String::startsWith(const String& prefix, unsigned int offset) const {
+  if(offset > _buf.length()) {
+    return false;
+  }
+  return _buf.compare(offset, prefix._buf.length(), prefix._buf) == 0;
+}
+
+bool String::endsWith(const String& suffix) const {
+  if(suffix._buf.length() > _buf.length()) {
+    return false;
+  }
+  return _buf.compare(_buf.length() - suffix._buf.length(), suffix._buf.length(), suffix._buf) == 0;
+}
+
+char String::charAt(unsigned int index) const {
+  return (index < _buf.length()) ? _buf[index] : '\0';
+}
+
+void String::setCharAt(unsigned int index, char c) {
+  if(index < _buf.length()) {
+    _buf[index] = c;
+  }
+}
+
+char& String::operator[](unsigned int index) {
+  static char dummy;
+  if(index >= _buf.length()) {
+    dummy = '\0';
+    return dummy;
+  }
+  return _buf[index];
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const {
+  size_t pos = _buf.find(ch, fromIndex);
+  return (pos == std::string::npos) ? -1 : (int)pos;
+}
+
+int String::indexOf(const String& str, unsigned int fromIndex) const {
+  size_t pos = _buf.find(str._buf, fromIndex);
+  return (pos == std::string::npos) ? -1 : (int)pos;
+}
+
+int String::lastIndexOf(char ch) const {
+  size_t pos = _buf.rfind(ch);
+  return (pos == std::string::npos) ? -1 : (int)pos;
+}
+
+String String::substring(unsigned int beginIndex) const {
+  return substring(beginIndex, _buf.length());
+}
+
+String String::substring(unsigned int left, unsigned int right) const {
+  if(left > right) {
+    std::swap(left, right);
+  }
+  if(left >= _buf.length()) {
+    return String();
+  }
+  if(right > _buf.length()) {
+    right = _buf.length();
+  }
+  return String(_buf.substr(left, right - left).c_str());
+}
+
+void String::replace(const String& find, const String& replace) {
+  if(find._buf.empty()) {
+    return;
+  }
+  size_t pos = 0;
+  while((pos = _buf.find(find._buf, pos)) != std::string::npos) {
+    _buf.replace(pos, find._buf.length(), replace._buf);
+    pos += replace._buf.length();
+  }
+}
+
+void String::remove(unsigned int index) {
+  remove(index, (unsigned int)-1);
+}
+
+void String::remove(unsigned int index, unsigned int count) {
+  if(index >= _buf.length()) {
+    return;
+  }
+  _buf.erase(index, count);
+}
+
+void String::toLowerCase() {
+  for(auto& c : _buf) {
+    c = tolower((unsigned char)c);
+  }
+}
+
+void String::toUpperCase() {
+  for(auto& c : _buf) {
+    c = toupper((unsigned char)c);
+  }
+}
+
+void String::trim() {
+  size_t begin = 0;
+  while((begin < _buf.length()) && isspace((unsigned char)_buf[begin])) {
+    begin++;
+  }
+  size_t end = _buf.length();
+  while((end > begin) && isspace((unsigned char)_buf[end - 1])) {
+    end--;
+  }
+  _buf = _buf.substr(begin, end - begin);
+}
+
+long String::toInt() const {
+  return atol(_buf.c_str());
+}
+
+float String::toFloat() const {
+  return atof(_buf.c_str());
+}
+
+double String::toDouble() const {
+  return atof(_buf.c_str());
+}
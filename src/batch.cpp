@@ -0,0 +1,71 @@
+#include "batch.h"
+#include "payload.h"
+
+BATCH_BUFFER::BATCH_BUFFER(struct batch_t* batch) : _batch(batch) {
+}
+
+void BATCH_BUFFER::push(const payload_t* p, float voltage, uint16_t send_cause) {
+  uint8_t slot = (_batch->head + _batch->count) % BATCH_MAX_RECORDS;
+  if(full()) {
+    _batch->head = (_batch->head + 1) % BATCH_MAX_RECORDS;
+  } else {
+    _batch->count++;
+  }
+  batch_record_t &r = _batch->rec[slot];
+  r.time = _batch->clock + millis() / 1000;
+  r.mv = (voltage > 0) ? (uint16_t)(voltage * 1000.0f + 0.5f) : 0;
+  r.send_cause = send_cause;
+  r.ap_ct = 0;
+  // insertion into the short list, strongest first
+  for(uint8_t i = 0; i < p->ap_ct; ++i) {
+    const payload_ap_t &ap = p->ap[i];
+    if((r.ap_ct == BATCH_MAX_APS) && (ap.rssi <= r.ap[BATCH_MAX_APS - 1].rssi)) {
+      continue;
+    }
+    uint8_t k = (r.ap_ct < BATCH_MAX_APS) ? r.ap_ct++ : BATCH_MAX_APS - 1;
+    while(k && (r.ap[k - 1].rssi < ap.rssi)) {
+      r.ap[k] = r.ap[k - 1];
+      k--;
+    }
+    memcpy(r.ap[k].bssid, ap.bssid, sizeof(r.ap[k].bssid));
+    r.ap[k].rssi = ap.rssi;
+    r.ap[k].channel = ap.channel;
+  }
+}
+
+void BATCH_BUFFER::clear() {
+  _batch->head = 0;
+  _batch->count = 0;
+}
+
+void BATCH_BUFFER::sleep(uint32_t seconds) {
+  _batch->clock += seconds + millis() / 1000;
+}
+
+uint8_t BATCH_BUFFER::count() {
+  return _batch->count;
+}
+
+bool BATCH_BUFFER::full() {
+  return _batch->count >= BATCH_MAX_RECORDS;
+}
+
+const batch_record_t &BATCH_BUFFER::get(uint8_t i) {
+  return _batch->rec[(_batch->head + i) % BATCH_MAX_RECORDS];
+}
+
+uint32_t BATCH_BUFFER::age(uint8_t i) {
+  return _batch->clock + millis() / 1000 - get(i).time;
+}
+
+void BATCH_BUFFER::print(Print* out) {
+  out->printf("%d of %d records\r\n", _batch->count, BATCH_MAX_RECORDS);
+  for(uint8_t i = 0; i < _batch->count; ++i) {
+    const batch_record_t &r = get(i);
+    out->printf("%6lus ago  %4dmV  cause %03x  %d APs", (unsigned long)age(i), r.mv, r.send_cause, r.ap_ct);
+    if(r.ap_ct) {
+      out->printf("  best ch %d %d", r.ap[0].channel, r.ap[0].rssi);
+    }
+    out->println();
+  }
+}
@@ -0,0 +1,124 @@
+#include "battery.h"
+
+BATTERY::BATTERY(struct battery_t* state)
+  : _state(state), _faktor(0), _offset_mv(0), _running(false), _start(0), _sum_mv(0), _frames(0) {
+}
+
+bool BATTERY::begin(float faktor, uint16_t offset_mv, void (*on_frame)()) {
+  static const uint8_t pins[] = {BATTERY_PIN};
+  _faktor = faktor;
+  _offset_mv = offset_mv;
+  _sum_mv = 0;
+  _frames = 0;
+  _start = millis();
+  // the driver fills its dma buffer on its own, the cpu only sees one average per frame
+  _running = analogContinuous(pins, 1, BATTERY_FRAME, BATTERY_RATE_HZ, on_frame) && analogContinuousStart();
+  return _running;
+}
+
+void BATTERY::poll() {
+  adc_continuous_data_t* frame;
+  if(_running && analogContinuousRead(&frame, 0) && (frame[0].avg_read_mvolts > 0)) {
+    _sum_mv += frame[0].avg_read_mvolts;
+    _frames++;
+  }
+}
+
+bool BATTERY::running() {
+  return _running;
+}
+
+uint32_t BATTERY::left(uint32_t ti) {
+  uint32_t gone = ti - _start;
+  return (!_running || (gone >= BATTERY_WINDOW_MS)) ? 0 : BATTERY_WINDOW_MS - gone;
+}
+
+void BATTERY::end() {
+  if(!_running) {
+    return;
+  }
+  poll();
+  analogContinuousStop();
+  analogContinuousDeinit();
+  _running = false;
+  if(!_frames) {
+    return;
+  }
+  uint16_t mv = toVolt((_sum_mv + _frames / 2) / _frames) * 1000.0f + 0.5f;
+  _state->last_mv = mv;
+  _state->last_frames = _frames;
+  _state->smooth = _state->smooth ? _state->smooth + ((int32_t)(mv << 4) - (int32_t)_state->smooth) / 4 : mv << 4;
+  uint32_t now = _state->clock + millis() / 1000;
+  const battery_entry_t &newest = _state->history[(_state->head + _state->count + BATTERY_HISTORY - 1) % BATTERY_HISTORY];
+  if(!_state->count || (now - newest.time >= BATTERY_HISTORY_S)) {
+    uint8_t slot = (_state->head + _state->count) % BATTERY_HISTORY;
+    if(_state->count < BATTERY_HISTORY) {
+      _state->count++;
+    } else {
+      _state->head = (_state->head + 1) % BATTERY_HISTORY;
+    }
+    _state->history[slot] = {now, (uint16_t)(_state->smooth >> 4)};
+  }
+}
+
+float BATTERY::toVolt(uint32_t adc_mv) {
+  return _faktor * adc_mv + _offset_mv / 1000.0f;
+}
+
+float BATTERY::voltage() {
+  if(_frames && !_running) {
+    return _state->last_mv / 1000.0f;
+  }
+  if(_frames) {
+    return toVolt(_sum_mv / _frames);
+  }
+  if(!_running && !_state->smooth) {
+    // nothing sampled since power on, one-shot once the adc is free
+    return toVolt(analogReadMilliVolts(BATTERY_PIN));
+  }
+  return smoothed();
+}
+
+float BATTERY::smoothed() {
+  return _state->smooth / 16000.0f;
+}
+
+// least squares over the history
+float BATTERY::trend() {
+  if(_state->count < 2) {
+    return 0;
+  }
+  const battery_entry_t &oldest = _state->history[_state->head];
+  const battery_entry_t &newest = _state->history[(_state->head + _state->count - 1) % BATTERY_HISTORY];
+  if(newest.time - oldest.time < 86400) {
+    return 0;
+  }
+  double st = 0, sv = 0, stt = 0, stv = 0;
+  for(uint8_t i = 0; i < _state->count; ++i) {
+    const battery_entry_t &e = _state->history[(_state->head + i) % BATTERY_HISTORY];
+    double t = (e.time - oldest.time) / 86400.0;
+    st += t;
+    sv += e.mv;
+    stt += t * t;
+    stv += t * e.mv;
+  }
+  double n = _state->count;
+  double d = n * stt - st * st;
+  if(d <= 0) {
+    return 0;
+  }
+  return (n * stv - st * sv) / d;
+}
+
+void BATTERY::sleep(uint32_t seconds) {
+  _state->clock += seconds + millis() / 1000;
+}
+
+void BATTERY::clear() {
+  *_state = {};
+}
+
+void BATTERY::print(Print* out) {
+  out->printf("battery %u mV from %u frames of %u, smoothed %u mV, %.1f mV/day over %u entries\r\n",
+              _state->last_mv, _state->last_frames, BATTERY_FRAME, _state->smooth >> 4, trend(), _state->count);
+}
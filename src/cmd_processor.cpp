@@ -1,216 +1,358 @@
 #include "cmd_processor.h"
 
-#define MAX_HISTORY 10
-
-CMDS::CMDS(String cmd, void (*callback)(String &cmd)) : _callback(callback) {
-  _cmd = cmd;
-  _args = "*s";
-  _callback2 = nullptr;
+CMD_PROCESSOR::CMD_PROCESSOR(Stream* cmd_stream) : _cmd_stream(cmd_stream) {
+  _line[0] = '\0';
 }
 
-CMDS::CMDS(String cmd, String args, void (*callback)(String &cmd, String args, void* values)) : _callback2(callback) {
-  _cmd = String(cmd);
-  _args = String(args);
-  _callback = nullptr;
+// crc16 ccitt, as config_crc
+uint16_t cmd_crc(const char* data, size_t len) {
+  uint16_t crc = 0xffff;
+  while(len--) {
+    crc ^= (uint8_t)*data++ << 8;
+    for(uint8_t i = 0; i < 8; ++i) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
 }
 
-String CMDS::getCmd() {
-  return _cmd;
-}
-String CMDS::getArgs() {
-  return _args;
+size_t cmd_frame(char* buf, size_t size, uint16_t seq, const char* line) {
+  int n = snprintf(buf, size, "%u %s", seq, line);
+  if((n < 0) || (n > CMD_FRAME_MAX - 5) || ((size_t)n + 7 > size)) {
+    return 0;
+  }
+  return n + snprintf(buf + n, size - n, "*%04X\n", cmd_crc(buf, n));
 }
 
-bool CMDS::handle(String cmd, String args) {
-  if(cmd.startsWith(_cmd)) {
-    if(_callback) {
-      if(args.isEmpty()) {
-        _callback(cmd);
-      } else {
-        _callback(cmd + " " + args);
-      }
-    } else if(_callback2) {
-      _callback2(cmd, _args, nullptr);
-    }
-    return true;
+bool CMD_PROCESSOR::registerCmd(const char* cmd, bool (*callback)(char* line)) {
+  if(_cmd_ct >= CMD_MAX_CMDS) {
+    return false;
   }
+  // longest prefix first, "" catches the rest
+  uint8_t len = strlen(cmd);
+  uint8_t i = _cmd_ct++;
+  while(i && (_cmds[i - 1].len < len)) {
+    _cmds[i] = _cmds[i - 1];
+    i--;
+  }
+  _cmds[i] = {cmd, len, callback};
+  return true;
+}
+
+bool CMD_PROCESSOR::registerKey(char key, void (*callback)(char key)) {
   return false;
 }
 
-///////////////////////////////////////////////////////
+bool CMD_PROCESSOR::machine() {
+  return _machine;
+}
 
-CMD_PROCESSOR::CMD_PROCESSOR(Stream* cmd_stream) : _cmd_stream(cmd_stream) {
-  _history_pos = -1;
+void CMD_PROCESSOR::process() {
+  while(!_machine && _cmd_stream->available()) {
+    handleByte(_cmd_stream->read());
+  }
+  if(_machine) {
+    processMachine();
+  }
 }
 
-bool CMD_PROCESSOR::registerCmd(String cmd, void (*callback)(String &cmd)) {
-  CMDS* p_cmd = new CMDS(cmd, callback);
-  _cmds.push_back(p_cmd);
-  std::sort(_cmds.begin(), _cmds.end());
-  return false;
+void CMD_PROCESSOR::handleByte(char c) {
+  if(!handleKey(c)) {
+    handleChar(c);
+    _last_char = c;
+  }
 }
 
-bool CMD_PROCESSOR::registerKey(char key, void (*callback)(char key)) {
-  return false;
+void CMD_PROCESSOR::enterMachine() {
+  _machine = true;
+  _len = 0;
+  _pos = 0;
+  _line[0] = '\0';
+  _ring_head = 0;
+  _ring_len = 0;
+  _ring_scan = 0;
+  _overlong = false;
+  _seq = 0;
+  _acked = 0;
+  _nak_sent = false;
+  _dup = false;
+  _cmd_stream->print("\r\n#ack 0\r\n");
 }
 
-void CMD_PROCESSOR::splitCmdline() {
-  String helper(_current_input);
-  helper.trim();
-  int idx = helper.indexOf(" ");
-  if(idx > 0) {
-    _cmd = helper.substring(0, idx);
-    _args = helper.substring(idx + 1);
-  } else {
-    _cmd = helper;
-    _args = "";
+// drains the driver in large reads, cuts the frames out of the ring and acks once per pass
+void CMD_PROCESSOR::processMachine() {
+  int avail;
+  while(_machine && ((avail = _cmd_stream->available()) > 0)) {
+    uint16_t tail = (_ring_head + _ring_len) % CMD_RING;
+    size_t room = std::min(CMD_RING - _ring_len, CMD_RING - tail);
+    _ring_len += _cmd_stream->readBytes(_ring + tail, std::min((size_t)avail, room));
+    while(_machine && (_ring_scan < _ring_len)) {
+      char c = _ring[(_ring_head + _ring_scan++) % CMD_RING];
+      if(c == 0x1B) {
+        if(_ring_scan == _ring_len) {
+          // the rest of the sequence is still on its way
+          _ring_scan--;
+          break;
+        }
+        char next = _ring[(_ring_head + _ring_scan++) % CMD_RING];
+        if((next == 'M') || (next == 'm')) {
+          _ring_head = (_ring_head + _ring_scan) % CMD_RING;
+          _ring_len -= _ring_scan;
+          _ring_scan = 0;
+          if(next == 'M') {
+            // the host starts over
+            enterMachine();
+          } else {
+            _machine = false;
+            _cmd_stream->print("#end\r\n");
+          }
+        }
+        continue;
+      }
+      if((c != '\n') && (c != '\r')) {
+        if(_ring_scan > CMD_FRAME_MAX) {
+          // no frame is this long, drop it up to its newline
+          _overlong = true;
+          _ring_head = (_ring_head + _ring_scan) % CMD_RING;
+          _ring_len -= _ring_scan;
+          _ring_scan = 0;
+        }
+        continue;
+      }
+      char frame[CMD_FRAME_MAX + 1];
+      uint16_t len = _ring_scan - 1;
+      for(uint16_t i = 0; i < len; ++i) {
+        frame[i] = _ring[(_ring_head + i) % CMD_RING];
+      }
+      _ring_head = (_ring_head + _ring_scan) % CMD_RING;
+      _ring_len -= _ring_scan;
+      _ring_scan = 0;
+      if(_overlong) {
+        _overlong = false;
+        nak();
+      } else if(len) {
+        handleFrame(frame, len);
+      }
+    }
+  }
+  if(_machine && ((_seq != _acked) || _dup)) {
+    _cmd_stream->printf("#ack %u\r\n", _seq);
+    _acked = _seq;
+    _dup = false;
+  }
+  // left machine mode, whatever came after the sequence is typed input
+  while(!_machine && _ring_len) {
+    handleByte(_ring[_ring_head]);
+    _ring_head = (_ring_head + 1) % CMD_RING;
+    _ring_len--;
+  }
+  if(!_machine) {
+    process();
   }
 }
 
-void CMD_PROCESSOR::process() {
-  if(!_cmd_stream->available()) {
+void CMD_PROCESSOR::nak() {
+  if(!_nak_sent) {
+    _cmd_stream->printf("#nak %u\r\n", _seq);
+    _nak_sent = true;
+  }
+}
+
+void CMD_PROCESSOR::handleFrame(char* frame, size_t len) {
+  frame[len] = '\0';
+  char* star = (len > 5) ? frame + len - 5 : nullptr;
+  char* end;
+  unsigned long crc = star ? strtoul(star + 1, &end, 16) : 0;
+  if(!star || (*star != '*') || (end != frame + len) || (cmd_crc(frame, len - 5) != crc)) {
+    nak();
     return;
   }
-  char c = _cmd_stream->read();
-  if(handleKey(c)) {
+  *star = '\0';
+  unsigned long seq = strtoul(frame, &end, 10);
+  if((end == frame) || (*end != ' ') || (seq > 0xffff)) {
+    nak();
     return;
   }
+  if(seq != _seq) {
+    if((uint16_t)(_seq - seq) <= 0x7fff) {
+      // done before, the host missed the ack
+      _dup = true;
+    } else {
+      nak();
+    }
+    return;
+  }
+  _seq++;
+  _nak_sent = false;
+  const char* line = end + 1;
+  _len = strlen(line);
+  if(_len >= CMD_LINE_MAX) {
+    _len = 0;
+    _cmd_stream->printf("#err %u\r\n", (unsigned)seq);
+    return;
+  }
+  memcpy(_line, line, _len + 1);
+  trim();
+  if(!dispatch()) {
+    _cmd_stream->printf("#err %u\r\n", (unsigned)seq);
+  }
+}
+
+void CMD_PROCESSOR::handleChar(char c) {
   if((c >= 0x20) && (c <= 0x7E)) {
-    if(_current_pos == _current_input.length()) {
-      _current_input += c;
+    if(_len >= CMD_LINE_MAX - 1) {
+      _cmd_stream->print('\a');
+      return;
+    }
+    if(_pos == _len) {
+      _line[_len++] = c;
+      _line[_len] = '\0';
       _cmd_stream->print(c);
     } else {
-      _current_input = _current_input.substring(0, _current_pos) + c + _current_input.substring(_current_pos);
-      _cmd_stream->printf("\r%s \b\33[%dD", _current_input.c_str(), _current_input.length() - _current_pos - 1);
+      memmove(_line + _pos + 1, _line + _pos, _len - _pos + 1);
+      _line[_pos] = c;
+      _len++;
+      _cmd_stream->printf("\r%s \b\33[%dD", _line, _len - _pos - 1);
     }
-    _current_pos++;
+    _pos++;
   } else if((c == '\r') || (c == '\n')) {
-    if(_current_pos != _current_input.length()) {
-      _cmd_stream->printf("\33[%dC", _current_input.length() - _current_pos);
+    if(_pos != _len) {
+      _cmd_stream->printf("\33[%dC", _len - _pos);
     }
     handleCrLf();
-    _current_pos = 0;
+    _pos = 0;
   } else if((c == 8) || (c == 0x7f)) { // backspace
-    if(!_current_input.isEmpty()) {
-      _current_input.remove(_current_pos - 1, 1);
-      if(_current_pos == _current_input.length() + 1) {
+    if(_pos) {
+      memmove(_line + _pos - 1, _line + _pos, _len - _pos + 1);
+      _len--;
+      if(_pos == _len + 1) {
         _cmd_stream->print("\b \b");
       } else {
-        _cmd_stream->printf("\r%s \b\33[%dD", _current_input.c_str(), _current_input.length() - _current_pos + 1);
+        _cmd_stream->printf("\r%s \b\33[%dD", _line, _len - _pos + 1);
       }
-      _current_pos--;
+      _pos--;
     }
   }
-  splitCmdline();
-  _last_char = c;
+}
+
+void CMD_PROCESSOR::showLine(const char* line) {
+  if(line != _line) {
+    strcpy(_line, line);
+  }
+  _len = strlen(_line);
+  _pos = _len;
+  _cmd_stream->printf("\33[2K\r%s", _line);
 }
 
 bool CMD_PROCESSOR::handleKey(char c) {
-  static bool esc = false;
-  static bool sci = false;
-  static bool csi = false;
-  static String csi_str("");
-  static char special_char = 0;
-  if(esc) {
+  if(_esc) {
     if(c == 'Z') {
-      sci = true;
+      _sci = true;
     } else if(c == 0x5B) {
-      csi = true;
+      _csi = true;
+      _csi_len = 0;
+    } else if(c == 'M') {
+      enterMachine();
+    } else if(c == 'm') {
+      // left before, the host did not hear it
+      _cmd_stream->print("\r\n#end\r\n");
     } else if(c == 0x4F) { // F1-F4
-      special_char = c;
+      _special_char = c;
     } else if((c >= 0x40) && (c < 0x7E)) {
       // TODO handle single esc
-      //_cmd_stream->printf("esc %02X\r\n", c);
       _cmd_stream->printf("\a");
     }
-    esc = false;
+    _esc = false;
     return true;
-  } else if(sci) {
+  } else if(_sci) {
     // TODO handle cursors etc
-    //_cmd_stream->printf("sci %02X\r\n", c);
     _cmd_stream->printf("\a");
-    sci = false;
+    _sci = false;
     return true;
-  } else if(special_char) {
-      // TODO handle F1-4, umlauts etc
-    //_cmd_stream->printf("special %02x %02X\r\n", special_char, c);
+  } else if(_special_char) {
+    // TODO handle F1-4, umlauts etc
     _cmd_stream->printf("\a");
-    special_char = 0;
+    _special_char = 0;
     return true;
-  } else if(csi) {
-    csi_str += c;
-    if((c >=0x40) && (c <= 0x7E)) {
-      // TODO handle cursors etc
-      if(csi_str == "A") { // cursor up
-        //_cmd_stream->printf("curup %d %d %d\r\n", _history_pos, _history.size());
-        if(_history_pos < ((int8_t)_history.size() - 1)) {
-          if(_history_pos == -1) {
-            _input_cache = _current_input;
-          }
-          _history_pos++;
-          _current_input = _history.at(_history_pos);
-          _cmd_stream->printf("\33[2K\r%s", _current_input.c_str());
-          _current_pos = _current_input.length();
-          splitCmdline();
-        } else {
-          _cmd_stream->printf("\a");
-        }
-      } else if(csi_str == "B") { // cursor down
-        //_cmd_stream->printf("curdown %d\r\n", _history_pos);
-        if(_history_pos > -1) {
-          _history_pos--;
-          if(_history_pos == -1) {
-            _current_input = _input_cache;
-          } else {
-            _current_input = _history.at(_history_pos);
-          }
-          _cmd_stream->printf("\33[2K\r%s", _current_input.c_str());
-          _current_pos = _current_input.length();
-          splitCmdline();
-        } else {
-          _cmd_stream->printf("\a");
-        }
-      } else if(csi_str == "C") { // cursor right
-        if(_current_pos < _current_input.length()) {
-          _cmd_stream->printf("\33[C");
-          _current_pos++;
-        }
-      } else if(csi_str == "D") { // cursor left
-        if(_current_pos) {
-          _cmd_stream->printf("\33[D");
-          _current_pos--;
+  } else if(_csi) {
+    if((c < 0x40) || (c > 0x7E)) {
+      _csi_len++;
+      return true;
+    }
+    if(_csi_len) {
+      _cmd_stream->printf("\a");
+    } else if(c == 'A') { // cursor up
+      if(_history_pos < (int8_t)_history_ct - 1) {
+        if(_history_pos == -1) {
+          strcpy(_input_cache, _line);
         }
+        _history_pos++;
+        showLine(history(_history_pos));
       } else {
         _cmd_stream->printf("\a");
-        //_cmd_stream->printf("csi %s\r\n", csi_str.c_str());
       }
-      csi_str = "";
-      csi = false;
+    } else if(c == 'B') { // cursor down
+      if(_history_pos > -1) {
+        _history_pos--;
+        showLine((_history_pos == -1) ? _input_cache : history(_history_pos));
+      } else {
+        _cmd_stream->printf("\a");
+      }
+    } else if(c == 'C') { // cursor right
+      if(_pos < _len) {
+        _cmd_stream->printf("\33[C");
+        _pos++;
+      }
+    } else if(c == 'D') { // cursor left
+      if(_pos) {
+        _cmd_stream->printf("\33[D");
+        _pos--;
+      }
+    } else {
+      _cmd_stream->printf("\a");
     }
+    _csi = false;
     return true;
   }
   if(c == 0x1B) {
-    esc = true;
+    _esc = true;
     return true;
-  } else if(c == 0xC3) {
-    special_char = c;
+  } else if(c == (char)0xC3) {
+    _special_char = c;
     return true;
   }
-  if(!_current_input.isEmpty()) {
-    return false;
-  }
   // TODO handle key cmds
-  //_cmd_stream->printf("key: %02X\r\n", c);
   return false;
 }
 
 void CMD_PROCESSOR::handleCrLf() {
-  if(_current_input.isEmpty() && (_last_char == '\r')) {
+  if(!_len && (_last_char == '\r')) {
     return;
   }
+  trim();
+  writeHistory();
+  dispatch();
+}
+
+// in place, the line is tokenized by the callback only now
+void CMD_PROCESSOR::trim() {
+  while(_len && (_line[_len - 1] == ' ')) {
+    _line[--_len] = '\0';
+  }
+  uint8_t lead = strspn(_line, " ");
+  if(lead) {
+    _len -= lead;
+    memmove(_line, _line + lead, _len + 1);
+  }
+}
+
+// runs the line and clears it, false if nothing matched or the command failed
+bool CMD_PROCESSOR::dispatch() {
+  bool ok = false;
   bool found = false;
-  for(auto it : _cmds) {
-    if(it->handle(_cmd, _args)) {
+  for(uint8_t i = 0; i < _cmd_ct; ++i) {
+    if(!strncmp(_line, _cmds[i].cmd, _cmds[i].len)) {
+      ok = _cmds[i].callback(_line);
       found = true;
       break;
     }
@@ -218,17 +360,22 @@ void CMD_PROCESSOR::handleCrLf() {
   if(!found) {
     _cmd_stream->println(" ??");
   }
-  writeHistory();
-  _current_input = "";
-  //_cmd_stream->printf("h:%d\r\n", _history.size());
+  _len = 0;
+  _line[0] = '\0';
+  return ok;
+}
+
+const char* CMD_PROCESSOR::history(uint8_t i) {
+  return _history[(_history_head + CMD_HISTORY - i) % CMD_HISTORY];
 }
 
 void CMD_PROCESSOR::writeHistory() {
-  if(!_current_input.isEmpty() && (_history.empty() || (_history.at(0) != _current_input))) {
-    _history.insert(_history.begin(), _current_input);
-    if(_history.size() > MAX_HISTORY) {
-      _history.pop_back();
+  if(_len && (!_history_ct || strcmp(history(0), _line))) {
+    _history_head = (_history_head + 1) % CMD_HISTORY;
+    strcpy(_history[_history_head], _line);
+    if(_history_ct < CMD_HISTORY) {
+      _history_ct++;
     }
   }
   _history_pos = -1;
-}
\ No newline at end of file
+}
@@ -0,0 +1,397 @@
+#include <Preferences.h>
+#include <cmath>
+#include "config.h"
+#include "name_index.h"
+
+static constexpr auto config_index = make_name_index<256>(config_fields);
+
+const config_field_t* config_find(const char* name) {
+  return name_index_find(config_index, config_fields, name);
+}
+
+// "1,6,11", "all" or "none" to a channel bitmask
+static bool parseChannels(const char* str, uint16_t &mask) {
+  if(!strcmp(str, "all")) {
+    mask = SCAN_ALL_CHANNELS;
+    return true;
+  } else if(!strcmp(str, "none")) {
+    mask = 0;
+    return true;
+  }
+  uint16_t m = 0;
+  while(*str) {
+    char* end;
+    long ch = strtol(str, &end, 10);
+    if((end == str) || (ch < 1) || (ch > SCAN_MAX_CHANNEL)) {
+      return false;
+    }
+    m |= 1 << (ch - 1);
+    str = (*end == ',') ? end + 1 : end;
+    if(*end && (*end != ',')) {
+      return false;
+    }
+  }
+  mask = m;
+  return true;
+}
+
+static void printChannels(uint16_t mask, Print* out) {
+  if(mask == SCAN_ALL_CHANNELS) {
+    out->print("all");
+    return;
+  } else if(!mask) {
+    out->print("none");
+    return;
+  }
+  const char* sep = "";
+  for(uint8_t ch = 1; ch <= SCAN_MAX_CHANNEL; ++ch) {
+    if(mask & (1 << (ch - 1))) {
+      out->printf("%s%d", sep, ch);
+      sep = ",";
+    }
+  }
+}
+
+// position of value in "<a|b|c>", -1 if it is none of them
+static int findChoice(const char* choices, const char* value) {
+  size_t len = strlen(value);
+  const char* p = choices + 1;
+  for(int i = 0; *p && (*p != '>'); ++i) {
+    const char* end = p + strcspn(p, "|>");
+    if((end - p == (ptrdiff_t)len) && !strncmp(p, value, len)) {
+      return i;
+    }
+    p = (*end == '|') ? end + 1 : end;
+  }
+  return -1;
+}
+
+static void printChoice(const char* choices, int idx, Print* out) {
+  const char* p = choices + 1;
+  while(idx-- && *p && (*p != '>')) {
+    p += strcspn(p, "|>");
+    if(*p == '|') {
+      p++;
+    }
+  }
+  out->write((const uint8_t*)p, strcspn(p, "|>"));
+}
+
+static uint32_t getUint(const uint8_t* v, uint8_t size) {
+  if(size == 1) {
+    return *v;
+  } else if(size == 2) {
+    return *(const uint16_t*)v;
+  }
+  return *(const uint32_t*)v;
+}
+
+static void putUint(uint8_t* v, uint8_t size, uint32_t val) {
+  if(size == 1) {
+    *v = val;
+  } else if(size == 2) {
+    *(uint16_t*)v = val;
+  } else {
+    *(uint32_t*)v = val;
+  }
+}
+
+bool config_set(systemconfig_t* cfg, const config_field_t &f, const char* value) {
+  uint8_t* v = (uint8_t*)cfg + f.offset;
+  if(!*value) {
+    return false;
+  }
+  switch(f.type) {
+    case CF_STR: {
+      size_t len = strlen(value);
+      if(len >= f.size) {
+        return false;
+      }
+      memcpy(v, value, len + 1);
+      return true;
+    }
+    case CF_UINT: {
+      char* end;
+      unsigned long val = strtoul(value, &end, 10);
+      if(*end || (*value == '-') || (val < f.min) || (val > f.max)) {
+        return false;
+      }
+      putUint(v, f.size, val);
+      return true;
+    }
+    case CF_CHANS: {
+      uint16_t mask;
+      if(!parseChannels(value, mask) || (mask < f.min)) {
+        return false;
+      }
+      *(uint16_t*)v = mask;
+      return true;
+    }
+    case CF_CHOICE: {
+      int idx = findChoice(f.help, value);
+      if(idx < 0) {
+        return false;
+      }
+      *v = idx;
+      return true;
+    }
+    case CF_VOLT: {
+      char* end;
+      float val = strtof(value, &end);
+      uint32_t mv = analogReadMilliVolts(6);
+      float offset = cfg->volt_offset / 1000.0f;
+      if(*end || (val <= offset) || !mv) {
+        return false;
+      }
+      *(float*)v = (val - offset) / mv;
+      return true;
+    }
+  }
+  return false;
+}
+
+void config_print(const systemconfig_t* cfg, const config_field_t &f, Print* out) {
+  const uint8_t* v = (const uint8_t*)cfg + f.offset;
+  out->print(f.name);
+  out->print(' ');
+  switch(f.type) {
+    case CF_STR:
+      out->write(v, strnlen((const char*)v, f.size));
+      break;
+    case CF_UINT:
+      out->print((unsigned long)getUint(v, f.size));
+      break;
+    case CF_CHANS:
+      printChannels(*(const uint16_t*)v, out);
+      break;
+    case CF_CHOICE:
+      printChoice(f.help, *v, out);
+      break;
+    case CF_VOLT:
+      out->printf("f %.3f", *(const float*)v * 1000.0);
+      break;
+  }
+  out->println();
+}
+
+void config_help(const config_field_t &f, Print* out) {
+  out->printf("%s %s\r\n", f.name, f.help);
+}
+
+uint16_t config_crc(const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+  uint16_t crc = 0xffff;
+  while(len--) {
+    crc ^= *p++ << 8;
+    for(uint8_t i = 0; i < 8; ++i) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+bool config_cached(const systemconfig_t* cfg, uint16_t crc) {
+  return cfg->valid && (config_crc(cfg, sizeof(*cfg)) == crc);
+}
+
+// largest field plus crc
+static constexpr size_t recordMax() {
+  size_t max = 0;
+  for(const auto &f : config_fields) {
+    max = (f.size > max) ? f.size : max;
+  }
+  return max + 2;
+}
+static constexpr size_t record_max = recordMax();
+
+// value and crc of a field as it goes to nvs
+static size_t makeRecord(const systemconfig_t* cfg, const config_field_t &f, uint8_t* rec) {
+  memcpy(rec, (const uint8_t*)cfg + f.offset, f.size);
+  uint16_t crc = config_crc(rec, f.size);
+  memcpy(rec + f.size, &crc, 2);
+  return f.size + 2;
+}
+
+// the single "system" blob written before CONFIG_VERSION 1. firmware up to then only appended
+// fields, so an older blob is a prefix of this, down to the 192 bytes of the first one
+struct legacy_config_v0_t {
+  bool valid;
+  char hostname[32];
+  char ssid[32];
+  char wifi_pw[32];
+  char mqtt_server[32];
+  uint16_t mqtt_server_port;
+  char mqtt_topic[40];
+  uint16_t retry;
+  uint16_t interval;
+  float voltage_faktor;
+  uint16_t id;
+  uint32_t wifi_wait;
+  uint16_t scan_channel_time;
+  bool ext_antenna;
+  uint16_t fast_wait;
+  uint16_t scan_channels;
+  uint16_t scan_passive;
+  uint16_t scan_min_time;
+  uint8_t scan_max_ch;
+  uint8_t scan_explore;
+  uint8_t payload_format;
+  uint8_t batch_wakes;
+  uint8_t trace_send;
+  energy_currents_t currents;
+  uint16_t capacity_mah;
+  uint8_t same_pct;
+  uint8_t heartbeat;
+  uint8_t delta_send;
+};
+static_assert(offsetof(legacy_config_v0_t, mqtt_server_port) == 130, "legacy layout is frozen");
+static_assert(offsetof(legacy_config_v0_t, voltage_faktor) == 176, "legacy layout is frozen");
+static_assert(offsetof(legacy_config_v0_t, id) == 180, "legacy layout is frozen");
+static_assert(offsetof(legacy_config_v0_t, wifi_wait) == 184, "legacy layout is frozen");
+static_assert(offsetof(legacy_config_v0_t, fast_wait) == 192, "legacy layout is frozen");
+static_assert(offsetof(legacy_config_v0_t, currents) == 206, "legacy layout is frozen");
+static_assert(sizeof(legacy_config_v0_t) == 220, "legacy layout is frozen");
+
+// the members the blob holds go over the defaults in cfg one by one
+static bool loadBlob(Preferences &prefs, systemconfig_t* cfg) {
+  size_t len = prefs.getBytesLength("system");
+  if((len < offsetof(legacy_config_v0_t, fast_wait)) || (len > sizeof(legacy_config_v0_t))) {
+    return false;
+  }
+  legacy_config_v0_t blob;
+  prefs.getBytes("system", &blob, len);
+#define LEGACY_COPY(member) \
+  static_assert(sizeof(blob.member) == sizeof(cfg->member), "same type"); \
+  if(offsetof(legacy_config_v0_t, member) + sizeof(blob.member) <= len) { \
+    memcpy(&cfg->member, &blob.member, sizeof(blob.member)); \
+  }
+  LEGACY_COPY(hostname);
+  LEGACY_COPY(ssid);
+  LEGACY_COPY(wifi_pw);
+  LEGACY_COPY(mqtt_server);
+  LEGACY_COPY(mqtt_server_port);
+  LEGACY_COPY(mqtt_topic);
+  LEGACY_COPY(retry);
+  LEGACY_COPY(interval);
+  LEGACY_COPY(voltage_faktor);
+  LEGACY_COPY(id);
+  LEGACY_COPY(wifi_wait);
+  LEGACY_COPY(scan_channel_time);
+  LEGACY_COPY(ext_antenna);
+  LEGACY_COPY(fast_wait);
+  LEGACY_COPY(scan_channels);
+  LEGACY_COPY(scan_passive);
+  LEGACY_COPY(scan_min_time);
+  LEGACY_COPY(scan_max_ch);
+  LEGACY_COPY(scan_explore);
+  LEGACY_COPY(payload_format);
+  LEGACY_COPY(batch_wakes);
+  LEGACY_COPY(trace_send);
+  LEGACY_COPY(currents);
+  LEGACY_COPY(capacity_mah);
+  LEGACY_COPY(same_pct);
+  LEGACY_COPY(heartbeat);
+  LEGACY_COPY(delta_send);
+#undef LEGACY_COPY
+  return true;
+}
+
+// false if a stored value is one config_set() would have refused
+static bool inRange(const systemconfig_t* cfg, const config_field_t &f) {
+  const uint8_t* v = (const uint8_t*)cfg + f.offset;
+  switch(f.type) {
+    case CF_STR:
+      return memchr(v, '\0', f.size) != nullptr;
+    case CF_UINT:
+    case CF_CHANS:
+      return (getUint(v, f.size) >= f.min) && (getUint(v, f.size) <= f.max);
+    case CF_CHOICE:
+      return *v <= f.max;
+    case CF_VOLT:
+      return std::isfinite(*(const float*)v) && (*(const float*)v > 0);
+  }
+  return false;
+}
+
+// fields out of range get back what they held before the load
+static void checkRanges(systemconfig_t* cfg, const systemconfig_t &before) {
+  for(const auto &f : config_fields) {
+    if(!inRange(cfg, f)) {
+      memcpy((uint8_t*)cfg + f.offset, (const uint8_t*)&before + f.offset, f.size);
+    }
+  }
+}
+
+bool config_load(systemconfig_t* cfg) {
+  Preferences prefs;
+  if(!prefs.begin("config", true)) {
+    return false;
+  }
+  const systemconfig_t before = *cfg;
+  uint16_t version = 0;
+  prefs.getBytes("ver", &version, sizeof(version));
+  if(!version) {
+    bool found = loadBlob(prefs, cfg);
+    prefs.end();
+    if(found) {
+      checkRanges(cfg, before);
+      config_store(cfg);
+    }
+    return found;
+  }
+  uint8_t rec[record_max];
+  uint8_t good = 0;
+  for(const auto &f : config_fields) {
+    if(prefs.getBytes(f.name, rec, sizeof(rec)) != f.size + 2u) {
+      continue;
+    }
+    uint16_t crc;
+    memcpy(&crc, rec + f.size, 2);
+    if(config_crc(rec, f.size) == crc) {
+      memcpy((uint8_t*)cfg + f.offset, rec, f.size);
+      good++;
+    }
+  }
+  prefs.end();
+  if(!good) {
+    return false;
+  }
+  checkRanges(cfg, before);
+  cfg->valid = true;
+  return true;
+}
+
+int config_store(systemconfig_t* cfg) {
+  Preferences prefs;
+  if(!prefs.begin("config")) {
+    return -1;
+  }
+  cfg->valid = true;
+  int written = 0;
+  uint8_t rec[record_max];
+  uint8_t old[record_max];
+  for(const auto &f : config_fields) {
+    size_t len = makeRecord(cfg, f, rec);
+    // flash is written only for changed fields, a repeated save costs reads only
+    if((prefs.getBytes(f.name, old, sizeof(old)) == len) && !memcmp(old, rec, len)) {
+      continue;
+    }
+    if(prefs.putBytes(f.name, rec, len) != len) {
+      prefs.end();
+      return -1;
+    }
+    written++;
+  }
+  // the version goes last, a save cut short by a reset still loads as the old version
+  uint16_t version = 0;
+  prefs.getBytes("ver", &version, sizeof(version));
+  if(version != CONFIG_VERSION) {
+    uint16_t v = CONFIG_VERSION;
+    prefs.putBytes("ver", &v, sizeof(v));
+  }
+  if(prefs.isKey("system")) {
+    prefs.remove("system");
+  }
+  prefs.end();
+  return written;
+}
@@ -0,0 +1,42 @@
+#include "cpu_policy.h"
+
+CPU_POLICY::CPU_POLICY() : _policy(CPU_FIXED_LOW), _dfs(false), _held(false), _lock(nullptr) {
+}
+
+void CPU_POLICY::begin(cpu_policy_t policy, bool light_sleep) {
+  _policy = policy;
+  int max_mhz = (policy == CPU_FIXED_LOW) ? CPU_LOW_MHZ : CPU_HIGH_MHZ;
+  int min_mhz = light_sleep ? CPU_SLEEP_MHZ : (policy == CPU_FIXED_HIGH) ? CPU_HIGH_MHZ : CPU_LOW_MHZ;
+  esp_pm_config_t pm = {.max_freq_mhz = max_mhz, .min_freq_mhz = min_mhz, .light_sleep_enable = light_sleep};
+  _dfs = (esp_pm_configure(&pm) == ESP_OK);
+  if(_dfs && !_lock) {
+    _dfs = (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "phase", &_lock) == ESP_OK);
+  }
+  if(!_dfs) {
+    setCpuFrequencyMhz(CPU_LOW_MHZ);
+    _held = false;
+  }
+  phase(CS_IDLE);
+}
+
+void CPU_POLICY::phase(cycle_state_t state) {
+  bool high = (_policy == CPU_FIXED_HIGH) || ((_policy == CPU_PHASES) && ((1 << state) & CPU_FAST_PHASES));
+  if(high == _held) {
+    return;
+  }
+  _held = high;
+  if(_dfs) {
+    // the lock only keeps the clock up, without it dfs drops to min_freq_mhz
+    if(high) {
+      esp_pm_lock_acquire(_lock);
+    } else {
+      esp_pm_lock_release(_lock);
+    }
+  } else {
+    setCpuFrequencyMhz(high ? CPU_HIGH_MHZ : CPU_LOW_MHZ);
+  }
+}
+
+uint16_t CPU_POLICY::mhz() {
+  return getCpuFrequencyMhz();
+}
@@ -0,0 +1,99 @@
+#include "dlog.h"
+#include "config.h"
+
+DLOG::DLOG(struct dlog_t* state) : _state(state) {
+}
+
+void DLOG::begin() {
+  if((_state->magic != DLOG_MAGIC) || (_state->head >= DLOG_RING) || (_state->len > DLOG_RING)) {
+    clear();
+  }
+}
+
+void DLOG::clear() {
+  portENTER_CRITICAL(&_mux);
+  _state->magic = DLOG_MAGIC;
+  _state->head = 0;
+  _state->len = 0;
+  _state->dropped = 0;
+  portEXIT_CRITICAL(&_mux);
+}
+
+uint16_t DLOG::pending() {
+  return _state->len;
+}
+
+void DLOG::copyOut(uint16_t pos, uint8_t* dst, uint16_t n) {
+  for(uint16_t i = 0; i < n; ++i) {
+    dst[i] = _state->ring[(pos + i) % DLOG_RING];
+  }
+}
+
+void DLOG::dropOldest() {
+  uint16_t n = DLOG_HEADER + _state->ring[(_state->head + DLOG_HEADER - 1) % DLOG_RING];
+  _state->head = (_state->head + n) % DLOG_RING;
+  _state->len -= n;
+  _state->dropped++;
+}
+
+void DLOG::append(uint16_t id, const uint8_t* args, uint8_t len) {
+  uint32_t ms = millis();
+  uint8_t header[DLOG_HEADER] = {(uint8_t)id, (uint8_t)(id >> 8), (uint8_t)ms, (uint8_t)(ms >> 8),
+                                 (uint8_t)(ms >> 16), (uint8_t)(ms >> 24), len};
+  uint16_t n = DLOG_HEADER + len;
+  portENTER_CRITICAL(&_mux);
+  while(_state->len + n > DLOG_RING) {
+    dropOldest();
+  }
+  uint16_t tail = (_state->head + _state->len) % DLOG_RING;
+  for(uint16_t i = 0; i < n; ++i) {
+    _state->ring[(tail + i) % DLOG_RING] = (i < DLOG_HEADER) ? header[i] : args[i - DLOG_HEADER];
+  }
+  _state->len += n;
+  portEXIT_CRITICAL(&_mux);
+}
+
+size_t DLOG::flush(Print* out, size_t max) {
+  size_t sent = 0;
+  uint8_t block[3 + DLOG_BLOCK_MAX + 2];
+  for(;;) {
+    // whole records that fit the block and the room on the uart, copied under the lock
+    uint16_t len = 0;
+    uint16_t take = 0;
+    portENTER_CRITICAL(&_mux);
+    if(_state->dropped) {
+      uint32_t ms = millis();
+      uint8_t dropped[DLOG_HEADER + 4] = {DLOG_ID_DROPPED, 0, (uint8_t)ms, (uint8_t)(ms >> 8), (uint8_t)(ms >> 16),
+                                          (uint8_t)(ms >> 24), 4, (uint8_t)_state->dropped,
+                                          (uint8_t)(_state->dropped >> 8), 0, 0};
+      memcpy(block + 3, dropped, sizeof(dropped));
+      len = sizeof(dropped);
+    }
+    while(take < _state->len) {
+      uint16_t n = DLOG_HEADER + _state->ring[(_state->head + take + DLOG_HEADER - 1) % DLOG_RING];
+      if((len + n > DLOG_BLOCK_MAX) || (sent + len + n + 5 > max)) {
+        break;
+      }
+      copyOut(_state->head + take, block + 3 + len, n);
+      len += n;
+      take += n;
+    }
+    if(!len || (sent + len + 5 > max)) {
+      portEXIT_CRITICAL(&_mux);
+      break;
+    }
+    _state->head = (_state->head + take) % DLOG_RING;
+    _state->len -= take;
+    _state->dropped = 0;
+    portEXIT_CRITICAL(&_mux);
+    uint16_t crc = config_crc(block + 3, len);
+    block[0] = DLOG_BLOCK_MAGIC0;
+    block[1] = DLOG_BLOCK_MAGIC1;
+    block[2] = len;
+    block[3 + len] = crc;
+    block[4 + len] = crc >> 8;
+    out->write(block, len + 5);
+    sent += len + 5;
+  }
+  return sent;
+}
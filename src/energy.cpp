@@ -0,0 +1,115 @@
+#include "energy.h"
+
+static const char* state_names[ES_COUNT] = {"idle", "scan", "radio"};
+
+// open circuit voltage to % charge of a lipo cell
+static const struct {
+  uint16_t mv;
+  uint8_t pct;
+} lipo_curve[] = {
+  {4200, 100}, {4100, 90}, {4000, 78}, {3900, 65}, {3800, 50},
+  {3700, 35}, {3600, 20}, {3500, 10}, {3400, 4}, {3300, 0},
+};
+
+ENERGY::ENERGY(struct energy_t* energy)
+  : _energy(energy), _currents{}, _state(ES_IDLE), _mhz(ENERGY_BASE_MHZ), _since(0) {
+}
+
+void ENERGY::begin(const energy_currents_t &currents) {
+  _currents = currents;
+  _state = ES_IDLE;
+  _mhz = ENERGY_BASE_MHZ;
+  _since = 0;
+}
+
+void ENERGY::book() {
+  uint32_t now = millis();
+  uint32_t ms = now - _since;
+  static_assert(ES_COUNT == 3, "current per state");
+  uint16_t ma = (_state == ES_SCAN) ? _currents.scan_ma : (_state == ES_RADIO) ? _currents.radio_ma : _currents.idle_ma;
+  int32_t ua = ma * 1000 + ((int32_t)_mhz - ENERGY_BASE_MHZ) * ENERGY_UA_PER_MHZ;
+  _energy->ua_ms += (uint64_t)((ua > 0) ? ua : 0) * ms;
+  _energy->state_ms[_state] += ms;
+  _since = now;
+}
+
+void ENERGY::state(energy_state_t state) {
+  if(state != _state) {
+    book();
+    _state = state;
+  }
+}
+
+void ENERGY::cpu(uint16_t mhz) {
+  if(mhz != _mhz) {
+    book();
+    _mhz = mhz;
+  }
+}
+
+void ENERGY::sleep(uint32_t seconds) {
+  book();
+  _energy->ua_ms += (uint64_t)_currents.sleep_ua * 1000 * seconds;
+  _energy->sleep_s += seconds;
+  _energy->wakes++;
+}
+
+void ENERGY::clear() {
+  memset(_energy, 0, sizeof(*_energy));
+  _since = millis();
+}
+
+uint32_t ENERGY::usedUah() {
+  return _energy->ua_ms / 3600000ULL;
+}
+
+float ENERGY::mahPerWake() {
+  return _energy->wakes ? _energy->ua_ms / 3.6e9 / _energy->wakes : 0;
+}
+
+float ENERGY::mahPerDay() {
+  double ms = _energy->sleep_s * 1000.0;
+  for(int i = 0; i < ES_COUNT; ++i) {
+    ms += _energy->state_ms[i];
+  }
+  return (ms > 0) ? _energy->ua_ms / 3.6e9 * 86.4e6 / ms : 0;
+}
+
+uint8_t ENERGY::charge(float voltage) {
+  uint16_t mv = voltage * 1000.0f;
+  if(mv >= lipo_curve[0].mv) {
+    return 100;
+  }
+  for(size_t i = 1; i < sizeof(lipo_curve) / sizeof(lipo_curve[0]); ++i) {
+    if(mv >= lipo_curve[i].mv) {
+      // linear between the points
+      return lipo_curve[i].pct + (lipo_curve[i - 1].pct - lipo_curve[i].pct) * (mv - lipo_curve[i].mv) /
+                                 (lipo_curve[i - 1].mv - lipo_curve[i].mv);
+    }
+  }
+  return 0;
+}
+
+uint16_t ENERGY::daysLeft(float voltage, uint16_t capacity_mah) {
+  float per_day = mahPerDay();
+  if(per_day <= 0) {
+    return 0xffff;
+  }
+  float days = capacity_mah * charge(voltage) / 100.0f / per_day;
+  return (days > 0xfffe) ? 0xfffe : (uint16_t)days;
+}
+
+void ENERGY::print(Print* out, float voltage, uint16_t capacity_mah) {
+  out->printf("used %.3f mAh in %lu wakes, %.4f mAh per wake\r\n", _energy->ua_ms / 3.6e9,
+              (unsigned long)_energy->wakes, mahPerWake());
+  for(int i = 0; i < ES_COUNT; ++i) {
+    out->printf("%-6s %8lu ms\r\n", state_names[i], (unsigned long)_energy->state_ms[i]);
+  }
+  out->printf("sleep  %8lu s\r\n", (unsigned long)_energy->sleep_s);
+  out->printf("%.2f mAh per day, battery %d%% of %d mAh", mahPerDay(), charge(voltage), capacity_mah);
+  uint16_t days = daysLeft(voltage, capacity_mah);
+  if(days != 0xffff) {
+    out->printf(", %d days left", days);
+  }
+  out->println();
+}
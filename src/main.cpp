@@ -1,123 +1,200 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include <esp_wifi.h>
-#include <Preferences.h>
+#include <esp_pm.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
 #include <AsyncMqttClient.h>
-#include <ArduinoJson.h>
 #include "EasyButton.h"
 #include "cmd_processor.h"
+#include "scan_planner.h"
+#include "payload.h"
+#include "batch.h"
+#include "config.h"
+#include "trace.h"
+#include "energy.h"
+#include "snapshot.h"
+#include "wake_cycle.h"
+#include "sleep_planner.h"
+#include "battery.h"
+#include "cpu_policy.h"
+#include "dlog.h"
+#include "press_stats.h"
+#include "name_index.h"
 
 #define BUTTON_PIN D0
 #define BUTTON_PIN_BITMASK (1ULL << GPIO_NUM_0) // GPIO 0 bitmask for ext1
 #define FactorSeconds 1000000ULL
-#define WIFI_WAIT_TIME 15000UL
+#define FAST_LEASE_TIME 14400UL   // sec a cached ip is reused before asking dhcp again
+#define BLINK_TIME 200UL
+#define MQTT_QOS1 0               // one message, radio on until its puback
+#define MQTT_QOS0 1               // one message, sleep once tcp has it delivered
+#define MQTT_PIPE 2               // message plus the values on subtopics, pubacks awaited together
+#define BUTTON_SETTLE_MS 100UL    // polled this long after an edge, EasyButton debounces by polling
+#define PRESS_FAST_WAIT 1500     // ms a press tries the cached ap when "fast" is 0
 
 AsyncMqttClient mqttClient;
 CMD_PROCESSOR cmd_processor = CMD_PROCESSOR();
 EasyButton button(BUTTON_PIN);
 
-struct systemconfig_t {
+RTC_DATA_ATTR struct systemconfig_t sys_config;
+RTC_DATA_ATTR uint16_t sys_config_crc;  // rtc copy is trusted only while it matches
+
+// last good connection, lets the next wake skip the scan and dhcp
+struct wifi_cache_t {
   bool valid;
-  char hostname[32];
-  char ssid[32];
-  char wifi_pw[32];
-  char mqtt_server[32];
-  uint16_t mqtt_server_port;
-  char mqtt_topic[40];
-  uint16_t retry;
-  uint16_t interval;
-  float voltage_faktor;
-  uint16_t id;
-  uint32_t wifi_wait;
-  uint16_t scan_channel_time;
-  bool ext_antenna;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t netmask;
+  uint32_t dns;
+  uint32_t age;            // sec slept since the lease was taken
 };
-RTC_DATA_ATTR struct systemconfig_t sys_config;
+RTC_DATA_ATTR struct wifi_cache_t wifi_cache;
+// broker address of the last lookup, the next wakes connect without dns
+struct broker_cache_t {
+  bool valid;
+  uint32_t ip;
+  uint16_t host_crc;       // of the server name it belongs to
+  uint32_t age;            // sec slept since the lookup
+};
+RTC_DATA_ATTR struct broker_cache_t broker_cache;
+RTC_DATA_ATTR struct scan_stats_t scan_stats;
+SCAN_PLANNER scan_planner(&scan_stats);
+RTC_DATA_ATTR struct batch_t batch_state;
+BATCH_BUFFER batch(&batch_state);
+RTC_DATA_ATTR struct trace_t trace_state;
+TRACE trace(&trace_state);
+uint8_t trace_sent = 0;            // trace events in the message in flight
+RTC_DATA_ATTR struct energy_t energy_state;
+ENERGY energy(&energy_state);
+RTC_DATA_ATTR struct snapshot_state_t snapshot_state;
+AP_SNAPSHOT snapshot(&snapshot_state);
+ap_snapshot_t scan_snapshot;       // AP set of this wake
+ap_snapshot_t next_snapshot;       // what the backend knows once the send is acknowledged
+bool snapshot_pending = false;
+RTC_DATA_ATTR struct cycle_stats_t cycle_stats;
+WAKE_CYCLE cycle(&cycle_stats);
+RTC_DATA_ATTR struct sleep_state_t sleep_state;
+SLEEP_PLANNER sleep_planner(&sleep_state);
+RTC_DATA_ATTR struct battery_t battery_state;
+BATTERY battery(&battery_state);
+RTC_DATA_ATTR struct press_stats_t press_state;
+PRESS_STATS press_stats(&press_state);
+CPU_POLICY cpu_policy;
 
 bool uart_avail = false;
+// loop() sleeps on these until something happens or the next deadline is due
+#define EV_RX (1 << 0)
+#define EV_BUTTON (1 << 1)
+#define EV_NET (1 << 2)
+#define EV_ADC (1 << 3)
+EventGroupHandle_t loop_events;
+volatile uint32_t button_edge = 0;
 float voltage;
-JsonDocument ap_list;              // json access point list from scan
+payload_t payload;                 // access point list from scan + status
+char payload_buf[PAYLOAD_SIZE];    // serialized payload, handed to the mqtt client
 std::vector<int> mqtt_pkt_ids;     // list of published packets
-volatile bool mqtt_queued = false; // set if mqtt client has published async
-bool send_failed = false;
+volatile bool mqtt_flushed = false; // qos0: the connection closed behind the message
+bool broker_cached = false;        // this connect uses the cached broker address
+volatile bool broker_connect = false; // loop() connects, the lookup in setBroker() may block on dns
+char mqtt_client_id[24];           // fixed per device, the broker finds a kept session by it
 uint32_t mid_time;                 // used to calc run time
-uint32_t wifi_start_time = 0;
 uint16_t send_cause = 0;
 uint8_t channel = 1;
-uint8_t app_ct = 0;
 uint8_t best_channel = 0;
 int best_rssi = -200;
 uint8_t best_bssid[6];
+bool fast_connect = false;         // set while connecting with the cached ap
+bool scan_only = false;            // batch wake, the scan is stored instead of sent
+bool change_check = false;         // timer wake, the send is skipped if the AP set is the same
+volatile bool skip_send = false;   // scan handled without a send, ready to sleep
+volatile bool batch_due = false;   // with skip_send, loop() puts the scan into the batch ring
+bool press = false;                // this send carries a button press, until its "pressed" is acked
+uint32_t press_ms = 0;             // millis() of the press, 0 on a button wake
+int press_pkt = 0;                 // packet id of "pressed"
+int32_t press_sent = -1;           // press_stats.total() of the histogram in flight, -1 = none
+bool fast_dhcp = false;            // fast connect with the cached ap, the lease is too old to reuse
 
 RTC_NOINIT_ATTR int wifi_failed_ct;
 RTC_NOINIT_ATTR int mqtt_failed_ct;
 RTC_NOINIT_ATTR int button_wakeups;
 RTC_NOINIT_ATTR uint32_t run_time;
 
-#ifdef DEBUG
-#define Debugprint(...) Serial0.print(__VA_ARGS__)
-#define Debugprintln(...) Serial0.println(__VA_ARGS__)
-#define Debugprintf(...) Serial0.printf(__VA_ARGS__)
-#else
-#define Debugprint(...)
-#define Debugprintln(...)
-#define Debugprintf(...)
-#endif
-
-bool get_system_config(struct systemconfig_t *sys_cfg) {
-  Debugprint("load syscfg ");
-  Preferences prefs;
-  if(prefs.begin("config")) {
-    size_t len = prefs.getBytesLength("system");
-    if(len > 0) {
-      prefs.getBytes("system", sys_cfg, len);
-    }
-    prefs.end();
-  } else {
-    sys_cfg->valid = false;
-    Debugprintln("failed");
-    return false;
-  }
-  Debugprintln("ok");
-  return true;
-}
+// log records go to a ring, Serial0 gets them when loop() is idle and before deep sleep
+RTC_NOINIT_ATTR dlog_t dlog_state;
+DLOG dlog(&dlog_state);
+#define Logerror(...) DLOG_AT(dlog, DLOG_ERROR, __VA_ARGS__)
+#define Logwarn(...) DLOG_AT(dlog, DLOG_WARN, __VA_ARGS__)
+#define Loginfo(...) DLOG_AT(dlog, DLOG_INFO, __VA_ARGS__)
+#define Logdebug(...) DLOG_AT(dlog, DLOG_DEBUG, __VA_ARGS__)
 
-bool store_system_config(struct systemconfig_t *sys_cfg) {
-  Preferences prefs;
-  if(!prefs.begin("config")) {
-    return false;
-  }  
-  prefs.clear();
-  sys_cfg->valid = true;
-  if(prefs.putBytes("system", sys_cfg, sizeof(systemconfig_t)) != sizeof(systemconfig_t)) {
-    prefs.clear();
-    prefs.end();
-    return false;
+// idle: what the uart buffer takes without blocking, before sleep: all of it
+void flushLog(bool all) {
+#if DLOG_LEVEL
+  dlog.flush(&Serial0, all ? SIZE_MAX : Serial0.availableForWrite());
+  if(all) {
+    Serial0.flush();
   }
-  prefs.end();
-  return true;
+#endif
 }
 
 void goToSleep(int seconds) {
   if(seconds) {
     esp_sleep_enable_timer_wakeup(FactorSeconds * seconds);
+    wifi_cache.age += seconds;
+    broker_cache.age += seconds;
   }
+  batch.sleep(seconds);
+  battery.sleep(seconds);
   //esp_deep_sleep_enable_gpio_wakeup(BUTTON_PIN_BITMASK, ESP_GPIO_WAKEUP_GPIO_LOW);
   esp_sleep_enable_ext1_wakeup(BUTTON_PIN_BITMASK,ESP_EXT1_WAKEUP_ANY_LOW);
   esp_deep_sleep_disable_rom_logging();
   digitalWrite(LED_BUILTIN, HIGH);
-  Debugprintf("sleep for %d sec after %d ms\r\n\r\n", seconds, millis());
+  Loginfo("sleep for %d s", seconds);
+  flushLog(true);
   run_time += millis() - mid_time;
+  sys_config_crc = config_crc(&sys_config, sizeof(sys_config));
+  trace.mark(TP_SLEEP);
+  energy.sleep(seconds);
   esp_deep_sleep_start();
 }
 
-uint16_t mqtt_publish_str(const char* subtopic, const char* data) {
+// sec since midnight utc, -1 until sntp set the clock, it runs on through deep sleep
+int32_t utcSecOfDay() {
+  struct tm tm;
+  if(!getLocalTime(&tm, 0)) {
+    return -1;
+  }
+  return tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+}
+
+// the battery reading of this wake, sampling ends early if it is needed before its window is over
+float readBattery() {
+  if(battery.running()) {
+    battery.end();
+    Logdebug("battery %.3f V, smoothed %.3f V", battery.voltage(), battery.smoothed());
+  }
+  voltage = battery.voltage();
+  return voltage;
+}
+
+// timer wake: interval, or retry backing off after failed sends, both stretched on a low battery
+uint32_t nextSleep(bool retry) {
+  sleep_planner.begin(sys_config.sleep, sys_config.interval, sys_config.retry);
+  uint32_t seconds = sleep_planner.next(retry, ENERGY::charge(readBattery()), utcSecOfDay(), esp_random());
+  Loginfo("next wake in %u s, %u failed in a row", seconds, sleep_planner.fails());
+  return seconds;
+}
+
+uint16_t mqtt_publish_str(const char* subtopic, const char* data, uint8_t qos = 1) {
   if(!mqttClient.connected()) {
     return 0;
   }
   char topic[64];
   sprintf(topic, "%s/%d/%s", sys_config.mqtt_topic, sys_config.id, subtopic);
-  return mqttClient.publish( topic, 1, false, data);
+  return mqttClient.publish( topic, qos, false, data);
 }
 
 uint16_t mqtt_publish_int(const char* subtopic, int data) {
@@ -132,306 +209,544 @@ uint16_t mqtt_publish_float(const char* subtopic, float data) {
   return mqtt_publish_str(subtopic, str);
 }
 
+// from the press edge, on a button wake from setup(), the boot before it is not seen
+void pressAcked(uint32_t now) {
+  press = false;
+  press_stats.acked(now - press_ms);
+  Loginfo("press acked after %u ms", now - press_ms);
+}
+
 void onMqttPublish(int packet_id) {
+  xEventGroupSetBits(loop_events, EV_NET);
+  trace.mark(TP_PUBACK);
+  if(press && (packet_id == press_pkt)) {
+    pressAcked(millis());
+  }
   std::erase_if(mqtt_pkt_ids, [packet_id] (const int& id) { return id == packet_id; });
 }
 
+void onMqttDisconnect(AsyncMqttClientDisconnectReason reason) {
+  mqtt_flushed = true;
+  if((cycle.state() == CS_MQTT) && broker_cached) {
+    // the broker may have moved, try once more with a fresh lookup
+    broker_cache.valid = false;
+    broker_connect = true;
+  }
+  xEventGroupSetBits(loop_events, EV_NET);
+}
+
 void onMqttConnect(bool sessionPresent) {
-  char uptime[16];
-  char str[16];
-  
-  Debugprintln("Connected to MQTT.");
-  Debugprintf("Session present: %d\r\n", sessionPresent);
-  //Debugprintf("Button pressed %d\r\n", button_wakeups);
-  //Debugprintf("voltage: %.2f\r\n", voltage);
+  xEventGroupSetBits(loop_events, EV_NET);
+  cycle.event(CE_MQTT_CONNECTED, millis());
+  trace.mark(TP_MQTT_CONNECTED);
+  Loginfo("mqtt connected, session present %d", sessionPresent);
 
   mqtt_pkt_ids.clear();
-  //mqtt_pkt_ids.push_back(mqtt_publish_float("voltage", voltage));
-  //mqtt_pkt_ids.push_back(mqtt_publish_int("button_ct", button_wakeups));
-  String output;
-  //serializeJson(ap_list, output);
-  //mqtt_pkt_ids.push_back(mqtt_publish_str("aps", output.c_str()));
-  ap_list["voltage"] = voltage;
-  ap_list["button_ct"] = button_wakeups;
-  ap_list["id"] = sys_config.id;
-  ap_list["wifi_fail"] = wifi_failed_ct;
-  ap_list["mqtt_fail"] = mqtt_failed_ct;
+  mqtt_flushed = false;
+  uint8_t qos = (sys_config.mqtt_mode == MQTT_QOS0) ? 0 : 1;
+  if(press) {
+    // a few bytes ahead of the message, its puback is what the user waits for
+    char count[8];
+    sprintf(count, "%d", button_wakeups);
+    press_pkt = mqtt_publish_str("pressed", count, qos);
+    if(qos) {
+      mqtt_pkt_ids.push_back(press_pkt);
+    }
+  }
+  if(press_stats.unpublished()) {
+    char stats[192];
+    if(press_stats.toJson(stats, sizeof(stats))) {
+      uint16_t id = mqtt_publish_str("press_ms", stats, qos);
+      if(qos) {
+        mqtt_pkt_ids.push_back(id);
+      }
+      press_sent = press_stats.total();
+    }
+  }
+  payload.voltage = voltage;
+  payload.button_ct = button_wakeups;
+  payload.id = sys_config.id;
+  payload.wifi_fail = wifi_failed_ct;
+  payload.mqtt_fail = mqtt_failed_ct;
   mid_time = millis();
   run_time += mid_time;
-  ap_list["send_cause"] = send_cause;
-  ap_list["runtime"] = run_time;
-  serializeJson(ap_list, output);
-  int id = mqttClient.publish(sys_config.mqtt_topic, 1, false, output.c_str());
-  mqtt_pkt_ids.push_back(id);
-  mqtt_queued = true;
-  #ifdef DEBUG
-  serializeJsonPretty(ap_list, output);
-  Debugprintln(output);
-  #endif
+  payload.send_cause = send_cause;
+  payload.runtime = run_time;
+  payload.used_uah = energy.usedUah();
+  // the average over wakes, a single reading jumps with the load
+  float smoothed = battery.smoothed();
+  payload.days_left = energy.daysLeft((smoothed > 0) ? smoothed : voltage, sys_config.capacity_mah);
+  payload.batch = &batch;
+  payload.trace = sys_config.trace_send ? &trace : nullptr;
+  payload.trace_ct = trace.complete();
+  trace_sent = payload.trace ? payload.trace_ct : 0;
+  size_t len;
+  if(sys_config.payload_format == PAYLOAD_BIN) {
+    len = payload_to_bin(&payload, (uint8_t*)payload_buf, sizeof(payload_buf));
+    Logdebug("%u bytes binary payload", (unsigned)len);
+  } else {
+    len = payload_to_json(&payload, payload_buf, sizeof(payload_buf));
+    Logdebug("%u bytes json payload", (unsigned)len);
+  }
+  if(sys_config.mqtt_mode == MQTT_QOS0) {
+    mqttClient.publish(sys_config.mqtt_topic, 0, false, payload_buf, len);
+    // DISCONNECT goes out behind the message, the close means tcp got everything to the broker
+    mqttClient.disconnect();
+  } else {
+    mqtt_pkt_ids.push_back(mqttClient.publish(sys_config.mqtt_topic, 1, false, payload_buf, len));
+  }
+  if(sys_config.mqtt_mode == MQTT_PIPE) {
+    // back to back without waiting, the pubacks arrive together one round trip later
+    mqtt_pkt_ids.push_back(mqtt_publish_float("voltage", voltage));
+    mqtt_pkt_ids.push_back(mqtt_publish_int("button_ct", button_wakeups));
+    mqtt_pkt_ids.push_back(mqtt_publish_int("wifi_fail", wifi_failed_ct));
+    mqtt_pkt_ids.push_back(mqtt_publish_int("mqtt_fail", mqtt_failed_ct));
+    mqtt_pkt_ids.push_back(mqtt_publish_int("days_left", payload.days_left));
+  }
+  cycle.event(CE_PUBLISHED, millis());
+}
+
+// connect by address: the server is one, or the cached lookup is young enough, or it is looked up now
+void setBroker() {
+  IPAddress ip;
+  uint16_t host_crc = config_crc(sys_config.mqtt_server, strlen(sys_config.mqtt_server));
+  broker_cached = false;
+  if(ip.fromString(sys_config.mqtt_server)) {
+    mqttClient.setServer(ip, sys_config.mqtt_server_port);
+    return;
+  }
+  if(broker_cache.valid && (broker_cache.host_crc == host_crc) && (broker_cache.age < sys_config.dns_ttl)) {
+    ip = broker_cache.ip;
+    broker_cached = true;
+  } else if(WiFi.hostByName(sys_config.mqtt_server, ip)) {
+    broker_cache.valid = true;
+    broker_cache.ip = ip;
+    broker_cache.host_crc = host_crc;
+    broker_cache.age = 0;
+  } else {
+    // let the client try the name itself
+    Logwarn("lookup of %s failed", sys_config.mqtt_server);
+    broker_cache.valid = false;
+    mqttClient.setServer(sys_config.mqtt_server, sys_config.mqtt_server_port);
+    return;
+  }
+  trace.mark(TP_DNS, broker_cached);
+  Loginfo("broker %u.%u.%u.%u%s", ip[0], ip[1], ip[2], ip[3], broker_cached ? " cached" : "");
+  mqttClient.setServer(ip, sys_config.mqtt_server_port);
 }
 
 void sendMqtt() {
-  //mqttClient.setServer(sys_config.mqtt_server, sys_config.mqtt_server_port);
-  //mqttClient.onConnect(onMqttConnect);
-  //mqttClient.onPublish(onMqttPublish);
+  setBroker();
   mqttClient.connect();
 }
 
+bool scanNextChannel() {
+  scan_step_t step;
+  if(!scan_planner.next(step)) {
+    return false;
+  }
+  channel = step.channel;
+  WiFi.scanNetworks(true, false, step.passive, step.dwell, channel);
+  return true;
+}
+
+void planScan() {
+  scan_planner.begin(sys_config.scan_channels, sys_config.scan_passive, sys_config.scan_channel_time,
+                     sys_config.scan_min_time, sys_config.scan_max_ch, sys_config.scan_explore);
+}
+
 void WiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
+  xEventGroupSetBits(loop_events, EV_NET);
   switch(event) {
     case ARDUINO_EVENT_WIFI_STA_CONNECTED:
-      Debugprintf("%d wifi connected in ch %d\r\n", millis(), WiFi.channel());
+      trace.mark(TP_STA_CONNECTED);
+      cycle.event(CE_CONNECTED, millis());
+      Loginfo("wifi connected in ch %d", WiFi.channel());
       break;
     case ARDUINO_EVENT_WIFI_STA_GOT_IP:
-      Debugprintf("%d WiFi got ip\r\n", millis());
-      Debugprint("IP address: ");
-      Debugprintln(IPAddress(info.got_ip.ip_info.ip.addr));
-      Debugprint("Hostname: ");
-      Debugprintln(WiFi.getHostname());
-      sendMqtt();
+      trace.mark(TP_GOT_IP);
+      cycle.event(CE_GOT_IP, millis());
+      Loginfo("got ip %u.%u.%u.%u", info.got_ip.ip_info.ip.addr & 0xff, (info.got_ip.ip_info.ip.addr >> 8) & 0xff,
+              (info.got_ip.ip_info.ip.addr >> 16) & 0xff, info.got_ip.ip_info.ip.addr >> 24);
+      Logdebug("hostname %s", WiFi.getHostname());
+      if((!fast_connect && best_channel) || fast_dhcp) {
+        // a scan found the ap, or a press went to the cached one and asked for a new lease
+        wifi_cache.valid = true;
+        if(!fast_connect) {
+          bcopy(best_bssid, wifi_cache.bssid, sizeof(wifi_cache.bssid));
+          wifi_cache.channel = best_channel;
+        }
+        wifi_cache.ip = info.got_ip.ip_info.ip.addr;
+        wifi_cache.gateway = info.got_ip.ip_info.gw.addr;
+        wifi_cache.netmask = info.got_ip.ip_info.netmask.addr;
+        wifi_cache.dns = WiFi.dnsIP(0);
+        wifi_cache.age = 0;
+      }
+      if(sys_config.sleep.quiet_from != sys_config.sleep.quiet_to) {
+        // quiet hours need the time of day, the answer sets the clock while mqtt runs
+        configTime(0, 0, "pool.ntp.org");
+      }
+      // not in the wifi event task, the other events would wait behind the dns lookup
+      broker_connect = true;
       break;
     case ARDUINO_EVENT_WIFI_SCAN_DONE:
       if(info.wifi_scan_done.status == 0) {
-        Debugprintf("%d scan ok: %d APs\r\n", millis(), info.wifi_scan_done.number);
+        Loginfo("scan ok: %d APs", info.wifi_scan_done.number);
+        uint8_t target_ct = 0;
+        // one pass over the driver's records, no String per field
         for(int i = 0; i < info.wifi_scan_done.number; ++i) {
-          ap_list["ap"][app_ct]["ssid"] = WiFi.SSID(i);
-          ap_list["ap"][app_ct]["bssid"] = WiFi.BSSIDstr(i);
-          ap_list["ap"][app_ct]["rssi"] = WiFi.RSSI(i);
-          ap_list["ap"][app_ct]["channel"] = WiFi.channel(i);
-          if((WiFi.SSID(i) == sys_config.ssid) && (WiFi.RSSI(i) > best_rssi)) {
-            best_rssi = WiFi.RSSI(i);
-            best_channel = WiFi.channel(i);
-            bcopy(WiFi.BSSID(i), best_bssid, sizeof(best_bssid));
+          const wifi_ap_record_t* ap = (const wifi_ap_record_t*)WiFi.getScanInfoByIndex(i);
+          if(!ap) {
+            break;
+          }
+          payload_keep_ap(&payload, sys_config.ap_max, (const char*)ap->ssid, ap->bssid, ap->rssi, ap->primary);
+          if(!strcmp((const char*)ap->ssid, sys_config.ssid)) {
+            target_ct++;
+            if(ap->rssi > best_rssi) {
+              best_rssi = ap->rssi;
+              best_channel = ap->primary;
+              bcopy(ap->bssid, best_bssid, sizeof(best_bssid));
+            }
           }
-          app_ct++;
         }
-        bool scan_done = false;
-        switch(channel) {
-          case 1: case 6:
-            channel += 6;
-            return;
-          case 11:
-            channel = 13;
-            return;
-          default:
-            scan_done = true;
-            break;
+        WiFi.scanDelete();
+        trace.mark(TP_SCAN_DONE, channel);
+        scan_planner.record(channel, info.wifi_scan_done.number, target_ct);
+        if(scanNextChannel()) {
+          return;
         }
-        if(!scan_done) {
-          WiFi.scanNetworks(true, false, false, sys_config.scan_channel_time, channel);
+        if(!best_channel && !scan_only && scan_planner.widen()) {
+          // the ap may have moved to a channel the history does not know yet
+          Logwarn("target not on the planned channels, scanning the rest");
+          cycle.planned(scan_planner.planTime());
+          scanNextChannel();
           return;
         }
+        scan_planner.end();
       } else {
-        Debugprintln("scan failed");
+        Logwarn("scan failed");
       }
-      #ifdef DEBUG
-      {
-        String output;
-        serializeJson(ap_list, output);
-        Debugprintf("%s\r\n", output.c_str());
+      payload_sort_aps(&payload);
+      Logdebug("%d APs in list", payload.ap_ct);
+      if(scan_only) {
+        // loop() pushes it, the battery reading belongs to loop()
+        batch_due = true;
+        skip_send = true;
+        cycle.event(CE_DONE, millis());
+        energy.state(ES_IDLE);
+        break;
       }
-      #endif
-      wifi_start_time = millis();
-      if(channel) {
-        Debugprintf("conecting on ch %d\r\n", best_channel);
+      if(info.wifi_scan_done.status == 0) {
+        // every full send is remembered, so later deltas build on what the backend has
+        AP_SNAPSHOT::take(&payload, scan_snapshot);
+        uint8_t same = snapshot.similarity(scan_snapshot);
+        Logdebug("%d%% same as sent", same);
+        if(change_check && sys_config.same_pct && (same >= sys_config.same_pct) &&
+           (!sys_config.heartbeat || (snapshot.skipped() + 1 < sys_config.heartbeat))) {
+          snapshot.skip();
+          skip_send = true;
+          cycle.event(CE_DONE, millis());
+          energy.state(ES_IDLE);
+          break;
+        }
+        if(change_check && sys_config.delta_send) {
+          snapshot.delta(&payload, scan_snapshot, next_snapshot);
+          Logdebug("delta %d APs, %d gone", payload.ap_ct, payload.gone_ct);
+        } else {
+          next_snapshot = scan_snapshot;
+        }
+        snapshot_pending = true;
+      }
+      cycle.event(CE_SCAN_DONE, millis());
+      energy.state(ES_RADIO);
+      if(best_channel) {
+        Logdebug("connecting on ch %d", best_channel);
         WiFi.begin(sys_config.ssid, sys_config.wifi_pw, best_channel, best_bssid);
       } else {
-        Debugprintln("connecting auto");
+        Logdebug("connecting auto");
         WiFi.begin(sys_config.ssid, sys_config.wifi_pw);
       }
       break;
     default:
-      Debugprintln("unhandled Wifi event");
+      Logdebug("unhandled wifi event %d", event);
   }
 }
 
+void startScan() {
+  best_channel = 0;
+  best_rssi = -200;
+  memset(best_bssid, 0, sizeof(best_bssid));
+  payload_clear(&payload);
+  planScan();
+  cycle.planned(scan_planner.planTime());
+  energy.state(ES_SCAN);
+  scanNextChannel();
+}
+
 void startWifi() {
   WiFi.mode(WIFI_STA);
   //WiFi.setScanMethod(WIFI_ALL_CHANNEL_SCAN);
   //WiFi.setAutoReconnect(true);
   WiFi.setHostname(sys_config.hostname);
-  app_ct = 0;
-  best_channel = 0;
-  best_rssi = -200;
-  ap_list.clear();
-  WiFi.scanNetworks(true, false, false, sys_config.scan_channel_time, channel);
+  // limits as configured now, the console may have changed them since boot
+  cycle.begin(sys_config.deadlines, sys_config.wifi_wait);
+  fast_dhcp = wifi_cache.valid && (wifi_cache.age > FAST_LEASE_TIME);
+  uint16_t fast_wait = sys_config.fast_wait;
+  if(press) {
+    // a press never waits for the scan while there is an ap to try, with dhcp if the lease is old
+    fast_wait = fast_wait ? fast_wait : PRESS_FAST_WAIT;
+  } else if(fast_dhcp) {
+    Logdebug("cached lease too old");
+    wifi_cache.valid = false;
+  }
+  if(fast_wait && wifi_cache.valid && (press || (!scan_only && !(change_check && sys_config.same_pct)))) {
+    // skip the scan, go straight to the last ap with the last lease
+    Loginfo("fast connect on ch %d%s", wifi_cache.channel, fast_dhcp ? ", dhcp" : "");
+    fast_connect = true;
+    payload_clear(&payload);
+    if(!fast_dhcp) {
+      WiFi.config(IPAddress(wifi_cache.ip), IPAddress(wifi_cache.gateway), IPAddress(wifi_cache.netmask), IPAddress(wifi_cache.dns));
+    }
+    cycle.start(millis(), true, fast_wait);
+    energy.state(ES_RADIO);
+    WiFi.begin(sys_config.ssid, sys_config.wifi_pw, wifi_cache.channel, wifi_cache.bssid);
+    return;
+  }
+  fast_connect = false;
+  fast_dhcp = false;
+  cycle.start(millis());
+  startScan();
 }
 
-void handleCmd(String &cmd) {
-  Debugprintf("cmd:'%s'\r\n", cmd.c_str());
-  if(cmd == "reset") {
-    Serial.println();
-    wifi_failed_ct = 0;
-    mqtt_failed_ct = 0;
-    button_wakeups = 0;
-    run_time = 0;
-    esp_restart();
-  } else if(cmd== "restart") {
-    Serial.println();
-    esp_restart();
-  } else if(cmd.startsWith("ssid ")) {
-    char str[128];
-    if(sscanf(cmd.c_str(), "ssid %127s", str) != 1) {
-      Serial.println("ssid <ssid>");
-      return;
-    }
-    Serial.println();
-    strncpy(sys_config.ssid, str, sizeof(sys_config.ssid));
-  } else if(cmd.startsWith("pw ")) {
-    char str[128];
-    if(sscanf(cmd.c_str(), "pw %127s", str) != 1) {
-      Serial.println("pw <password>");
-      return;
-    }
-    Serial.println();
-    strncpy(sys_config.wifi_pw, str, sizeof(sys_config.wifi_pw));
-  } else if(cmd.startsWith("name ")) {
-    char str[128];
-    if(sscanf(cmd.c_str(), "name %127s", str) != 1) {
-      Serial.println("name <hostname>");
-      return;
-    }
-    Serial.println();
-    strncpy(sys_config.hostname, str, sizeof(sys_config.hostname));
-  } else if(cmd.startsWith("server ")) {
-    char str[128];
-    if(sscanf(cmd.c_str(), "server %127s", str) != 1) {
-      Serial.println("server <mqtt server>");
-      return;
-    }
-    Serial.println();
-    strncpy(sys_config.mqtt_server, str, sizeof(sys_config.mqtt_server));
-  } else if(cmd.startsWith("topic ")) {
-    char str[128];
-    if(sscanf(cmd.c_str(), "topic %127s", str) != 1) {
-      Serial.println("topic <base topic>");
-      return;
-    }
-    Serial.println();
-    strncpy(sys_config.mqtt_topic, str, sizeof(sys_config.mqtt_topic));
-  } else if(cmd.startsWith("port ")) {
-    int val;
-    if(sscanf(cmd.c_str(), "port %d", &val) != 1) {
-      Serial.println("port <mqtt port>");
-      return;
-    }
-    Serial.println();
-    sys_config.mqtt_server_port = val;
-  } else if(cmd.startsWith("retry ")) {
-    int val;
-    if(sscanf(cmd.c_str(), "retry %d", &val) != 1) {
-      Serial.println("retry <time>");
-      return;
-    }
-    Serial.println();
-    sys_config.retry = val;
-  } else if(cmd.startsWith("interval ")) {
-    int val;
-    if(sscanf(cmd.c_str(), "interval %d", &val) != 1) {
-      Serial.println("interval <time>");
-      return;
-    }
-    Serial.println();
-    sys_config.interval = val;
-  } else if(cmd.startsWith("id ")) {
-    int val;
-    if(sscanf(cmd.c_str(), "id %d", &val) != 1) {
-      Serial.println("id <number>");
-      return;
-    }
-    Serial.println();
-    sys_config.id = val;
-  } else if(cmd.startsWith("scantime ")) {
-    int val;
-    if(sscanf(cmd.c_str(), "scantime %d", &val) != 1) {
-      Serial.println("scantime <ms scan each channel>");
-      return;
-    }
-    Serial.println();
-    sys_config.scan_channel_time = val;
-  } else if(cmd.startsWith("wait ")) {
-    int val;
-    if(sscanf(cmd.c_str(), "wait %d", &val) != 1) {
-      Serial.println("wait <seconds to wait for connect>");
-      return;
+void stopFastConnect() {
+  Logwarn("fast connect failed, scanning");
+  fast_connect = false;
+  fast_dhcp = false;
+  wifi_cache.valid = false;
+  WiFi.disconnect();
+  WiFi.config(IPAddress(), IPAddress(), IPAddress());
+  startScan();
+}
+
+bool cmdReset(const char* args) {
+  Serial.println();
+  wifi_failed_ct = 0;
+  mqtt_failed_ct = 0;
+  button_wakeups = 0;
+  run_time = 0;
+  wifi_cache.valid = false;
+  broker_cache.valid = false;
+  energy.clear();
+  snapshot.clear();
+  cycle.clear();
+  sleep_planner.clear();
+  battery.clear();
+  press_stats.clear();
+  sys_config_crc = config_crc(&sys_config, sizeof(sys_config));
+  esp_restart();
+  return true;
+}
+
+bool cmdRestart(const char* args) {
+  Serial.println();
+  sys_config_crc = config_crc(&sys_config, sizeof(sys_config));
+  esp_restart();
+  return true;
+}
+
+bool cmdScanplan(const char* args) {
+  Serial.println();
+  planScan();
+  scan_planner.print(&Serial);
+  return true;
+}
+
+bool cmdBatched(const char* args) {
+  Serial.println();
+  batch.print(&Serial);
+  return true;
+}
+
+bool cmdSleep(const char* args) {
+  int val;
+  if(sscanf(args, "%d", &val) != 1) {
+    return false;
+  }
+  Serial.println();
+  goToSleep(val);
+  return true;
+}
+
+bool cmdShow(const char* args) {
+  Serial.println();
+  for(const auto &f : config_fields) {
+    config_print(&sys_config, f, &Serial);
+  }
+  return true;
+}
+
+bool cmdSave(const char* args) {
+  int written = config_store(&sys_config);
+  if(written >= 0) {
+    Serial.printf(" ok, %d changed\r\n", written);
+  } else {
+    Serial.println(" failed");
+  }
+  return true;
+}
+
+bool cmdSend(const char* args) {
+  Serial.println();
+  sendMqtt();
+  return true;
+}
+
+bool cmdVoltage(const char* args) {
+  Serial.printf(" %.2f\r\n", readBattery());
+  return true;
+}
+
+bool cmdTracelog(const char* args) {
+  Serial.println();
+  trace.print(&Serial);
+  return true;
+}
+
+bool cmdCycles(const char* args) {
+  Serial.println();
+  cycle.print(&Serial);
+  return true;
+}
+
+bool cmdStats(const char* args) {
+  Serial.println();
+  energy.print(&Serial, readBattery(), sys_config.capacity_mah);
+  battery.print(&Serial);
+  press_stats.print(&Serial);
+  sleep_planner.begin(sys_config.sleep, sys_config.interval, sys_config.retry);
+  sleep_planner.print(&Serial);
+  return true;
+}
+
+bool cmdHelp(const char* args);
+
+struct console_cmd_t {
+  const char* name;
+  bool (*fn)(const char* args);  // false prints the usage
+  const char* help;
+};
+
+// commands besides the settings of config_fields
+constexpr console_cmd_t console_cmds[] = {
+  {"scanplan", cmdScanplan, ""},
+  {"batched", cmdBatched, ""},
+  {"tracelog", cmdTracelog, ""},
+  {"stats", cmdStats, ""},
+  {"cycles", cmdCycles, ""},
+  {"sleep", cmdSleep, "<time>"},
+  {"restart", cmdRestart, ""},
+  {"reset", cmdReset, ""},
+  {"save", cmdSave, ""},
+  {"show", cmdShow, ""},
+  {"send", cmdSend, ""},
+  {"v", cmdVoltage, ""},
+  {"?", cmdHelp, ""},
+  {"h", cmdHelp, ""},
+};
+constexpr auto console_index = make_name_index<32>(console_cmds);
+
+bool cmdHelp(const char* args) {
+  Serial.println();
+  for(const auto &f : config_fields) {
+    config_help(f, &Serial);
+  }
+  for(const auto &c : console_cmds) {
+    Serial.print(c.name);
+    if(*c.help) {
+      Serial.printf(" %s", c.help);
     }
     Serial.println();
-    sys_config.wifi_wait = val;
-  } else if(cmd.startsWith("volt ")) {
-    float v;
-    if(sscanf(cmd.c_str(), "volt %f", &v) != 1) {
-      Serial.println("volt <measured voltage>");
-      return;
-    }
+  }
+  return true;
+}
+
+bool handleCmd(char* line) {
+  Logdebug("cmd '%s'", line);
+  if(!*line) {
     Serial.println();
-    sys_config.voltage_faktor = v / analogReadMilliVolts(6);
-  } else if(cmd.startsWith("ant ")) {
-    if(cmd == "ant ext") {
-      sys_config.ext_antenna = true;
-    } else if(cmd == "ant int") {
-      sys_config.ext_antenna = true;
-    } else {
-      Serial.println("ant <int|ext>");
-      return;
+    return true;
+  }
+  char name[16];
+  size_t len = strcspn(line, " ");
+  if(len >= sizeof(name)) {
+    Serial.printf(" ?%s?\r\n", line);
+    return false;
+  }
+  memcpy(name, line, len);
+  name[len] = '\0';
+  const char* args = line + len + strspn(line + len, " ");
+  if(const console_cmd_t* c = name_index_find(console_index, console_cmds, name)) {
+    if(!c->fn(args)) {
+      Serial.printf("%s %s\r\n", c->name, c->help);
+      return false;
     }
-    Serial.println();
-  } else if(cmd.startsWith("sleep ")) {
-    int val;
-    if(sscanf(cmd.c_str(), "sleep %d", &val) != 1) {
-      Serial.println("sleep <time>");
-      return;
+  } else if(const config_field_t* f = config_find(name)) {
+    if(f->type == CF_VOLT) {
+      // the calibration takes a one-shot reading, the adc has to leave continuous mode
+      readBattery();
     }
-    Serial.println();
-    goToSleep(val);
-  } else if(cmd == "show") {
-    Serial.println();
-    Serial.printf("ssid %s\r\n", sys_config.ssid);
-    Serial.printf("pw %s\r\n", sys_config.wifi_pw);
-    Serial.printf("name %s\r\n", sys_config.hostname);
-    Serial.printf("id %d\r\n", sys_config.id);
-    Serial.printf("server %s\r\n", sys_config.mqtt_server);
-    Serial.printf("port %d\r\n", sys_config.mqtt_server_port);
-    Serial.printf("topic %s\r\n", sys_config.mqtt_topic);
-    Serial.printf("retry %d\r\n", sys_config.retry);
-    Serial.printf("interval %d\r\n", sys_config.interval);
-    Serial.printf("wait %d\r\n", sys_config.wifi_wait);
-    Serial.printf("scantime %d\r\n", sys_config.scan_channel_time);
-    Serial.printf("volt f %.3f\r\n", sys_config.voltage_faktor * 1000.0);
-    Serial.println(sys_config.ext_antenna ? "ant ext" : "ant int");
-  } else if(cmd == "save") {
-    if(store_system_config(&sys_config)) {
-      Serial.println(" ok");
-    } else {
-      Serial.println(" failed");
+    if(!config_set(&sys_config, *f, args)) {
+      config_help(*f, &Serial);
+      return false;
     }
-  } else if(cmd == "send") {
-    Serial.println();
-    sendMqtt();
-  } else if(cmd == "v") {
-    Serial.printf(" %.2f\r\n", voltage);
-  } else if((cmd == "?") || cmd == "h") {
-    Serial.println("\r\nssid <ssid>");
-    Serial.println("pw <password>");
-    Serial.println("name <hostname>");
-    Serial.println("server <mqtt server>");
-    Serial.println("topic <base topic>");
-    Serial.println("port <mqtt port>");
-    Serial.println("retry <time>");
-    Serial.println("interval <time>");
-    Serial.println("id <number>");
-    Serial.println("scantime <ms scan each channel>");
-    Serial.println("wait <seconds to wait for connect>");
-    Serial.println("volt <measured voltage>");
-    Serial.println("ant <int|ext>");
-    Serial.println("sleep <time>");
-    Serial.println("restart");
-    Serial.println("reset");
-    Serial.println("save");
-    Serial.println("show");
-  } else if(cmd == "") {
     Serial.println();
   } else {
-    Serial.println(" ?" + cmd + "?");
+    Serial.printf(" ?%s?\r\n", line);
+    return false;
+  }
+  return true;
+}
+
+void IRAM_ATTR onButtonEdge() {
+  BaseType_t woken = pdFALSE;
+  button_edge = millis();
+  xEventGroupSetBitsFromISR(loop_events, EV_BUTTON, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+void IRAM_ATTR onAdcFrame() {
+  BaseType_t woken = pdFALSE;
+  xEventGroupSetBitsFromISR(loop_events, EV_ADC, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+void onConsoleRx(void* arg, esp_event_base_t base, int32_t id, void* data) {
+  xEventGroupSetBits(loop_events, EV_RX);
+}
+
+// usb powered, the cpu sleeps between events, the button and the console wake it
+void beginConsole() {
+  uart_avail = true;
+  button.begin();
+  Serial.setRxBufferSize(CMD_RX_BUFFER);
+  Serial.begin(115200);
+  Serial.onEvent(ARDUINO_HW_CDC_RX_EVENT, onConsoleRx);
+  // the button level is armed around each wait in loop(), it shares the pin interrupt with onButtonEdge
+  esp_sleep_enable_gpio_wakeup();
+}
+
+// the clock of each phase, booked by the energy model
+void onCycleEnter(cycle_state_t state) {
+  cpu_policy.phase(state);
+  energy.cpu(cpu_policy.mhz());
+}
+
+// needs the loaded config, light sleep only on usb
+void beginCpuPolicy() {
+  cpu_policy.begin((cpu_policy_t)sys_config.cpu_policy, uart_avail);
+  onCycleEnter(cycle.state());
+  if(uart_avail) {
+    Loginfo("light sleep %s", cpu_policy.dfs() ? "on" : "not supported");
   }
 }
 
@@ -440,17 +755,22 @@ void setup() {
   pinMode(LED_BUILTIN, OUTPUT);
   pinMode(BUTTON_PIN, INPUT_PULLUP);
   digitalWrite(LED_BUILTIN, LOW);
-  #ifdef DEBUG
+  loop_events = xEventGroupCreate();
+  attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), onButtonEdge, CHANGE);
+  #if DLOG_LEVEL
+  Serial0.setTxBufferSize(DLOG_RING);
   Serial0.begin(115200);
   #endif
-  Debugprintln("Init");
+  // a crashed wake left its records, they go out with this one
+  dlog.begin();
+  Logdebug("init");
   esp_wifi_set_country_code("DE", false);
   esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
   esp_reset_reason_t reset_reason = esp_reset_reason();
   send_cause = reset_reason << 4 | wakeup_reason;
   //on reset
   if(wakeup_reason == ESP_SLEEP_WAKEUP_UNDEFINED) {
-    Debugprintf("reset %d\r\n", reset_reason);
+    Loginfo("reset %d", reset_reason);
     if((reset_reason == ESP_RST_UNKNOWN) ||
        (reset_reason == ESP_RST_POWERON) ||
        (reset_reason == ESP_RST_BROWNOUT) ||
@@ -460,22 +780,30 @@ void setup() {
       mqtt_failed_ct = 0;
       button_wakeups = 0;
       run_time = 0;
+      batch.clear();
+      trace.clear();
+      energy.clear();
+      snapshot.clear();
+      cycle.clear();
+      sleep_planner.clear();
+      battery.clear();
+      press_stats.clear();
     }
   } else if (wakeup_reason == ESP_SLEEP_WAKEUP_TIMER) {
-    Debugprintln("TIMER wakeup");
+    Loginfo("timer wakeup");
   } else if (wakeup_reason == ESP_SLEEP_WAKEUP_EXT1) {
-    Debugprintln("EXT1 wakeup");
+    Loginfo("ext1 wakeup");
     button_wakeups++;
+    press = true;
   } else {
-    Debugprintf("wakeup %d\n", wakeup_reason);
+    Loginfo("wakeup %d", wakeup_reason);
   }
+  trace.mark(TP_BOOT, wakeup_reason);
   if((wakeup_reason == ESP_SLEEP_WAKEUP_UNDEFINED) ||
      ((wakeup_reason == ESP_SLEEP_WAKEUP_EXT1) && !digitalRead(BUTTON_PIN))) {
     if(usb_serial_jtag_is_connected()) {
-      Debugprintln("usb connected");
-      uart_avail = true;
-      button.begin();
-      Serial.begin(115200);
+      Loginfo("usb connected");
+      beginConsole();
       int ct = 20;
       while(!Serial && ct) {
         ct--;
@@ -484,16 +812,41 @@ void setup() {
       }
     }
   }
-  if(!sys_config.valid) {
-    if(!get_system_config(&sys_config)) {
-      sys_config = {.mqtt_server_port = 1883,
-                    .retry = 30,
-                    .interval = 7200,
-                    .voltage_faktor = 0.002,
-                    .wifi_wait = 15000,
-                    .scan_channel_time = 300};
-    }
+  if(!config_cached(&sys_config, sys_config_crc)) {
+    // power on, or the rtc copy got damaged
+    sys_config = {.mqtt_server_port = 1883,
+                  .retry = 30,
+                  .interval = 7200,
+                  .voltage_faktor = 0.002,
+                  .wifi_wait = 15000,
+                  .scan_channel_time = 300,
+                  .fast_wait = 0,
+                  .ap_max = PAYLOAD_MAX_APS,
+                  .deadlines = {.scan_ms = 2000, .assoc_ms = 3000, .dhcp_ms = 4000,
+                                .mqtt_ms = 3000, .publish_ms = 1000, .ack_ms = 3000},
+                  .dns_ttl = 3600,
+                  .cpu_policy = CPU_PHASES,
+                  .sleep = {.retry_max = 3600, .low_pct = 20}};
+    bool loaded = config_load(&sys_config);
+    Loginfo("load syscfg %s", loaded ? "ok" : "none");
   }
+  if(!sys_config.scan_channels) {
+    // config saved before the scan planner existed
+    sys_config.scan_channels = SCAN_ALL_CHANNELS;
+    sys_config.scan_min_time = sys_config.scan_channel_time / 4;
+    sys_config.scan_explore = 8;
+  }
+  if(!sys_config.currents.idle_ma) {
+    // config saved before the energy model existed
+    sys_config.currents = {ENERGY_SLEEP_UA, ENERGY_IDLE_MA, ENERGY_SCAN_MA, ENERGY_RADIO_MA};
+    sys_config.capacity_mah = ENERGY_CAPACITY_MAH;
+  }
+  energy.begin(sys_config.currents);
+  beginCpuPolicy();
+  cycle.onEnter(onCycleEnter);
+  // oversampled in the background while the scan runs, ready before the message is built
+  battery.begin(sys_config.voltage_faktor, sys_config.volt_offset, onAdcFrame);
+  voltage = battery.voltage();
   if(sys_config.valid) {
     if(sys_config.ext_antenna) {
       pinMode(3, OUTPUT);
@@ -505,136 +858,215 @@ void setup() {
     WiFi.onEvent(WiFiEvent, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_CONNECTED);
     WiFi.onEvent(WiFiEvent, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_GOT_IP);
     WiFi.onEvent(WiFiEvent, WiFiEvent_t::ARDUINO_EVENT_WIFI_SCAN_DONE);
-    mqttClient.setServer(sys_config.mqtt_server, sys_config.mqtt_server_port);
+    if(sys_config.mqtt_session) {
+      // the broker keeps subscriptions and unacked qos 1 messages of this id between wakes
+      snprintf(mqtt_client_id, sizeof(mqtt_client_id), "wifiscan-%u", sys_config.id);
+      mqttClient.setClientId(mqtt_client_id);
+      mqttClient.setCleanSession(false);
+    }
     mqttClient.onConnect(onMqttConnect);
     mqttClient.onPublish(onMqttPublish);
+    mqttClient.onDisconnect(onMqttDisconnect);
+    // the k-th timer wake sends, the ones before only scan, a full ring or the button sends at once
+    scan_only = (wakeup_reason == ESP_SLEEP_WAKEUP_TIMER) && (sys_config.batch_wakes > 1) &&
+                (batch.count() + 1 < sys_config.batch_wakes) && !batch.full();
+    change_check = (wakeup_reason == ESP_SLEEP_WAKEUP_TIMER) && !scan_only;
     startWifi();
   }
   if(uart_avail) {
     cmd_processor.registerCmd("", handleCmd);
   }
-  voltage = sys_config.voltage_faktor * analogReadMilliVolts(6);
-  Debugprintln("Init end");
+  Logdebug("init end");
 }
 
 uint32_t last_blink = 0;
 uint32_t last_send = 0;
+
+// ms left until period is over since, the checks in loop() fire one ms later
+uint32_t until(uint32_t ti, uint32_t since, uint32_t period) {
+  uint32_t gone = ti - since;
+  return (gone > period) ? 0 : period + 1 - gone;
+}
+
+// ms until loop() has a timeout to handle without an event
+uint32_t loopTimeout(uint32_t ti) {
+  uint32_t ms = until(ti, last_blink, BLINK_TIME);
+  if((ti - button_edge) < BUTTON_SETTLE_MS) {
+    ms = std::min<uint32_t>(ms, 5);
+  }
+  ms = std::min(ms, cycle.timeout(ti));
+  if(battery.running()) {
+    ms = std::min(ms, battery.left(ti));
+  }
+  ms = std::min(ms, until(ti, last_send, 1000 * sys_config.interval));
+  if(cycle.state() == CS_FAILED) {
+    ms = std::min(ms, until(ti, last_send, 1000 * sys_config.retry));
+  }
+  return ms;
+}
 void loop() {
   uint32_t ti = millis();
 
+  if(battery.running()) {
+    battery.poll();
+    if(!battery.left(ti)) {
+      readBattery();
+    }
+  }
+
   button.read();
-  if(button.wasPressed()) {
-    Debugprintln("button pressed");
+  if(button.wasPressed() && press) {
+    // the press that woke the chip, or another one while it is on its way
+    Logdebug("button pressed, press in flight");
+  } else if(button.wasPressed()) {
+    Loginfo("button pressed");
     button_wakeups++;
     send_cause = 0x200;
+    press = true;
+    press_ms = button_edge;
+    scan_only = false;
+    change_check = false;
     startWifi();
-    /*
-    if(WiFi.isConnected()) {
-      wifi_start_time = millis();
-      sendMqtt();
-    } else {
-      WiFi.disconnect();
-      delay(10);
-      wifi_start_time = millis();
-      WiFi.begin(sys_config.ssid, sys_config.wifi_pw);
-    }
-    */
   }
 
-  if((ti - last_blink) > 200) {
+  if((ti - last_blink) > BLINK_TIME) {
     last_blink = ti;
     digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN));
     if(!uart_avail && usb_serial_jtag_is_connected()) {
-      Debugprintln("detected serial");
-      button.begin();
-      Serial.begin(115200);
-      uart_avail = true;
+      Loginfo("detected serial");
+      beginConsole();
+      beginCpuPolicy();
     }
     if(uart_avail && !usb_serial_jtag_is_connected()) {
-      Debugprintln("serial disconnect");
+      Loginfo("serial disconnect");
       uart_avail = false;
       run_time = 0;
       goToSleep(sys_config.retry);
     }
   }
 
-  if(mqtt_queued && !mqtt_pkt_ids.size()) {
-    Debugprintf("%d mqtt fin\r\n", millis() -wifi_start_time);
+  if((cycle.state() == CS_ACK) && mqtt_pkt_ids.empty() && ((sys_config.mqtt_mode != MQTT_QOS0) || mqtt_flushed)) {
+    cycle.event(CE_ACKED, ti);
+    Loginfo("mqtt fin after %u ms", cycle.elapsed(ti));
+    if(press) {
+      // qos0, the close says the broker has it
+      pressAcked(ti);
+    }
+    if(press_sent >= 0) {
+      press_stats.published(press_sent);
+      press_sent = -1;
+    }
     last_send = ti;
-    mqtt_queued = false;
     button_wakeups = 0;
-    send_failed = false;
+    sleep_planner.sent(true);
+    batch.clear();
+    trace.drop(trace_sent);
+    trace_sent = 0;
+    if(snapshot_pending) {
+      snapshot.commit(next_snapshot);
+      snapshot_pending = false;
+    }
     mqttClient.disconnect();
-    wifi_start_time = 0;
-    if(!uart_avail) {
-      goToSleep(sys_config.interval);
+    if(fast_connect && !sys_config.fast_wait && !uart_avail) {
+      // "fast 0" wants the APs of every wake, the press went without them. they go to the
+      // batch ring for the next send
+      Logdebug("scan after the press");
+      WiFi.disconnect();
+      fast_connect = false;
+      fast_dhcp = false;
+      scan_only = true;
+      cycle.start(ti);
+      startScan();
+    } else if(!uart_avail) {
+      goToSleep(nextSleep(false));
     } else {
       WiFi.disconnect();
       WiFi.mode(WIFI_MODE_NULL);
+      energy.state(ES_IDLE);
+    }
+  }
+
+  if(broker_connect) {
+    broker_connect = false;
+    // the message is built in onMqttConnect, the sampling ends here and not in the event task
+    readBattery();
+    sendMqtt();
+  }
+
+  if(skip_send) {
+    skip_send = false;
+    if(batch_due) {
+      batch_due = false;
+      batch.push(&payload, readBattery(), send_cause);
+      Loginfo("batched %d of %d", batch.count(), sys_config.batch_wakes);
     }
+    WiFi.mode(WIFI_MODE_NULL);
+    goToSleep(nextSleep(false));
   }
 
-  // wait max 10 sec until sleep and retry
-  if(wifi_start_time && (ti - wifi_start_time) > WIFI_WAIT_TIME) {
-    Debugprintln("send failed");
+  // each phase has its own deadline, a dead ap or broker ends the wake as soon as its budget is gone
+  cycle_state_t late = cycle.expired(ti);
+  if((late != CS_IDLE) && (cycle.state() == CS_SCAN)) {
+    stopFastConnect();
+  } else if(late != CS_IDLE) {
+    Logerror("send failed, %s took too long", WAKE_CYCLE::name(late));
     last_send = ti;
-    wifi_start_time = 0;
-    mqtt_queued = false; 
-    send_failed = true;
-    if(!WiFi.isConnected()) {
-      Debugprintln("wifi failed");
+    if(press) {
+      press = false;
+      press_stats.failed();
+    }
+    if(late <= CS_DHCP) {
       wifi_failed_ct++;
     } else {
-      Debugprintln("mqtt failed");
       mqtt_failed_ct++;
     }
+    if(fast_connect) {
+      // the cached lease may be gone, scan and ask dhcp next time
+      wifi_cache.valid = false;
+    }
+    if(late == CS_MQTT) {
+      broker_cache.valid = false;
+    }
+    sleep_planner.sent(false);
     if(!uart_avail) {
-      goToSleep(sys_config.retry);
+      goToSleep(nextSleep(true));
     } else {
       mqttClient.disconnect();
       WiFi.disconnect();
       WiFi.mode(WIFI_MODE_NULL);
+      energy.state(ES_IDLE);
     }
   }
 
   if((ti - last_send) > (1000 * sys_config.interval)) {
-    Debugprintf("timer send while loading %d %d %d\r\n", ti, last_send, sys_config.interval);
+    Logdebug("timer send while loading %u %u %u", ti, last_send, sys_config.interval);
     last_send = ti;
     send_cause = 0x400;
     startWifi();
-    /*
-    if(WiFi.isConnected()) {
-      wifi_start_time = millis();
-      sendMqtt();
-    } else {
-      WiFi.disconnect();
-      delay(10);
-      wifi_start_time = millis();
-      WiFi.begin(sys_config.ssid, sys_config.wifi_pw);
-    }
-    */
   }
 
-  if(send_failed && ((ti - last_send) > (1000 * sys_config.retry))) {
-    Debugprintln("retry send while loading");
+  if((cycle.state() == CS_FAILED) && ((ti - last_send) > (1000 * sys_config.retry))) {
+    Logdebug("retry send while loading");
     last_send = ti;
     send_cause = 0x600;
     startWifi();
-    /*
-    if(WiFi.isConnected()) {
-      wifi_start_time = millis();
-      sendMqtt();
-    } else {
-      WiFi.disconnect();
-      delay(10);
-      wifi_start_time = millis();
-      WiFi.begin(sys_config.ssid, sys_config.wifi_pw);
-    }
-    */
   }
 
   if(uart_avail) {
     cmd_processor.process();
   }
+
+  // nothing left for this pass, block until an event or the next deadline
+  flushLog(false);
+  // light sleep only wakes on a level, armed opposite to the current one so it fires once per edge
+  bool level_wake = uart_avail && cpu_policy.dfs();
+  if(level_wake) {
+    gpio_wakeup_enable((gpio_num_t)BUTTON_PIN, digitalRead(BUTTON_PIN) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+  }
+  xEventGroupWaitBits(loop_events, EV_RX | EV_BUTTON | EV_NET | EV_ADC, pdTRUE, pdFALSE, pdMS_TO_TICKS(loopTimeout(millis())));
+  if(level_wake) {
+    gpio_wakeup_disable((gpio_num_t)BUTTON_PIN);
+    gpio_set_intr_type((gpio_num_t)BUTTON_PIN, GPIO_INTR_ANYEDGE);
+  }
 }
 
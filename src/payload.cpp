@@ -0,0 +1,429 @@
+#include "payload.h"
+#include "payload_format.h"
+
+#define PAYLOAD_HEADER_RESERVE 200  // room kept for the fields after the ap list
+
+// appends to a fixed buffer, remembers an overflow instead of writing past the end
+class JSON_WRITER {
+public:
+  JSON_WRITER(char* buf, size_t size) : _buf(buf), _size(size), _len(0), _overflow(false) {}
+  void raw(const char* str) {
+    while(*str) {
+      put(*str++);
+    }
+  }
+  void put(char c) {
+    if(_len + 1 < _size) {
+      _buf[_len++] = c;
+    } else {
+      _overflow = true;
+    }
+  }
+  void key(const char* name) {
+    put('"');
+    raw(name);
+    raw("\":");
+  }
+  void str(const char* s, size_t max_len) {
+    static const char hex[] = "0123456789abcdef";
+    put('"');
+    for(size_t i = 0; (i < max_len) && s[i]; ++i) {
+      uint8_t c = s[i];
+      if((c == '"') || (c == '\\')) {
+        put('\\');
+        put(c);
+      } else if(c < 0x20) {
+        raw("\\u00");
+        put(hex[c >> 4]);
+        put(hex[c & 0x0f]);
+      } else {
+        put(c);
+      }
+    }
+    put('"');
+  }
+  void mac(const uint8_t* b) {
+    static const char hex[] = "0123456789ABCDEF";
+    put('"');
+    for(int i = 0; i < 6; ++i) {
+      if(i) {
+        put(':');
+      }
+      put(hex[b[i] >> 4]);
+      put(hex[b[i] & 0x0f]);
+    }
+    put('"');
+  }
+  void num(int32_t v) {
+    if(v < 0) {
+      put('-');
+      unum(-(int64_t)v);
+    } else {
+      unum(v);
+    }
+  }
+  void unum(uint32_t v) {
+    char tmp[10];
+    int n = 0;
+    do {
+      tmp[n++] = '0' + v % 10;
+      v /= 10;
+    } while(v);
+    while(n) {
+      put(tmp[--n]);
+    }
+  }
+  void flt(float v) {
+    char tmp[16];
+    snprintf(tmp, sizeof(tmp), "%.7g", v);
+    raw(tmp);
+  }
+  size_t len() { return _len; }
+  void rewind(size_t len) {
+    _len = len;
+    _overflow = false;
+  }
+  bool overflow() { return _overflow; }
+  size_t space() { return _size - _len; }
+  size_t finish() {
+    _buf[_len] = '\0';
+    return _overflow ? 0 : _len;
+  }
+private:
+  char* _buf;
+  size_t _size;
+  size_t _len;
+  bool _overflow;
+};
+
+template <size_t N>
+static void writeFields(JSON_WRITER &w, const void* base, const payload_field_t (&fields)[N]) {
+  const uint8_t* p = static_cast<const uint8_t*>(base);
+  for(size_t i = 0; i < N; ++i) {
+    const payload_field_t &f = fields[i];
+    if(i) {
+      w.put(',');
+    }
+    w.key(f.name);
+    const uint8_t* v = p + f.offset;
+    switch(f.type) {
+      case PT_INT:
+        if(f.size == 1) {
+          w.num(*(const int8_t*)v);
+        } else if(f.size == 2) {
+          w.num(*(const int16_t*)v);
+        } else {
+          w.num(*(const int32_t*)v);
+        }
+        break;
+      case PT_UINT:
+        if(f.size == 1) {
+          w.unum(*(const uint8_t*)v);
+        } else if(f.size == 2) {
+          w.unum(*(const uint16_t*)v);
+        } else {
+          w.unum(*(const uint32_t*)v);
+        }
+        break;
+      case PT_FLOAT:
+        w.flt(*(const float*)v);
+        break;
+      case PT_STR:
+        w.str((const char*)v, f.size);
+        break;
+      case PT_MAC:
+        w.mac(v);
+        break;
+    }
+  }
+}
+
+void payload_clear(payload_t* p) {
+  p->ap_ct = 0;
+  p->delta = false;
+  p->gone_ct = 0;
+}
+
+bool payload_add_ap(payload_t* p, const char* ssid, const uint8_t* bssid, int8_t rssi, uint8_t channel) {
+  if(p->ap_ct >= PAYLOAD_MAX_APS) {
+    return false;
+  }
+  payload_ap_t &ap = p->ap[p->ap_ct++];
+  strncpy(ap.ssid, ssid, sizeof(ap.ssid) - 1);
+  ap.ssid[sizeof(ap.ssid) - 1] = '\0';
+  memcpy(ap.bssid, bssid, sizeof(ap.bssid));
+  ap.rssi = rssi;
+  ap.channel = channel;
+  return true;
+}
+
+// weakest ap of ap[0..n) to the root again after it changed
+static void siftDown(payload_ap_t* ap, uint8_t n, uint8_t i) {
+  payload_ap_t v = ap[i];
+  for(;;) {
+    uint8_t c = 2 * i + 1;
+    if(c >= n) {
+      break;
+    }
+    if((c + 1 < n) && (ap[c + 1].rssi < ap[c].rssi)) {
+      c++;
+    }
+    if(ap[c].rssi >= v.rssi) {
+      break;
+    }
+    ap[i] = ap[c];
+    i = c;
+  }
+  ap[i] = v;
+}
+
+bool payload_keep_ap(payload_t* p, uint8_t k, const char* ssid, const uint8_t* bssid, int8_t rssi, uint8_t channel) {
+  if(k > PAYLOAD_MAX_APS) {
+    k = PAYLOAD_MAX_APS;
+  }
+  uint8_t i;
+  if(p->ap_ct < k) {
+    // sift up from the new leaf
+    i = p->ap_ct++;
+    while(i && (p->ap[(i - 1) / 2].rssi > rssi)) {
+      p->ap[i] = p->ap[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+  } else if(k && (rssi > p->ap[0].rssi)) {
+    // replaces the weakest, the ssid is only copied for APs that stay
+    i = 0;
+  } else {
+    return false;
+  }
+  payload_ap_t &ap = p->ap[i];
+  strncpy(ap.ssid, ssid, sizeof(ap.ssid) - 1);
+  ap.ssid[sizeof(ap.ssid) - 1] = '\0';
+  memcpy(ap.bssid, bssid, sizeof(ap.bssid));
+  ap.rssi = rssi;
+  ap.channel = channel;
+  if(!i) {
+    siftDown(p->ap, p->ap_ct, 0);
+  }
+  return true;
+}
+
+void payload_sort_aps(payload_t* p) {
+  // heap sort, taking the weakest to the end leaves the strongest first
+  for(uint8_t n = p->ap_ct; n > 1; --n) {
+    payload_ap_t weakest = p->ap[0];
+    p->ap[0] = p->ap[n - 1];
+    p->ap[n - 1] = weakest;
+    siftDown(p->ap, n - 1, 0);
+  }
+}
+
+size_t payload_to_json(const payload_t* p, char* buf, size_t size) {
+  JSON_WRITER w(buf, size);
+  w.put('{');
+  if(p->trace && p->trace_ct) {
+    // [probe,ms,arg] per event
+    w.raw("\"trace\":[");
+    for(uint8_t i = 0; i < p->trace_ct; ++i) {
+      const trace_event_t &e = p->trace->get(i);
+      if(i) {
+        w.put(',');
+      }
+      w.put('[');
+      w.unum(e.probe);
+      w.put(',');
+      w.unum(e.ms);
+      w.put(',');
+      w.unum(e.arg);
+      w.put(']');
+    }
+    w.raw("],");
+  }
+  if(p->batch && p->batch->count()) {
+    w.raw("\"batch\":[");
+    for(uint8_t i = 0; i < p->batch->count(); ++i) {
+      const batch_record_t &r = p->batch->get(i);
+      size_t mark = w.len();
+      if(i) {
+        w.put(',');
+      }
+      w.put('{');
+      w.key("age");
+      w.unum(p->batch->age(i));
+      w.put(',');
+      writeFields(w, &r, batch_record_fields);
+      w.raw(",\"ap\":[");
+      for(uint8_t k = 0; k < r.ap_ct; ++k) {
+        if(k) {
+          w.put(',');
+        }
+        w.put('{');
+        writeFields(w, &r.ap[k], batch_ap_fields);
+        w.put('}');
+      }
+      w.raw("]}");
+      if(w.overflow() || (w.space() < PAYLOAD_HEADER_RESERVE)) {
+        w.rewind(mark);
+        break;
+      }
+    }
+    w.raw("],");
+  }
+  if(p->delta) {
+    // present, even if empty, marks the ap list as a delta
+    w.raw("\"gone\":[");
+    for(uint8_t i = 0; i < p->gone_ct; ++i) {
+      if(i) {
+        w.put(',');
+      }
+      w.mac(p->gone[i]);
+    }
+    w.raw("],");
+  }
+  if(p->ap_ct) {
+    w.raw("\"ap\":[");
+    for(uint8_t i = 0; i < p->ap_ct; ++i) {
+      size_t mark = w.len();
+      if(i) {
+        w.put(',');
+      }
+      w.put('{');
+      writeFields(w, &p->ap[i], payload_ap_fields);
+      w.put('}');
+      if(w.overflow() || (w.space() < PAYLOAD_HEADER_RESERVE)) {
+        w.rewind(mark);
+        break;
+      }
+    }
+    w.raw("],");
+  }
+  writeFields(w, p, payload_fields);
+  w.put('}');
+  return w.finish();
+}
+
+static uint8_t* put16(uint8_t* b, uint32_t v) {
+  if(v > 0xffff) {
+    v = 0xffff;
+  }
+  b[0] = v;
+  b[1] = v >> 8;
+  return b + 2;
+}
+
+static uint8_t* put32(uint8_t* b, uint32_t v) {
+  b[0] = v;
+  b[1] = v >> 8;
+  b[2] = v >> 16;
+  b[3] = v >> 24;
+  return b + 4;
+}
+
+static uint32_t counter(int32_t v) {
+  return (v < 0) ? 0 : v;
+}
+
+size_t payload_to_bin(const payload_t* p, uint8_t* buf, size_t size) {
+  // every distinct ssid goes once into the dictionary
+  uint8_t dict[PAYLOAD_MAX_APS];     // ap that holds the ssid text
+  uint8_t ssid_idx[PAYLOAD_MAX_APS];
+  uint8_t dict_ct = 0;
+  size_t need = PAYLOAD_BIN_HEADER;
+  for(uint8_t i = 0; i < p->ap_ct; ++i) {
+    uint8_t k = 0;
+    while((k < dict_ct) && strcmp(p->ap[dict[k]].ssid, p->ap[i].ssid)) {
+      k++;
+    }
+    if(k == dict_ct) {
+      dict[dict_ct++] = i;
+      need += 1 + strlen(p->ap[i].ssid);
+    }
+    ssid_idx[i] = k;
+    need += PAYLOAD_BIN_AP + ((k >= PAYLOAD_BIN_SSID_ESC) ? 1 : 0);
+  }
+  uint8_t batch_ct = p->batch ? p->batch->count() : 0;
+  if(batch_ct) {
+    need++;
+    for(uint8_t i = 0; i < batch_ct; ++i) {
+      need += PAYLOAD_BIN_RECORD + p->batch->get(i).ap_ct * PAYLOAD_BIN_AP;
+    }
+  }
+  need += PAYLOAD_BIN_ENERGY;
+  if(p->delta) {
+    need += 1 + p->gone_ct * 6;
+  }
+  uint8_t trace_ct = p->trace ? p->trace_ct : 0;
+  if(trace_ct) {
+    need += 1 + trace_ct * PAYLOAD_BIN_TRACE;
+  }
+  if(need > size) {
+    return 0;
+  }
+  uint8_t* b = buf;
+  *b++ = PAYLOAD_BIN_MAGIC;
+  *b++ = PAYLOAD_BIN_VERSION;
+  *b++ = (batch_ct ? PAYLOAD_BIN_FLAG_BATCH : 0) | PAYLOAD_BIN_FLAG_ENERGY | (trace_ct ? PAYLOAD_BIN_FLAG_TRACE : 0) |
+         (p->delta ? PAYLOAD_BIN_FLAG_DELTA : 0);
+  b = put16(b, (p->voltage > 0) ? (uint32_t)(p->voltage * 1000.0f + 0.5f) : 0);
+  b = put16(b, p->id);
+  b = put16(b, counter(p->button_ct));
+  b = put16(b, counter(p->wifi_fail));
+  b = put16(b, counter(p->mqtt_fail));
+  b = put16(b, p->send_cause);
+  b = put32(b, p->runtime);
+  *b++ = dict_ct;
+  *b++ = p->ap_ct;
+  for(uint8_t k = 0; k < dict_ct; ++k) {
+    const char* ssid = p->ap[dict[k]].ssid;
+    uint8_t len = strlen(ssid);
+    *b++ = len;
+    memcpy(b, ssid, len);
+    b += len;
+  }
+  for(uint8_t i = 0; i < p->ap_ct; ++i) {
+    const payload_ap_t &ap = p->ap[i];
+    memcpy(b, ap.bssid, 6);
+    b += 6;
+    *b++ = (uint8_t)ap.rssi;
+    if(ssid_idx[i] < PAYLOAD_BIN_SSID_ESC) {
+      *b++ = (ap.channel << 4) | ssid_idx[i];
+    } else {
+      *b++ = (ap.channel << 4) | PAYLOAD_BIN_SSID_ESC;
+      *b++ = ssid_idx[i];
+    }
+  }
+  if(batch_ct) {
+    *b++ = batch_ct;
+    for(uint8_t i = 0; i < batch_ct; ++i) {
+      const batch_record_t &r = p->batch->get(i);
+      b = put32(b, p->batch->age(i));
+      b = put16(b, r.mv);
+      b = put16(b, r.send_cause);
+      *b++ = r.ap_ct;
+      for(uint8_t k = 0; k < r.ap_ct; ++k) {
+        memcpy(b, r.ap[k].bssid, 6);
+        b += 6;
+        *b++ = (uint8_t)r.ap[k].rssi;
+        *b++ = r.ap[k].channel;
+      }
+    }
+  }
+  b = put32(b, p->used_uah);
+  b = put16(b, p->days_left);
+  if(p->delta) {
+    *b++ = p->gone_ct;
+    for(uint8_t i = 0; i < p->gone_ct; ++i) {
+      memcpy(b, p->gone[i], 6);
+      b += 6;
+    }
+  }
+  if(trace_ct) {
+    *b++ = trace_ct;
+    for(uint8_t i = 0; i < trace_ct; ++i) {
+      const trace_event_t &e = p->trace->get(i);
+      *b++ = e.probe;
+      *b++ = e.arg;
+      b = put16(b, e.ms);
+    }
+  }
+  return b - buf;
+}
@@ -0,0 +1,89 @@
+#include "press_stats.h"
+
+static const uint16_t bounds[PRESS_BUCKETS - 1] = {100, 150, 200, 300, 400, 500, 750, 1000, 1500, 2000, 3000, 5000, 10000};
+
+PRESS_STATS::PRESS_STATS(struct press_stats_t* stats) : _stats(stats) {
+}
+
+void PRESS_STATS::acked(uint32_t ms) {
+  uint8_t i = 0;
+  while((i < PRESS_BUCKETS - 1) && (ms > bounds[i])) {
+    i++;
+  }
+  if(_stats->bucket[i] < UINT16_MAX) {
+    _stats->bucket[i]++;
+  }
+  if(_stats->acked < UINT16_MAX) {
+    _stats->acked++;
+    _stats->sum_ms += ms;
+  }
+  _stats->max_ms = std::max<uint32_t>(_stats->max_ms, std::min<uint32_t>(ms, UINT16_MAX));
+}
+
+void PRESS_STATS::failed() {
+  if(_stats->failed < UINT16_MAX) {
+    _stats->failed++;
+  }
+}
+
+void PRESS_STATS::clear() {
+  memset(_stats, 0, sizeof(*_stats));
+}
+
+uint16_t PRESS_STATS::total() {
+  return _stats->acked + _stats->failed;
+}
+
+bool PRESS_STATS::unpublished() {
+  return total() != _stats->published;
+}
+
+void PRESS_STATS::published(uint16_t total) {
+  _stats->published = total;
+}
+
+uint16_t PRESS_STATS::percentile(uint8_t pct) {
+  if(!_stats->acked) {
+    return 0;
+  }
+  uint32_t need = ((uint32_t)_stats->acked * pct + 99) / 100;
+  uint32_t sum = 0;
+  for(uint8_t i = 0; i < PRESS_BUCKETS - 1; ++i) {
+    sum += _stats->bucket[i];
+    if(sum >= need) {
+      return std::min(bounds[i], _stats->max_ms);
+    }
+  }
+  return _stats->max_ms;
+}
+
+size_t PRESS_STATS::toJson(char* buf, size_t size) {
+  uint16_t avg = _stats->acked ? _stats->sum_ms / _stats->acked : 0;
+  int len = snprintf(buf, size, "{\"n\":%u,\"fail\":%u,\"avg\":%u,\"p50\":%u,\"p90\":%u,\"max\":%u,\"hist\":[",
+                     _stats->acked, _stats->failed, avg, percentile(50), percentile(90), _stats->max_ms);
+  for(uint8_t i = 0; (i < PRESS_BUCKETS) && (len > 0) && ((size_t)len < size); ++i) {
+    len += snprintf(buf + len, size - len, i ? ",%u" : "%u", _stats->bucket[i]);
+  }
+  if((len > 0) && ((size_t)len < size)) {
+    len += snprintf(buf + len, size - len, "]}");
+  }
+  return ((len > 0) && ((size_t)len < size)) ? len : 0;
+}
+
+void PRESS_STATS::print(Print* out) {
+  out->printf("%u presses acked, %u failed", _stats->acked, _stats->failed);
+  if(_stats->acked) {
+    out->printf(", avg %lu ms, p50 %u, p90 %u, max %u", (unsigned long)(_stats->sum_ms / _stats->acked),
+                percentile(50), percentile(90), _stats->max_ms);
+  }
+  out->println();
+  for(uint8_t i = 0; i < PRESS_BUCKETS; ++i) {
+    if(_stats->bucket[i]) {
+      if(i < PRESS_BUCKETS - 1) {
+        out->printf("<= %5u ms %5u\r\n", bounds[i], _stats->bucket[i]);
+      } else {
+        out->printf(" > %5u ms %5u\r\n", bounds[i - 1], _stats->bucket[i]);
+      }
+    }
+  }
+}
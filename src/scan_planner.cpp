@@ -0,0 +1,158 @@
+#include "scan_planner.h"
+
+#define SCAN_PASSIVE_MIN 110    // a passive scan has to cover one beacon interval
+
+SCAN_PLANNER::SCAN_PLANNER(struct scan_stats_t* stats) : _stats(stats) {
+  _plan_ct = 0;
+  _pos = 0;
+  _channels = 0;
+  _passive = 0;
+  _dwell = 0;
+}
+
+uint16_t SCAN_PLANNER::score(uint8_t channel) {
+  scan_channel_stats_t &s = _stats->ch[channel - 1];
+  return s.target_avg * 4 + s.ap_avg;
+}
+
+void SCAN_PLANNER::begin(uint16_t channels, uint16_t passive, uint16_t dwell, uint16_t min_dwell,
+                         uint8_t max_channels, uint8_t explore) {
+  _plan_ct = 0;
+  _pos = 0;
+  if(!channels) {
+    channels = SCAN_ALL_CHANNELS;
+  }
+  if(!min_dwell || (min_dwell > dwell)) {
+    min_dwell = dwell / 4;
+  }
+  _channels = channels;
+  _passive = passive;
+  _dwell = dwell;
+  uint16_t current = _stats->plans + 1;
+  bool bootstrap = (_stats->plans == 0);
+
+  // allowed channels, best expected yield first
+  uint8_t order[SCAN_MAX_CHANNEL];
+  uint8_t n = 0;
+  for(uint8_t c = 1; c <= SCAN_MAX_CHANNEL; ++c) {
+    if(channels & (1 << (c - 1))) {
+      uint8_t i = n++;
+      while(i && (score(order[i - 1]) < score(c))) {
+        order[i] = order[i - 1];
+        i--;
+      }
+      order[i] = c;
+    }
+  }
+
+  uint8_t useful = 0;
+  uint8_t explore_ch = 0;
+  uint16_t explore_age = 0;
+  for(uint8_t i = 0; i < n; ++i) {
+    uint8_t c = order[i];
+    scan_channel_stats_t &s = _stats->ch[c - 1];
+    bool known = score(c) > 0;
+    uint16_t age = current - s.last_scan;
+    if(bootstrap || (known && (!max_channels || (useful < max_channels)))) {
+      _plan[_plan_ct++] = {c, false, (bootstrap || s.target_avg) ? dwell : min_dwell};
+      if(known) {
+        useful++;
+      }
+    } else if(explore && (age >= explore) && (age > explore_age)) {
+      // every channel gets a short look now and then to notice new APs
+      explore_ch = c;
+      explore_age = age;
+    }
+  }
+  if(explore_ch) {
+    _plan[_plan_ct++] = {explore_ch, false, min_dwell};
+  }
+  if(!_plan_ct) {
+    // nothing ever seen, keep looking everywhere
+    for(uint8_t i = 0; i < n; ++i) {
+      _plan[_plan_ct++] = {order[i], false, min_dwell};
+    }
+  }
+  for(uint8_t i = 0; i < _plan_ct; ++i) {
+    if(passive & (1 << (_plan[i].channel - 1))) {
+      _plan[i].passive = true;
+      if(_plan[i].dwell < SCAN_PASSIVE_MIN) {
+        _plan[i].dwell = SCAN_PASSIVE_MIN;
+      }
+    }
+  }
+}
+
+bool SCAN_PLANNER::next(scan_step_t &step) {
+  if(_pos >= _plan_ct) {
+    return false;
+  }
+  step = _plan[_pos++];
+  return true;
+}
+
+bool SCAN_PLANNER::widen() {
+  uint16_t planned = 0;
+  for(uint8_t i = 0; i < _plan_ct; ++i) {
+    planned |= 1 << (_plan[i].channel - 1);
+  }
+  uint8_t before = _plan_ct;
+  for(uint8_t c = 1; c <= SCAN_MAX_CHANNEL; ++c) {
+    uint16_t bit = 1 << (c - 1);
+    if((_channels & bit) && !(planned & bit)) {
+      bool passive = _passive & bit;
+      _plan[_plan_ct++] = {c, passive, (passive && (_dwell < SCAN_PASSIVE_MIN)) ? (uint16_t)SCAN_PASSIVE_MIN : _dwell};
+    }
+  }
+  return _plan_ct > before;
+}
+
+void SCAN_PLANNER::record(uint8_t channel, uint8_t ap_ct, uint8_t target_ct) {
+  if(!channel || (channel > SCAN_MAX_CHANNEL)) {
+    return;
+  }
+  scan_channel_stats_t &s = _stats->ch[channel - 1];
+  // alpha 1/4, values saturate at ~15 APs. the decay rounds up, so a channel that goes quiet gets back to 0
+  uint16_t ap_avg = s.ap_avg - (s.ap_avg + 3) / 4 + std::min<uint16_t>(ap_ct, 15) * 4;
+  uint16_t target_avg = s.target_avg - (s.target_avg + 3) / 4 + std::min<uint16_t>(target_ct, 15) * 4;
+  s.ap_avg = std::min<uint16_t>(ap_avg, 255);
+  s.target_avg = std::min<uint16_t>(target_avg, 255);
+  s.last_scan = _stats->plans + 1;
+  if(target_ct) {
+    s.last_target = _stats->plans + 1;
+  }
+}
+
+void SCAN_PLANNER::end() {
+  _stats->plans++;
+  if(!_stats->plans) {
+    _stats->plans = 1;
+  }
+}
+
+uint32_t SCAN_PLANNER::planTime() {
+  uint32_t ms = 0;
+  for(uint8_t i = 0; i < _plan_ct; ++i) {
+    ms += _plan[i].dwell;
+  }
+  return ms;
+}
+
+void SCAN_PLANNER::print(Print* out) {
+  out->printf("plans %u\r\n", _stats->plans);
+  out->println("ch   aps target  ago target_ago");
+  for(uint8_t c = 1; c <= SCAN_MAX_CHANNEL; ++c) {
+    scan_channel_stats_t &s = _stats->ch[c - 1];
+    if(!s.last_scan) {
+      continue;
+    }
+    out->printf("%2u %5.1f %6.1f %4u %10d\r\n", c, s.ap_avg / 16.0, s.target_avg / 16.0,
+                (uint16_t)(_stats->plans - s.last_scan),
+                s.last_target ? (int)(uint16_t)(_stats->plans - s.last_target) : -1);
+  }
+  out->print("next:");
+  for(uint8_t i = 0; i < _plan_ct; ++i) {
+    out->printf(" %u/%u%s", _plan[i].channel, _plan[i].dwell, _plan[i].passive ? "p" : "");
+  }
+  out->printf(" = %u ms\r\n", planTime());
+}
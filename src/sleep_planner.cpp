@@ -0,0 +1,79 @@
+#include "sleep_planner.h"
+
+SLEEP_PLANNER::SLEEP_PLANNER(struct sleep_state_t* state)
+  : _state(state), _config{}, _interval(0), _retry(0) {
+}
+
+void SLEEP_PLANNER::begin(const sleep_config_t &config, uint16_t interval, uint16_t retry) {
+  _config = config;
+  _interval = interval;
+  _retry = retry;
+}
+
+void SLEEP_PLANNER::sent(bool ok) {
+  if(ok) {
+    _state->fails = 0;
+  } else if(_state->fails < UINT8_MAX) {
+    _state->fails++;
+  }
+}
+
+uint8_t SLEEP_PLANNER::fails() {
+  return _state->fails;
+}
+
+// retry doubled per failed send in a row up to retry_max, +-25% so devices that lost the same ap
+// do not come back in step
+uint32_t SLEEP_PLANNER::backoff(uint32_t rnd) {
+  if((_config.retry_max <= _retry) || !_state->fails) {
+    return _retry;
+  }
+  uint8_t shift = (_state->fails > 16) ? 15 : _state->fails - 1;
+  uint32_t s = (uint32_t)_retry << shift;
+  if(s > _config.retry_max) {
+    s = _config.retry_max;
+  }
+  s = s - s / 4 + rnd % (2 * (s / 4) + 1);
+  return (s < _retry) ? _retry : s;
+}
+
+// a wake due in the quiet hours moves to their end
+uint32_t SLEEP_PLANNER::quiet(uint32_t seconds, int32_t utc_sec) {
+  if((_config.quiet_from == _config.quiet_to) || (utc_sec < 0)) {
+    return seconds;
+  }
+  uint32_t wake = (utc_sec + 60UL * _config.utc_offset + seconds) % SLEEP_DAY;
+  uint8_t hour = wake / 3600;
+  bool in_quiet = (_config.quiet_from < _config.quiet_to)
+                    ? ((hour >= _config.quiet_from) && (hour < _config.quiet_to))
+                    : ((hour >= _config.quiet_from) || (hour < _config.quiet_to));
+  if(!in_quiet) {
+    return seconds;
+  }
+  return seconds + (3600UL * _config.quiet_to + SLEEP_DAY - wake) % SLEEP_DAY;
+}
+
+uint32_t SLEEP_PLANNER::next(bool retry, uint8_t charge, int32_t utc_sec, uint32_t rnd) {
+  uint32_t s = retry ? backoff(rnd) : _interval;
+  _state->base = s;
+  _state->charge = charge;
+  if(_config.low_pct && (charge < _config.low_pct)) {
+    // linear from 1x at low_pct to SLEEP_STRETCH_MAX x when empty
+    s += (uint64_t)s * (SLEEP_STRETCH_MAX - 1) * (_config.low_pct - charge) / _config.low_pct;
+  }
+  _state->stretched = s;
+  s = quiet(s, utc_sec);
+  _state->planned = s;
+  return s;
+}
+
+void SLEEP_PLANNER::clear() {
+  *_state = {};
+}
+
+void SLEEP_PLANNER::print(Print* out) {
+  out->printf("%u failed sends in a row, backoff %u..%u s\r\n", _state->fails, _retry,
+              (_config.retry_max > _retry) ? _config.retry_max : _retry);
+  out->printf("last sleep %u s, battery %u%% %u s, quiet hours %u s\r\n", _state->base, _state->charge,
+              _state->stretched, _state->planned);
+}
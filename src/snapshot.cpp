@@ -0,0 +1,113 @@
+#include "snapshot.h"
+
+AP_SNAPSHOT::AP_SNAPSHOT(struct snapshot_state_t* state) : _state(state) {
+}
+
+void AP_SNAPSHOT::take(const payload_t* p, ap_snapshot_t &snap) {
+  snap.valid = true;
+  snap.ap_ct = 0;
+  for(uint8_t i = 0; i < p->ap_ct; ++i) {
+    const payload_ap_t &ap = p->ap[i];
+    // insertion by bssid, a bssid seen twice keeps the stronger rssi
+    uint8_t k = 0;
+    int cmp = 1;
+    while((k < snap.ap_ct) && ((cmp = memcmp(snap.ap[k].bssid, ap.bssid, 6)) < 0)) {
+      k++;
+    }
+    if((k < snap.ap_ct) && !cmp) {
+      if(ap.rssi > snap.ap[k].rssi) {
+        snap.ap[k].rssi = ap.rssi;
+      }
+      continue;
+    }
+    memmove(&snap.ap[k + 1], &snap.ap[k], (snap.ap_ct - k) * sizeof(snapshot_ap_t));
+    memcpy(snap.ap[k].bssid, ap.bssid, 6);
+    snap.ap[k].rssi = ap.rssi;
+    snap.ap_ct++;
+  }
+}
+
+static bool near(int8_t a, int8_t b) {
+  return abs(a - b) <= SNAPSHOT_RSSI_TOLERANCE;
+}
+
+uint8_t AP_SNAPSHOT::similarity(const ap_snapshot_t &snap) {
+  const ap_snapshot_t &last = _state->last;
+  if(!last.valid) {
+    return 0;
+  }
+  // merge of the two sorted lists
+  uint8_t i = 0, k = 0, same = 0, all = 0;
+  while((i < last.ap_ct) || (k < snap.ap_ct)) {
+    int cmp = (i == last.ap_ct) ? 1 : (k == snap.ap_ct) ? -1 : memcmp(last.ap[i].bssid, snap.ap[k].bssid, 6);
+    if(!cmp) {
+      same += near(last.ap[i].rssi, snap.ap[k].rssi);
+      i++;
+      k++;
+    } else if(cmp < 0) {
+      i++;
+    } else {
+      k++;
+    }
+    all++;
+  }
+  return all ? same * 100 / all : 100;
+}
+
+void AP_SNAPSHOT::delta(payload_t* p, const ap_snapshot_t &snap, ap_snapshot_t &next) {
+  const ap_snapshot_t &last = _state->last;
+  next = snap;
+  if(!last.valid) {
+    // nothing acknowledged yet, the full list goes out
+    return;
+  }
+  p->delta = true;
+  p->gone_ct = 0;
+  uint8_t i = 0;
+  for(uint8_t k = 0; k < last.ap_ct; ++k) {
+    while((i < next.ap_ct) && (memcmp(next.ap[i].bssid, last.ap[k].bssid, 6) < 0)) {
+      i++;
+    }
+    if((i < next.ap_ct) && !memcmp(next.ap[i].bssid, last.ap[k].bssid, 6)) {
+      if(near(next.ap[i].rssi, last.ap[k].rssi)) {
+        // unchanged, the backend keeps the value it has
+        next.ap[i].rssi = last.ap[k].rssi;
+      }
+    } else {
+      memcpy(p->gone[p->gone_ct++], last.ap[k].bssid, 6);
+    }
+  }
+  // keep the APs of the scan that are new or moved beyond the tolerance
+  uint8_t n = 0;
+  for(uint8_t a = 0; a < p->ap_ct; ++a) {
+    bool keep = true;
+    for(uint8_t k = 0; keep && (k < last.ap_ct); ++k) {
+      keep = memcmp(last.ap[k].bssid, p->ap[a].bssid, 6) || !near(last.ap[k].rssi, p->ap[a].rssi);
+    }
+    if(keep) {
+      p->ap[n++] = p->ap[a];
+    }
+  }
+  p->ap_ct = n;
+}
+
+void AP_SNAPSHOT::commit(const ap_snapshot_t &next) {
+  _state->last = next;
+  _state->skipped = 0;
+}
+
+void AP_SNAPSHOT::skip() {
+  if(_state->skipped < UINT8_MAX) {
+    _state->skipped++;
+  }
+}
+
+uint8_t AP_SNAPSHOT::skipped() {
+  return _state->skipped;
+}
+
+void AP_SNAPSHOT::clear() {
+  _state->last.valid = false;
+  _state->last.ap_ct = 0;
+  _state->skipped = 0;
+}
@@ -0,0 +1,59 @@
+#include "trace.h"
+
+static const char* probe_names[TP_COUNT] = {
+  "boot", "scan done", "connected", "got ip", "mqtt", "puback", "sleep", "dns"
+};
+
+TRACE::TRACE(struct trace_t* trace) : _trace(trace) {
+}
+
+void TRACE::mark(trace_probe_t probe, uint8_t arg) {
+  uint32_t ms = millis();
+  uint8_t slot = (_trace->head + _trace->count) % TRACE_MAX_EVENTS;
+  if(_trace->count >= TRACE_MAX_EVENTS) {
+    _trace->head = (_trace->head + 1) % TRACE_MAX_EVENTS;
+  } else {
+    _trace->count++;
+  }
+  trace_event_t &e = _trace->ev[slot];
+  e.ms = (ms > UINT16_MAX) ? UINT16_MAX : ms;
+  e.probe = probe;
+  e.arg = arg;
+}
+
+void TRACE::clear() {
+  _trace->head = 0;
+  _trace->count = 0;
+}
+
+uint8_t TRACE::complete() {
+  uint8_t i = _trace->count;
+  while(i && (get(i - 1).probe != TP_BOOT)) {
+    i--;
+  }
+  return i ? i - 1 : 0;
+}
+
+void TRACE::drop(uint8_t n) {
+  if(n > _trace->count) {
+    n = _trace->count;
+  }
+  _trace->head = (_trace->head + n) % TRACE_MAX_EVENTS;
+  _trace->count -= n;
+}
+
+uint8_t TRACE::count() {
+  return _trace->count;
+}
+
+const trace_event_t &TRACE::get(uint8_t i) {
+  return _trace->ev[(_trace->head + i) % TRACE_MAX_EVENTS];
+}
+
+void TRACE::print(Print* out) {
+  out->printf("%d of %d events\r\n", _trace->count, TRACE_MAX_EVENTS);
+  for(uint8_t i = 0; i < _trace->count; ++i) {
+    const trace_event_t &e = get(i);
+    out->printf("%6u ms  %-10s %d\r\n", e.ms, (e.probe < TP_COUNT) ? probe_names[e.probe] : "?", e.arg);
+  }
+}
@@ -0,0 +1,132 @@
+#include "wake_cycle.h"
+
+static const char* state_names[CS_COUNT] = {
+  "idle", "scan", "assoc", "dhcp", "mqtt", "publish", "ack", "sleep", "failed"
+};
+
+// phase an event leads to
+static const cycle_state_t event_targets[] = {
+  CS_ASSOC, CS_DHCP, CS_MQTT, CS_PUBLISH, CS_ACK, CS_SLEEP, CS_SLEEP
+};
+static_assert(sizeof(event_targets) == CE_DONE + 1, "target per event");
+static_assert(sizeof(cycle_deadlines_t) == (CS_ACK - CS_SCAN + 1) * 2, "deadline per phase, scan to ack");
+
+WAKE_CYCLE::WAKE_CYCLE(struct cycle_stats_t* stats)
+  : _stats(stats), _deadlines{}, _total_ms(0), _state(CS_IDLE), _fast(false), _fast_ms(0), _plan_ms(0),
+    _start(0), _since(0), _on_enter(nullptr) {
+}
+
+void WAKE_CYCLE::begin(const cycle_deadlines_t &deadlines, uint32_t total_ms) {
+  _deadlines = deadlines;
+  _total_ms = total_ms;
+  _state = CS_IDLE;
+}
+
+void WAKE_CYCLE::enter(cycle_state_t state, uint32_t now) {
+  _state = state;
+  _since = now;
+  if(_stats->entered[state] < UINT16_MAX) {
+    _stats->entered[state]++;
+  }
+  if(_on_enter) {
+    _on_enter(state);
+  }
+}
+
+void WAKE_CYCLE::start(uint32_t now, bool fast, uint16_t fast_ms) {
+  _start = now;
+  _fast = fast;
+  _fast_ms = fast_ms;
+  _plan_ms = 0;
+  enter(fast ? CS_ASSOC : CS_SCAN, now);
+}
+
+void WAKE_CYCLE::planned(uint32_t plan_ms) {
+  _plan_ms = plan_ms;
+}
+
+bool WAKE_CYCLE::event(cycle_event_t event, uint32_t now) {
+  cycle_state_t target = event_targets[event];
+  if(!busy() || (target <= _state)) {
+    return false;
+  }
+  enter(target, now);
+  return true;
+}
+
+// of the current phase, 0 = none
+uint32_t WAKE_CYCLE::budget() {
+  switch(_state) {
+    case CS_SCAN:
+      return _deadlines.scan_ms ? _deadlines.scan_ms + _plan_ms : 0;
+    case CS_ASSOC:
+      return _fast ? _fast_ms : _deadlines.assoc_ms;
+    case CS_DHCP:
+      return _deadlines.dhcp_ms;
+    case CS_MQTT:
+      return _deadlines.mqtt_ms;
+    case CS_PUBLISH:
+      return _deadlines.publish_ms;
+    case CS_ACK:
+      return _deadlines.ack_ms;
+    default:
+      return 0;
+  }
+}
+
+uint32_t WAKE_CYCLE::timeout(uint32_t now) {
+  if(!busy()) {
+    return UINT32_MAX;
+  }
+  uint32_t ms = UINT32_MAX;
+  uint32_t phase = budget();
+  if(phase) {
+    uint32_t gone = now - _since;
+    ms = (gone >= phase) ? 0 : phase - gone;
+  }
+  if(_total_ms) {
+    uint32_t gone = now - _start;
+    ms = std::min(ms, (gone >= _total_ms) ? 0 : _total_ms - gone);
+  }
+  return ms;
+}
+
+cycle_state_t WAKE_CYCLE::expired(uint32_t now) {
+  if(timeout(now)) {
+    return CS_IDLE;
+  }
+  cycle_state_t late = _state;
+  if(_fast && (late == CS_ASSOC) && (now - _since >= _fast_ms) && (!_total_ms || (now - _start < _total_ms))) {
+    // the cached ap did not answer in time, it may be gone or moved, scan as usual
+    _fast = false;
+    _stats->fast_miss++;
+    enter(CS_SCAN, now);
+    return late;
+  }
+  if(_stats->timeout[late] < UINT16_MAX) {
+    _stats->timeout[late]++;
+  }
+  enter(CS_FAILED, now);
+  return late;
+}
+
+void WAKE_CYCLE::clear() {
+  memset(_stats, 0, sizeof(*_stats));
+}
+
+void WAKE_CYCLE::print(Print* out) {
+  out->printf("%-8s %8s %8s  %s\r\n", "phase", "entered", "timeout", "deadline ms");
+  const uint16_t* ms = &_deadlines.scan_ms;
+  for(uint8_t s = CS_SCAN; s < CS_COUNT; ++s) {
+    out->printf("%-8s %8u %8u", state_names[s], _stats->entered[s], _stats->timeout[s]);
+    if((s <= CS_ACK) && ms[s - CS_SCAN]) {
+      out->printf("  %u%s", ms[s - CS_SCAN], (s == CS_SCAN) ? " + plan" : "");
+    }
+    out->println();
+  }
+  out->printf("total limit %u ms, %u fast connects fell back to the scan\r\n", _total_ms, _stats->fast_miss);
+}
+
+const char* WAKE_CYCLE::name(cycle_state_t state) {
+  return (state < CS_COUNT) ? state_names[state] : "?";
+}
@@ -0,0 +1,24 @@
+#include <unity.h>
+#include "../../sim/src/bench.h"
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// random messages through payload_to_bin and payload_decoder, cut ones must be refused
+static void test_round_trip() {
+  TEST_ASSERT_EQUAL_INT(0, sim::formatRoundTrip(2000, 1));
+}
+
+static void test_round_trip_other_seed() {
+  TEST_ASSERT_EQUAL_INT(0, sim::formatRoundTrip(2000, 0x5eed));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_round_trip_other_seed);
+  return UNITY_END();
+}